@@ -0,0 +1,67 @@
+#ifndef _H_RR_COMPRESS_
+#define _H_RR_COMPRESS_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+/*
+  Streaming HTTP content encoding. A stream pulls the plain body from its
+  source callback and deflates it straight into the caller's buffer.
+*/
+typedef enum RRCompressEncoding
+{
+  RR_COMPRESS_NONE,
+  RR_COMPRESS_DEFLATE,
+  RR_COMPRESS_GZIP
+}
+RRCompressEncoding;
+
+// the preferred encoding allowed by an Accept-Encoding header, which may be NULL
+RRCompressEncoding rr_compress_negotiate(const char *accept);
+const char        *rr_compress_name     (RRCompressEncoding enc);
+
+// returns the number of bytes written, 0 at the end of the body or -1 on error
+typedef ssize_t (*RRCompressSource)(void *udata, char *buf, size_t max);
+
+typedef struct RRCompressStream
+{
+  z_stream         z;
+  bool             init;
+  RRCompressSource source;
+  void            *udata;
+
+  char  *in;
+  size_t inSize;
+  bool   eof;
+  bool   done;
+
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint64_t cpuTime;
+}
+RRCompressStream;
+
+bool    rr_compress_stream_init(RRCompressStream *s, RRCompressEncoding enc,
+  int level, RRCompressSource source, void *udata);
+ssize_t rr_compress_stream_read(RRCompressStream *s, char *buf, size_t max);
+
+// adds the totals of the stream to the statistics
+void    rr_compress_stream_free(RRCompressStream *s);
+
+typedef struct RRCompressStats
+{
+  unsigned long long streams;  // bodies compressed
+  unsigned long long bytesIn;  // plain bytes
+  unsigned long long bytesOut; // compressed bytes
+  unsigned long long cpuTime;  // thread CPU time spent in deflate, microseconds
+  unsigned long long hits;     // bodies served from a precompressed cache
+}
+RRCompressStats;
+
+void rr_compress_count_hit(void);
+void rr_compress_get_stats(RRCompressStats *out);
+
+#endif
@@ -9,9 +9,18 @@
   SETTING_STR(database.user, "rackradar") \
   SETTING_STR(database.pass, "rackradar") \
   SETTING_STR(database.name, "rackradar") \
-  SETTING_STR(database.pool, 8          ) \
+  SETTING_INT(database.pool, 8          ) \
   \
-  SETTING_INT(http.port    , 8888       )
+  SETTING_INT(http.port        , 8888   ) \
+  SETTING_INT(http.threads     , 4      ) \
+  SETTING_INT(http.workers     , 4      ) \
+  SETTING_INT(http.connections , 1000   ) \
+  SETTING_INT(http.list_history, 8      ) \
+  SETTING_INT(http.compress    , 6      ) \
+  SETTING_STR(http.cache_dir   , ""     ) \
+  \
+  SETTING_INT(import.threads     , 0    ) \
+  SETTING_INT(import.list_workers, 2    )
 
 #define CONFIG_LIST_FIELDS \
   X(org, handle ) \
@@ -59,10 +68,23 @@ typedef struct Config
 
   struct
   {
-    int port;
+    int         port;
+    int         threads;      // connection polling threads
+    int         workers;      // threads running queries and list builds
+    int         connections;  // connections open at once, waiting ones included
+    int         list_history; // generations of each list kept for ?since= deltas
+    int         compress;     // zlib level for compressed responses, 0 = disabled
+    const char *cache_dir;    // rendered list bodies are kept here, "" = disabled
   }
   http;
 
+  struct
+  {
+    int threads;      // RPSL parser threads, 0 = one per CPU
+    int list_workers; // lists built in parallel, each uses a connection
+  }
+  import;
+
   struct
   {
     const char *name;
@@ -72,7 +94,8 @@ typedef struct Config
       SOURCE_TYPE_RPSL,
       SOURCE_TYPE_ARIN,
       SOURCE_TYPE_JSON,
-      SOURCE_TYPE_REGEX
+      SOURCE_TYPE_REGEX,
+      SOURCE_TYPE_NRTM
     }
     type;
     int frequency;
@@ -81,6 +104,18 @@ typedef struct Config
     const char *pass;
     const char *extra_v4;
     const char *extra_v6;
+
+    // NRTM mirroring, only used by SOURCE_TYPE_NRTM
+    struct
+    {
+      const char *host;
+      int         port;
+      const char *source;
+      const char *serial_url;
+      int         version;
+      int         frequency;
+    }
+    nrtm;
   }
   *sources;
   unsigned nbSources;
@@ -19,7 +19,8 @@ typedef enum RRDBType
   RRDB_TYPE_FLOAT,
   RRDB_TYPE_DOUBLE,
   RRDB_TYPE_STRING,
-  RRDB_TYPE_BINARY
+  RRDB_TYPE_BINARY,
+  RRDB_TYPE_STRVIEW  // bind is a RRStrView, input only
 }
 RRDBType;
 
@@ -63,4 +64,21 @@ bool rr_db_stmt_store(RRDBStmt *stmt);
 int  rr_db_stmt_fetch(RRDBStmt *stmt);
 void rr_db_stmt_close(RRDBStmt *stmt);
 
+/*
+  Multi-row statements of fixed length columns. The SQL is built as the
+  prefix followed by the row template repeated for each row, separated by a
+  comma, and then the suffix. Rows are executed as they fill a batch, the
+  remainder when flushed in at most log2(rows) statements.
+*/
+typedef struct RRDBBulk RRDBBulk;
+
+RRDBBulk          *rr_db_bulk_new     (RRDBCon *con, const char *prefix,
+  const char *row, const char *suffix, size_t rows, const RRDBParam *cols,
+  size_t ncols);
+void               rr_db_bulk_free    (RRDBBulk **b);
+bool               rr_db_bulk_add     (RRDBBulk *b, const void **values);
+bool               rr_db_bulk_flush   (RRDBBulk *b);
+void               rr_db_bulk_discard (RRDBBulk *b);
+unsigned long long rr_db_bulk_affected(RRDBBulk *b);
+
 #endif
@@ -2,6 +2,13 @@
 #define _H_RR_DB_STRUCTS_
 
 #include <stdint.h>
+#include "util.h"
+
+// maximum stored field lengths in bytes, these match the schema
+#define RRDB_HANDLE_MAX   32
+#define RRDB_ORG_NAME_MAX 1023
+#define RRDB_NETNAME_MAX  255
+#define RRDB_DESCR_MAX    8191
 
 typedef struct RRDBStatistics
 {
@@ -28,11 +35,11 @@ RRDBRegistrar;
 
 typedef struct RRDBOrg
 {
-  unsigned registrar_id;
-  unsigned serial;
-  char     handle[32];
-  char     name  [1024];
-  char     descr [8192];
+  unsigned  registrar_id;
+  unsigned  serial;
+  RRStrView handle;
+  RRStrView name;
+  RRStrView descr;
 }
 RRDBOrg;
 
@@ -45,29 +52,46 @@ RRDBAddr;
 
 typedef struct RRDBNetBlock
 {
-  unsigned registrar_id;
-  unsigned serial;
-  char     org_handle[33];
-  RRDBAddr startAddr;
-  RRDBAddr endAddr;
-  uint8_t  prefixLen;
-  char     netname[256 ];
-  char     descr  [8192];
+  unsigned  registrar_id;
+  unsigned  serial;
+  RRStrView org_handle;
+  RRDBAddr  startAddr;
+  RRDBAddr  endAddr;
+  uint8_t   prefixLen;
+  RRStrView netname;
+  RRStrView descr;
 }
 RRDBNetBlock;
 
+// a string held in a separate buffer, as an offset so the buffer can grow
+typedef struct RRDBStrRef
+{
+  uint32_t off;
+  uint32_t len;
+}
+RRDBStrRef;
+
+/*
+  The best match for an address. The strings are copied at their actual
+  length into the buffer passed to the lookup, each NUL terminated.
+*/
 typedef struct RRDBIPInfo
 {
   unsigned long long id;
-  unsigned registrar_id;
-  char     org_handle[33];
-  char     org_name[1024];
-  RRDBAddr start_ip;
-  RRDBAddr end_ip;
-  uint8_t  prefix_len;
-  char     netname[256];
-  char     descr  [8192];
+  unsigned   registrar_id;
+  RRDBAddr   start_ip;
+  RRDBAddr   end_ip;
+  uint8_t    prefix_len;
+  RRDBStrRef org_handle;
+  RRDBStrRef org_name;
+  RRDBStrRef netname;
+  RRDBStrRef descr;
 }
 RRDBIPInfo;
 
+static inline const char *rr_db_str(const RRBuffer *buf, RRDBStrRef ref)
+{
+  return buf->buffer + ref.off;
+}
+
 #endif
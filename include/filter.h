@@ -0,0 +1,36 @@
+#ifndef _H_RR_FILTER_
+#define _H_RR_FILTER_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  A set of SQL LIKE patterns matched against a string in a single pass. The
+  longest literal run of each pattern is found with an Aho-Corasick automaton
+  and only the patterns whose literal occurs are verified.
+
+  Matching is ASCII case insensitive, '%' matches any run of characters, '_'
+  a single UTF-8 character, and '\' escapes the next character.
+
+  A filter is not thread safe, matching uses state kept in the filter.
+*/
+typedef struct RRFilter RRFilter;
+
+bool rr_filter_init  (RRFilter **ph);
+void rr_filter_deinit(RRFilter **ph);
+
+// add a pattern, returns its index or -1 on failure
+int  rr_filter_add    (RRFilter *h, const char *pattern);
+bool rr_filter_compile(RRFilter *h);
+
+// the number of patterns added
+unsigned rr_filter_count(RRFilter *h);
+
+/*
+  Match the text, the indices of the patterns that match are written to out
+  which must have room for every pattern. Returns the number of matches.
+*/
+size_t rr_filter_match(RRFilter *h, const char *text, size_t len, unsigned *out);
+
+#endif
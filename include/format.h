@@ -0,0 +1,65 @@
+#ifndef _H_RR_FORMAT_
+#define _H_RR_FORMAT_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+  Streaming list output. A stream pulls CIDRs from its next callback and
+  writes them in the selected format straight into the caller's buffer,
+  which must be at least RR_FORMAT_BLOCK_MIN bytes.
+*/
+#define RR_FORMAT_SET_MAX   31
+#define RR_FORMAT_BLOCK_MIN 256
+
+typedef struct RRFormat RRFormat;
+
+// returns NULL for an unknown name, a NULL name selects the plain format
+const RRFormat *rr_format_by_name(const char *name);
+const char     *rr_format_content_type(const RRFormat *fmt);
+
+// true if the format writes the set name into its output
+bool rr_format_uses_set(const RRFormat *fmt);
+
+// true if name can be used as a set name in the formats that take one
+bool rr_format_valid_set(const char *name);
+
+/*
+  returns 1 with the next CIDR, 0 at the end of the list, or -1 on error.
+  IPv4 addresses are in host order, IPv6 addresses are raw.
+*/
+typedef int (*RRFormatNextV4)(void *udata, uint32_t *ip, uint8_t *prefix_len);
+typedef int (*RRFormatNextV6)(void *udata, unsigned __int128 *ip, uint8_t *prefix_len);
+
+typedef struct RRFormatStream
+{
+  const RRFormat *fmt;
+  bool            v6;
+  char            set[RR_FORMAT_SET_MAX + 1];
+  RRFormatNextV4  nextV4;
+  RRFormatNextV6  nextV6;
+  void           *udata;
+
+  // the build generation, written by the formats that carry it
+  unsigned generation;
+
+  unsigned stage;
+  size_t   count;
+
+  // compact format state
+  unsigned __int128 next;
+  uint32_t          crc;
+}
+RRFormatStream;
+
+void rr_format_stream_v4(RRFormatStream *s, const RRFormat *fmt,
+  const char *set, RRFormatNextV4 next, void *udata);
+void rr_format_stream_v6(RRFormatStream *s, const RRFormat *fmt,
+  const char *set, RRFormatNextV6 next, void *udata);
+
+// returns the number of bytes written, 0 at the end of the stream or -1 on error
+ssize_t rr_format_stream_read(RRFormatStream *s, char *buf, size_t max);
+
+#endif
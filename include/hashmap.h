@@ -0,0 +1,19 @@
+#ifndef _H_RR_HASHMAP_
+#define _H_RR_HASHMAP_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// string keyed map of integer values, keys are copied into the map
+typedef struct RRHashMap RRHashMap;
+
+bool rr_hashmap_init  (RRHashMap **ph);
+void rr_hashmap_deinit(RRHashMap **ph);
+void rr_hashmap_clear (RRHashMap *h);
+
+bool   rr_hashmap_put  (RRHashMap *h, const char *key, size_t len, uintptr_t value);
+bool   rr_hashmap_get  (RRHashMap *h, const char *key, size_t len, uintptr_t *value);
+size_t rr_hashmap_count(RRHashMap *h);
+
+#endif
@@ -18,11 +18,41 @@ bool rr_import_org_insert       (RRDBOrg      *in_org     );
 bool rr_import_netblockv4_insert(RRDBNetBlock *in_netblock);
 bool rr_import_netblockv6_insert(RRDBNetBlock *in_netblock);
 
+// removal of single objects for incremental (NRTM) updates
+bool rr_import_org_delete       (RRDBOrg      *in_org     );
+bool rr_import_netblockv4_delete(RRDBNetBlock *in_netblock);
+bool rr_import_netblockv6_delete(RRDBNetBlock *in_netblock);
+
 bool rr_rpsl_import_gz_FILE(const char *registrar, FILE *fp,
   unsigned registrar_id, unsigned new_serial);
 bool rr_rpsl_import_gz(const char *filename, const char *registrar,
   unsigned registar_id, unsigned new_serial);
 
+// incremental RPSL object processing as used by the NRTM client
+typedef struct RRRPSLState RRRPSLState;
+
+typedef enum RRRPSLOp
+{
+  RR_RPSL_OP_INSERT,  // full dump, objects are upserted
+  RR_RPSL_OP_REPLACE, // NRTM ADD, replaces any previous version of the object
+  RR_RPSL_OP_DELETE   // NRTM DEL
+}
+RRRPSLOp;
+
+RRRPSLState *rr_rpsl_state_new (const char *registrar, unsigned registrar_id);
+void         rr_rpsl_state_free(RRRPSLState **state);
+void         rr_rpsl_state_set_op(RRRPSLState *state, RRRPSLOp op, unsigned serial);
+bool         rr_rpsl_state_line  (RRRPSLState *state, const char *line, size_t len);
+
+/*
+  returns -1 on failure, 0 if there was nothing to apply, or 1 if updates were
+  applied. out_serial is set to the last serial applied and out_resync is set
+  if the mirror has fallen outside of the servers journal and needs a reload.
+*/
+int rr_nrtm_update(const char *registrar, const char *host, int port,
+  const char *source, int version, unsigned registrar_id, unsigned serial,
+  unsigned *out_serial, bool *out_resync);
+
 bool rr_arin_import_zip_FILE(const char *registrar, FILE *fp,
   unsigned registrar_id, unsigned new_serial);
 bool rr_arin_import_zip(const char *registrar, const char *filename,
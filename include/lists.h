@@ -0,0 +1,65 @@
+#ifndef _H_RR_LISTS_
+#define _H_RR_LISTS_
+
+#include "rangeset.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  The registry of built lists, indexed by name when the configuration is
+  loaded, and the most recent generations of each list union, kept varint
+  packed in memory so that clients can be sent the changes since the
+  generation they hold. The number kept is set by http.list_history.
+*/
+bool rr_lists_init(void);
+void rr_lists_deinit(void);
+
+// record a new generation of the named list, the sets are copied
+bool rr_lists_publish(const char *name, unsigned id, unsigned generation,
+  const RRRangeSetV4 *v4, const RRRangeSetV6 *v6);
+
+// the latest generation published for the named list, 0 if there is none
+unsigned rr_lists_generation(const char *name);
+
+typedef struct RRListInfo
+{
+  const char *name;
+  unsigned    id;         // the list row id, 0 if the list was never built
+  unsigned    generation; // the latest generation published, 0 if none
+
+  unsigned long long requests;   // list requests served
+  unsigned long long dbRequests; // those that read the list from the database
+}
+RRListInfo;
+
+// the registry entry of a built list, false if there is no such list
+bool rr_lists_lookup(const char *name, RRListInfo *out);
+
+// the registry entry of each list, false past the last one
+bool rr_lists_info(unsigned index, RRListInfo *out);
+
+// count a request for the named list, db if it was read from the database
+void rr_lists_count_request(const char *name, bool db);
+
+// fn is called after every publish, from the thread that built the list
+typedef void (*RRListsNotifyFn)(void *udata);
+void rr_lists_set_notify(RRListsNotifyFn fn, void *udata);
+
+/*
+  When http.cache_dir is set each publish also renders the plain body of the
+  list, and a gzip copy when compression is enabled, to files there that are
+  replaced by rename. Opens the file for the latest generation, returns the
+  fd or -1 if there is none.
+*/
+int rr_lists_open(const char *name, bool v6, bool gzip,
+  unsigned *generation, uint64_t *size);
+
+/*
+  unpack a kept generation of the named list into out, returns 1 on success,
+  0 if the generation is not kept, or -1 on error
+*/
+int rr_lists_get_v4(const char *name, unsigned generation, RRRangeSetV4 *out);
+int rr_lists_get_v6(const char *name, unsigned generation, RRRangeSetV6 *out);
+
+#endif
@@ -19,15 +19,21 @@ int rr_query_registrar_insert(
   const char *in_name,
   unsigned *out_registrar_id);
 
+/*
+  the best match for an address, the strings of out are appended to strings.
+  returns 1 on success, 0 if there is no match, or -1 on error
+*/
 int rr_query_netblockv4_by_ip(
   RRDBCon *con,
   uint32_t in_ipv4,
-  RRDBIPInfo *out);
+  RRDBIPInfo *out,
+  RRBuffer *strings);
 
 int rr_query_netblockv6_by_ip(
   RRDBCon           *con,
   unsigned __int128  in_ipv6,
-  RRDBIPInfo        *out);
+  RRDBIPInfo        *out,
+  RRBuffer          *strings);
 
 int  rr_query_list_by_name(RRDBCon *con, const char *in_name, unsigned *out_list_id);
 bool rr_query_netblockv4_list_start(RRDBCon *con, unsigned in_list_id, bool store);
@@ -0,0 +1,109 @@
+#ifndef _H_RR_RANGESET_
+#define _H_RR_RANGESET_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Sets of inclusive address ranges held as sorted arrays. IPv6 addresses are
+  in the BE-numeric domain, see rr_raw_to_be.
+
+  Ranges are appended with add in any order and normalize sorts and merges
+  them. push appends a range that does not start before the last one and
+  merges it as it goes. The set operations take normalized sets, run in
+  linear time, and replace the content of out which must not be an input.
+*/
+typedef struct RRRangeV4
+{
+  uint32_t start;
+  uint32_t end;
+}
+RRRangeV4;
+
+typedef struct RRRangeSetV4
+{
+  RRRangeV4 *ranges;
+  size_t     count;
+  size_t     size;
+}
+RRRangeSetV4;
+
+typedef struct RRRangeV6
+{
+  unsigned __int128 start;
+  unsigned __int128 end;
+}
+RRRangeV6;
+
+typedef struct RRRangeSetV6
+{
+  RRRangeV6 *ranges;
+  size_t     count;
+  size_t     size;
+}
+RRRangeSetV6;
+
+// position of a walk over the CIDRs of a set, zero initialize to start
+typedef struct RRRangeSetV4Cursor
+{
+  size_t   index;
+  uint32_t cur;
+  bool     active;
+}
+RRRangeSetV4Cursor;
+
+typedef struct RRRangeSetV6Cursor
+{
+  size_t            index;
+  unsigned __int128 cur;
+  bool              active;
+}
+RRRangeSetV6Cursor;
+
+typedef bool (*RRRangeSetV4CIDRFn)(void *udata, uint32_t ip, uint8_t prefix_len);
+typedef bool (*RRRangeSetV6CIDRFn)(void *udata, unsigned __int128 ip, uint8_t prefix_len);
+
+void rr_rangeset_v4_free      (RRRangeSetV4 *s);
+void rr_rangeset_v4_clear     (RRRangeSetV4 *s);
+bool rr_rangeset_v4_add       (RRRangeSetV4 *s, uint32_t start, uint32_t end);
+bool rr_rangeset_v4_copy      (RRRangeSetV4 *out, const RRRangeSetV4 *in);
+bool rr_rangeset_v4_push      (RRRangeSetV4 *s, uint32_t start, uint32_t end);
+bool rr_rangeset_v4_normalize (RRRangeSetV4 *s);
+bool rr_rangeset_v4_union     (RRRangeSetV4 *out, const RRRangeSetV4 *a, const RRRangeSetV4 *b);
+bool rr_rangeset_v4_intersect (RRRangeSetV4 *out, const RRRangeSetV4 *a, const RRRangeSetV4 *b);
+bool rr_rangeset_v4_difference(RRRangeSetV4 *out, const RRRangeSetV4 *a, const RRRangeSetV4 *b);
+bool rr_rangeset_v4_complement(RRRangeSetV4 *out, const RRRangeSetV4 *a);
+
+// call fn for each of the fewest CIDRs that cover the set, in order
+bool rr_rangeset_v4_cidrs(const RRRangeSetV4 *s, RRRangeSetV4CIDRFn fn, void *udata);
+
+// the next of those CIDRs, returns false at the end of the set
+bool rr_rangeset_v4_cidr_next(const RRRangeSetV4 *s, RRRangeSetV4Cursor *c,
+  uint32_t *ip, uint8_t *prefix_len);
+
+/*
+  Widen the set so no CIDR is longer than maxprefix, then merge neighbouring
+  CIDRs into supernets until the set is at most max CIDRs (0 for no limit),
+  adding as little address space as the greedy choice allows.
+*/
+bool rr_rangeset_v4_aggregate (RRRangeSetV4 *out, const RRRangeSetV4 *in,
+  size_t max, unsigned maxprefix);
+
+void rr_rangeset_v6_free      (RRRangeSetV6 *s);
+void rr_rangeset_v6_clear     (RRRangeSetV6 *s);
+bool rr_rangeset_v6_add       (RRRangeSetV6 *s, unsigned __int128 start, unsigned __int128 end);
+bool rr_rangeset_v6_copy      (RRRangeSetV6 *out, const RRRangeSetV6 *in);
+bool rr_rangeset_v6_push      (RRRangeSetV6 *s, unsigned __int128 start, unsigned __int128 end);
+bool rr_rangeset_v6_normalize (RRRangeSetV6 *s);
+bool rr_rangeset_v6_union     (RRRangeSetV6 *out, const RRRangeSetV6 *a, const RRRangeSetV6 *b);
+bool rr_rangeset_v6_intersect (RRRangeSetV6 *out, const RRRangeSetV6 *a, const RRRangeSetV6 *b);
+bool rr_rangeset_v6_difference(RRRangeSetV6 *out, const RRRangeSetV6 *a, const RRRangeSetV6 *b);
+bool rr_rangeset_v6_complement(RRRangeSetV6 *out, const RRRangeSetV6 *a);
+bool rr_rangeset_v6_cidrs     (const RRRangeSetV6 *s, RRRangeSetV6CIDRFn fn, void *udata);
+bool rr_rangeset_v6_cidr_next (const RRRangeSetV6 *s, RRRangeSetV6Cursor *c,
+  unsigned __int128 *ip, uint8_t *prefix_len);
+bool rr_rangeset_v6_aggregate (RRRangeSetV6 *out, const RRRangeSetV6 *in,
+  size_t max, unsigned maxprefix);
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef _H_RR_RRLIST_
+#define _H_RR_RRLIST_
+
+/*
+  Reference decoder for the compact list format served by ?format=compact.
+  This header has no dependencies on the rest of RackRadar and may be copied
+  into clients as is.
+
+  All multi-byte integers are big-endian.
+
+    header   "RRLS", version (1), family (4 or 6), two reserved bytes and the
+             32-bit build generation of the list
+
+    entries  the prefix length, then the gap from the address following the
+             previous CIDR (0 for the first) to the start of this one as an
+             unsigned LEB128 varint. Entries are sorted and do not overlap.
+
+    trailer  0xFF, the 32-bit entry count, and the CRC-32 (as zlib) of every
+             byte before it
+
+  Usage:
+
+    RRListDecoder d;
+    if (rrlist_open(&d, buf, len) != 0)
+      fail;
+
+    uint8_t ip[16], prefix_len;
+    int rc;
+    while((rc = rrlist_next(&d, ip, &prefix_len)) == 1)
+      use ip (d.family == 4 ? 4 : 16 bytes, network order) / prefix_len;
+
+    if (rc < 0)
+      fail;
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define RRLIST_MAGIC        "RRLS"
+#define RRLIST_VERSION      1
+#define RRLIST_HEADER_SIZE  12
+#define RRLIST_END          0xFF
+#define RRLIST_TRAILER_SIZE 9
+
+typedef struct RRListDecoder
+{
+  uint8_t  version;
+  uint8_t  family;
+  uint32_t generation;
+  uint32_t count;
+
+  const uint8_t *pos;
+  const uint8_t *end;
+  uint8_t        next[16]; // the address following the previous CIDR
+  uint32_t       decoded;  // entries returned so far, checked against count
+  int            done;
+}
+RRListDecoder;
+
+static inline uint32_t rrlist_be32(const uint8_t *p)
+{
+  return
+    ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+    ((uint32_t)p[2] <<  8) |  (uint32_t)p[3];
+}
+
+static inline uint32_t rrlist_crc32(uint32_t crc, const uint8_t *p, size_t len)
+{
+  static const uint32_t table[16] =
+  {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+
+  crc = ~crc;
+  while(len--)
+  {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 0xf];
+    crc = (crc >> 4) ^ table[crc & 0xf];
+  }
+  return ~crc;
+}
+
+// returns 0 if buf holds a complete and intact list, or -1
+static inline int rrlist_open(RRListDecoder *d, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  memset(d, 0, sizeof(*d));
+
+  if (len < RRLIST_HEADER_SIZE + RRLIST_TRAILER_SIZE ||
+      memcmp(p, RRLIST_MAGIC, 4) != 0 ||
+      p[4] != RRLIST_VERSION ||
+      (p[5] != 4 && p[5] != 6))
+    return -1;
+
+  const uint8_t *trailer = p + len - RRLIST_TRAILER_SIZE;
+  if (trailer[0] != RRLIST_END ||
+      rrlist_crc32(0, p, len - 4) != rrlist_be32(trailer + 5))
+    return -1;
+
+  d->version    = p[4];
+  d->family     = p[5];
+  d->generation = rrlist_be32(p + 8);
+  d->count      = rrlist_be32(trailer + 1);
+  d->pos        = p + RRLIST_HEADER_SIZE;
+  d->end        = trailer;
+  return 0;
+}
+
+// adds a LEB128 gap to the big-endian address a, returns -1 on overflow
+static inline int rrlist_add_gap(uint8_t *a, unsigned bytes, const uint8_t **pos,
+  const uint8_t *end)
+{
+  uint8_t gap[16] = { 0 };
+  unsigned shift = 0;
+  while(1)
+  {
+    if (*pos >= end)
+      return -1;
+
+    uint8_t b = *(*pos)++;
+    for(unsigned i = 0; i < 7; ++i, ++shift)
+      if (b & (1u << i))
+      {
+        if (shift >= bytes * 8)
+          return -1;
+        gap[bytes - 1 - shift / 8] |= (uint8_t)(1u << (shift % 8));
+      }
+
+    if (!(b & 0x80))
+      break;
+  }
+
+  unsigned carry = 0;
+  for(unsigned i = bytes; i-- > 0;)
+  {
+    unsigned sum = (unsigned)a[i] + gap[i] + carry;
+    a[i]  = (uint8_t)sum;
+    carry = sum >> 8;
+  }
+  return carry ? -1 : 0;
+}
+
+/*
+  returns 1 with the next CIDR, 0 at the end of the list, or -1 if the list
+  is malformed, including when it holds more or fewer entries than the
+  trailer's count. ip receives 4 or 16 bytes as given by d->family.
+*/
+static inline int rrlist_next(RRListDecoder *d, uint8_t *ip, uint8_t *prefix_len)
+{
+  if (d->pos >= d->end)
+    return d->decoded == d->count ? 0 : -1;
+
+  const unsigned bytes = d->family == 4 ? 4 : 16;
+  uint8_t len = *d->pos++;
+  if (d->done || d->decoded == d->count || len > bytes * 8)
+    return -1;
+
+  if (rrlist_add_gap(d->next, bytes, &d->pos, d->end) != 0)
+    return -1;
+
+  // the start must be aligned to the prefix
+  for(unsigned bit = len; bit < bytes * 8; ++bit)
+    if (d->next[bit / 8] & (0x80 >> (bit % 8)))
+      return -1;
+
+  memcpy(ip, d->next, bytes);
+  *prefix_len = len;
+  ++d->decoded;
+
+  // advance past the CIDR, wrapping to the end of the address space
+  if (len == 0)
+    d->done = 1;
+  else
+  {
+    unsigned bit   = len - 1;
+    unsigned carry = 0x80 >> (bit % 8);
+    for(unsigned i = bit / 8 + 1; carry && i-- > 0;)
+    {
+      unsigned sum = (unsigned)d->next[i] + carry;
+      d->next[i] = (uint8_t)sum;
+      carry = sum >> 8;
+    }
+    if (carry)
+      d->done = 1;
+  }
+
+  return 1;
+}
+
+#endif
@@ -22,21 +22,67 @@ typedef struct RRBuffer
 }
 RRBuffer;
 
+// a length tracked string, str is not required to be NUL terminated
+typedef struct RRStrView
+{
+  const char *str;
+  size_t      len;
+}
+RRStrView;
+
 ssize_t rr_alloc_vsprintf   (RRBuffer *buf, const char *fmt, va_list ap);
 ssize_t rr_alloc_sprintf    (RRBuffer *buf, const char *fmt, ...);
+bool    rr_buffer_reserve   (RRBuffer *buf, size_t size);
+ssize_t rr_buffer_append    (RRBuffer *buf, const char *data, size_t len);
 ssize_t rr_buffer_append_str(RRBuffer *buf, const char *str);
 bool    rr_buffer_appendf   (RRBuffer *buf, const char *fmt, ...);
 void    rr_buffer_reset     (RRBuffer *buf);
 void    rr_buffer_free      (RRBuffer *buf);
 
+typedef struct RRSanatizeStats
+{
+  unsigned long long ascii; // plain ascii, left as is
+  unsigned long long utf8;  // valid UTF-8, left as is
+  unsigned long long slow;  // needed ICU charset detection
+}
+RRSanatizeStats;
+
 bool    rr_sanatize          (char *text, size_t maxLen);
+bool    rr_sanatize_buffer   (RRBuffer *buf, size_t maxLen);
+void    rr_sanatize_get_stats(RRSanatizeStats *out);
 int     rr_parse_ipv4_decimal(const char *str, uint32_t *host);
 int     rr_parse_ipv6_decimal(const char *str, unsigned __int128 *host);
+
+// parse exactly len bytes of address text, returns 1 on success or 0 if invalid
+int     rr_parse_ipv4        (const char *str, size_t len, uint32_t *host);
+int     rr_parse_ipv6        (const char *str, size_t len, unsigned __int128 *raw);
+
 uint8_t rr_ipv4_to_cidr      (const uint32_t start, const uint32_t end);
 uint8_t rr_ipv6_to_cidr      (const unsigned __int128 start, const unsigned __int128 end);
 bool    rr_calc_ipv4_cidr_end(uint32_t start, unsigned prefix_len, uint32_t *end_out);
 bool    rr_calc_ipv6_cidr_end(const unsigned __int128 *start, unsigned prefix_len, unsigned __int128 *end_out);
 
+/*
+  Address text written straight into buf without a terminator, returning the
+  length. buf needs RR_IPV4_STR_MAX or RR_IPV6_STR_MAX bytes, the v6 address
+  is raw and the v4 address in host order. The prefix is written as "/len".
+*/
+#define RR_IPV4_STR_MAX   16
+#define RR_IPV6_STR_MAX   46
+#define RR_PREFIX_STR_MAX 4
+
+size_t  rr_ipv4_to_str       (char *buf, uint32_t host);
+size_t  rr_ipv6_to_str       (char *buf, unsigned __int128 raw);
+size_t  rr_prefix_to_str     (char *buf, unsigned prefix_len);
+
+// printf arguments for a view, use with "%.*s"
+#define RR_STRVIEW_FMT(v) (int)(v).len, (v).str ? (v).str : ""
+
+static inline RRStrView rr_buffer_view(const RRBuffer *buf)
+{
+  return (RRStrView){ .str = buf->buffer, .len = buf->pos };
+}
+
 static inline uint64_t rr_microtime(void)
 {
   struct timespec time;
@@ -142,8 +142,9 @@ COLLATE         = utf8mb4_unicode_ci;
 
 CREATE TABLE IF NOT EXISTS list
 (
-  id   INT UNSIGNED NOT NULL AUTO_INCREMENT,
-  name VARCHAR(32)  NOT NULL,
+  id         INT UNSIGNED NOT NULL AUTO_INCREMENT,
+  name       VARCHAR(32)  NOT NULL,
+  generation INT UNSIGNED NOT NULL DEFAULT 0,
 
   PRIMARY KEY(id),
 
@@ -0,0 +1,3 @@
+-- upgrades a v1 schema created before lists carried a build generation
+ALTER TABLE list
+  ADD COLUMN IF NOT EXISTS generation INT UNSIGNED NOT NULL DEFAULT 0;
@@ -14,6 +14,16 @@ enum RecordType
   RECORD_TYPE_NET
 };
 
+// string fields of the current record, see RRDBOrg and RRDBNetBlock
+enum RecordField
+{
+  FIELD_HANDLE,
+  FIELD_NAME,
+  FIELD_DESCR,
+
+  FIELD_MAX
+};
+
 typedef struct AddrPair
 {
   RRDBAddr start;
@@ -40,6 +50,9 @@ struct ProcessState
   }
   x;
 
+  // backing storage for the views in x, reused between records
+  RRBuffer field[FIELD_MAX];
+
   char ipVersion[8];
   char ipType   [8];
   bool inNetBlocks;
@@ -51,35 +64,70 @@ struct ProcessState
   size_t    nbAddrs;
   size_t    szAddrs;
 
-  char   *textPtr;
-  size_t  textPtrSz;
+  // text is captured into either a record field or one of the above
+  RRBuffer *textBuf;
+  size_t    textBufMax;
+  char     *textPtr;
+  size_t    textPtrSz;
 
-  bool    inComment;
-  char   *commentPtr;
-  size_t  commentPtrSz;
-  size_t  commentPtrOff;
+  bool inComment;
 };
 
-static void setup_comment(struct ProcessState *state)
+static inline bool field_equals(struct ProcessState *state,
+  enum RecordField field, const char *str)
 {
-  state->textPtr   = NULL;
-  state->textPtrSz = 0;
+  const RRBuffer *buf = &state->field[field];
+  size_t len = strlen(str);
+  return buf->pos == len && memcmp(buf->buffer, str, len) == 0;
+}
 
-  if (!state->commentPtr || state->commentPtrSz == 0)
-    return;
+static void capture_field(struct ProcessState *state, enum RecordField field,
+  size_t max)
+{
+  rr_buffer_reset(&state->field[field]);
+  state->textBuf    = &state->field[field];
+  state->textBufMax = max;
+}
 
-  if (state->commentPtrOff >= state->commentPtrSz - 1)
+static void setup_comment(struct ProcessState *state)
+{
+  RRBuffer *descr = &state->field[FIELD_DESCR];
+  state->textBuf = NULL;
+
+  if (descr->pos >= RRDB_DESCR_MAX)
     return;
 
-  if (state->commentPtrOff > 0)
+  if (descr->pos > 0)
   {
-    if (state->commentPtrOff >= state->commentPtrSz - 1)
+    if (descr->pos + 1 >= RRDB_DESCR_MAX)
+      return;
+
+    if (rr_buffer_append(descr, "\n", 1) < 0)
+    {
+      XML_StopParser(state->p, XML_FALSE);
+      state->faulted = true;
       return;
-    state->commentPtr[state->commentPtrOff++] = '\n';
+    }
   }
 
-  state->textPtr   = state->commentPtr   + state->commentPtrOff;
-  state->textPtrSz = state->commentPtrSz - state->commentPtrOff;
+  state->textBuf    = descr;
+  state->textBufMax = RRDB_DESCR_MAX;
+}
+
+static void bind_fields(struct ProcessState *state)
+{
+  if (state->recordType == RECORD_TYPE_ORG)
+  {
+    state->x.org.handle = rr_buffer_view(&state->field[FIELD_HANDLE]);
+    state->x.org.name   = rr_buffer_view(&state->field[FIELD_NAME  ]);
+    state->x.org.descr  = rr_buffer_view(&state->field[FIELD_DESCR ]);
+  }
+  else
+  {
+    state->x.inetnum.org_handle = rr_buffer_view(&state->field[FIELD_HANDLE]);
+    state->x.inetnum.netname    = rr_buffer_view(&state->field[FIELD_NAME  ]);
+    state->x.inetnum.descr      = rr_buffer_view(&state->field[FIELD_DESCR ]);
+  }
 }
 
 static void add_netblock(struct ProcessState *state)
@@ -117,8 +165,8 @@ static void add_netblock(struct ProcessState *state)
   AddrPair *pair = &state->addrs[state->nbAddrs];
   if (strstr(state->startAddr, ":") != NULL)
   {
-    if (inet_pton(AF_INET6, state->startAddr, (void *)&pair->start.v6) != 1 ||
-        inet_pton(AF_INET6, state->endAddr  , (void *)&pair->end.v6  ) != 1)
+    if (rr_parse_ipv6_decimal(state->startAddr, &pair->start.v6) != 1 ||
+        rr_parse_ipv6_decimal(state->endAddr  , &pair->end  .v6) != 1)
     {
       LOG_WARN("v6 inet_pton failure: %s -> %s", state->startAddr, state->endAddr);
       return;
@@ -151,6 +199,10 @@ static void xml_on_start(void *userData, const char *name, const char **atts)
   else if (strcmp(name, a) == 0) \
     state->textPtr = state->b, state->textPtrSz = sizeof(state->b)
 
+#define MATCH_FIELD(a, b, max) \
+  else if (strcmp(name, a) == 0) \
+    capture_field(state, b, max)
+
   struct ProcessState *state = userData;
   switch(state->level++)
   {
@@ -181,6 +233,8 @@ static void xml_on_start(void *userData, const char *name, const char **atts)
         return;
       }
       memset(&state->x, 0, sizeof(state->x));
+      for(int i = 0; i < FIELD_MAX; ++i)
+        rr_buffer_reset(&state->field[i]);
       break;
 
     case 2:
@@ -191,30 +245,26 @@ static void xml_on_start(void *userData, const char *name, const char **atts)
 
         case RECORD_TYPE_ORG:
           if (0);
-          MATCH("handle", x.org.handle);
-          MATCH("name"  , x.org.name  );
+          MATCH_FIELD("handle", FIELD_HANDLE, RRDB_HANDLE_MAX  );
+          MATCH_FIELD("name"  , FIELD_NAME  , RRDB_ORG_NAME_MAX);
           else if (strcmp(name, "comment") == 0)
           {
-            state->inComment     = true;
-            state->commentPtr    = state->x.org.descr;
-            state->commentPtrSz  = sizeof(state->x.org.descr);
-            state->commentPtrOff = 0;
+            state->inComment = true;
+            rr_buffer_reset(&state->field[FIELD_DESCR]);
           }
           break;
 
         case RECORD_TYPE_NET:
           if (0);
-          MATCH("orgHandle", x.inetnum.org_handle);
-          MATCH("name"     , x.inetnum.netname   );
-          MATCH("version"  , ipVersion           );
+          MATCH_FIELD("orgHandle", FIELD_HANDLE, RRDB_HANDLE_MAX );
+          MATCH_FIELD("name"     , FIELD_NAME  , RRDB_NETNAME_MAX);
+          MATCH      ("version"  , ipVersion                     );
           else if (strcmp(name, "netBlocks") == 0)
             state->inNetBlocks = true;
           else if (strcmp(name, "comment") == 0)
           {
-            state->inComment     = true;
-            state->commentPtr    = state->x.inetnum.descr;
-            state->commentPtrSz  = sizeof(state->x.inetnum.descr);
-            state->commentPtrOff = 0;
+            state->inComment = true;
+            rr_buffer_reset(&state->field[FIELD_DESCR]);
           }
           break;
       }
@@ -255,6 +305,7 @@ static void xml_on_start(void *userData, const char *name, const char **atts)
       break;
   }
 #undef MATCH
+#undef MATCH_FIELD
 }
 
 static void xml_on_end(void *userData, const char *name)
@@ -262,6 +313,7 @@ static void xml_on_end(void *userData, const char *name)
   struct ProcessState *state = userData;
 
   state->textPtr = NULL;
+  state->textBuf = NULL;
   switch(state->level--)
   {
     case 0:
@@ -284,12 +336,19 @@ static void xml_on_end(void *userData, const char *name)
 
         case RECORD_TYPE_ORG:
           //filter out the generic top level org
-          if (strcmp(state->x.org.handle, "ARIN") == 0)
+          if (field_equals(state, FIELD_HANDLE, "ARIN"))
             break;
 
+          if (!rr_sanatize_buffer(&state->field[FIELD_DESCR], RRDB_DESCR_MAX))
+          {
+            XML_StopParser(state->p, XML_FALSE);
+            state->faulted = true;
+            return;
+          }
+
+          bind_fields(state);
           state->x.org.registrar_id = state->registrar_id;
           state->x.org.serial       = state->serial;
-          rr_sanatize(state->x.org.descr, sizeof(state->x.org.descr));
           if (!rr_import_org_insert(&state->x.org))
           {
             XML_StopParser(state->p, XML_FALSE);
@@ -301,9 +360,10 @@ static void xml_on_end(void *userData, const char *name)
         case RECORD_TYPE_NET:
         {
           //filter out the generic top level netblocks
-          if (strcmp(state->x.inetnum.org_handle, "ARIN") == 0)
+          if (field_equals(state, FIELD_HANDLE, "ARIN"))
             break;
 
+          bind_fields(state);
           state->x.inetnum.registrar_id = state->registrar_id;
           state->x.inetnum.serial       = state->serial;
 
@@ -361,19 +421,28 @@ static void xml_on_end(void *userData, const char *name)
 static void xml_on_text(void *userData, const XML_Char *s, int len)
 {
   struct ProcessState *state = userData;
+  size_t n = (len > 0) ? (size_t)len : 0;
+
+  if (state->textBuf)
+  {
+    RRBuffer *buf = state->textBuf;
+    n = MIN(n, state->textBufMax - MIN(buf->pos, state->textBufMax));
+    if (n && rr_buffer_append(buf, s, n) < 0)
+    {
+      XML_StopParser(state->p, XML_FALSE);
+      state->faulted = true;
+    }
+    return;
+  }
+
   if (!state->textPtr || state->textPtrSz == 0)
     return;
 
   size_t avail = state->textPtrSz;
-  size_t n     = (len > 0) ? (size_t)len : 0;
-
   if (n >= avail)
     n = avail - 1;
 
   memcpy(state->textPtr, s, n);
-  if (state->inComment)
-    state->commentPtrOff += n;
-
   state->textPtr   += n;
   state->textPtrSz -= n;
   *state->textPtr   = '\0';
@@ -489,6 +558,8 @@ err_xml_parser:
   XML_ParserFree(state.p);
 err_addrs:
   free(state.addrs);
+  for(int i = 0; i < FIELD_MAX; ++i)
+    rr_buffer_free(&state.field[i]);
   unzCloseCurrentFile(uz);
 err:
   unzClose(uz);
@@ -0,0 +1,199 @@
+#include "compress.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define RR_COMPRESS_IN_SIZE (64 * 1024)
+
+static struct
+{
+  atomic_ullong streams;
+  atomic_ullong bytesIn;
+  atomic_ullong bytesOut;
+  atomic_ullong cpuTime;
+  atomic_ullong hits;
+}
+s_compressStats;
+
+static inline uint64_t rr_compress_cputime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+  Picks the encoding with the highest q-value, gzip winning a tie. A q-value
+  of zero refuses the encoding, and * applies to any not listed.
+*/
+RRCompressEncoding rr_compress_negotiate(const char *accept)
+{
+  if (!accept)
+    return RR_COMPRESS_NONE;
+
+  double gzip = -1.0, deflate = -1.0, any = -1.0;
+  const char *p = accept;
+  while(*p)
+  {
+    const char *end = p + strcspn(p, ",");
+    while(p < end && (*p == ' ' || *p == '\t'))
+      ++p;
+
+    size_t nameLen = strcspn(p, ";, \t");
+    if (nameLen > (size_t)(end - p))
+      nameLen = end - p;
+
+    double q = 1.0;
+    for(const char *param = memchr(p, ';', end - p); param;
+      param = memchr(param, ';', end - param))
+    {
+      ++param;
+      while(param < end && (*param == ' ' || *param == '\t'))
+        ++param;
+
+      if (end - param >= 2 && (*param == 'q' || *param == 'Q') && param[1] == '=')
+      {
+        q = strtod(param + 2, NULL);
+        break;
+      }
+    }
+
+    if (nameLen == 4 && strncasecmp(p, "gzip", 4) == 0)
+      gzip = q;
+    else if (nameLen == 7 && strncasecmp(p, "deflate", 7) == 0)
+      deflate = q;
+    else if (nameLen == 1 && *p == '*')
+      any = q;
+
+    p = *end ? end + 1 : end;
+  }
+
+  if (gzip    < 0.0) gzip    = any;
+  if (deflate < 0.0) deflate = any;
+
+  if (gzip > 0.0 && gzip >= deflate)
+    return RR_COMPRESS_GZIP;
+  if (deflate > 0.0)
+    return RR_COMPRESS_DEFLATE;
+  return RR_COMPRESS_NONE;
+}
+
+const char *rr_compress_name(RRCompressEncoding enc)
+{
+  switch(enc)
+  {
+    case RR_COMPRESS_DEFLATE: return "deflate";
+    case RR_COMPRESS_GZIP   : return "gzip";
+    default:
+      return NULL;
+  }
+}
+
+bool rr_compress_stream_init(RRCompressStream *s, RRCompressEncoding enc,
+  int level, RRCompressSource source, void *udata)
+{
+  memset(s, 0, sizeof(*s));
+  s->source = source;
+  s->udata  = udata;
+
+  if (!(s->in = malloc(RR_COMPRESS_IN_SIZE)))
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+  s->inSize = RR_COMPRESS_IN_SIZE;
+
+  // HTTP deflate is the zlib format, gzip adds 16 to the window bits
+  int windowBits = enc == RR_COMPRESS_GZIP ? 15 + 16 : 15;
+  if (deflateInit2(&s->z, level, Z_DEFLATED, windowBits, 8,
+    Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    LOG_ERROR("deflateInit2 failed");
+    free(s->in);
+    s->in = NULL;
+    return false;
+  }
+
+  s->init = true;
+  return true;
+}
+
+ssize_t rr_compress_stream_read(RRCompressStream *s, char *buf, size_t max)
+{
+  if (s->done)
+    return 0;
+
+  s->z.next_out  = (Bytef *)buf;
+  s->z.avail_out = max;
+  while(s->z.avail_out > 0)
+  {
+    if (s->z.avail_in == 0 && !s->eof)
+    {
+      ssize_t n = s->source(s->udata, s->in, s->inSize);
+      if (n < 0)
+        return -1;
+
+      if (n == 0)
+        s->eof = true;
+
+      s->z.next_in  = (Bytef *)s->in;
+      s->z.avail_in = n;
+      s->bytesIn   += n;
+    }
+
+    uint64_t start = rr_compress_cputime();
+    int rc = deflate(&s->z, s->eof ? Z_FINISH : Z_NO_FLUSH);
+    s->cpuTime += rr_compress_cputime() - start;
+
+    if (rc == Z_STREAM_END)
+    {
+      s->done = true;
+      break;
+    }
+
+    // Z_BUF_ERROR only means there was no input to consume yet
+    if (rc != Z_OK && rc != Z_BUF_ERROR)
+    {
+      LOG_ERROR("deflate failed: %d", rc);
+      return -1;
+    }
+  }
+
+  size_t out = max - s->z.avail_out;
+  s->bytesOut += out;
+  return out;
+}
+
+void rr_compress_stream_free(RRCompressStream *s)
+{
+  if (!s->init)
+    return;
+
+  deflateEnd(&s->z);
+  free(s->in);
+  s->in   = NULL;
+  s->init = false;
+
+  atomic_fetch_add_explicit(&s_compressStats.streams , 1          , memory_order_relaxed);
+  atomic_fetch_add_explicit(&s_compressStats.bytesIn , s->bytesIn , memory_order_relaxed);
+  atomic_fetch_add_explicit(&s_compressStats.bytesOut, s->bytesOut, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s_compressStats.cpuTime , s->cpuTime , memory_order_relaxed);
+}
+
+void rr_compress_count_hit(void)
+{
+  atomic_fetch_add_explicit(&s_compressStats.hits, 1, memory_order_relaxed);
+}
+
+void rr_compress_get_stats(RRCompressStats *out)
+{
+  out->streams  = atomic_load_explicit(&s_compressStats.streams , memory_order_relaxed);
+  out->bytesIn  = atomic_load_explicit(&s_compressStats.bytesIn , memory_order_relaxed);
+  out->bytesOut = atomic_load_explicit(&s_compressStats.bytesOut, memory_order_relaxed);
+  out->cpuTime  = atomic_load_explicit(&s_compressStats.cpuTime , memory_order_relaxed);
+  out->hits     = atomic_load_explicit(&s_compressStats.hits    , memory_order_relaxed);
+}
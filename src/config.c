@@ -90,6 +90,44 @@ static bool rr_config_read_list_filter(config_setting_t *filter, ConfigFilter *o
   return true;
 }
 
+static bool rr_config_read_nrtm(const char *name, config_setting_t *src,
+  typeof(g_config.sources->nrtm) *out)
+{
+  // defaults, the NRTM source name is usually the same as the registrar
+  out->port      = 43;
+  out->source    = name;
+  out->version   = 3;
+  out->frequency = 60;
+
+  config_setting_t *nrtm = config_setting_lookup(src, "nrtm");
+  if (!nrtm || config_setting_type(nrtm) != CONFIG_TYPE_GROUP)
+  {
+    LOG_ERROR("sources.%s.nrtm missing or is not a group", name);
+    return false;
+  }
+
+  config_setting_lookup_string(nrtm, "host"      , &out->host      );
+  config_setting_lookup_int   (nrtm, "port"      , &out->port      );
+  config_setting_lookup_string(nrtm, "source"    , &out->source    );
+  config_setting_lookup_string(nrtm, "serial_url", &out->serial_url);
+  config_setting_lookup_int   (nrtm, "version"   , &out->version   );
+  config_setting_lookup_int   (nrtm, "frequency" , &out->frequency );
+
+  if (!out->host || !out->serial_url)
+  {
+    LOG_ERROR("sources.%s.nrtm requires 'host' and 'serial_url'", name);
+    return false;
+  }
+
+  if (out->version != 3 && out->version != 4)
+  {
+    LOG_ERROR("sources.%s.nrtm.version %d is not supported", name, out->version);
+    return false;
+  }
+
+  return true;
+}
+
 void rr_resolve_list_children(const char **children)
 {
   if (!children)
@@ -175,11 +213,17 @@ bool rr_config_init(void)
       dst->type = SOURCE_TYPE_JSON;
     else if (strcmp(type, "REGEX") == 0)
       dst->type = SOURCE_TYPE_REGEX;
+    else if (strcmp(type, "NRTM") == 0)
+      dst->type = SOURCE_TYPE_NRTM;
     else
     {
       dst->type = SOURCE_TYPE_INVALID;
       LOG_ERROR("Unsupported source type %s", type);
     }
+
+    if (dst->type == SOURCE_TYPE_NRTM &&
+        !rr_config_read_nrtm(dst->name, (config_setting_t *)src, &dst->nrtm))
+      dst->type = SOURCE_TYPE_INVALID;
   }
 
   config_setting_t *lists = config_lookup(&s_config, "lists");
@@ -49,6 +49,8 @@ struct RRDBStmt
 
   size_t         in_params;
   RRDBType      *types;
+  void         **src;
+  bool           has_views;
   MYSQL_BIND    *bind;
   unsigned long *lengths;
   my_bool       *is_null;
@@ -75,6 +77,7 @@ static inline enum enum_field_types rr_db_type_to_mysql_type(RRDBType type)
     case RRDB_TYPE_DOUBLE : return MYSQL_TYPE_DOUBLE  ;
     case RRDB_TYPE_STRING : return MYSQL_TYPE_STRING  ;
     case RRDB_TYPE_BINARY : return MYSQL_TYPE_BLOB    ;
+    case RRDB_TYPE_STRVIEW: return MYSQL_TYPE_STRING  ;
   }
   assert(false);
 };
@@ -99,6 +102,7 @@ static inline bool rr_db_type_is_stringish(RRDBType type)
   {
     case RRDB_TYPE_STRING:
     case RRDB_TYPE_BINARY:
+    case RRDB_TYPE_STRVIEW:
       return true;
 
     default:
@@ -120,6 +124,7 @@ static inline unsigned long rr_db_type_length(RRDBType type)
     case RRDB_TYPE_DOUBLE : return sizeof(double            );
     case RRDB_TYPE_STRING : return 0;
     case RRDB_TYPE_BINARY : return 0;
+    case RRDB_TYPE_STRVIEW: return 0;
   }
   assert(false);
 }
@@ -427,7 +432,8 @@ bool rr_db_rollback(RRDBCon *con)
   return true;
 }
 
-RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
+static RRDBStmt *rr_db_stmt_prepare_params(RRDBCon *con, const char *sql,
+  RRDBParam **params)
 {
   MYSQL_STMT *stmt = mysql_stmt_init(&con->con);
   if (!stmt)
@@ -445,14 +451,12 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
     return NULL;
   }
 
-  va_list ap;
-  va_start(ap, sql);
   size_t in_params  = 0;
   size_t out_params = 0;
   bool   in         = true;
-  for (;;)
+  for (RRDBParam **p = params;; ++p)
   {
-    RRDBParam *param = va_arg(ap, RRDBParam *);
+    RRDBParam *param = *p;
     if (param == RRDB_PARAM_OUT)
     {
       in = false;
@@ -467,11 +471,11 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
     else
       ++out_params;
   }
-  va_end(ap);
 
 
   #define RRDB_FIELDS(T, X, ...) \
     X(T, types   , in_params , __VA_ARGS__); \
+    X(T, src     , in_params , __VA_ARGS__); \
     X(T, bind    , in_params , __VA_ARGS__); \
     X(T, lengths , in_params , __VA_ARGS__); \
     X(T, is_null , in_params , __VA_ARGS__); \
@@ -493,12 +497,12 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
   rs->in_params  = in_params;
   rs->out_params = out_params;
 
-  va_start(ap, sql);
   for (size_t i = 0; i < in_params; i++)
   {
-    RRDBParam *param = va_arg(ap, RRDBParam *);
+    RRDBParam *param = *params++;
 
     rs->types[i]              = param->type;
+    rs->src  [i]              = param->bind;
     rs->bind[i].buffer_type   = rr_db_type_to_mysql_type(param->type);
     rs->bind[i].buffer        = param->bind;
     rs->bind[i].buffer_length = rr_db_type_length(param->type);
@@ -523,6 +527,13 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
         rs->bind[i].flags |= BINARY_FLAG;
         rs->lengths[i]     = param->size;
       }
+
+      // the buffer is only known at execute time
+      if (param->type == RRDB_TYPE_STRVIEW)
+      {
+        rs->bind[i].buffer = "";
+        rs->has_views      = true;
+      }
     }
     else
     {
@@ -533,11 +544,19 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
   }
 
   // NULL or RRDB_PARAM_OUT
-  (void)va_arg(ap, void *);
+  ++params;
 
   for(size_t i = 0; i < out_params; ++i)
   {
-    RRDBParam *param = va_arg(ap, RRDBParam *);
+    RRDBParam *param = *params++;
+
+    if (param->type == RRDB_TYPE_STRVIEW)
+    {
+      LOG_ERROR("out parameter %ld is a string view which is input only", i);
+      mysql_stmt_close(stmt);
+      free(rs);
+      return NULL;
+    }
 
     if (rr_db_type_is_stringish(param->type) && param->size == 0)
     {
@@ -551,7 +570,8 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
     rs->rbind[i].buffer_type   = rr_db_type_to_mysql_type(param->type);
     rs->rbind[i].buffer        = param->bind;
     rs->rbind[i].buffer_length = rr_db_type_is_stringish(param->type) ? param->size : rr_db_type_length(param->type);
-    rs->rbind[i].is_null       = &rs->ris_null[i];
+    rs->rbind[i].is_null       = param->is_null ?
+      (my_bool *)param->is_null : &rs->ris_null[i];
     rs->rbind[i].length        = &rs->rlengths[i];
     rs->rbind[i].is_unsigned   = rr_db_type_is_unsigned(param->type);
     rs->ris_null[i]            = param->bind == NULL;
@@ -564,12 +584,6 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
       rs->rbind[i].buffer_length = 0;
   }
 
-  // NULL
-  if (out_params > 0)
-    (void)va_arg(ap, void *);
-
-  va_end(ap);
-
   if (rs->in_params > 0 && mysql_stmt_bind_param(stmt, rs->bind) != 0)
   {
     LOG_ERROR("mysql_stmt_bind_param failed: %s", mysql_stmt_error(stmt));
@@ -589,6 +603,24 @@ RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
   return rs;
 }
 
+RRDBStmt *rr_db_stmt_prepare(RRDBCon *con, const char *sql, ...)
+{
+  va_list ap;
+  size_t  count = 0;
+  va_start(ap, sql);
+  while(va_arg(ap, RRDBParam *))
+    ++count;
+  va_end(ap);
+
+  RRDBParam *params[count + 1];
+  va_start(ap, sql);
+  for(size_t i = 0; i <= count; ++i)
+    params[i] = va_arg(ap, RRDBParam *);
+  va_end(ap);
+
+  return rr_db_stmt_prepare_params(con, sql, params);
+}
+
 bool rr_db_stmt_execute(RRDBStmt *stmt, unsigned long long *affectedRows)
 {
   for(int i = 0; i < stmt->in_params; ++i)
@@ -598,6 +630,20 @@ bool rr_db_stmt_execute(RRDBStmt *stmt, unsigned long long *affectedRows)
       stmt->lengths[i] = (unsigned long)strlen(str);
       stmt->bind[i].buffer_length = stmt->lengths[i];
     }
+    else if (stmt->types[i] == RRDB_TYPE_STRVIEW && stmt->src[i])
+    {
+      const RRStrView *view = stmt->src[i];
+      stmt->bind[i].buffer        = view->str ? (void *)view->str : "";
+      stmt->lengths[i]            = view->str ? (unsigned long)view->len : 0;
+      stmt->bind[i].buffer_length = stmt->lengths[i];
+    }
+
+  // the client library copies the binds, views need them applied again
+  if (stmt->has_views && mysql_stmt_bind_param(stmt->stmt, stmt->bind) != 0)
+  {
+    LOG_ERROR("mysql_stmt_bind_param failed: %s", mysql_stmt_error(stmt->stmt));
+    return false;
+  }
 
   if (mysql_stmt_execute(stmt->stmt) != 0)
   {
@@ -643,12 +689,15 @@ int rr_db_stmt_fetch_one(RRDBStmt *stmt)
     goto err;
   }
 
-  // null terminate strings
+  // null terminate strings, the length is the full length when truncated
   for(int i = 0; i < stmt->out_params; ++i)
     if (stmt->rtypes[i] == RRDB_TYPE_STRING)
     {
       char *str = stmt->rbind[i].buffer;
-      str[stmt->rlengths[i]] = '\0';
+      unsigned long len = stmt->rlengths[i];
+      if (len > stmt->rbind[i].buffer_length)
+        len = stmt->rbind[i].buffer_length;
+      str[len] = '\0';
     }
 
   ret = 1;
@@ -705,12 +754,15 @@ int rr_db_stmt_fetch(RRDBStmt *stmt)
     goto err;
   }
 
-  // null terminate strings
+  // null terminate strings, the length is the full length when truncated
   for(int i = 0; i < stmt->out_params; ++i)
     if (stmt->rtypes[i] == RRDB_TYPE_STRING)
     {
       char *str = stmt->rbind[i].buffer;
-      str[stmt->rlengths[i]] = '\0';
+      unsigned long len = stmt->rlengths[i];
+      if (len > stmt->rbind[i].buffer_length)
+        len = stmt->rbind[i].buffer_length;
+      str[len] = '\0';
     }
 
   ret = 1;
@@ -726,3 +778,208 @@ void rr_db_stmt_close(RRDBStmt *stmt)
     stmt->con->is_faulty = rr_mysql_needs_reconnect(mysql_stmt_errno(stmt->stmt));
   }
 }
+
+// partial batches are flushed with statements of power of two rows
+#define RRDB_BULK_TAILS 16
+
+struct RRDBBulk
+{
+  RRDBStmt *stmt;                   // a full batch of rows
+  RRDBStmt *tail[RRDB_BULK_TAILS];  // 1 << n rows, for n below log2(rows)
+  size_t    nbTails;
+
+  size_t   rows;
+  size_t   cols;
+  size_t   count;
+  size_t   rowSize;
+  size_t  *offsets;
+  size_t  *sizes;
+  uint8_t *data;
+
+  unsigned long long affected;
+};
+
+static RRDBStmt *rr_db_bulk_prepare(RRDBCon *con, RRDBBulk *b,
+  const char *prefix, const char *row, const char *suffix,
+  const RRDBParam *cols, size_t rows)
+{
+  RRDBStmt  *stmt   = NULL;
+  RRBuffer   sql    = { .bufferSz = 8192 };
+  RRDBParam *params = calloc(rows * b->cols, sizeof(*params));
+  RRDBParam **ptrs  = calloc(rows * b->cols + 1, sizeof(*ptrs));
+  if (!params || !ptrs)
+  {
+    LOG_ERROR("out of memory");
+    goto err;
+  }
+
+  if (rr_buffer_append_str(&sql, prefix) < 0)
+    goto err_oom;
+
+  for(size_t r = 0; r < rows; ++r)
+  {
+    if ((r > 0 && rr_buffer_append_str(&sql, ",") < 0) ||
+        rr_buffer_append_str(&sql, row) < 0)
+      goto err_oom;
+
+    for(size_t c = 0; c < b->cols; ++c)
+    {
+      RRDBParam *p = &params[r * b->cols + c];
+      p->type = cols[c].type;
+      p->bind = b->data + r * b->rowSize + b->offsets[c];
+      p->size = b->sizes[c];
+      ptrs[r * b->cols + c] = p;
+    }
+  }
+
+  if (rr_buffer_append_str(&sql, suffix) < 0)
+    goto err_oom;
+
+  stmt = rr_db_stmt_prepare_params(con, sql.buffer, ptrs);
+  goto err;
+
+err_oom:
+  LOG_ERROR("out of memory");
+err:
+  rr_buffer_free(&sql);
+  free(ptrs);
+  free(params);
+  return stmt;
+}
+
+RRDBBulk *rr_db_bulk_new(RRDBCon *con, const char *prefix, const char *row,
+  const char *suffix, size_t rows, const RRDBParam *cols, size_t ncols)
+{
+  // the protocol limits a statement to 65535 placeholders
+  if (rows == 0 || ncols == 0 || rows * ncols > 65535)
+  {
+    LOG_ERROR("invalid bulk statement size %zu x %zu", rows, ncols);
+    return NULL;
+  }
+
+  RRDBBulk *b = calloc(1, sizeof(*b));
+  if (!b)
+  {
+    LOG_ERROR("out of memory");
+    return NULL;
+  }
+
+  b->rows    = rows;
+  b->cols    = ncols;
+  b->offsets = calloc(ncols, sizeof(*b->offsets));
+  b->sizes   = calloc(ncols, sizeof(*b->sizes));
+  if (!b->offsets || !b->sizes)
+  {
+    LOG_ERROR("out of memory");
+    goto err;
+  }
+
+  for(size_t c = 0; c < ncols; ++c)
+  {
+    if (cols[c].type == RRDB_TYPE_STRING || cols[c].type == RRDB_TYPE_STRVIEW)
+    {
+      LOG_ERROR("bulk column %zu is not fixed length", c);
+      goto err;
+    }
+
+    b->sizes  [c] = cols[c].type == RRDB_TYPE_BINARY ?
+      cols[c].size : rr_db_type_length(cols[c].type);
+    b->offsets[c] = b->rowSize;
+    b->rowSize    = rr_align_up(b->rowSize + b->sizes[c], sizeof(uint64_t));
+  }
+
+  b->data = calloc(rows, b->rowSize);
+  if (!b->data)
+  {
+    LOG_ERROR("out of memory");
+    goto err;
+  }
+
+  b->stmt = rr_db_bulk_prepare(con, b, prefix, row, suffix, cols, rows);
+  if (!b->stmt)
+    goto err;
+
+  for(; ((size_t)1 << b->nbTails) < rows && b->nbTails < RRDB_BULK_TAILS;
+    ++b->nbTails)
+    if (!(b->tail[b->nbTails] = rr_db_bulk_prepare(con, b, prefix, row,
+      suffix, cols, (size_t)1 << b->nbTails)))
+      goto err;
+
+  return b;
+
+err:
+  rr_db_bulk_free(&b);
+  return NULL;
+}
+
+void rr_db_bulk_free(RRDBBulk **b)
+{
+  if (!*b)
+    return;
+
+  rr_db_stmt_free(&(*b)->stmt);
+  for(size_t i = 0; i < (*b)->nbTails; ++i)
+    rr_db_stmt_free(&(*b)->tail[i]);
+  free((*b)->data);
+  free((*b)->sizes);
+  free((*b)->offsets);
+  free(*b);
+  *b = NULL;
+}
+
+bool rr_db_bulk_flush(RRDBBulk *b)
+{
+  unsigned long long ra;
+  if (b->count == b->rows)
+  {
+    if (!rr_db_stmt_execute(b->stmt, &ra))
+      return false;
+
+    b->affected += ra;
+    b->count     = 0;
+    return true;
+  }
+
+  // the tail statements are bound to the first rows, largest first
+  size_t offset = 0;
+  for(size_t i = b->nbTails; i-- > 0;)
+  {
+    size_t n = (size_t)1 << i;
+    if (b->count - offset < n)
+      continue;
+
+    if (offset > 0)
+      memmove(b->data, b->data + offset * b->rowSize, n * b->rowSize);
+
+    if (!rr_db_stmt_execute(b->tail[i], &ra))
+      return false;
+
+    b->affected += ra;
+    offset      += n;
+  }
+
+  b->count = 0;
+  return true;
+}
+
+bool rr_db_bulk_add(RRDBBulk *b, const void **values)
+{
+  uint8_t *row = b->data + b->count * b->rowSize;
+  for(size_t c = 0; c < b->cols; ++c)
+    memcpy(row + b->offsets[c], values[c], b->sizes[c]);
+
+  if (++b->count < b->rows)
+    return true;
+
+  return rr_db_bulk_flush(b);
+}
+
+void rr_db_bulk_discard(RRDBBulk *b)
+{
+  b->count = 0;
+}
+
+unsigned long long rr_db_bulk_affected(RRDBBulk *b)
+{
+  return b->affected;
+}
@@ -0,0 +1,364 @@
+#include "filter.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// pattern tokens, 0-255 are literal bytes
+#define TOK_ONE  256
+#define TOK_MANY 257
+
+typedef struct Pattern
+{
+  uint16_t *tok;
+  size_t    len;
+  unsigned  next;  // next pattern on the same node + 1, 0 ends the chain
+  unsigned  stamp;
+}
+Pattern;
+
+typedef struct Node
+{
+  int32_t  next[256];
+  int32_t  fail;
+  int32_t  dict;     // nearest node on the fail chain with patterns, or -1
+  unsigned first;    // first pattern ending at the node + 1, 0 if none
+}
+Node;
+
+struct RRFilter
+{
+  Pattern  *patterns;
+  unsigned  nbPatterns;
+  unsigned  szPatterns;
+
+  // patterns without a literal, these are always verified
+  unsigned *always;
+  unsigned  nbAlways;
+
+  Node     *nodes;
+  unsigned  nbNodes;
+  unsigned  szNodes;
+
+  unsigned  stamp;
+  bool      compiled;
+};
+
+static inline uint8_t rr_filter_lower(uint8_t c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline size_t rr_filter_utf8_len(uint8_t c)
+{
+  if (c >= 0xF0) return 4;
+  if (c >= 0xE0) return 3;
+  if (c >= 0xC0) return 2;
+  return 1;
+}
+
+bool rr_filter_init(RRFilter **ph)
+{
+  if (*ph)
+  {
+    LOG_ERROR("expected *handle to be NULL");
+    return false;
+  }
+
+  RRFilter *h = calloc(1, sizeof(*h));
+  if (!h)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  *ph = h;
+  return true;
+}
+
+void rr_filter_deinit(RRFilter **ph)
+{
+  if (!*ph)
+    return;
+
+  RRFilter *h = *ph;
+  for(unsigned i = 0; i < h->nbPatterns; ++i)
+    free(h->patterns[i].tok);
+  free(h->patterns);
+  free(h->always);
+  free(h->nodes);
+  free(h);
+  *ph = NULL;
+}
+
+int rr_filter_add(RRFilter *h, const char *pattern)
+{
+  if (h->compiled)
+  {
+    LOG_ERROR("the filter has already been compiled");
+    return -1;
+  }
+
+  if (h->nbPatterns == h->szPatterns)
+  {
+    unsigned newSz = h->szPatterns ? h->szPatterns * 2 : 16;
+    Pattern *newPatterns = realloc(h->patterns, newSz * sizeof(*newPatterns));
+    if (!newPatterns)
+    {
+      LOG_ERROR("out of memory");
+      return -1;
+    }
+    h->patterns   = newPatterns;
+    h->szPatterns = newSz;
+  }
+
+  Pattern *p = &h->patterns[h->nbPatterns];
+  memset(p, 0, sizeof(*p));
+
+  p->tok = malloc((strlen(pattern) + 1) * sizeof(*p->tok));
+  if (!p->tok)
+  {
+    LOG_ERROR("out of memory");
+    return -1;
+  }
+
+  for(const uint8_t *c = (const uint8_t *)pattern; *c; ++c)
+  {
+    if (*c == '\\' && c[1])
+    {
+      p->tok[p->len++] = rr_filter_lower(*++c);
+      continue;
+    }
+
+    if (*c == '%')
+    {
+      // runs of '%' are the same as one
+      if (p->len == 0 || p->tok[p->len - 1] != TOK_MANY)
+        p->tok[p->len++] = TOK_MANY;
+      continue;
+    }
+
+    p->tok[p->len++] = *c == '_' ? TOK_ONE : rr_filter_lower(*c);
+  }
+
+  return h->nbPatterns++;
+}
+
+unsigned rr_filter_count(RRFilter *h)
+{
+  return h->nbPatterns;
+}
+
+static int32_t rr_filter_new_node(RRFilter *h)
+{
+  if (h->nbNodes == h->szNodes)
+  {
+    unsigned newSz = h->szNodes ? h->szNodes * 2 : 64;
+    Node *newNodes = realloc(h->nodes, newSz * sizeof(*newNodes));
+    if (!newNodes)
+    {
+      LOG_ERROR("out of memory");
+      return -1;
+    }
+    h->nodes   = newNodes;
+    h->szNodes = newSz;
+  }
+
+  Node *n = &h->nodes[h->nbNodes];
+  memset(n->next, 0xff, sizeof(n->next));
+  n->fail  = 0;
+  n->dict  = -1;
+  n->first = 0;
+  return h->nbNodes++;
+}
+
+bool rr_filter_compile(RRFilter *h)
+{
+  h->always = calloc(h->nbPatterns + 1, sizeof(*h->always));
+  if (!h->always || rr_filter_new_node(h) < 0)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  // build the trie from the longest literal run of each pattern
+  for(unsigned i = 0; i < h->nbPatterns; ++i)
+  {
+    Pattern *p = &h->patterns[i];
+    size_t bestStart = 0, bestLen = 0;
+    for(size_t s = 0; s < p->len;)
+    {
+      if (p->tok[s] > 255)
+      {
+        ++s;
+        continue;
+      }
+
+      size_t e = s;
+      while(e < p->len && p->tok[e] <= 255)
+        ++e;
+
+      if (e - s > bestLen)
+      {
+        bestStart = s;
+        bestLen   = e - s;
+      }
+      s = e;
+    }
+
+    if (bestLen == 0)
+    {
+      h->always[h->nbAlways++] = i;
+      continue;
+    }
+
+    int32_t node = 0;
+    for(size_t t = bestStart; t < bestStart + bestLen; ++t)
+    {
+      uint8_t c = p->tok[t];
+      if (h->nodes[node].next[c] < 0)
+      {
+        int32_t n = rr_filter_new_node(h);
+        if (n < 0)
+          return false;
+        h->nodes[node].next[c] = n;
+      }
+      node = h->nodes[node].next[c];
+    }
+
+    p->next = h->nodes[node].first;
+    h->nodes[node].first = i + 1;
+  }
+
+  // breadth first to set the fail links and complete the transitions
+  int32_t *queue = malloc(h->nbNodes * sizeof(*queue));
+  if (!queue)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  unsigned head = 0, tail = 0;
+  for(unsigned c = 0; c < 256; ++c)
+  {
+    int32_t n = h->nodes[0].next[c];
+    if (n < 0)
+      h->nodes[0].next[c] = 0;
+    else
+      queue[tail++] = n;
+  }
+
+  while(head < tail)
+  {
+    int32_t node = queue[head++];
+    Node   *fail = &h->nodes[h->nodes[node].fail];
+    h->nodes[node].dict = fail->first ? h->nodes[node].fail : fail->dict;
+
+    for(unsigned c = 0; c < 256; ++c)
+    {
+      int32_t n = h->nodes[node].next[c];
+      if (n < 0)
+      {
+        h->nodes[node].next[c] = h->nodes[h->nodes[node].fail].next[c];
+        continue;
+      }
+
+      h->nodes[n].fail = h->nodes[h->nodes[node].fail].next[c];
+      queue[tail++] = n;
+    }
+  }
+
+  free(queue);
+  h->compiled = true;
+  return true;
+}
+
+static bool rr_filter_like(const Pattern *p, const uint8_t *s, size_t len)
+{
+  size_t pi = 0, si = 0, star = SIZE_MAX, mark = 0;
+  while(si < len)
+  {
+    if (pi < p->len && p->tok[pi] == TOK_MANY)
+    {
+      star = pi++;
+      mark = si;
+      continue;
+    }
+
+    if (pi < p->len && p->tok[pi] == TOK_ONE)
+    {
+      size_t n = rr_filter_utf8_len(s[si]);
+      si += n > len - si ? len - si : n;
+      ++pi;
+      continue;
+    }
+
+    if (pi < p->len && p->tok[pi] == rr_filter_lower(s[si]))
+    {
+      ++pi;
+      ++si;
+      continue;
+    }
+
+    if (star == SIZE_MAX)
+      return false;
+
+    // let the last '%' take one more character and try again
+    size_t n = rr_filter_utf8_len(s[mark]);
+    mark += n > len - mark ? len - mark : n;
+    pi    = star + 1;
+    si    = mark;
+  }
+
+  while(pi < p->len && p->tok[pi] == TOK_MANY)
+    ++pi;
+
+  return pi == p->len;
+}
+
+static inline void rr_filter_verify(RRFilter *h, unsigned i,
+  const uint8_t *text, size_t len, unsigned *out, size_t *count)
+{
+  Pattern *p = &h->patterns[i];
+  if (p->stamp == h->stamp)
+    return;
+
+  p->stamp = h->stamp;
+  if (rr_filter_like(p, text, len))
+    out[(*count)++] = i;
+}
+
+size_t rr_filter_match(RRFilter *h, const char *text, size_t len, unsigned *out)
+{
+  if (!h->compiled || h->nbPatterns == 0)
+    return 0;
+
+  // a new stamp invalidates the verified state of every pattern
+  if (++h->stamp == 0)
+  {
+    for(unsigned i = 0; i < h->nbPatterns; ++i)
+      h->patterns[i].stamp = 0;
+    h->stamp = 1;
+  }
+
+  const uint8_t *s     = (const uint8_t *)text;
+  size_t         count = 0;
+
+  for(unsigned i = 0; i < h->nbAlways; ++i)
+    rr_filter_verify(h, h->always[i], s, len, out, &count);
+
+  if (h->nbNodes == 1)
+    return count;
+
+  int32_t state = 0;
+  for(size_t i = 0; i < len; ++i)
+  {
+    state = h->nodes[state].next[rr_filter_lower(s[i])];
+    for(int32_t n = h->nodes[state].first ? state : h->nodes[state].dict;
+      n >= 0; n = h->nodes[n].dict)
+      for(unsigned p = h->nodes[n].first; p; p = h->patterns[p - 1].next)
+        rr_filter_verify(h, p - 1, s, len, out, &count);
+  }
+
+  return count;
+}
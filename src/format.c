@@ -0,0 +1,450 @@
+#include "format.h"
+#include "rrlist.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+// the most any format writes for one CIDR, or for its header or footer
+#define RR_FORMAT_ENTRY_MAX 128
+
+enum
+{
+  RR_FORMAT_STAGE_BEGIN,
+  RR_FORMAT_STAGE_ENTRIES,
+  RR_FORMAT_STAGE_END,
+  RR_FORMAT_STAGE_DONE
+};
+
+struct RRFormat
+{
+  const char *name;
+  const char *contentType;
+  bool        usesSet;
+
+  // each returns the number of bytes written, begin and end are optional
+  size_t (*begin)(RRFormatStream *s, char *buf);
+  size_t (*v4   )(RRFormatStream *s, char *buf, uint32_t ip, uint8_t prefix_len);
+  size_t (*v6   )(RRFormatStream *s, char *buf, unsigned __int128 ip, uint8_t prefix_len);
+  size_t (*end  )(RRFormatStream *s, char *buf);
+};
+
+static size_t rr_format_put(char *buf, const char *str)
+{
+  size_t len = strlen(str);
+  memcpy(buf, str, len);
+  return len;
+}
+
+static size_t rr_format_cidr_v4(char *buf, uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = rr_ipv4_to_str(buf, ip);
+  return len + rr_prefix_to_str(buf + len, prefix_len);
+}
+
+static size_t rr_format_cidr_v6(char *buf, unsigned __int128 ip, uint8_t prefix_len)
+{
+  size_t len = rr_ipv6_to_str(buf, ip);
+  return len + rr_prefix_to_str(buf + len, prefix_len);
+}
+
+/* plain: one CIDR per line */
+
+static size_t rr_format_plain_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_cidr_v4(buf, ip, prefix_len);
+  buf[len++] = '\n';
+  return len;
+}
+
+static size_t rr_format_plain_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_cidr_v6(buf, ip, prefix_len);
+  buf[len++] = '\n';
+  return len;
+}
+
+/* ipset: input for `ipset restore`, replacing the content of the set */
+
+static size_t rr_format_ipset_begin(RRFormatStream *s, char *buf)
+{
+  return sprintf(buf,
+    "create %s hash:net family %s -exist\n"
+    "flush %s\n",
+    s->set, s->v6 ? "inet6" : "inet", s->set);
+}
+
+static size_t rr_format_ipset_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = sprintf(buf, "add %s ", s->set);
+  len += rr_format_cidr_v4(buf + len, ip, prefix_len);
+  buf[len++] = '\n';
+  return len;
+}
+
+static size_t rr_format_ipset_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  size_t len = sprintf(buf, "add %s ", s->set);
+  len += rr_format_cidr_v6(buf + len, ip, prefix_len);
+  buf[len++] = '\n';
+  return len;
+}
+
+/*
+  nft: the elements of an interval set, to be included in a set definition.
+  nft does not accept an empty element list so nothing is written for one.
+*/
+
+static size_t rr_format_nft_sep(RRFormatStream *s, char *buf)
+{
+  return rr_format_put(buf, s->count == 0 ? "elements = {\n  " : ",\n  ");
+}
+
+static size_t rr_format_nft_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_nft_sep(s, buf);
+  return len + rr_format_cidr_v4(buf + len, ip, prefix_len);
+}
+
+static size_t rr_format_nft_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_nft_sep(s, buf);
+  return len + rr_format_cidr_v6(buf + len, ip, prefix_len);
+}
+
+static size_t rr_format_nft_end(RRFormatStream *s, char *buf)
+{
+  return s->count == 0 ? 0 : rr_format_put(buf, "\n}\n");
+}
+
+/* json: an array of CIDR strings */
+
+static size_t rr_format_json_begin(RRFormatStream *s, char *buf)
+{
+  return rr_format_put(buf, "[");
+}
+
+static size_t rr_format_json_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_put(buf, s->count == 0 ? "\n  \"" : ",\n  \"");
+  len += rr_format_cidr_v4(buf + len, ip, prefix_len);
+  buf[len++] = '"';
+  return len;
+}
+
+static size_t rr_format_json_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_put(buf, s->count == 0 ? "\n  \"" : ",\n  \"");
+  len += rr_format_cidr_v6(buf + len, ip, prefix_len);
+  buf[len++] = '"';
+  return len;
+}
+
+static size_t rr_format_json_end(RRFormatStream *s, char *buf)
+{
+  return rr_format_put(buf, s->count == 0 ? "]\n" : "\n]\n");
+}
+
+/* binary: the address in network order followed by the prefix length */
+
+static size_t rr_format_binary_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  ip = htonl(ip);
+  memcpy(buf, &ip, sizeof(ip));
+  buf[sizeof(ip)] = (char)prefix_len;
+  return sizeof(ip) + 1;
+}
+
+static size_t rr_format_binary_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  memcpy(buf, &ip, sizeof(ip));
+  buf[sizeof(ip)] = (char)prefix_len;
+  return sizeof(ip) + 1;
+}
+
+/* csv: each CIDR with the first and last address it covers */
+
+static size_t rr_format_csv_begin(RRFormatStream *s, char *buf)
+{
+  return rr_format_put(buf, "cidr,first,last\n");
+}
+
+static size_t rr_format_csv_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  uint32_t last = prefix_len >= 32 ? ip : ip | (UINT32_MAX >> prefix_len);
+
+  size_t len = rr_format_cidr_v4(buf, ip, prefix_len);
+  buf[len++] = ',';
+  len += rr_ipv4_to_str(buf + len, ip);
+  buf[len++] = ',';
+  len += rr_ipv4_to_str(buf + len, last);
+  buf[len++] = '\n';
+  return len;
+}
+
+static size_t rr_format_csv_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
+  unsigned __int128 last = rr_raw_to_be(ip);
+  if (prefix_len < 128)
+    last |= U128_MAX >> prefix_len;
+  last = rr_be_to_raw(last);
+
+  size_t len = rr_format_cidr_v6(buf, ip, prefix_len);
+  buf[len++] = ',';
+  len += rr_ipv6_to_str(buf + len, ip);
+  buf[len++] = ',';
+  len += rr_ipv6_to_str(buf + len, last);
+  buf[len++] = '\n';
+  return len;
+}
+
+/*
+  compact: sorted CIDRs as a prefix length and a varint gap from the end of
+  the previous one, see rrlist.h for the layout and a reference decoder
+*/
+
+static size_t rr_format_compact_put32(char *buf, uint32_t value)
+{
+  value = htonl(value);
+  memcpy(buf, &value, sizeof(value));
+  return sizeof(value);
+}
+
+static size_t rr_format_compact_begin(RRFormatStream *s, char *buf)
+{
+  memcpy(buf, RRLIST_MAGIC, 4);
+  buf[4] = RRLIST_VERSION;
+  buf[5] = s->v6 ? 6 : 4;
+  buf[6] = 0;
+  buf[7] = 0;
+  rr_format_compact_put32(buf + 8, s->generation);
+
+  s->next = 0;
+  s->crc  = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)buf, RRLIST_HEADER_SIZE);
+  return RRLIST_HEADER_SIZE;
+}
+
+static size_t rr_format_compact_entry(RRFormatStream *s, char *buf,
+  unsigned __int128 start, uint8_t prefix_len, unsigned bits)
+{
+  unsigned __int128 gap = start - s->next;
+  size_t len = 0;
+  buf[len++] = (char)prefix_len;
+  do
+  {
+    uint8_t b = gap & 0x7f;
+    gap >>= 7;
+    buf[len++] = (char)(gap ? b | 0x80 : b);
+  }
+  while(gap);
+
+  // wraps to zero past the end of the address space, which ends the list
+  s->next = prefix_len == 0 ? 0 :
+    start + ((unsigned __int128)1 << (bits - prefix_len));
+
+  s->crc = crc32(s->crc, (const Bytef *)buf, len);
+  return len;
+}
+
+static size_t rr_format_compact_v4(RRFormatStream *s, char *buf,
+  uint32_t ip, uint8_t prefix_len)
+{
+  size_t len = rr_format_compact_entry(s, buf, ip, prefix_len, 32);
+  s->next &= UINT32_MAX;
+  return len;
+}
+
+static size_t rr_format_compact_v6(RRFormatStream *s, char *buf,
+  unsigned __int128 ip, uint8_t prefix_len)
+{
+  return rr_format_compact_entry(s, buf, rr_raw_to_be(ip), prefix_len, 128);
+}
+
+static size_t rr_format_compact_end(RRFormatStream *s, char *buf)
+{
+  size_t len = 0;
+  buf[len++] = (char)RRLIST_END;
+  len += rr_format_compact_put32(buf + len, s->count);
+
+  s->crc = crc32(s->crc, (const Bytef *)buf, len);
+  return len + rr_format_compact_put32(buf + len, s->crc);
+}
+
+static const RRFormat s_formats[] =
+{
+  {
+    .name        = "plain",
+    .contentType = "text/plain",
+    .v4          = rr_format_plain_v4,
+    .v6          = rr_format_plain_v6
+  },
+  {
+    .name        = "ipset",
+    .contentType = "text/plain",
+    .usesSet     = true,
+    .begin       = rr_format_ipset_begin,
+    .v4          = rr_format_ipset_v4,
+    .v6          = rr_format_ipset_v6
+  },
+  {
+    .name        = "nft",
+    .contentType = "text/plain",
+    .v4          = rr_format_nft_v4,
+    .v6          = rr_format_nft_v6,
+    .end         = rr_format_nft_end
+  },
+  {
+    .name        = "json",
+    .contentType = "application/json",
+    .begin       = rr_format_json_begin,
+    .v4          = rr_format_json_v4,
+    .v6          = rr_format_json_v6,
+    .end         = rr_format_json_end
+  },
+  {
+    .name        = "binary",
+    .contentType = "application/octet-stream",
+    .v4          = rr_format_binary_v4,
+    .v6          = rr_format_binary_v6
+  },
+  {
+    .name        = "compact",
+    .contentType = "application/octet-stream",
+    .begin       = rr_format_compact_begin,
+    .v4          = rr_format_compact_v4,
+    .v6          = rr_format_compact_v6,
+    .end         = rr_format_compact_end
+  },
+  {
+    .name        = "csv",
+    .contentType = "text/csv",
+    .begin       = rr_format_csv_begin,
+    .v4          = rr_format_csv_v4,
+    .v6          = rr_format_csv_v6
+  }
+};
+
+const RRFormat *rr_format_by_name(const char *name)
+{
+  if (!name)
+    return &s_formats[0];
+
+  for(unsigned i = 0; i < ARRAY_SIZE(s_formats); ++i)
+    if (strcmp(s_formats[i].name, name) == 0)
+      return &s_formats[i];
+  return NULL;
+}
+
+const char *rr_format_content_type(const RRFormat *fmt)
+{
+  return fmt->contentType;
+}
+
+bool rr_format_uses_set(const RRFormat *fmt)
+{
+  return fmt->usesSet;
+}
+
+bool rr_format_valid_set(const char *name)
+{
+  size_t len = strlen(name);
+  if (len == 0 || len > RR_FORMAT_SET_MAX)
+    return false;
+
+  for(const char *c = name; *c; ++c)
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+          (*c >= '0' && *c <= '9') || *c == '_' || *c == '-' || *c == '.'))
+      return false;
+  return true;
+}
+
+static void rr_format_stream_init(RRFormatStream *s, const RRFormat *fmt,
+  const char *set, bool v6, void *udata)
+{
+  memset(s, 0, sizeof(*s));
+  s->fmt   = fmt;
+  s->v6    = v6;
+  s->udata = udata;
+  if (set)
+    snprintf(s->set, sizeof(s->set), "%s", set);
+}
+
+void rr_format_stream_v4(RRFormatStream *s, const RRFormat *fmt,
+  const char *set, RRFormatNextV4 next, void *udata)
+{
+  rr_format_stream_init(s, fmt, set, false, udata);
+  s->nextV4 = next;
+}
+
+void rr_format_stream_v6(RRFormatStream *s, const RRFormat *fmt,
+  const char *set, RRFormatNextV6 next, void *udata)
+{
+  rr_format_stream_init(s, fmt, set, true, udata);
+  s->nextV6 = next;
+}
+
+ssize_t rr_format_stream_read(RRFormatStream *s, char *buf, size_t max)
+{
+  const RRFormat *fmt = s->fmt;
+  size_t out = 0;
+
+  if (s->stage == RR_FORMAT_STAGE_BEGIN)
+  {
+    if (fmt->begin)
+      out += fmt->begin(s, buf);
+    s->stage = RR_FORMAT_STAGE_ENTRIES;
+  }
+
+  while(s->stage == RR_FORMAT_STAGE_ENTRIES && max - out >= RR_FORMAT_ENTRY_MAX)
+  {
+    int     rc;
+    uint8_t prefix_len;
+    if (s->v6)
+    {
+      unsigned __int128 ip;
+      if ((rc = s->nextV6(s->udata, &ip, &prefix_len)) == 1)
+        out += fmt->v6(s, buf + out, ip, prefix_len);
+    }
+    else
+    {
+      uint32_t ip;
+      if ((rc = s->nextV4(s->udata, &ip, &prefix_len)) == 1)
+        out += fmt->v4(s, buf + out, ip, prefix_len);
+    }
+
+    if (rc < 0)
+      return -1;
+
+    if (rc == 0)
+    {
+      s->stage = RR_FORMAT_STAGE_END;
+      break;
+    }
+
+    ++s->count;
+  }
+
+  if (s->stage == RR_FORMAT_STAGE_END && max - out >= RR_FORMAT_ENTRY_MAX)
+  {
+    if (fmt->end)
+      out += fmt->end(s, buf + out);
+    s->stage = RR_FORMAT_STAGE_DONE;
+  }
+
+  return out;
+}
@@ -0,0 +1,190 @@
+#include "hashmap.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Entry
+{
+  uint64_t  hash;  // 0 marks an empty slot
+  uint32_t  keyOff;
+  uint32_t  keyLen;
+  uintptr_t value;
+}
+Entry;
+
+struct RRHashMap
+{
+  Entry  *entries;
+  size_t  size;   // always a power of two
+  size_t  count;
+
+  // key storage, entries reference keys by offset so this can grow
+  char   *keys;
+  size_t  keysLen;
+  size_t  keysSz;
+};
+
+static inline uint64_t rr_hashmap_hash(const char *key, size_t len)
+{
+  // FNV-1a
+  uint64_t hash = 1469598103934665603ULL;
+  for(size_t i = 0; i < len; ++i)
+  {
+    hash ^= (uint8_t)key[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash ? hash : 1;
+}
+
+bool rr_hashmap_init(RRHashMap **ph)
+{
+  if (*ph)
+  {
+    LOG_ERROR("expected *handle to be NULL");
+    return false;
+  }
+
+  RRHashMap *h = calloc(1, sizeof(*h));
+  if (!h)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  h->size    = 1024;
+  h->entries = calloc(h->size, sizeof(*h->entries));
+  if (!h->entries)
+  {
+    LOG_ERROR("out of memory");
+    free(h);
+    return false;
+  }
+
+  *ph = h;
+  return true;
+}
+
+void rr_hashmap_deinit(RRHashMap **ph)
+{
+  if (!*ph)
+    return;
+
+  RRHashMap *h = *ph;
+  free(h->entries);
+  free(h->keys);
+  free(h);
+  *ph = NULL;
+}
+
+void rr_hashmap_clear(RRHashMap *h)
+{
+  memset(h->entries, 0, h->size * sizeof(*h->entries));
+  h->count   = 0;
+  h->keysLen = 0;
+}
+
+static Entry *rr_hashmap_find(RRHashMap *h, uint64_t hash, const char *key, size_t len)
+{
+  size_t mask = h->size - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask)
+  {
+    Entry *e = &h->entries[i];
+    if (e->hash == 0)
+      return e;
+
+    if (e->hash == hash && e->keyLen == len &&
+        memcmp(h->keys + e->keyOff, key, len) == 0)
+      return e;
+  }
+}
+
+static bool rr_hashmap_grow(RRHashMap *h)
+{
+  size_t newSize    = h->size * 2;
+  Entry *newEntries = calloc(newSize, sizeof(*newEntries));
+  if (!newEntries)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  size_t mask = newSize - 1;
+  for(size_t i = 0; i < h->size; ++i)
+  {
+    Entry *e = &h->entries[i];
+    if (e->hash == 0)
+      continue;
+
+    size_t n = e->hash & mask;
+    while(newEntries[n].hash != 0)
+      n = (n + 1) & mask;
+    newEntries[n] = *e;
+  }
+
+  free(h->entries);
+  h->entries = newEntries;
+  h->size    = newSize;
+  return true;
+}
+
+bool rr_hashmap_put(RRHashMap *h, const char *key, size_t len, uintptr_t value)
+{
+  // keep the load factor under 3/4
+  if ((h->count + 1) * 4 > h->size * 3 && !rr_hashmap_grow(h))
+    return false;
+
+  uint64_t hash = rr_hashmap_hash(key, len);
+  Entry   *e    = rr_hashmap_find(h, hash, key, len);
+  if (e->hash != 0)
+  {
+    e->value = value;
+    return true;
+  }
+
+  if (h->keysLen + len > UINT32_MAX)
+  {
+    LOG_ERROR("hashmap key storage exhausted");
+    return false;
+  }
+
+  if (h->keysLen + len > h->keysSz)
+  {
+    size_t newSz = h->keysSz ? h->keysSz : 4096;
+    while(newSz < h->keysLen + len)
+      newSz *= 2;
+
+    char *newKeys = realloc(h->keys, newSz);
+    if (!newKeys)
+    {
+      LOG_ERROR("out of memory");
+      return false;
+    }
+    h->keys   = newKeys;
+    h->keysSz = newSz;
+  }
+
+  memcpy(h->keys + h->keysLen, key, len);
+  e->hash   = hash;
+  e->keyOff = (uint32_t)h->keysLen;
+  e->keyLen = (uint32_t)len;
+  e->value  = value;
+  h->keysLen += len;
+  ++h->count;
+  return true;
+}
+
+bool rr_hashmap_get(RRHashMap *h, const char *key, size_t len, uintptr_t *value)
+{
+  Entry *e = rr_hashmap_find(h, rr_hashmap_hash(key, len), key, len);
+  if (e->hash == 0)
+    return false;
+
+  *value = e->value;
+  return true;
+}
+
+size_t rr_hashmap_count(RRHashMap *h)
+{
+  return h->count;
+}
@@ -3,119 +3,1712 @@
 #include "config.h"
 #include "util.h"
 #include "query.h"
+#include "rangeset.h"
+#include "lists.h"
+#include "format.h"
+#include "compress.h"
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <microhttpd.h>
 
+#define HTTP_AGG_CACHE_MAX 32
+
+// list bodies kept, and the largest body kept
+#define HTTP_BODY_CACHE_MAX 16
+#define HTTP_BODY_MAX       (64 * 1024 * 1024)
+
+// bodies being produced at once, and how long identical requests wait, seconds
+#define HTTP_FLIGHT_MAX  32
+#define HTTP_FLIGHT_WAIT 30
+
+// returned by a handler that suspended the connection without a response
+#define HTTP_SUSPENDED 1
+
+// ?wait= timeout default and limit, and the SSE keepalive interval, seconds
+#define HTTP_WAIT_DEFAULT     60
+#define HTTP_WAIT_MAX         3600
+#define HTTP_EVENTS_KEEPALIVE 30
+
+/*
+  Blocking work run by a worker, it owns udata and returns the status of the
+  request, with *resp set for a 200.
+*/
+typedef int (*HTTPJobFn)(void *udata, struct MHD_Response **resp);
+
+// per request state, kept while the connection is suspended
+typedef struct HTTPRequest
+{
+  uint64_t deadline;
+  uint64_t flightDeadline;
+
+  // the blocking work of the request and its result, see http_job_queue
+  struct MHD_Connection *con;
+  struct HTTPRequest    *next;
+  HTTPJobFn              job;
+  void                  *udata;
+  bool                   done;
+  int                    status;
+  struct MHD_Response   *resp;
+}
+HTTPRequest;
+
 typedef struct RRHTTPHandler
 {
   const char *route;
-  int (*handler)(struct MHD_Connection *con, const char *uri);
+  int (*handler)(struct MHD_Connection *con, const char *uri, HTTPRequest *req);
 }
 RRHTTPHander;
 
+// a list body shared by the cache and the responses serving it
+typedef struct HTTPBody
+{
+  unsigned refs;
+  size_t   size;
+  char    *data;
+}
+HTTPBody;
+
+/*
+  a suspended connection, resumed at its deadline or when what it waits on
+  happens: the flight it waits on ends, or a list changes if flight is 0
+*/
+typedef struct HTTPParked
+{
+  struct MHD_Connection *con;
+  uint64_t               deadline;
+  unsigned               flight;
+  struct HTTPParked     *next;
+}
+HTTPParked;
+
 struct
 {
   struct MHD_Daemon *daemon;
   struct
   {
+    struct MHD_Response *r304;
     struct MHD_Response *r400;
     struct MHD_Response *r404;
     struct MHD_Response *r405;
     struct MHD_Response *r500;
   }
   response;
+
+  // aggregated lists by expression, parameters and generation
+  pthread_mutex_t aggLock;
+  struct
+  {
+    char        *expr;
+    bool         v6;
+    size_t       max;
+    unsigned     maxprefix;
+    unsigned     generation;
+    uint64_t     lastUsed;
+    RRRangeSetV4 v4set;
+    RRRangeSetV6 v6set;
+  }
+  agg[HTTP_AGG_CACHE_MAX];
+  uint64_t aggTick;
+
+  /*
+    list bodies by request key, encoding and generation, and the bodies
+    being produced that identical requests wait on
+  */
+  pthread_mutex_t bodyLock;
+  struct
+  {
+    char              *key;
+    RRCompressEncoding enc;
+    unsigned           generation;
+    uint64_t           lastUsed;
+    HTTPBody          *body;
+  }
+  bodies[HTTP_BODY_CACHE_MAX];
+  uint64_t bodyTick;
+
+  struct
+  {
+    char              *key;
+    RRCompressEncoding enc;
+    unsigned           generation;
+    unsigned           id;
+  }
+  flights[HTTP_FLIGHT_MAX];
+  unsigned flightSeq;
+
+  struct
+  {
+    atomic_ullong hits;    // bodies served from the cache
+    atomic_ullong leaders; // bodies produced for waiting requests
+    atomic_ullong waits;   // requests that waited for another
+  }
+  stats;
+
+  /*
+    parked connections, changes is bumped by every list publish and
+    flightsEnded by every flight that ends
+  */
+  pthread_mutex_t parkLock;
+  pthread_cond_t  parkCond;
+  pthread_t       parkThread;
+  bool            parkRunning;
+  unsigned        changes;
+  unsigned        flightsEnded;
+  HTTPParked     *parked;
+
+  // requests waiting for a worker, run in the order queued
+  pthread_mutex_t jobLock;
+  pthread_cond_t  jobCond;
+  pthread_t      *workers;
+  unsigned        nbWorkers;
+  bool            jobsRunning;
+  HTTPRequest    *jobs;
+  HTTPRequest   **jobsTail;
 }
 s_http = {};
 
-static int http_handler_ip(struct MHD_Connection *con, const char *uri)
+static unsigned http_park_changes(void)
+{
+  pthread_mutex_lock(&s_http.parkLock);
+  unsigned changes = s_http.changes;
+  pthread_mutex_unlock(&s_http.parkLock);
+  return changes;
+}
+
+static unsigned http_park_flights_ended(void)
+{
+  pthread_mutex_lock(&s_http.parkLock);
+  unsigned ended = s_http.flightsEnded;
+  pthread_mutex_unlock(&s_http.parkLock);
+  return ended;
+}
+
+/*
+  Suspend con until the flight ends, or a list changes if flight is 0, or the
+  deadline passes. seen is the flightsEnded or changes count read before the
+  caller checked. Returns 1 if the connection was suspended, 0 if the count
+  has moved since and the caller must check again, or -1 on error.
+*/
+static int http_park(struct MHD_Connection *con, uint64_t deadline,
+  unsigned flight, unsigned seen)
+{
+  HTTPParked *p = malloc(sizeof(*p));
+  if (!p)
+  {
+    LOG_ERROR("out of memory");
+    return -1;
+  }
+
+  pthread_mutex_lock(&s_http.parkLock);
+  if (!s_http.parkRunning ||
+      (flight ? s_http.flightsEnded : s_http.changes) != seen)
+  {
+    int rc = s_http.parkRunning ? 0 : -1;
+    pthread_mutex_unlock(&s_http.parkLock);
+    free(p);
+    return rc;
+  }
+
+  MHD_suspend_connection(con);
+  p->con        = con;
+  p->deadline   = deadline;
+  p->flight     = flight;
+  p->next       = s_http.parked;
+  s_http.parked = p;
+  pthread_cond_signal(&s_http.parkCond);
+  pthread_mutex_unlock(&s_http.parkLock);
+  return 1;
+}
+
+// resume the connections waiting on a list change to check their lists
+static void http_park_wake(void)
+{
+  pthread_mutex_lock(&s_http.parkLock);
+  ++s_http.changes;
+  pthread_cond_signal(&s_http.parkCond);
+  pthread_mutex_unlock(&s_http.parkLock);
+}
+
+// resume only the connections waiting on the flight, which has ended
+static void http_park_flight_end(unsigned flight)
+{
+  pthread_mutex_lock(&s_http.parkLock);
+  ++s_http.flightsEnded;
+  for(HTTPParked **pp = &s_http.parked; *pp;)
+  {
+    HTTPParked *p = *pp;
+    if (p->flight != flight)
+    {
+      pp = &p->next;
+      continue;
+    }
+
+    *pp = p->next;
+    MHD_resume_connection(p->con);
+    free(p);
+  }
+  pthread_mutex_unlock(&s_http.parkLock);
+}
+
+static void http_lists_changed(void *udata)
+{
+  http_park_wake();
+}
+
+static void *http_park_thread(void *opaque)
+{
+  pthread_mutex_lock(&s_http.parkLock);
+  unsigned seen = s_http.changes;
+  while(true)
+  {
+    /*
+      connections waiting on the lists recheck on a change, and every one
+      when it expires or on shutdown, flights resume their own waiters
+    */
+    uint64_t now     = rr_microtime();
+    bool     stop    = !s_http.parkRunning;
+    bool     changed = s_http.changes != seen;
+    uint64_t next    = UINT64_MAX;
+    seen = s_http.changes;
+
+    for(HTTPParked **pp = &s_http.parked; *pp;)
+    {
+      HTTPParked *p = *pp;
+      if (stop || (changed && !p->flight) || now >= p->deadline)
+      {
+        *pp = p->next;
+        MHD_resume_connection(p->con);
+        free(p);
+        continue;
+      }
+
+      if (p->deadline < next)
+        next = p->deadline;
+      pp = &p->next;
+    }
+
+    if (!s_http.parkRunning)
+      break;
+
+    if (next == UINT64_MAX)
+      pthread_cond_wait(&s_http.parkCond, &s_http.parkLock);
+    else
+    {
+      struct timespec ts =
+      {
+        .tv_sec  = next / 1000000ULL,
+        .tv_nsec = (next % 1000000ULL) * 1000
+      };
+      pthread_cond_timedwait(&s_http.parkCond, &s_http.parkLock, &ts);
+    }
+  }
+  pthread_mutex_unlock(&s_http.parkLock);
+  return NULL;
+}
+
+/*
+  The workers run the database queries, list builds and compression of
+  requests, which would otherwise stall every connection on the polling
+  thread that serves them, including SSE keepalives and file responses.
+*/
+static void *http_worker_thread(void *opaque)
+{
+  pthread_mutex_lock(&s_http.jobLock);
+  while(true)
+  {
+    HTTPRequest *req = s_http.jobs;
+    if (!req)
+    {
+      // the jobs queued are all run before the workers stop
+      if (!s_http.jobsRunning)
+        break;
+
+      pthread_cond_wait(&s_http.jobCond, &s_http.jobLock);
+      continue;
+    }
+
+    if (!(s_http.jobs = req->next))
+      s_http.jobsTail = &s_http.jobs;
+    pthread_mutex_unlock(&s_http.jobLock);
+
+    req->status = req->job(req->udata, &req->resp);
+    req->done   = true;
+    MHD_resume_connection(req->con);
+
+    pthread_mutex_lock(&s_http.jobLock);
+  }
+  pthread_mutex_unlock(&s_http.jobLock);
+  return NULL;
+}
+
+// queue the response of a finished job, returns the status of the request
+static int http_job_finish(struct MHD_Connection *con, HTTPRequest *req)
+{
+  struct MHD_Response *resp = req->resp;
+  req->resp = NULL;
+  if (!resp)
+    return req->status == 200 ? 500 : req->status;
+
+  int rc = MHD_queue_response(con, MHD_HTTP_OK, resp) == MHD_YES ? 200 : 500;
+  MHD_destroy_response(resp);
+  return rc;
+}
+
+/*
+  Run job on a worker with con suspended, its response is queued when MHD
+  calls the handler again. Returns HTTP_SUSPENDED, or the status of the job
+  if it had to run here because the workers have stopped.
+*/
+static int http_job_queue(struct MHD_Connection *con, HTTPRequest *req,
+  HTTPJobFn job, void *udata)
+{
+  req->con   = con;
+  req->job   = job;
+  req->udata = udata;
+  req->next  = NULL;
+
+  pthread_mutex_lock(&s_http.jobLock);
+  if (s_http.jobsRunning)
+  {
+    MHD_suspend_connection(con);
+    *s_http.jobsTail = req;
+    s_http.jobsTail  = &req->next;
+    pthread_cond_signal(&s_http.jobCond);
+    pthread_mutex_unlock(&s_http.jobLock);
+    return HTTP_SUSPENDED;
+  }
+  pthread_mutex_unlock(&s_http.jobLock);
+
+  req->status = job(udata, &req->resp);
+  req->done   = true;
+  return http_job_finish(con, req);
+}
+
+// the content encoding to respond with, none when compression is disabled
+static RRCompressEncoding http_accept_encoding(struct MHD_Connection *con)
+{
+  if (g_config.http.compress <= 0)
+    return RR_COMPRESS_NONE;
+
+  return rr_compress_negotiate(MHD_lookup_connection_value(
+    con, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING));
+}
+
+static void http_body_put(HTTPBody *body)
+{
+  pthread_mutex_lock(&s_http.bodyLock);
+  bool last = --body->refs == 0;
+  pthread_mutex_unlock(&s_http.bodyLock);
+
+  if (last)
+  {
+    free(body->data);
+    free(body);
+  }
+}
+
+static ssize_t http_body_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+  HTTPBody *body = cls;
+  if (pos >= body->size)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+
+  size_t len = MIN(max, body->size - pos);
+  memcpy(buf, body->data + pos, len);
+  return len;
+}
+
+static void http_body_cb_free(void *cls)
+{
+  http_body_put(cls);
+}
+
+/*
+  A response sending body in the encoding it was produced for. The response
+  takes over the caller's reference, which is dropped if it can not be
+  created.
+*/
+static struct MHD_Response *http_body_response(HTTPBody *body,
+  RRCompressEncoding enc)
+{
+  struct MHD_Response *resp = MHD_create_response_from_callback(
+    body->size,
+    64 * 1024,
+    http_body_cb_reader,
+    body,
+    http_body_cb_free);
+
+  if (!resp)
+  {
+    http_body_put(body);
+    return NULL;
+  }
+
+  if (enc != RR_COMPRESS_NONE)
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_ENCODING, rr_compress_name(enc));
+  if (g_config.http.compress > 0)
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  return resp;
+}
+
+static int http_flight_find(const char *key, RRCompressEncoding enc,
+  unsigned generation)
+{
+  for(unsigned i = 0; i < HTTP_FLIGHT_MAX; ++i)
+    if (s_http.flights[i].key && s_http.flights[i].enc == enc &&
+        s_http.flights[i].generation == generation &&
+        strcmp(s_http.flights[i].key, key) == 0)
+      return i;
+  return -1;
+}
+
+/*
+  Keep a finished body, replacing the entry for the key or the oldest one,
+  and end the flight that produced it, if any. The cache takes its own
+  reference. A NULL body, or one too large to keep, only ends the flight,
+  and the requests waiting on it go on to produce the body alone.
+*/
+static void http_body_store(const char *key, RRCompressEncoding enc,
+  unsigned generation, HTTPBody *body, bool leader)
+{
+  char     *dup     = NULL;
+  char     *oldKey  = NULL;
+  HTTPBody *oldBody = NULL;
+  char     *flight  = NULL;
+  unsigned  id      = 0;
+
+  if (body && (!generation || body->size > HTTP_BODY_MAX))
+    body = NULL;
+
+  if (body && !(dup = strdup(key)))
+  {
+    LOG_ERROR("out of memory");
+    body = NULL;
+  }
+
+  pthread_mutex_lock(&s_http.bodyLock);
+  if (body)
+  {
+    unsigned slot = 0;
+    for(unsigned i = 0; i < HTTP_BODY_CACHE_MAX; ++i)
+    {
+      if (s_http.bodies[i].key && s_http.bodies[i].enc == enc &&
+          strcmp(s_http.bodies[i].key, key) == 0)
+      {
+        slot = i;
+        break;
+      }
+
+      if (s_http.bodies[i].lastUsed < s_http.bodies[slot].lastUsed)
+        slot = i;
+    }
+
+    typeof(s_http.bodies[0]) *e = &s_http.bodies[slot];
+    oldKey        = e->key;
+    oldBody       = e->body;
+    e->key        = dup;
+    e->enc        = enc;
+    e->generation = generation;
+    e->lastUsed   = ++s_http.bodyTick;
+    e->body       = body;
+    ++body->refs;
+  }
+
+  int i;
+  if (leader && (i = http_flight_find(key, enc, generation)) >= 0)
+  {
+    flight = s_http.flights[i].key;
+    id     = s_http.flights[i].id;
+    s_http.flights[i].key = NULL;
+  }
+  pthread_mutex_unlock(&s_http.bodyLock);
+
+  free(oldKey);
+  if (oldBody)
+    http_body_put(oldBody);
+
+  if (flight)
+  {
+    free(flight);
+    http_park_flight_end(id);
+  }
+}
+
+// end the flight of a body that will not be produced
+static void http_flight_end(struct MHD_Connection *con, const char *key,
+  unsigned generation)
+{
+  http_body_store(key, http_accept_encoding(con), generation, NULL, true);
+}
+
+// call with bodyLock held, returns the body with a reference for the caller
+static HTTPBody *http_body_cached(const char *key, RRCompressEncoding enc,
+  unsigned generation)
+{
+  for(unsigned i = 0; i < HTTP_BODY_CACHE_MAX; ++i)
+  {
+    typeof(s_http.bodies[0]) *e = &s_http.bodies[i];
+    if (e->key && e->enc == enc && e->generation == generation &&
+        strcmp(e->key, key) == 0)
+    {
+      e->lastUsed = ++s_http.bodyTick;
+      ++e->body->refs;
+      return e->body;
+    }
+  }
+  return NULL;
+}
+
+/*
+  Find the body kept for key at generation, or wait for an identical request
+  that is producing it. Returns 200 with *resp set when it is kept,
+  HTTP_SUSPENDED while waiting, or 0 if the caller has to produce the body,
+  with *leader set if identical requests will wait for it.
+*/
+static int http_body_lookup(struct MHD_Connection *con, HTTPRequest *req,
+  const char *key, unsigned generation, struct MHD_Response **resp, bool *leader)
+{
+  RRCompressEncoding enc = http_accept_encoding(con);
+
+  *resp   = NULL;
+  *leader = false;
+  if (!generation)
+    return 0;
+
+  while(true)
+  {
+    unsigned ended = http_park_flights_ended();
+
+    pthread_mutex_lock(&s_http.bodyLock);
+    HTTPBody *body = http_body_cached(key, enc, generation);
+    if (body)
+    {
+      pthread_mutex_unlock(&s_http.bodyLock);
+      if (!(*resp = http_body_response(body, enc)))
+        return 0;
+
+      atomic_fetch_add_explicit(&s_http.stats.hits, 1, memory_order_relaxed);
+      if (enc != RR_COMPRESS_NONE)
+        rr_compress_count_hit();
+      return 200;
+    }
+
+    int f = http_flight_find(key, enc, generation);
+    if (f < 0)
+    {
+      for(unsigned i = 0; i < HTTP_FLIGHT_MAX; ++i)
+      {
+        if (s_http.flights[i].key)
+          continue;
+
+        if ((s_http.flights[i].key = strdup(key)))
+        {
+          s_http.flights[i].enc        = enc;
+          s_http.flights[i].generation = generation;
+          // 0 is kept for connections waiting on the lists
+          if (!(s_http.flights[i].id = ++s_http.flightSeq))
+            s_http.flights[i].id = ++s_http.flightSeq;
+          *leader = true;
+          atomic_fetch_add_explicit(&s_http.stats.leaders, 1, memory_order_relaxed);
+        }
+        break;
+      }
+      pthread_mutex_unlock(&s_http.bodyLock);
+      return 0;
+    }
+    unsigned flight = s_http.flights[f].id;
+    pthread_mutex_unlock(&s_http.bodyLock);
+
+    // a request that waits too long produces the body itself
+    uint64_t now = rr_microtime();
+    if (!req->flightDeadline)
+    {
+      req->flightDeadline = now + HTTP_FLIGHT_WAIT * 1000000ULL;
+      atomic_fetch_add_explicit(&s_http.stats.waits, 1, memory_order_relaxed);
+    }
+    else if (now >= req->flightDeadline)
+      return 0;
+
+    int rc = http_park(con, req->flightDeadline, flight, ended);
+    if (rc < 0)
+      return 0;
+
+    if (rc > 0)
+      return HTTP_SUSPENDED;
+  }
+}
+
+static ssize_t http_body_format_source(void *udata, char *buf, size_t max)
+{
+  return rr_format_stream_read(udata, buf, max);
+}
+
+/*
+  Produce the whole body of a format stream, compressed for enc, without
+  waiting on any connection. Returns the body with one reference, or NULL on
+  error.
+*/
+static HTTPBody *http_body_build(RRFormatStream *fmt, RRCompressEncoding enc)
+{
+  RRCompressStream z;
+  if (enc != RR_COMPRESS_NONE && !rr_compress_stream_init(&z, enc,
+    MIN(g_config.http.compress, Z_BEST_COMPRESSION), http_body_format_source, fmt))
+    return NULL;
+
+  RRBuffer data = { 0 };
+  ssize_t  n;
+  do
+  {
+    if (!rr_buffer_reserve(&data, data.pos + 64 * 1024))
+    {
+      n = -1;
+      break;
+    }
+
+    n = enc == RR_COMPRESS_NONE ?
+      rr_format_stream_read(fmt, data.buffer + data.pos, data.bufferSz - data.pos) :
+      rr_compress_stream_read(&z, data.buffer + data.pos, data.bufferSz - data.pos);
+    if (n > 0)
+      data.pos += n;
+  }
+  while(n > 0);
+
+  if (enc != RR_COMPRESS_NONE)
+    rr_compress_stream_free(&z);
+
+  HTTPBody *body = NULL;
+  if (n == 0 && !(body = malloc(sizeof(*body))))
+    LOG_ERROR("out of memory");
+
+  if (!body)
+  {
+    rr_buffer_free(&data);
+    return NULL;
+  }
+
+  body->refs = 1;
+  body->size = data.pos;
+  body->data = data.buffer;
+  return body;
+}
+
+/*
+  How a list body produced by a worker is sent and kept: the encoding the
+  client accepts, and the cache key and whether identical requests wait for
+  it.
+*/
+typedef struct HTTPListOut
+{
+  RRCompressEncoding enc;
+  bool               keyed;
+  bool               leader;
+  unsigned           generation;
+  char               key[512];
+}
+HTTPListOut;
+
+static void http_list_out_init(HTTPListOut *out, struct MHD_Connection *con,
+  const char *key, unsigned generation, bool leader)
+{
+  out->enc        = http_accept_encoding(con);
+  out->keyed      = key != NULL;
+  out->leader     = leader;
+  out->generation = generation;
+  if (key)
+    strcpy(out->key, key);
+}
+
+/*
+  Respond with the whole body of a list. It is kept for later requests of
+  the same key and generation when keyed, and for a leader the flight ends
+  with it, so that the requests waiting on it are sent the same body as this
+  one. A NULL fmt only ends the flight.
+*/
+static struct MHD_Response *http_list_response(const HTTPListOut *out,
+  RRFormatStream *fmt)
+{
+  HTTPBody *body = fmt ? http_body_build(fmt, out->enc) : NULL;
+  if (out->keyed && (body || out->leader))
+    http_body_store(out->key, out->enc, out->generation, body, out->leader);
+
+  if (!body)
+    return NULL;
+
+  struct MHD_Response *resp = http_body_response(body, out->enc);
+  if (resp)
+    MHD_add_response_header(resp, "Content-Type", rr_format_content_type(fmt->fmt));
+  return resp;
+}
+
+/*
+  A streamed response body, compressed when the client accepts it.
+*/
+typedef struct HTTPBodyStream
+{
+  RRCompressStream              z;
+  MHD_ContentReaderCallback     reader;
+  MHD_ContentReaderFreeCallback freeFn;
+  void                         *cls;
+  uint64_t                      srcPos; // bytes read from the wrapped reader
+}
+HTTPBodyStream;
+
+// the readers wrapped never return 0, which the compressor takes as the end
+static ssize_t http_body_stream_source(void *udata, char *buf, size_t max)
+{
+  HTTPBodyStream *st = udata;
+  ssize_t n = st->reader(st->cls, st->srcPos, buf, max);
+  if (n == MHD_CONTENT_READER_END_OF_STREAM)
+    return 0;
+
+  if (n < 0)
+    return -1;
+
+  st->srcPos += n;
+  return n;
+}
+
+static ssize_t http_body_stream_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+  HTTPBodyStream *st = cls;
+  ssize_t n = rr_compress_stream_read(&st->z, buf, max);
+  if (n < 0)
+    return MHD_CONTENT_READER_END_WITH_ERROR;
+
+  if (n == 0)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+
+  return n;
+}
+
+static void http_body_stream_cb_free(void *cls)
+{
+  HTTPBodyStream *st = cls;
+  rr_compress_stream_free(&st->z);
+  st->freeFn(st->cls);
+  free(st);
+}
+
+/*
+  Create a streamed response, compressed when the client accepts it. The
+  response owns cls, and it is freed if the response can not be created.
+*/
+static struct MHD_Response *http_create_response(struct MHD_Connection *con,
+  size_t blockSize, MHD_ContentReaderCallback reader, void *cls,
+  MHD_ContentReaderFreeCallback freeFn)
+{
+  RRCompressEncoding enc = http_accept_encoding(con);
+
+  struct MHD_Response *resp;
+  if (enc == RR_COMPRESS_NONE)
+  {
+    resp = MHD_create_response_from_callback(
+      MHD_SIZE_UNKNOWN, blockSize, reader, cls, freeFn);
+    if (!resp)
+      freeFn(cls);
+    return resp;
+  }
+
+  HTTPBodyStream *st = calloc(1, sizeof(*st));
+  if (!st)
+  {
+    LOG_ERROR("out of memory");
+    freeFn(cls);
+    return NULL;
+  }
+
+  st->reader = reader;
+  st->freeFn = freeFn;
+  st->cls    = cls;
+  if (!rr_compress_stream_init(&st->z, enc,
+    MIN(g_config.http.compress, Z_BEST_COMPRESSION), http_body_stream_source, st))
+  {
+    free(st);
+    freeFn(cls);
+    return NULL;
+  }
+
+  resp = MHD_create_response_from_callback(
+    MHD_SIZE_UNKNOWN, blockSize, http_body_stream_cb_reader, st,
+    http_body_stream_cb_free);
+  if (!resp)
+  {
+    http_body_stream_cb_free(st);
+    return NULL;
+  }
+
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_ENCODING, rr_compress_name(enc));
+  MHD_add_response_header(resp, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  return resp;
+}
+
+// the lossy aggregation asked for, see http_list_agg_parse
+typedef struct HTTPListAgg
+{
+  size_t   max;
+  unsigned maxprefix;
+}
+HTTPListAgg;
+
+/*
+  The cache key of a list response, the uri and the query that shapes the
+  body, with the aggregation as rounded if any. Returns false if it does not
+  fit, and the response is not cached.
+*/
+static bool http_list_key(struct MHD_Connection *con, const char *uri, bool v6,
+  const char *set, const HTTPListAgg *agg, char *key, size_t keySize)
+{
+  const char *format = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "format");
+  int n = agg ?
+    snprintf(key, keySize, "v%c/%s?%s&%s&%zu&%u",
+      v6 ? '6' : '4', uri,
+      format ? format : "",
+      set,
+      agg->max,
+      agg->maxprefix) :
+    snprintf(key, keySize, "v%c/%s?%s&%s&&",
+      v6 ? '6' : '4', uri,
+      format ? format : "",
+      set);
+  return n > 0 && (size_t)n < keySize;
+}
+
+/*
+  The file rendered for a plain list at its last build, sent by the kernel
+  with sendfile. Returns NULL if there is none for the encoding accepted.
+*/
+static struct MHD_Response *http_list_file_response(struct MHD_Connection *con,
+  const char *name, bool v6, unsigned *generation)
+{
+  RRCompressEncoding enc = http_accept_encoding(con);
+  if (enc == RR_COMPRESS_DEFLATE)
+    return NULL;
+
+  uint64_t size;
+  int fd = rr_lists_open(name, v6, enc == RR_COMPRESS_GZIP, generation, &size);
+  if (fd < 0)
+    return NULL;
+
+  struct MHD_Response *resp = MHD_create_response_from_fd64(size, fd);
+  if (!resp)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  if (enc == RR_COMPRESS_GZIP)
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_ENCODING, rr_compress_name(enc));
+  if (g_config.http.compress > 0)
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  return resp;
+}
+
+/*
+  Each thread keeps the buffers of the address lookup, they grow to fit the
+  largest record seen and are reused so that a lookup does not allocate.
+*/
+typedef struct HTTPArena
+{
+  RRBuffer strings;
+  RRBuffer body;
+}
+HTTPArena;
+
+static pthread_key_t  s_arenaKey;
+static pthread_once_t s_arenaOnce = PTHREAD_ONCE_INIT;
+
+static void http_arena_free(void *opaque)
+{
+  HTTPArena *arena = opaque;
+  rr_buffer_free(&arena->strings);
+  rr_buffer_free(&arena->body);
+  free(arena);
+}
+
+static void http_arena_key_init(void)
+{
+  pthread_key_create(&s_arenaKey, http_arena_free);
+}
+
+static HTTPArena *http_arena_get(void)
+{
+  pthread_once(&s_arenaOnce, http_arena_key_init);
+  HTTPArena *arena = pthread_getspecific(s_arenaKey);
+  if (!arena)
+  {
+    if (!(arena = calloc(1, sizeof(*arena))))
+    {
+      LOG_ERROR("out of memory");
+      return NULL;
+    }
+    pthread_setspecific(s_arenaKey, arena);
+  }
+
+  rr_buffer_reset(&arena->strings);
+  rr_buffer_reset(&arena->body);
+  return arena;
+}
+
+static bool http_arena_field(HTTPArena *arena, const char *label, RRDBStrRef ref)
+{
+  return
+    rr_buffer_append_str(&arena->body, label) >= 0 &&
+    rr_buffer_append(&arena->body, rr_db_str(&arena->strings, ref), ref.len) >= 0 &&
+    rr_buffer_append(&arena->body, "\n", 1) >= 0;
+}
+
+// an address to look up, parsed by the handler
+typedef struct HTTPIPJob
+{
+  bool              v6;
+  uint32_t          ipv4;
+  unsigned __int128 ipv6;
+}
+HTTPIPJob;
+
+static int http_ip_job(void *udata, struct MHD_Response **resp)
+{
+  HTTPIPJob *job   = udata;
+  RRDBCon   *dbcon = NULL;
+  RRDBIPInfo info;
+  char       netblock[RR_IPV6_STR_MAX + RR_PREFIX_STR_MAX];
+  size_t     len;
+  int        rc    = 500;
+
+  HTTPArena *arena = http_arena_get();
+  if (!arena || !rr_db_get(&dbcon))
+    goto out;
+
+  int found = job->v6 ?
+    rr_query_netblockv6_by_ip(dbcon, job->ipv6, &info, &arena->strings) :
+    rr_query_netblockv4_by_ip(dbcon, job->ipv4, &info, &arena->strings);
+  rr_db_put(&dbcon);
+  if (found < 1)
+  {
+    rc = found < 0 ? 500 : 404;
+    goto out;
+  }
+
+  len = job->v6 ?
+    rr_ipv6_to_str(netblock, info.start_ip.v6) :
+    rr_ipv4_to_str(netblock, info.start_ip.v4);
+  len += rr_prefix_to_str(netblock + len, info.prefix_len);
+
+  if (rr_buffer_append_str(&arena->body, "netblock  : ") < 0 ||
+      rr_buffer_append(&arena->body, netblock, len) < 0 ||
+      rr_buffer_append(&arena->body, "\n", 1) < 0 ||
+      !http_arena_field(arena, "netname   : ", info.netname   ) ||
+      !http_arena_field(arena, "org_handle: ", info.org_handle) ||
+      !http_arena_field(arena, "org_name  : ", info.org_name  ) ||
+      !http_arena_field(arena, "descr     : ", info.descr     ))
+    goto out;
+
+  // the arena is reused by the next lookup on this thread, MHD keeps a copy
+  *resp = MHD_create_response_from_buffer(arena->body.pos, arena->body.buffer,
+    MHD_RESPMEM_MUST_COPY);
+  if (!*resp)
+    goto out;
+
+  MHD_add_response_header(*resp, "Content-Type", "text/plain");
+  rc = 200;
+
+out:
+  free(job);
+  return rc;
+}
+
+static int http_handler_ip(struct MHD_Connection *con, const char *uri, HTTPRequest *req)
+{
+  HTTPIPJob parsed = { .v6 = strstr(uri, ":") != NULL };
+  if (parsed.v6 ?
+      rr_parse_ipv6_decimal(uri, &parsed.ipv6) != 1 :
+      rr_parse_ipv4_decimal(uri, &parsed.ipv4) != 1)
+    return 400;
+
+  HTTPIPJob *job = malloc(sizeof(*job));
+  if (!job)
+  {
+    LOG_ERROR("out of memory");
+    return 500;
+  }
+
+  *job = parsed;
+  return http_job_queue(con, req, http_ip_job, job);
+}
+
+/*
+  List expressions such as "A/minus/B/and/C/or/D" are evaluated left to
+  right over the built list unions.
+*/
+#define HTTP_LIST_EXPR_MAX 16
+
+typedef enum HTTPListOp
+{
+  HTTP_LIST_OP_OR,
+  HTTP_LIST_OP_AND,
+  HTTP_LIST_OP_MINUS
+}
+HTTPListOp;
+
+typedef struct HTTPListExpr
+{
+  unsigned   count;
+  char       names[HTTP_LIST_EXPR_MAX][33];
+  HTTPListOp ops  [HTTP_LIST_EXPR_MAX]; // the op applying names[i], i > 0
+}
+HTTPListExpr;
+
+// an expression evaluated and formatted by a worker
+typedef struct HTTPListExprStream
+{
+  RRFormatStream     fmt;
+  bool               v6;
+  RRRangeSetV4       v4set;
+  RRRangeSetV6       v6set;
+  RRRangeSetV4Cursor v4cur;
+  RRRangeSetV6Cursor v6cur;
+
+  char        *uri;
+  HTTPListExpr expr;
+  bool         aggregate;
+  HTTPListAgg  agg;
+  HTTPListOut  out;
+}
+HTTPListExprStream;
+
+static bool http_list_is_built(const char *name)
+{
+  RRListInfo info;
+  return rr_lists_lookup(name, &info);
+}
+
+/*
+  The list row id from the registry, the database is only asked for lists
+  not built since it was loaded. Returns 1, 0 if there is no such row, or -1
+  on error.
+*/
+static int http_list_id(RRDBCon *dbcon, const RRListInfo *info, unsigned *list_id)
+{
+  if (info->id)
+  {
+    *list_id = info->id;
+    return 1;
+  }
+  return rr_query_list_by_name(dbcon, info->name, list_id);
+}
+
+static int http_list_expr_parse(const char *uri, HTTPListExpr *e)
+{
+  e->count = 0;
+  bool wantName = true;
+  while(true)
+  {
+    const char *end = strchr(uri, '/');
+    size_t      len = end ? (size_t)(end - uri) : strlen(uri);
+
+    if (wantName)
+    {
+      if (e->count == HTTP_LIST_EXPR_MAX)
+        return 400;
+
+      if (len == 0 || len >= sizeof(e->names[0]))
+        return 404;
+
+      memcpy(e->names[e->count], uri, len);
+      e->names[e->count][len] = '\0';
+      if (!http_list_is_built(e->names[e->count]))
+        return 404;
+      ++e->count;
+    }
+    else
+    {
+      HTTPListOp op;
+      if      (len == 2 && strncmp(uri, "or"   , len) == 0) op = HTTP_LIST_OP_OR;
+      else if (len == 3 && strncmp(uri, "and"  , len) == 0) op = HTTP_LIST_OP_AND;
+      else if (len == 5 && strncmp(uri, "minus", len) == 0) op = HTTP_LIST_OP_MINUS;
+      else
+        return 400;
+      e->ops[e->count] = op;
+    }
+
+    if (!end)
+      break;
+
+    uri      = end + 1;
+    wantName = !wantName;
+  }
+
+  // an expression can not end with an operator
+  return wantName ? 200 : 400;
+}
+
+static int http_list_load_v4(RRDBCon *dbcon, const char *name, RRRangeSetV4 *out)
+{
+  rr_rangeset_v4_clear(out);
+
+  RRListInfo info;
+  if (!rr_lists_lookup(name, &info))
+    return 404;
+
+  unsigned list_id;
+  int rc = http_list_id(dbcon, &info, &list_id);
+  if (rc != 1)
+    return rc < 0 ? 500 : 404;
+
+  if (!rr_query_netblockv4_list_union_start(dbcon, list_id, false))
+    return 500;
+
+  uint32_t ip;
+  uint8_t  prefix_len;
+  while((rc = rr_query_netblockv4_list_union_fetch(dbcon, &ip, &prefix_len)) == 1)
+  {
+    uint32_t end = prefix_len >= 32 ? ip : ip | (UINT32_MAX >> prefix_len);
+    if (!rr_rangeset_v4_add(out, ip, end))
+    {
+      rc = -1;
+      break;
+    }
+  }
+  rr_query_netblockv4_list_union_end(dbcon);
+
+  if (rc < 0 || !rr_rangeset_v4_normalize(out))
+    return 500;
+  return 200;
+}
+
+static int http_list_load_v6(RRDBCon *dbcon, const char *name, RRRangeSetV6 *out)
+{
+  rr_rangeset_v6_clear(out);
+
+  RRListInfo info;
+  if (!rr_lists_lookup(name, &info))
+    return 404;
+
+  unsigned list_id;
+  int rc = http_list_id(dbcon, &info, &list_id);
+  if (rc != 1)
+    return rc < 0 ? 500 : 404;
+
+  if (!rr_query_netblockv6_list_union_start(dbcon, list_id, false))
+    return 500;
+
+  // BE-numeric domain
+  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
+  unsigned __int128 ip;
+  uint8_t prefix_len;
+  while((rc = rr_query_netblockv6_list_union_fetch(dbcon, &ip, &prefix_len)) == 1)
+  {
+    unsigned __int128 start = rr_raw_to_be(ip);
+    unsigned __int128 end   = prefix_len >= 128 ? start : start | (U128_MAX >> prefix_len);
+    if (!rr_rangeset_v6_add(out, start, end))
+    {
+      rc = -1;
+      break;
+    }
+  }
+  rr_query_netblockv6_list_union_end(dbcon);
+
+  if (rc < 0 || !rr_rangeset_v6_normalize(out))
+    return 500;
+  return 200;
+}
+
+static int http_list_expr_eval_v4(RRDBCon *dbcon, const HTTPListExpr *e, RRRangeSetV4 *acc)
+{
+  RRRangeSetV4 operand = { 0 };
+  RRRangeSetV4 result  = { 0 };
+
+  int rc = http_list_load_v4(dbcon, e->names[0], acc);
+  for(unsigned i = 1; rc == 200 && i < e->count; ++i)
+  {
+    if ((rc = http_list_load_v4(dbcon, e->names[i], &operand)) != 200)
+      break;
+
+    bool ok = false;
+    switch(e->ops[i])
+    {
+      case HTTP_LIST_OP_OR   : ok = rr_rangeset_v4_union     (&result, acc, &operand); break;
+      case HTTP_LIST_OP_AND  : ok = rr_rangeset_v4_intersect (&result, acc, &operand); break;
+      case HTTP_LIST_OP_MINUS: ok = rr_rangeset_v4_difference(&result, acc, &operand); break;
+    }
+
+    if (!ok)
+    {
+      rc = 500;
+      break;
+    }
+
+    RRRangeSetV4 swap = *acc;
+    *acc   = result;
+    result = swap;
+  }
+
+  rr_rangeset_v4_free(&operand);
+  rr_rangeset_v4_free(&result);
+  return rc;
+}
+
+static int http_list_expr_eval_v6(RRDBCon *dbcon, const HTTPListExpr *e, RRRangeSetV6 *acc)
+{
+  RRRangeSetV6 operand = { 0 };
+  RRRangeSetV6 result  = { 0 };
+
+  int rc = http_list_load_v6(dbcon, e->names[0], acc);
+  for(unsigned i = 1; rc == 200 && i < e->count; ++i)
+  {
+    if ((rc = http_list_load_v6(dbcon, e->names[i], &operand)) != 200)
+      break;
+
+    bool ok = false;
+    switch(e->ops[i])
+    {
+      case HTTP_LIST_OP_OR   : ok = rr_rangeset_v6_union     (&result, acc, &operand); break;
+      case HTTP_LIST_OP_AND  : ok = rr_rangeset_v6_intersect (&result, acc, &operand); break;
+      case HTTP_LIST_OP_MINUS: ok = rr_rangeset_v6_difference(&result, acc, &operand); break;
+    }
+
+    if (!ok)
+    {
+      rc = 500;
+      break;
+    }
+
+    RRRangeSetV6 swap = *acc;
+    *acc   = result;
+    result = swap;
+  }
+
+  rr_rangeset_v6_free(&operand);
+  rr_rangeset_v6_free(&result);
+  return rc;
+}
+
+/*
+  round the entry budget down to 1, 2 or 5 times a power of ten, so that
+  clients asking for similar limits share a cached result
+*/
+static size_t http_list_agg_round(size_t max)
+{
+  size_t scale = 1;
+  while(max / scale >= 10)
+    scale *= 10;
+
+  size_t lead = max / scale;
+  return (lead >= 5 ? 5 : lead >= 2 ? 2 : lead) * scale;
+}
+
+/*
+  Lossy aggregation as requested by ?max=N&maxprefix=P, returns 0 if neither
+  was given, 400 if either is invalid, or 200. Both are rounded down to the
+  few values that are computed, an IPv6 maxprefix to a nibble boundary.
+*/
+static int http_list_agg_parse(struct MHD_Connection *con, bool v6, HTTPListAgg *agg)
+{
+  const char *max       = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "max"      );
+  const char *maxprefix = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "maxprefix");
+
+  agg->max       = 0;
+  agg->maxprefix = v6 ? 128 : 32;
+  if (!max && !maxprefix)
+    return 0;
+
+  char *end;
+  if (max)
+  {
+    unsigned long long value = strtoull(max, &end, 10);
+    if (end == max || *end != '\0' || *max == '-' || value > SIZE_MAX)
+      return 400;
+    agg->max = http_list_agg_round(value);
+  }
+
+  if (maxprefix)
+  {
+    unsigned long value = strtoul(maxprefix, &end, 10);
+    if (end == maxprefix || *end != '\0' || *maxprefix == '-' ||
+        value > agg->maxprefix)
+      return 400;
+    agg->maxprefix = v6 ? value & ~3UL : value;
+  }
+
+  return 200;
+}
+
+static unsigned http_list_expr_generation(const HTTPListExpr *e)
+{
+  // each generation only increases so the sum changes whenever one does
+  unsigned generation = 0;
+  for(unsigned i = 0; i < e->count; ++i)
+    generation += rr_lists_generation(e->names[i]);
+  return generation;
+}
+
+static bool http_list_agg_get(const char *expr, bool v6, const HTTPListAgg *agg,
+  unsigned generation, HTTPListExprStream *st)
+{
+  bool found = false;
+  pthread_mutex_lock(&s_http.aggLock);
+  for(unsigned i = 0; i < HTTP_AGG_CACHE_MAX; ++i)
+  {
+    typeof(*s_http.agg) *e = &s_http.agg[i];
+    if (!e->expr                        ||
+        e->v6         != v6             ||
+        e->max        != agg->max       ||
+        e->maxprefix  != agg->maxprefix ||
+        e->generation != generation     ||
+        strcmp(e->expr, expr) != 0)
+      continue;
+
+    found = v6 ?
+      rr_rangeset_v6_copy(&st->v6set, &e->v6set) :
+      rr_rangeset_v4_copy(&st->v4set, &e->v4set);
+    e->lastUsed = ++s_http.aggTick;
+    break;
+  }
+  pthread_mutex_unlock(&s_http.aggLock);
+  return found;
+}
+
+static void http_list_agg_put(const char *expr, bool v6, const HTTPListAgg *agg,
+  unsigned generation, const HTTPListExprStream *st)
+{
+  pthread_mutex_lock(&s_http.aggLock);
+
+  // replace the entry for an older generation, or the least recently used
+  typeof(*s_http.agg) *slot = NULL;
+  for(unsigned i = 0; i < HTTP_AGG_CACHE_MAX; ++i)
+  {
+    typeof(*s_http.agg) *e = &s_http.agg[i];
+    if (e->expr && e->v6 == v6 && e->max == agg->max &&
+        e->maxprefix == agg->maxprefix && strcmp(e->expr, expr) == 0)
+    {
+      slot = e;
+      break;
+    }
+
+    if (!slot || (slot->expr && (!e->expr || e->lastUsed < slot->lastUsed)))
+      slot = e;
+  }
+
+  free(slot->expr);
+  slot->expr = strdup(expr);
+  if (!slot->expr)
+  {
+    LOG_ERROR("out of memory");
+    goto out;
+  }
+
+  slot->v6         = v6;
+  slot->max        = agg->max;
+  slot->maxprefix  = agg->maxprefix;
+  slot->generation = generation;
+  slot->lastUsed   = ++s_http.aggTick;
+
+  bool ok = v6 ?
+    rr_rangeset_v6_copy(&slot->v6set, &st->v6set) :
+    rr_rangeset_v4_copy(&slot->v4set, &st->v4set);
+  if (!ok)
+  {
+    free(slot->expr);
+    slot->expr = NULL;
+  }
+
+out:
+  pthread_mutex_unlock(&s_http.aggLock);
+}
+
+static bool http_list_agg_apply(bool v6, const HTTPListAgg *agg,
+  HTTPListExprStream *st)
+{
+  bool ok;
+  if (v6)
+  {
+    RRRangeSetV6 out = { 0 };
+    ok = rr_rangeset_v6_aggregate(&out, &st->v6set, agg->max, agg->maxprefix);
+    rr_rangeset_v6_free(&st->v6set);
+    st->v6set = out;
+  }
+  else
+  {
+    RRRangeSetV4 out = { 0 };
+    ok = rr_rangeset_v4_aggregate(&out, &st->v4set, agg->max, agg->maxprefix);
+    rr_rangeset_v4_free(&st->v4set);
+    st->v4set = out;
+  }
+  return ok;
+}
+
+/*
+  Output format selection by ?format=, and the set name for the formats that
+  use one by ?set= or from the list expression. The other formats get an
+  empty set name, so neither ?set= nor the list name is validated for them.
+*/
+static int http_list_format(struct MHD_Connection *con, const char *uri,
+  const RRFormat **fmt, char set[RR_FORMAT_SET_MAX + 1])
+{
+  *fmt = rr_format_by_name(
+    MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "format"));
+  if (!*fmt)
+    return 400;
+
+  set[0] = '\0';
+  if (!rr_format_uses_set(*fmt))
+    return 200;
+
+  const char *name = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "set");
+  if (name)
+  {
+    if (!rr_format_valid_set(name))
+      return 400;
+    strcpy(set, name);
+    return 200;
+  }
+
+  size_t i;
+  for(i = 0; i < RR_FORMAT_SET_MAX && uri[i]; ++i)
+    set[i] = uri[i] == '/' ? '_' : uri[i];
+  set[i] = '\0';
+
+  return rr_format_valid_set(set) ? 200 : 400;
+}
+
+static int http_list_expr_next_v4(void *udata, uint32_t *ip, uint8_t *prefix_len)
+{
+  HTTPListExprStream *st = udata;
+  return rr_rangeset_v4_cidr_next(&st->v4set, &st->v4cur, ip, prefix_len) ? 1 : 0;
+}
+
+static int http_list_expr_next_v6(void *udata, unsigned __int128 *ip, uint8_t *prefix_len)
+{
+  HTTPListExprStream *st = udata;
+  if (!rr_rangeset_v6_cidr_next(&st->v6set, &st->v6cur, ip, prefix_len))
+    return 0;
+
+  *ip = rr_be_to_raw(*ip);
+  return 1;
+}
+
+static void http_list_expr_free(HTTPListExprStream *st)
+{
+  rr_rangeset_v4_free(&st->v4set);
+  rr_rangeset_v6_free(&st->v6set);
+  free(st->uri);
+  free(st);
+}
+
+static int http_list_expr_job(void *udata, struct MHD_Response **resp)
+{
+  HTTPListExprStream *st = udata;
+  int                 rc = 200;
+
+  if (!st->aggregate ||
+      !http_list_agg_get(st->uri, st->v6, &st->agg, st->out.generation, st))
+  {
+    RRDBCon *dbcon = NULL;
+    if (!rr_db_get(&dbcon))
+      rc = 500;
+    else
+    {
+      rc = st->v6 ?
+        http_list_expr_eval_v6(dbcon, &st->expr, &st->v6set) :
+        http_list_expr_eval_v4(dbcon, &st->expr, &st->v4set);
+      rr_db_put(&dbcon);
+    }
+
+    if (rc == 200 && st->aggregate)
+    {
+      if (http_list_agg_apply(st->v6, &st->agg, st))
+        http_list_agg_put(st->uri, st->v6, &st->agg, st->out.generation, st);
+      else
+        rc = 500;
+    }
+  }
+
+  *resp = http_list_response(&st->out, rc == 200 ? &st->fmt : NULL);
+  if (rc == 200 && !*resp)
+    rc = 500;
+
+  http_list_expr_free(st);
+  return rc;
+}
+
+static int http_handler_list_expr(struct MHD_Connection *con, const char *uri,
+  bool v6, HTTPRequest *req)
 {
-  struct MHD_Response *res;
-  RRDBCon   *dbcon = NULL;
-  RRDBIPInfo info;
-  char       ipstring[64];
+  HTTPListAgg agg;
+  int aggRc = http_list_agg_parse(con, v6, &agg);
+  if (aggRc == 400)
+    return 400;
 
-  if(strstr(uri, ":"))
-  {
-    unsigned __int128 ipv6;
-    if (rr_parse_ipv6_decimal(uri, &ipv6) != 1)
-      return 400;
+  HTTPListExpr expr;
+  int rc = http_list_expr_parse(uri, &expr);
+  if (rc != 200)
+    return rc;
 
-    if (!rr_db_get(&dbcon))
-      return 500;
+  const RRFormat *fmt;
+  char            set[RR_FORMAT_SET_MAX + 1];
+  if ((rc = http_list_format(con, uri, &fmt, set)) != 200)
+    return rc;
+
+  char     key[512];
+  bool     keyed      = http_list_key(con, uri, v6, set,
+    aggRc == 200 ? &agg : NULL, key, sizeof(key));
+  unsigned generation = http_list_expr_generation(&expr);
+
+  struct MHD_Response *resp   = NULL;
+  bool                 leader = false;
+  if (keyed &&
+    http_body_lookup(con, req, key, generation, &resp, &leader) == HTTP_SUSPENDED)
+    return HTTP_SUSPENDED;
 
-    if (!rr_query_netblockv6_by_ip(dbcon, ipv6, &info))
+  if (resp)
+  {
+    MHD_add_response_header(resp, "Content-Type", rr_format_content_type(fmt));
+    if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
     {
-      rr_db_put(&dbcon);
-      return 404;
+      MHD_destroy_response(resp);
+      return 500;
     }
-    rr_db_put(&dbcon);
+    MHD_destroy_response(resp);
+    return 200;
+  }
 
-    inet_ntop(AF_INET6, &info.start_ip.v6, ipstring, sizeof(ipstring));
+  HTTPListExprStream *st = calloc(1, sizeof(*st));
+  if (!st || !(st->uri = strdup(uri)))
+  {
+    LOG_ERROR("out of memory");
+    free(st);
+    if (leader)
+      http_flight_end(con, key, generation);
+    return 500;
   }
+  st->v6        = v6;
+  st->expr      = expr;
+  st->aggregate = aggRc == 200;
+  st->agg       = agg;
+  http_list_out_init(&st->out, con, keyed ? key : NULL, generation, leader);
+
+  if (v6)
+    rr_format_stream_v6(&st->fmt, fmt, set, http_list_expr_next_v6, st);
   else
-  {
-    uint32_t ipv4;
-    if (rr_parse_ipv4_decimal(uri, &ipv4) != 1)
-      return 400;
+    rr_format_stream_v4(&st->fmt, fmt, set, http_list_expr_next_v4, st);
+  st->fmt.generation = generation;
 
-    if (!rr_db_get(&dbcon))
-      return 500;
+  return http_job_queue(con, req, http_list_expr_job, st);
+}
+
+static void http_add_generation_header(struct MHD_Response *resp, unsigned generation)
+{
+  char value[16];
+  snprintf(value, sizeof(value), "%u", generation);
+  MHD_add_response_header(resp, "X-RackRadar-Generation", value);
+}
+
+/*
+  ?wait=<generation>&timeout=<seconds> holds the request until the list has
+  been built past generation, without holding a thread while it waits.
+  Returns 0 once it has, HTTP_SUSPENDED if the connection was parked, 304 if
+  the timeout passed first, or an error status.
+*/
+static int http_list_wait(struct MHD_Connection *con, const char *name,
+  const char *wait, HTTPRequest *req)
+{
+  char *end;
+  unsigned long generation = strtoul(wait, &end, 10);
+  if (end == wait || *end != '\0' || *wait == '-' || generation > UINT_MAX)
+    return 400;
 
-    if (!rr_query_netblockv4_by_ip(dbcon, ipv4, &info))
+  if (!req->deadline)
+  {
+    unsigned long timeout = HTTP_WAIT_DEFAULT;
+    const char   *value   =
+      MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "timeout");
+    if (value)
     {
-      rr_db_put(&dbcon);
-      return 404;
+      timeout = strtoul(value, &end, 10);
+      if (end == value || *end != '\0' || *value == '-' || timeout > HTTP_WAIT_MAX)
+        return 400;
     }
-    rr_db_put(&dbcon);
-
-    uint32_t netip = htonl(info.start_ip.v4);
-    inet_ntop(AF_INET, &netip, ipstring, sizeof(ipstring));
-  }
-
-  char * buffer = malloc(16384);
-  int n = snprintf(buffer, 16384,
-    "netblock  : %s/%d\n"
-    "netname   : %s\n"
-    "org_handle: %s\n"
-    "org_name  : %s\n"
-    "descr     : %s\n",
-    ipstring,
-    info.prefix_len,
-    info.netname,
-    info.org_handle,
-    info.org_name,
-    info.descr
-  );
-
-  res = MHD_create_response_from_buffer_with_free_callback(n, buffer, &(free));
-  MHD_add_response_header(res, "Content-Type", "text/plain");
-  MHD_queue_response(con, MHD_HTTP_OK, res);
-  MHD_destroy_response(res);
-  return 200;
+    req->deadline = rr_microtime() + timeout * 1000000ULL;
+  }
+
+  while(true)
+  {
+    unsigned changes = http_park_changes();
+    if (rr_lists_generation(name) > generation)
+      return 0;
+
+    if (rr_microtime() >= req->deadline)
+      return 304;
+
+    int rc = http_park(con, req->deadline, 0, changes);
+    if (rc != 0)
+      return rc < 0 ? 500 : HTTP_SUSPENDED;
+  }
 }
 
-static ssize_t http_handler_list_v4_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+/*
+  The changes to a list since an earlier generation, as "-cidr" lines for
+  the CIDRs removed followed by "+cidr" lines for those added.
+*/
+typedef struct HTTPListDeltaStream
 {
-  RRDBCon *dbcon = cls;
-  uint32_t ip;
-  uint8_t  prefix_len;
+  bool               v6;
+  bool               adding;
+  RRRangeSetV4       removedV4, addedV4;
+  RRRangeSetV6       removedV6, addedV6;
+  RRRangeSetV4Cursor v4cur;
+  RRRangeSetV6Cursor v6cur;
+}
+HTTPListDeltaStream;
 
-  const size_t maxLineLen = 19; //ipv4 + / + 2 + \n
+static ssize_t http_list_delta_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+  HTTPListDeltaStream *st = cls;
+
+  // sign + address + prefix + \n
+  const size_t maxLineLen = 1 + RR_IPV6_STR_MAX + RR_PREFIX_STR_MAX + 1;
   ssize_t out = 0;
   while(max >= maxLineLen)
   {
-    int rc = rr_query_netblockv4_list_union_fetch(dbcon, &ip, &prefix_len);
-    if (rc == 0)
-      break;
+    uint8_t prefix_len;
+    bool    more;
+    size_t  len = 1;
+    if (st->v6)
+    {
+      unsigned __int128 ip;
+      more = rr_rangeset_v6_cidr_next(st->adding ? &st->addedV6 : &st->removedV6,
+        &st->v6cur, &ip, &prefix_len);
+      if (more)
+        len += rr_ipv6_to_str(buf + 1, rr_be_to_raw(ip));
+    }
+    else
+    {
+      uint32_t ip;
+      more = rr_rangeset_v4_cidr_next(st->adding ? &st->addedV4 : &st->removedV4,
+        &st->v4cur, &ip, &prefix_len);
+      if (more)
+        len += rr_ipv4_to_str(buf + 1, ip);
+    }
 
-    if (rc < 0)
-      return MHD_CONTENT_READER_END_WITH_ERROR;
+    if (!more)
+    {
+      if (st->adding)
+        break;
+
+      st->adding = true;
+      memset(&st->v4cur, 0, sizeof(st->v4cur));
+      memset(&st->v6cur, 0, sizeof(st->v6cur));
+      continue;
+    }
 
-    ip = htonl(ip);
-    inet_ntop(AF_INET, &ip, buf, max);
-    size_t len = strlen(buf);
-    len += sprintf(buf + len, "/%d\n", prefix_len);
+    buf[0] = st->adding ? '+' : '-';
+    len += rr_prefix_to_str(buf + len, prefix_len);
+    buf[len++] = '\n';
 
     buf += len;
     out += len;
@@ -128,59 +1721,104 @@ static ssize_t http_handler_list_v4_cb_reader(void *cls, uint64_t pos, char *buf
   return out;
 }
 
-static void http_handler_list_v4_cb_free(void *cls)
+static void http_list_delta_cb_free(void *cls)
 {
-  RRDBCon *dbcon = cls;
-  rr_query_netblockv4_list_union_end(dbcon);
-  rr_db_put(&dbcon);
+  HTTPListDeltaStream *st = cls;
+  rr_rangeset_v4_free(&st->removedV4);
+  rr_rangeset_v4_free(&st->addedV4);
+  rr_rangeset_v6_free(&st->removedV6);
+  rr_rangeset_v6_free(&st->addedV6);
+  free(st);
 }
 
-static int http_handler_list_v4(struct MHD_Connection *con, const char *uri)
+static int http_list_delta_v4(const char *name, unsigned since, unsigned generation,
+  HTTPListDeltaStream *st)
 {
-  bool found = false;
-  for(ConfigList * list = g_config.lists; list->name; ++list)
-  {
-    if (!list->build_list)
-      continue;
+  RRRangeSetV4 base    = { 0 };
+  RRRangeSetV4 current = { 0 };
+  int rc = rr_lists_get_v4(name, since, &base);
+  if (rc == 1)
+    rc = rr_lists_get_v4(name, generation, &current);
 
-    if (strcmp(list->name, uri) == 0)
-    {
-      found = true;
-      break;
-    }
-  }
+  if (rc == 1 && (
+      !rr_rangeset_v4_difference(&st->removedV4, &base, &current) ||
+      !rr_rangeset_v4_difference(&st->addedV4  , &current, &base)))
+    rc = -1;
 
-  if (!found)
-    return 404;
+  rr_rangeset_v4_free(&base);
+  rr_rangeset_v4_free(&current);
+  return rc;
+}
 
-  RRDBCon *dbcon = NULL;
-  if (!rr_db_get(&dbcon))
-    return 500;
+static int http_list_delta_v6(const char *name, unsigned since, unsigned generation,
+  HTTPListDeltaStream *st)
+{
+  RRRangeSetV6 base    = { 0 };
+  RRRangeSetV6 current = { 0 };
+  int rc = rr_lists_get_v6(name, since, &base);
+  if (rc == 1)
+    rc = rr_lists_get_v6(name, generation, &current);
 
-  unsigned list_id;
-  if (rr_query_list_by_name(dbcon, uri, &list_id) != 1)
+  if (rc == 1 && (
+      !rr_rangeset_v6_difference(&st->removedV6, &base, &current) ||
+      !rr_rangeset_v6_difference(&st->addedV6  , &current, &base)))
+    rc = -1;
+
+  rr_rangeset_v6_free(&base);
+  rr_rangeset_v6_free(&current);
+  return rc;
+}
+
+/*
+  Serve ?since=<generation>, returns 0 if the base generation is no longer
+  kept or a format other than plain was asked for, and the full list has to
+  be sent instead.
+*/
+static int http_handler_list_delta(struct MHD_Connection *con, const char *uri,
+  bool v6, const char *since)
+{
+  char *end;
+  unsigned long base = strtoul(since, &end, 10);
+  if (end == since || *end != '\0' || *since == '-' || base > UINT_MAX)
+    return 400;
+
+  const char *format = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "format");
+  if (format && strcmp(format, "plain") != 0)
+    return 0;
+
+  unsigned generation = rr_lists_generation(uri);
+  if (generation == 0 || base == 0 || base > generation)
+    return 0;
+
+  HTTPListDeltaStream *st = calloc(1, sizeof(*st));
+  if (!st)
   {
-    rr_db_put(&dbcon);
+    LOG_ERROR("out of memory");
     return 500;
   }
+  st->v6 = v6;
 
-  if (!rr_query_netblockv4_list_union_start(dbcon, list_id, false))
+  int rc = v6 ?
+    http_list_delta_v6(uri, base, generation, st) :
+    http_list_delta_v4(uri, base, generation, st);
+  if (rc != 1)
   {
-    rr_db_put(&dbcon);
-    return 500;
+    http_list_delta_cb_free(st);
+    return rc == 0 ? 0 : 500;
   }
 
-  struct MHD_Response *resp = MHD_create_response_from_callback(
-    MHD_SIZE_UNKNOWN,
+  struct MHD_Response *resp = http_create_response(con,
     64 * 1024,
-    http_handler_list_v4_cb_reader,
-    dbcon,
-    http_handler_list_v4_cb_free);
+    http_list_delta_cb_reader,
+    st,
+    http_list_delta_cb_free);
 
   if (!resp)
     return 500;
 
   MHD_add_response_header(resp, "Content-Type", "text/plain");
+  MHD_add_response_header(resp, "X-RackRadar-Since", since);
+  http_add_generation_header(resp, generation);
   if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
   {
     MHD_destroy_response(resp);
@@ -190,88 +1828,374 @@ static int http_handler_list_v4(struct MHD_Connection *con, const char *uri)
   return 200;
 }
 
-static ssize_t http_handler_list_v6_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+// a list read from the database and formatted by a worker
+typedef struct HTTPListDBStream
 {
-  RRDBCon *dbcon = cls;
-  unsigned __int128 ip;
-  uint8_t  prefix_len;
+  RRFormatStream fmt;
+  RRDBCon       *dbcon;
 
-  const size_t maxLineLen = 44; //ipv6 + / + 3 + \n
-  ssize_t out = 0;
-  while(max >= maxLineLen)
+  bool        v6;
+  RRListInfo  info;
+  HTTPListOut out;
+}
+HTTPListDBStream;
+
+static int http_list_db_next_v4(void *udata, uint32_t *ip, uint8_t *prefix_len)
+{
+  HTTPListDBStream *st = udata;
+  return rr_query_netblockv4_list_union_fetch(st->dbcon, ip, prefix_len);
+}
+
+static int http_list_db_next_v6(void *udata, unsigned __int128 *ip, uint8_t *prefix_len)
+{
+  HTTPListDBStream *st = udata;
+  return rr_query_netblockv6_list_union_fetch(st->dbcon, ip, prefix_len);
+}
+
+static int http_list_db_job(void *udata, struct MHD_Response **resp)
+{
+  HTTPListDBStream *st = udata;
+  unsigned          list_id;
+
+  bool started = rr_db_get(&st->dbcon) &&
+    http_list_id(st->dbcon, &st->info, &list_id) == 1 && (st->v6 ?
+      rr_query_netblockv6_list_union_start(st->dbcon, list_id, false) :
+      rr_query_netblockv4_list_union_start(st->dbcon, list_id, false));
+
+  *resp = http_list_response(&st->out, started ? &st->fmt : NULL);
+  if (started)
   {
-    int rc = rr_query_netblockv6_list_union_fetch(dbcon, &ip, &prefix_len);
-    if (rc == 0)
-      break;
+    if (st->v6)
+      rr_query_netblockv6_list_union_end(st->dbcon);
+    else
+      rr_query_netblockv4_list_union_end(st->dbcon);
+  }
+  rr_db_put(&st->dbcon);
 
-    if (rc < 0)
-      return MHD_CONTENT_READER_END_WITH_ERROR;
+  if (*resp)
+  {
+    rr_lists_count_request(st->info.name, true);
+    http_add_generation_header(*resp, st->out.generation);
+  }
 
-    inet_ntop(AF_INET6, &ip, buf, max);
-    size_t len = strlen(buf);
-    len += sprintf(buf + len, "/%d\n", prefix_len);
+  free(st);
+  return *resp ? 200 : 500;
+}
 
-    buf += len;
-    out += len;
-    max -= len;
+static int http_handler_list_v4(struct MHD_Connection *con, const char *uri, HTTPRequest *req)
+{
+  const char *wait = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "wait");
+  if (wait)
+  {
+    if (!http_list_is_built(uri))
+      return 404;
+
+    int rc = http_list_wait(con, uri, wait, req);
+    if (rc != 0)
+      return rc;
   }
 
-  if (out == 0)
-    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (strchr(uri, '/') ||
+      MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "max"      ) ||
+      MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "maxprefix"))
+    return http_handler_list_expr(con, uri, false, req);
 
-  return out;
+  RRListInfo info;
+  if (!rr_lists_lookup(uri, &info))
+    return 404;
+
+  int rc;
+  const char *since = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "since");
+  if (since && (rc = http_handler_list_delta(con, uri, false, since)) != 0)
+    return rc;
+
+  const RRFormat *fmt;
+  char            set[RR_FORMAT_SET_MAX + 1];
+  if ((rc = http_list_format(con, uri, &fmt, set)) != 200)
+    return rc;
+
+  char     key[512];
+  bool     keyed      = http_list_key(con, uri, false, set, NULL, key, sizeof(key));
+  unsigned generation = info.generation;
+
+  struct MHD_Response *resp   = fmt == rr_format_by_name(NULL) ?
+    http_list_file_response(con, uri, false, &generation) : NULL;
+  bool                 leader = false;
+  if (!resp && keyed &&
+    http_body_lookup(con, req, key, generation, &resp, &leader) == HTTP_SUSPENDED)
+    return HTTP_SUSPENDED;
+
+  if (!resp)
+  {
+    HTTPListDBStream *st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+      LOG_ERROR("out of memory");
+      if (leader)
+        http_flight_end(con, key, generation);
+      return 500;
+    }
+    st->v6   = false;
+    st->info = info;
+    http_list_out_init(&st->out, con, keyed ? key : NULL, generation, leader);
+    rr_format_stream_v4(&st->fmt, fmt, set, http_list_db_next_v4, st);
+    st->fmt.generation = generation;
+
+    return http_job_queue(con, req, http_list_db_job, st);
+  }
+
+  rr_lists_count_request(uri, false);
+  MHD_add_response_header(resp, "Content-Type", rr_format_content_type(fmt));
+  http_add_generation_header(resp, generation);
+  if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
+  {
+    MHD_destroy_response(resp);
+    return 500;
+  }
+  MHD_destroy_response(resp);
+  return 200;
 }
 
-static void http_handler_list_v6_cb_free(void *cls)
+static int http_handler_list_v6(struct MHD_Connection *con, const char *uri, HTTPRequest *req)
 {
-  RRDBCon *dbcon = cls;
-  rr_query_netblockv6_list_union_end(dbcon);
-  rr_db_put(&dbcon);
+  const char *wait = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "wait");
+  if (wait)
+  {
+    if (!http_list_is_built(uri))
+      return 404;
+
+    int rc = http_list_wait(con, uri, wait, req);
+    if (rc != 0)
+      return rc;
+  }
+
+  if (strchr(uri, '/') ||
+      MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "max"      ) ||
+      MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "maxprefix"))
+    return http_handler_list_expr(con, uri, true, req);
+
+  RRListInfo info;
+  if (!rr_lists_lookup(uri, &info))
+    return 404;
+
+  int rc;
+  const char *since = MHD_lookup_connection_value(con, MHD_GET_ARGUMENT_KIND, "since");
+  if (since && (rc = http_handler_list_delta(con, uri, true, since)) != 0)
+    return rc;
+
+  const RRFormat *fmt;
+  char            set[RR_FORMAT_SET_MAX + 1];
+  if ((rc = http_list_format(con, uri, &fmt, set)) != 200)
+    return rc;
+
+  char     key[512];
+  bool     keyed      = http_list_key(con, uri, true, set, NULL, key, sizeof(key));
+  unsigned generation = info.generation;
+
+  struct MHD_Response *resp   = fmt == rr_format_by_name(NULL) ?
+    http_list_file_response(con, uri, true, &generation) : NULL;
+  bool                 leader = false;
+  if (!resp && keyed &&
+    http_body_lookup(con, req, key, generation, &resp, &leader) == HTTP_SUSPENDED)
+    return HTTP_SUSPENDED;
+
+  if (!resp)
+  {
+    HTTPListDBStream *st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+      LOG_ERROR("out of memory");
+      if (leader)
+        http_flight_end(con, key, generation);
+      return 500;
+    }
+    st->v6   = true;
+    st->info = info;
+    http_list_out_init(&st->out, con, keyed ? key : NULL, generation, leader);
+    rr_format_stream_v6(&st->fmt, fmt, set, http_list_db_next_v6, st);
+    st->fmt.generation = generation;
+
+    return http_job_queue(con, req, http_list_db_job, st);
+  }
+
+  rr_lists_count_request(uri, false);
+  MHD_add_response_header(resp, "Content-Type", rr_format_content_type(fmt));
+  http_add_generation_header(resp, generation);
+  if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
+  {
+    MHD_destroy_response(resp);
+    return 500;
+  }
+  MHD_destroy_response(resp);
+  return 200;
 }
 
-static int http_handler_list_v6(struct MHD_Connection *con, const char *uri)
+/*
+  Server-sent events for list builds, the current generation of every built
+  list is sent on connect and each new generation as it is published. List
+  names are configuration group names and need no escaping.
+*/
+typedef struct HTTPEventStream
 {
-  bool found = false;
-  for(ConfigList * list = g_config.lists; list->name; ++list)
+  struct MHD_Connection *con;
+  unsigned              *seen;
+  uint64_t               keepalive;
+}
+HTTPEventStream;
+
+static ssize_t http_events_cb_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+  HTTPEventStream *st = cls;
+
+  while(true)
   {
-    if (strcmp(list->name, uri) == 0)
+    unsigned changes = http_park_changes();
+
+    size_t     out = 0;
+    RRListInfo info;
+    for(unsigned i = 0; rr_lists_info(i, &info); ++i)
     {
-      found = true;
-      break;
+      if (info.generation == st->seen[i])
+        continue;
+
+      // room for the event with the largest generation
+      if (max - out < strlen(info.name) + 64)
+        break;
+
+      st->seen[i] = info.generation;
+      out += sprintf(buf + out,
+        "event: list\ndata: {\"name\":\"%s\",\"generation\":%u}\n\n",
+        info.name, info.generation);
+    }
+
+    uint64_t now = rr_microtime();
+    if (out == 0 && now >= st->keepalive)
+      out = sprintf(buf, ": keepalive\n\n");
+
+    if (out > 0)
+    {
+      st->keepalive = now + HTTP_EVENTS_KEEPALIVE * 1000000ULL;
+      return out;
     }
+
+    // nothing to send, wait for a change without holding the thread
+    int rc = http_park(st->con, st->keepalive, 0, changes);
+    if (rc < 0)
+      return MHD_CONTENT_READER_END_WITH_ERROR;
+
+    if (rc > 0)
+      return 0;
   }
+}
+
+static void http_events_cb_free(void *cls)
+{
+  HTTPEventStream *st = cls;
+  free(st->seen);
+  free(st);
+}
 
-  if (!found)
+static int http_handler_events(struct MHD_Connection *con, const char *uri, HTTPRequest *req)
+{
+  if (*uri != '\0')
     return 404;
 
-  RRDBCon *dbcon = NULL;
-  if (!rr_db_get(&dbcon))
+  unsigned   count = 0;
+  RRListInfo info;
+  while(rr_lists_info(count, &info))
+    ++count;
+
+  HTTPEventStream *st = calloc(1, sizeof(*st));
+  if (!st || !(st->seen = calloc(count + 1, sizeof(*st->seen))))
+  {
+    LOG_ERROR("out of memory");
+    free(st);
     return 500;
+  }
+  st->con = con;
 
-  unsigned list_id;
-  if (rr_query_list_by_name(dbcon, uri, &list_id) != 1)
+  struct MHD_Response *resp = MHD_create_response_from_callback(
+    MHD_SIZE_UNKNOWN,
+    4096,
+    http_events_cb_reader,
+    st,
+    http_events_cb_free);
+
+  if (!resp)
   {
-    rr_db_put(&dbcon);
+    http_events_cb_free(st);
     return 500;
   }
 
-  if (!rr_query_netblockv6_list_union_start(dbcon, list_id, false))
+  MHD_add_response_header(resp, "Content-Type" , "text/event-stream");
+  MHD_add_response_header(resp, "Cache-Control", "no-cache");
+  if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
   {
-    rr_db_put(&dbcon);
+    MHD_destroy_response(resp);
     return 500;
   }
+  MHD_destroy_response(resp);
+  return 200;
+}
 
-  struct MHD_Response *resp = MHD_create_response_from_callback(
-    MHD_SIZE_UNKNOWN,
-    1024,
-    http_handler_list_v6_cb_reader,
-    dbcon,
-    http_handler_list_v6_cb_free);
+static int http_handler_stats(struct MHD_Connection *con, const char *uri, HTTPRequest *req)
+{
+  if (*uri != '\0')
+    return 404;
 
+  RRCompressStats zs;
+  rr_compress_get_stats(&zs);
+
+  RRBuffer buf = { 0 };
+  if (!rr_buffer_appendf(&buf,
+    "{\"compress\":{"
+      "\"streams\":%llu,"
+      "\"bytes_in\":%llu,"
+      "\"bytes_out\":%llu,"
+      "\"ratio\":%.3f,"
+      "\"cpu_usec\":%llu,"
+      "\"cache_hits\":%llu"
+    "},"
+    "\"bodies\":{"
+      "\"cache_hits\":%llu,"
+      "\"leaders\":%llu,"
+      "\"waits\":%llu"
+    "},"
+    "\"lists\":[",
+    zs.streams,
+    zs.bytesIn,
+    zs.bytesOut,
+    zs.bytesOut ? (double)zs.bytesIn / zs.bytesOut : 0.0,
+    zs.cpuTime,
+    zs.hits,
+    atomic_load_explicit(&s_http.stats.hits   , memory_order_relaxed),
+    atomic_load_explicit(&s_http.stats.leaders, memory_order_relaxed),
+    atomic_load_explicit(&s_http.stats.waits  , memory_order_relaxed)))
+    goto err;
+
+  RRListInfo info;
+  for(unsigned i = 0; rr_lists_info(i, &info); ++i)
+    if (!rr_buffer_appendf(&buf,
+      "%s{\"name\":\"%s\",\"id\":%u,\"generation\":%u,"
+        "\"requests\":%llu,\"db_requests\":%llu}",
+      i ? "," : "",
+      info.name,
+      info.id,
+      info.generation,
+      info.requests,
+      info.dbRequests))
+      goto err;
+
+  if (!rr_buffer_appendf(&buf, "]}\n"))
+    goto err;
+
+  struct MHD_Response *resp =
+    MHD_create_response_from_buffer_with_free_callback(buf.pos, buf.buffer, &(free));
   if (!resp)
-    return 500;
+    goto err;
 
-  MHD_add_response_header(resp, "Content-Type", "text/plain");
+  MHD_add_response_header(resp, "Content-Type" , "application/json");
+  MHD_add_response_header(resp, "Cache-Control", "no-cache");
   if (MHD_queue_response(con, MHD_HTTP_OK, resp) != MHD_YES)
   {
     MHD_destroy_response(resp);
@@ -279,13 +2203,19 @@ static int http_handler_list_v6(struct MHD_Connection *con, const char *uri)
   }
   MHD_destroy_response(resp);
   return 200;
+
+err:
+  rr_buffer_free(&buf);
+  return 500;
 }
 
 static RRHTTPHander s_handlers[] =
 {
   { "/ip/"     , http_handler_ip      },
   { "/list/v4/", http_handler_list_v4 },
-  { "/list/v6/", http_handler_list_v6 }
+  { "/list/v6/", http_handler_list_v6 },
+  { "/events"  , http_handler_events  },
+  { "/stats"   , http_handler_stats   }
 };
 
 static enum MHD_Result httpd_handler(
@@ -305,44 +2235,61 @@ static enum MHD_Result httpd_handler(
     return MHD_YES;
   }
 
-  for(unsigned i = 0; i < ARRAY_SIZE(s_handlers); ++i)
+  if (!*ptr && !(*ptr = calloc(1, sizeof(HTTPRequest))))
   {
-    RRHTTPHander *h = &s_handlers[i];
-    int len = strlen(h->route);
-    if (strncmp(h->route, url, len) == 0)
+    LOG_ERROR("out of memory");
+    return MHD_NO;
+  }
+
+  // a request resumed by a worker is answered with the result of its job
+  HTTPRequest *req = *ptr;
+  int          rc  = 404;
+  if (req->done)
+    rc = http_job_finish(con, req);
+  else
+    for(unsigned i = 0; i < ARRAY_SIZE(s_handlers); ++i)
     {
-      switch(h->handler(con, url + len))
+      RRHTTPHander *h = &s_handlers[i];
+      int len = strlen(h->route);
+      if (strncmp(h->route, url, len) == 0)
       {
-        case 200:
-          break;
-
-        case 400:
-          MHD_queue_response(con,
-            MHD_HTTP_BAD_REQUEST, s_http.response.r400);
-          break;
-
-        case 404:
-          MHD_queue_response(con,
-            MHD_HTTP_NOT_FOUND, s_http.response.r404);
-          break;
-
-        case 405:
-          MHD_queue_response(con,
-            MHD_HTTP_METHOD_NOT_ALLOWED, s_http.response.r405);
-          break;
-
-        case 500:
-        default:
-          MHD_queue_response(con,
-            MHD_HTTP_INTERNAL_SERVER_ERROR, s_http.response.r500);
-          break;
+        rc = h->handler(con, url + len, req);
+        break;
       }
-
-      return MHD_YES;
     }
+
+  switch(rc)
+  {
+    case 200:
+    case HTTP_SUSPENDED:
+      break;
+
+    case 304:
+      MHD_queue_response(con,
+        MHD_HTTP_NOT_MODIFIED, s_http.response.r304);
+      break;
+
+    case 400:
+      MHD_queue_response(con,
+        MHD_HTTP_BAD_REQUEST, s_http.response.r400);
+      break;
+
+    case 404:
+      MHD_queue_response(con,
+        MHD_HTTP_NOT_FOUND, s_http.response.r404);
+      break;
+
+    case 405:
+      MHD_queue_response(con,
+        MHD_HTTP_METHOD_NOT_ALLOWED, s_http.response.r405);
+      break;
+
+    case 500:
+    default:
+      MHD_queue_response(con,
+        MHD_HTTP_INTERNAL_SERVER_ERROR, s_http.response.r500);
+      break;
   }
-  MHD_queue_response(con,
-    MHD_HTTP_NOT_FOUND, s_http.response.r404);
   return MHD_YES;
 }
 
@@ -355,6 +2302,20 @@ static void httpd_panic_handler(
   LOG_ERROR("%s:%u - %s", file, line, reason);
 }
 
+static void httpd_completed_handler(
+  void *cls,
+  struct MHD_Connection *con,
+  void **ptr,
+  enum MHD_RequestTerminationCode toe)
+{
+  HTTPRequest *req = *ptr;
+  if (req && req->resp)
+    MHD_destroy_response(req->resp);
+
+  free(req);
+  *ptr = NULL;
+}
+
 static void rr_http_noop_free(void *cls)
 {
   (void)cls;
@@ -372,6 +2333,8 @@ bool rr_http_init(void)
     emulate it by providing a no-op free callback
   */
 
+  s_http.response.r304 =
+    MHD_create_response_from_buffer_with_free_callback(0, (char *)"", rr_http_noop_free);
   s_http.response.r400 =
     MHD_create_response_from_buffer_with_free_callback(strlen(r400), (char *)r400, rr_http_noop_free);
   MHD_add_response_header(s_http.response.r400, "Content-Type", "text/plain");
@@ -385,13 +2348,66 @@ bool rr_http_init(void)
     MHD_create_response_from_buffer_with_free_callback(strlen(r500), (char *)r500, rr_http_noop_free);
   MHD_add_response_header(s_http.response.r500, "Content-Type", "text/plain");
 
+  pthread_mutex_init(&s_http.aggLock , NULL);
+  pthread_mutex_init(&s_http.bodyLock, NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&s_http.parkLock, NULL);
+  pthread_cond_init (&s_http.parkCond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  s_http.parkRunning = true;
+  if (pthread_create(&s_http.parkThread, NULL, http_park_thread, NULL) != 0)
+  {
+    LOG_ERROR("failed to create the park thread");
+    s_http.parkRunning = false;
+    return false;
+  }
+  rr_lists_set_notify(http_lists_changed, NULL);
+
+  pthread_mutex_init(&s_http.jobLock, NULL);
+  pthread_cond_init (&s_http.jobCond, NULL);
+  s_http.jobsTail  = &s_http.jobs;
+  s_http.nbWorkers = g_config.http.workers > 0 ? g_config.http.workers : 1;
+  if (!(s_http.workers = calloc(s_http.nbWorkers, sizeof(*s_http.workers))))
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  s_http.jobsRunning = true;
+  for(unsigned i = 0; i < s_http.nbWorkers; ++i)
+    if (pthread_create(&s_http.workers[i], NULL, http_worker_thread, NULL) != 0)
+    {
+      LOG_ERROR("failed to create the HTTP workers");
+      s_http.nbWorkers = i;
+      return false;
+    }
+
+  /*
+    A pool of polling threads rather than a thread per connection, so that
+    waiting requests can be suspended without holding a thread. The polling
+    threads only answer from memory and files, anything that blocks is
+    handed to the workers.
+
+    Every connection counts against the limit, including those suspended on
+    ?wait= or /events, so it must leave room for them and for the clients of
+    the lookups and lists.
+  */
   MHD_set_panic_func(httpd_panic_handler, NULL);
   s_http.daemon = MHD_start_daemon(
-    MHD_USE_THREAD_PER_CONNECTION,
+    MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_EPOLL | MHD_ALLOW_SUSPEND_RESUME,
     g_config.http.port,
     NULL,
     NULL,
     &httpd_handler, NULL,
+    MHD_OPTION_NOTIFY_COMPLETED, httpd_completed_handler, NULL,
+    MHD_OPTION_THREAD_POOL_SIZE,
+      (unsigned)(g_config.http.threads > 0 ? g_config.http.threads : 1),
+    MHD_OPTION_CONNECTION_LIMIT,
+      (unsigned)(g_config.http.connections > 0 ? g_config.http.connections : 1),
     MHD_OPTION_END);
   if (!s_http.daemon)
   {
@@ -404,9 +2420,53 @@ bool rr_http_init(void)
 
 void rr_http_deinit(void)
 {
+  // resume every parked connection so the daemon can close them
+  rr_lists_set_notify(NULL, NULL);
+  pthread_mutex_lock(&s_http.parkLock);
+  bool running = s_http.parkRunning;
+  s_http.parkRunning = false;
+  pthread_cond_signal(&s_http.parkCond);
+  pthread_mutex_unlock(&s_http.parkLock);
+  if (running)
+    pthread_join(s_http.parkThread, NULL);
+
+  // the workers run the jobs queued and resume their connections first
+  pthread_mutex_lock(&s_http.jobLock);
+  s_http.jobsRunning = false;
+  pthread_cond_broadcast(&s_http.jobCond);
+  pthread_mutex_unlock(&s_http.jobLock);
+  for(unsigned i = 0; i < s_http.nbWorkers; ++i)
+    pthread_join(s_http.workers[i], NULL);
+  free(s_http.workers);
+
   MHD_stop_daemon(s_http.daemon);
+  MHD_destroy_response(s_http.response.r304);
   MHD_destroy_response(s_http.response.r400);
   MHD_destroy_response(s_http.response.r404);
   MHD_destroy_response(s_http.response.r405);
   MHD_destroy_response(s_http.response.r500);
+
+  for(unsigned i = 0; i < HTTP_AGG_CACHE_MAX; ++i)
+  {
+    free(s_http.agg[i].expr);
+    rr_rangeset_v4_free(&s_http.agg[i].v4set);
+    rr_rangeset_v6_free(&s_http.agg[i].v6set);
+  }
+  pthread_mutex_destroy(&s_http.aggLock);
+
+  for(unsigned i = 0; i < HTTP_BODY_CACHE_MAX; ++i)
+  {
+    free(s_http.bodies[i].key);
+    if (s_http.bodies[i].body)
+      http_body_put(s_http.bodies[i].body);
+  }
+
+  for(unsigned i = 0; i < HTTP_FLIGHT_MAX; ++i)
+    free(s_http.flights[i].key);
+  pthread_mutex_destroy(&s_http.bodyLock);
+
+  pthread_mutex_destroy(&s_http.parkLock);
+  pthread_cond_destroy (&s_http.parkCond);
+  pthread_mutex_destroy(&s_http.jobLock);
+  pthread_cond_destroy (&s_http.jobCond);
 }
@@ -6,10 +6,123 @@
 #include "db.h"
 #include "query.h"
 #include "query_macros.h"
+#include "hashmap.h"
+#include "filter.h"
+#include "rangeset.h"
+#include "lists.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+
+// per connection state of a list build worker
+typedef struct RRImportListCon
+{
+  RRDBCon *con;
+
+  STMT_STRUCT(list_insert,
+    char in_list_name[32];
+  );
+
+  STMT_STRUCT(list_generation_bump, unsigned in_list_id; );
+  STMT_STRUCT(list_generation,
+    unsigned in_list_id;
+    unsigned out_generation;
+  );
+
+  STMT_STRUCT(netblockv4_list_delete      , unsigned in_list_id; );
+  STMT_STRUCT(netblockv6_list_delete      , unsigned in_list_id; );
+  STMT_STRUCT(netblockv4_list_union_delete, unsigned in_list_id; );
+  STMT_STRUCT(netblockv6_list_union_delete, unsigned in_list_id; );
+
+  STMT_STRUCT(netblockv4_list_source,
+    unsigned long long out_id;
+    unsigned           out_registrar_id;
+    uint32_t           out_start_ip;
+    uint32_t           out_end_ip;
+    uint8_t            out_prefix_len;
+    char               out_netname   [RRDB_NETNAME_MAX  + 1];
+    char               out_descr     [RRDB_DESCR_MAX    + 1];
+    char               out_org_handle[RRDB_HANDLE_MAX   + 1];
+    char               out_org_name  [RRDB_ORG_NAME_MAX + 1];
+    char               out_org_descr [RRDB_DESCR_MAX    + 1];
+    char               out_org_null;
+    char               out_org_descr_null;
+  );
+
+  STMT_STRUCT(netblockv6_list_source,
+    unsigned long long out_id;
+    unsigned           out_registrar_id;
+    unsigned __int128  out_start_ip;
+    unsigned __int128  out_end_ip;
+    uint8_t            out_prefix_len;
+    char               out_netname   [RRDB_NETNAME_MAX  + 1];
+    char               out_descr     [RRDB_DESCR_MAX    + 1];
+    char               out_org_handle[RRDB_HANDLE_MAX   + 1];
+    char               out_org_name  [RRDB_ORG_NAME_MAX + 1];
+    char               out_org_descr [RRDB_DESCR_MAX    + 1];
+    char               out_org_null;
+    char               out_org_descr_null;
+  );
+
+  RRDBBulk *netblockv4_list_insert;
+  RRDBBulk *netblockv6_list_insert;
+  RRDBBulk *netblockv4_list_union_insert;
+  RRDBBulk *netblockv6_list_union_insert;
+
+  // CIDRs emitted for the list being built
+  unsigned long long emitted;
+}
+RRImportListCon;
+
+// the fields list filters match against, as CONFIG_LIST_FIELDS
+#define X(x, y) LIST_FIELD_ ##x ##_ ##y,
+enum
+{
+  CONFIG_LIST_FIELDS
+  LIST_FIELD_MAX
+};
+#undef X
+
+#define LIST_FIELD_ORG_MASK ( \
+  (1U << LIST_FIELD_org_handle) | \
+  (1U << LIST_FIELD_org_name  ) | \
+  (1U << LIST_FIELD_org_descr ))
+
+typedef struct RRListMemberV4
+{
+  unsigned long long id;
+  uint32_t           start_ip;
+  uint32_t           end_ip;
+  uint8_t            prefix_len;
+}
+RRListMemberV4;
+
+typedef struct RRListMemberV6
+{
+  unsigned long long id;
+  unsigned __int128  start_ip;
+  unsigned __int128  end_ip;
+  uint8_t            prefix_len;
+}
+RRListMemberV6;
+
+/*
+  A netblock is a member of a list if any of its terms match. A term
+  requires the registrar if set, and the filters of the list at index set in
+  g_config.lists if set is not negative.
+*/
+typedef struct RRListTerm
+{
+  const char *registrar;
+  int         set;
+
+  // resolved for each scan, a registrar that does not exist never matches
+  unsigned registrar_id;
+  bool     known;
+}
+RRListTerm;
 
 typedef struct RRImport
 {
@@ -30,13 +143,31 @@ typedef struct RRImport
     RRDBOrg in;
   );
 
+  STMT_STRUCT(registrar_set_serial,
+    unsigned in_registrar_id;
+    unsigned in_serial;
+  );
+
   STMT_STRUCT(org_delete_old,
     unsigned in_registrar_id;
     unsigned in_serial;
   );
 
+  STMT_STRUCT(org_delete,
+    unsigned  in_registrar_id;
+    RRStrView in_handle;
+  );
+
+  STMT_STRUCT(org_select_ids,
+    unsigned in_registrar_id;
+    unsigned out_id;
+    char     out_handle[RRDB_HANDLE_MAX + 1];
+  );
+
   STMT_STRUCT(netblockv4_insert,
     RRDBNetBlock in;
+    unsigned     in_org_id;
+    char         in_org_id_null;
   );
 
   STMT_STRUCT(netblockv4_delete_old,
@@ -44,10 +175,27 @@ typedef struct RRImport
     unsigned in_serial;
   );
 
-  STMT_STRUCT(netblockv4_link_org,);
+  STMT_STRUCT(netblockv4_delete,
+    unsigned in_registrar_id;
+    uint32_t in_start_ip;
+    uint32_t in_end_ip;
+  );
+
+  STMT_STRUCT(netblockv4_link_org,
+    unsigned in_registrar_id;
+  );
+
+  STMT_STRUCT(netblockv4_link_handle,
+    unsigned  in_org_id;
+    char      in_org_id_null;
+    unsigned  in_registrar_id;
+    RRStrView in_handle;
+  );
 
   STMT_STRUCT(netblockv6_insert,
     RRDBNetBlock in;
+    unsigned     in_org_id;
+    char         in_org_id_null;
   );
 
   STMT_STRUCT(netblockv6_delete_old,
@@ -55,67 +203,167 @@ typedef struct RRImport
     unsigned in_serial;
   );
 
-  STMT_STRUCT(netblockv6_link_org,);
+  STMT_STRUCT(netblockv6_delete,
+    unsigned          in_registrar_id;
+    unsigned __int128 in_start_ip;
+    unsigned __int128 in_end_ip;
+  );
 
-  STMT_STRUCT(netblockv4_union_truncate,);
-  STMT_STRUCT(netblockv6_union_truncate,);
-  STMT_STRUCT(netblockv4_union_populate,);
-  STMT_STRUCT(netblockv6_union_populate,);
+  STMT_STRUCT(netblockv6_link_org,
+    unsigned in_registrar_id;
+  );
 
-  STMT_STRUCT(list_insert,
-    char in_list_name[32];
+  STMT_STRUCT(netblockv6_link_handle,
+    unsigned  in_org_id;
+    char      in_org_id_null;
+    unsigned  in_registrar_id;
+    RRStrView in_handle;
   );
 
-  STMT_STRUCT(netblockv4_list_delete      , unsigned in_list_id; );
-  STMT_STRUCT(netblockv6_list_delete      , unsigned in_list_id; );
-  STMT_STRUCT(netblockv4_list_union_delete, unsigned in_list_id; );
-  STMT_STRUCT(netblockv6_list_union_delete, unsigned in_list_id; );
+  STMT_STRUCT(netblockv4_union_source,
+    uint32_t out_start_ip;
+    uint32_t out_end_ip;
+  );
 
-  STMT_STRUCT(netblockv4_list_union_insert,
-    unsigned in_list_id;
-    unsigned in_ip;
-    uint8_t  in_prefix_len;
+  STMT_STRUCT(netblockv6_union_source,
+    unsigned __int128 out_start_ip;
+    unsigned __int128 out_end_ip;
   );
 
-  STMT_STRUCT(netblockv6_list_union_insert,
-    unsigned in_list_id;
-    unsigned __int128 in_ip;
-    uint8_t  in_prefix_len;
+  STMT_STRUCT(netblockv4_union_current,
+    uint32_t out_start_ip;
+    uint32_t out_end_ip;
+  );
+
+  STMT_STRUCT(netblockv6_union_current,
+    unsigned __int128 out_start_ip;
+    unsigned __int128 out_end_ip;
   );
 
+  RRDBBulk *netblockv4_union_insert;
+  RRDBBulk *netblockv6_union_insert;
+  RRDBBulk *netblockv4_union_delete;
+  RRDBBulk *netblockv6_union_delete;
+
+  // the configured lists that are built
   struct
   {
     ConfigList *cl;
-    char in_list_name[32];
-    RRDBStmt *stmt[2];
+    RRListTerm *terms;
+    unsigned    nbTerms;
+
+    // members found by the last scan, written out when the list is built
+    RRListMemberV4 *v4;
+    size_t          nbV4, szV4;
+    RRListMemberV6 *v6;
+    size_t          nbV6, szV6;
+
+    // sources the list content depends on, indexed as g_config.sources
+    bool *deps;
+    bool  dirty;
+
+    // build state, protected by listsLock
+    bool     busy;
+    bool     failed;
+    unsigned orderPos;
+  }
+  *lists;
+  unsigned nbLists;
+
+  // lists indices ordered so excluded lists are built first
+  unsigned *listsOrder;
+
+  // list patterns for each field, each pattern is owned by a filter set
+  struct
+  {
+    RRFilter *filter;
+    struct
+    {
+      unsigned set;
+      bool     ignore;
+    }
+    *owners;
+    unsigned *matches;
+  }
+  filters[LIST_FIELD_MAX];
+
+  // filter sets indexed as g_config.lists, evaluated once per netblock
+  struct
+  {
+    bool     used;
+    uint8_t  ignoreFields;
+    unsigned stamp;
+    bool     matched;
+    bool     ignored;
+  }
+  *filterSets;
+  unsigned filterStamp;
+
+  // list build workers, each on its own reserved connection
+  RRDBCon       **listCons;
+  unsigned        nbListCons;
+  pthread_mutex_t listsLock;
+  pthread_cond_t  listsCond;
+
+  // per source NRTM mirror state, indexed as g_config.sources
+  struct
+  {
+    time_t last_poll;
+    bool   resync;
+
+    // org handle to id map, kept between polls while valid
+    RRHashMap *orgIds;
+    bool       orgIdsValid;
   }
-  *lists_prepare;
+  *nrtm;
+
+  // org map of the source being imported
+  RRHashMap *orgIds;
+  bool       incremental;
+  unsigned   orgMisses;
 }
 RRImport;
 RRImport s_import = { 0 };
 
+// rows per multi-row statement when writing the unions
+#define UNION_BULK_ROWS 512
+
+// rows per multi-row statement when writing the list members
+#define LIST_BULK_ROWS 512
+
 #define STATEMENTS(X) \
   X(registrar_insert              ) \
   X(registrar_update_serial       ) \
+  X(registrar_set_serial          ) \
   X(org_insert                    ) \
   X(org_delete_old                ) \
+  X(org_delete                    ) \
+  X(org_select_ids                ) \
   X(netblockv4_insert             ) \
   X(netblockv4_delete_old         ) \
+  X(netblockv4_delete             ) \
   X(netblockv4_link_org           ) \
+  X(netblockv4_link_handle        ) \
   X(netblockv6_insert             ) \
   X(netblockv6_delete_old         ) \
+  X(netblockv6_delete             ) \
   X(netblockv6_link_org           ) \
-  X(netblockv4_union_truncate     ) \
-  X(netblockv6_union_truncate     ) \
-  X(netblockv4_union_populate     ) \
-  X(netblockv6_union_populate     ) \
+  X(netblockv6_link_handle        ) \
+  X(netblockv4_union_source       ) \
+  X(netblockv6_union_source       ) \
+  X(netblockv4_union_current      ) \
+  X(netblockv6_union_current      )
+
+#define LIST_STATEMENTS(X) \
   X(list_insert                   ) \
+  X(list_generation_bump          ) \
+  X(list_generation               ) \
   X(netblockv4_list_delete        ) \
   X(netblockv6_list_delete        ) \
   X(netblockv4_list_union_delete  ) \
   X(netblockv6_list_union_delete  ) \
-  X(netblockv4_list_union_insert  ) \
-  X(netblockv6_list_union_insert  )
+  X(netblockv4_list_source        ) \
+  X(netblockv6_list_source        )
 
 #pragma region statements
 DEFAULT_STMT(RRImport, registrar_insert,
@@ -129,6 +377,12 @@ DEFAULT_STMT(RRImport, registrar_update_serial,
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id }
 );
 
+DEFAULT_STMT(RRImport, registrar_set_serial,
+  "UPDATE registrar SET serial = ? WHERE id = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_serial       },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id }
+);
+
 DEFAULT_STMT(RRImport, org_insert,
   "INSERT INTO org ("
     "registrar_id, "
@@ -143,15 +397,16 @@ DEFAULT_STMT(RRImport, org_insert,
     "?,"
     "?"
   ") ON DUPLICATE KEY UPDATE "
+    "id     = LAST_INSERT_ID(id), "
     "serial = VALUES(serial), "
     "name   = VALUES(name), "
     "descr  = VALUES(descr)",
 
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.registrar_id },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT,   .bind = &this->in.serial       },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.handle       },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.name         },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.descr        }
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.serial       },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.handle       },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.name         },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.descr        }
 );
 
 DEFAULT_STMT(RRImport, org_delete_old,
@@ -160,11 +415,26 @@ DEFAULT_STMT(RRImport, org_delete_old,
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_serial       }
 );
 
+DEFAULT_STMT(RRImport, org_delete,
+  "DELETE FROM org WHERE registrar_id = ? AND handle = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in_handle       }
+);
+
+DEFAULT_STMT(RRImport, org_select_ids,
+  "SELECT id, handle FROM org WHERE registrar_id = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id },
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->out_id                                        },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->out_handle, .size = sizeof(this->out_handle) }
+);
+
 DEFAULT_STMT(RRImport, netblockv4_insert,
   "INSERT INTO netblock_v4 ("
     "registrar_id, "
     "serial, "
     "org_handle, "
+    "org_id, "
     "start_ip, "
     "end_ip, "
     "prefix_len, "
@@ -178,20 +448,23 @@ DEFAULT_STMT(RRImport, netblockv4_insert,
     "?,"
     "?,"
     "?,"
+    "?,"
     "?"
   ") ON DUPLICATE KEY UPDATE "
     "serial  = VALUES(serial), "
+    "org_id  = VALUES(org_id), "
     "netname = VALUES(netname), "
     "descr   = VALUES(descr)",
 
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.registrar_id },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.serial       },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.org_handle   },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.startAddr.v4 },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.endAddr  .v4 },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT8 , .bind = &this->in.prefixLen    },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.netname      },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.descr        }
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.serial       },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.org_handle   },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.startAddr.v4 },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.endAddr  .v4 },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT8  , .bind = &this->in.prefixLen    },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.netname      },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.descr        }
 );
 
 DEFAULT_STMT(RRImport, netblockv4_delete_old,
@@ -200,12 +473,35 @@ DEFAULT_STMT(RRImport, netblockv4_delete_old,
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_serial       }
 );
 
+DEFAULT_STMT(RRImport, netblockv4_delete,
+  "DELETE FROM netblock_v4 WHERE registrar_id = ? AND start_ip = ? AND end_ip = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_start_ip     },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_end_ip       }
+);
+
 DEFAULT_STMT(RRImport, netblockv4_link_org,
   "UPDATE netblock_v4 nb "
-    "LEFT JOIN org o "
+    "JOIN org o "
     "ON o.registrar_id = nb.registrar_id "
     "AND o.handle = nb.org_handle "
-    "SET nb.org_id = o.id"
+    "SET nb.org_id = o.id "
+    "WHERE nb.registrar_id = ? "
+    "AND nb.org_id IS NULL "
+    "AND nb.org_handle != ''",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id }
+);
+
+DEFAULT_STMT(RRImport, netblockv4_link_handle,
+  "UPDATE netblock_v4 "
+    "SET org_id = ? "
+    "WHERE registrar_id = ? "
+    "AND org_handle = ? "
+    "AND NOT (org_id <=> ?)",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in_handle       },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null }
 );
 
 DEFAULT_STMT(RRImport, netblockv6_insert,
@@ -213,6 +509,7 @@ DEFAULT_STMT(RRImport, netblockv6_insert,
     "registrar_id, "
     "serial, "
     "org_handle, "
+    "org_id, "
     "start_ip, "
     "end_ip, "
     "prefix_len, "
@@ -226,20 +523,23 @@ DEFAULT_STMT(RRImport, netblockv6_insert,
     "?,"
     "?,"
     "?,"
+    "?,"
     "?"
   ") ON DUPLICATE KEY UPDATE "
     "serial  = VALUES(serial), "
+    "org_id  = VALUES(org_id), "
     "netname = VALUES(netname), "
     "descr   = VALUES(descr)",
 
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.registrar_id },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in.serial       },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.org_handle   },
-  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->in.startAddr.v6, .size = sizeof(this->in.startAddr) },
-  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->in.endAddr  .v6, .size = sizeof(this->in.endAddr  ) },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT8 , .bind = &this->in.prefixLen    },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.netname      },
-  &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in.descr        }
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in.serial       },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.org_handle   },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY , .bind = &this->in.startAddr.v6, .size = sizeof(this->in.startAddr) },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY , .bind = &this->in.endAddr  .v6, .size = sizeof(this->in.endAddr  ) },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT8  , .bind = &this->in.prefixLen    },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.netname      },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in.descr        }
 );
 
 DEFAULT_STMT(RRImport, netblockv6_delete_old,
@@ -248,103 +548,144 @@ DEFAULT_STMT(RRImport, netblockv6_delete_old,
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_serial       }
 );
 
+DEFAULT_STMT(RRImport, netblockv6_delete,
+  "DELETE FROM netblock_v6 WHERE registrar_id = ? AND start_ip = ? AND end_ip = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in_registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->in_start_ip, .size = sizeof(this->in_start_ip) },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->in_end_ip  , .size = sizeof(this->in_end_ip  ) }
+);
+
 DEFAULT_STMT(RRImport, netblockv6_link_org,
   "UPDATE netblock_v6 nb "
-    "LEFT JOIN org o "
+    "JOIN org o "
     "ON o.registrar_id = nb.registrar_id "
     "AND o.handle = nb.org_handle "
-    "SET nb.org_id = o.id"
+    "SET nb.org_id = o.id "
+    "WHERE nb.registrar_id = ? "
+    "AND nb.org_id IS NULL "
+    "AND nb.org_handle != ''",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_registrar_id }
+);
+
+DEFAULT_STMT(RRImport, netblockv6_link_handle,
+  "UPDATE netblock_v6 "
+    "SET org_id = ? "
+    "WHERE registrar_id = ? "
+    "AND org_handle = ? "
+    "AND NOT (org_id <=> ?)",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_registrar_id },
+  &(RRDBParam){ .type = RRDB_TYPE_STRVIEW, .bind = &this->in_handle       },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT   , .bind = &this->in_org_id, .is_null = &this->in_org_id_null }
 );
 
-DEFAULT_STMT(RRImport, netblockv4_union_truncate,
-  "TRUNCATE TABLE netblock_v4_union"
+DEFAULT_STMT(RRImport, netblockv4_union_source,
+  "SELECT start_ip, end_ip "
+  "FROM netblock_v4 FORCE INDEX (idx_start_end) "
+  "ORDER BY start_ip, end_ip",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->out_start_ip },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->out_end_ip   }
 );
 
-DEFAULT_STMT(RRImport, netblockv6_union_truncate,
-  "TRUNCATE TABLE netblock_v6_union"
+DEFAULT_STMT(RRImport, netblockv6_union_source,
+  "SELECT start_ip, end_ip "
+  "FROM netblock_v6 FORCE INDEX (idx_start_end) "
+  "ORDER BY start_ip, end_ip",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->out_start_ip, .size = sizeof(this->out_start_ip) },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->out_end_ip  , .size = sizeof(this->out_end_ip  ) }
 );
 
-DEFAULT_STMT(RRImport, netblockv4_union_populate,
-  "INSERT INTO netblock_v4_union (start_ip, end_ip) "
-  "SELECT MIN(start_ip) AS start_ip, MAX(running_end) AS end_ip "
-  "FROM ( "
-    "SELECT "
-      "t.start_ip, "
-      "(@grp := @grp + (t.start_ip > @end)) AS grp, "
-      "(@end := IF(t.start_ip > @end, t.end_ip, GREATEST(@end, t.end_ip))) AS running_end "
-    "FROM ( "
-      "SELECT start_ip, end_ip "
-      "FROM netblock_v4 FORCE INDEX (idx_start_end) "
-      "ORDER BY start_ip, end_ip "
-    ") t "
-    "CROSS JOIN (SELECT @grp := -1, @end := -1) vars "
-    "ORDER BY t.start_ip, t.end_ip "
-  ") x "
-  "GROUP BY grp"
+DEFAULT_STMT(RRImport, netblockv4_union_current,
+  "SELECT start_ip, end_ip FROM netblock_v4_union ORDER BY start_ip",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->out_start_ip },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->out_end_ip   }
 );
 
-DEFAULT_STMT(RRImport, netblockv6_union_populate,
-  "INSERT INTO netblock_v6_union (start_ip, end_ip) "
-  "SELECT MIN(start_ip) AS start_ip, MAX(running_end) AS end_ip "
-  "FROM ( "
-    "SELECT "
-      "t.start_ip, "
-      "(@grp := @grp + (t.start_ip > CAST(@end AS BINARY(16)))) AS grp, "
-      "(@end := IF( "
-        "t.start_ip > CAST(@end AS BINARY(16)), "
-        "t.end_ip, "
-        "IF(t.end_ip > CAST(@end AS BINARY(16)), t.end_ip, CAST(@end AS BINARY(16))) "
-      ")) AS running_end "
-    "FROM ( "
-      "SELECT start_ip, end_ip "
-      "FROM netblock_v6 FORCE INDEX (idx_start_end) "
-      "ORDER BY start_ip, end_ip "
-    ") t "
-    "CROSS JOIN ( "
-      "SELECT @grp := -1, @end := CAST(UNHEX('00000000000000000000000000000000') AS BINARY(16)) "
-    ") vars "
-    "ORDER BY t.start_ip, t.end_ip "
-  ") x "
-  "GROUP BY grp"
+DEFAULT_STMT(RRImport, netblockv6_union_current,
+  "SELECT start_ip, end_ip FROM netblock_v6_union ORDER BY start_ip",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->out_start_ip, .size = sizeof(this->out_start_ip) },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->out_end_ip  , .size = sizeof(this->out_end_ip  ) }
 );
 
-DEFAULT_STMT(RRImport, list_insert,
+DEFAULT_STMT(RRImportListCon, list_insert,
   "INSERT IGNORE INTO list (name) VALUES (?)",
   &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &this->in_list_name }
 );
 
-DEFAULT_STMT(RRImport, netblockv4_list_delete,
+DEFAULT_STMT(RRImportListCon, list_generation_bump,
+  "UPDATE list SET generation = generation + 1 WHERE id = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id }
+);
+
+DEFAULT_STMT(RRImportListCon, list_generation,
+  "SELECT generation FROM list WHERE id = ?",
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id },
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->out_generation }
+);
+
+DEFAULT_STMT(RRImportListCon, netblockv4_list_delete,
   "DELETE FROM netblock_v4_list WHERE list_id = ?",
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id }
 );
 
-DEFAULT_STMT(RRImport, netblockv6_list_delete,
+DEFAULT_STMT(RRImportListCon, netblockv6_list_delete,
   "DELETE FROM netblock_v6_list WHERE list_id = ?",
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id }
 );
 
-DEFAULT_STMT(RRImport, netblockv4_list_union_delete,
+DEFAULT_STMT(RRImportListCon, netblockv4_list_union_delete,
   "DELETE FROM netblock_v4_list_union WHERE list_id = ?",
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id }
 );
 
-DEFAULT_STMT(RRImport, netblockv6_list_union_delete,
+DEFAULT_STMT(RRImportListCon, netblockv6_list_union_delete,
   "DELETE FROM netblock_v6_list_union WHERE list_id = ?",
   &(RRDBParam){ .type = RRDB_TYPE_UINT, .bind = &this->in_list_id }
 );
 
-DEFAULT_STMT(RRImport, netblockv4_list_union_insert,
-  "INSERT INTO netblock_v4_list_union (list_id, ip, prefix_len) VALUES (?, ?, ?)",
-  &(RRDBParam){ .type = RRDB_TYPE_UINT , .bind = &this->in_list_id    },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT , .bind = &this->in_ip         },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT8, .bind = &this->in_prefix_len }
+DEFAULT_STMT(RRImportListCon, netblockv4_list_source,
+  "SELECT ip.id, ip.registrar_id, ip.start_ip, ip.end_ip, ip.prefix_len, "
+    "ip.netname, ip.descr, org.handle, org.name, org.descr "
+  "FROM netblock_v4 AS ip "
+  "LEFT JOIN org AS org ON org.id = ip.org_id",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UBIGINT  , .bind = &this->out_id             },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT     , .bind = &this->out_registrar_id   },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT     , .bind = &this->out_start_ip       },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT     , .bind = &this->out_end_ip         },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT8    , .bind = &this->out_prefix_len     },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_netname       , .size = sizeof(this->out_netname   ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_descr         , .size = sizeof(this->out_descr     ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_handle    , .size = sizeof(this->out_org_handle),
+    .is_null = &this->out_org_null },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_name      , .size = sizeof(this->out_org_name  ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_descr     , .size = sizeof(this->out_org_descr ),
+    .is_null = &this->out_org_descr_null }
 );
 
-DEFAULT_STMT(RRImport, netblockv6_list_union_insert,
-  "INSERT INTO netblock_v6_list_union (list_id, ip, prefix_len) VALUES (?, ?, ?)",
-  &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in_list_id    },
-  &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->in_ip, .size = sizeof(this->in_ip) },
-  &(RRDBParam){ .type = RRDB_TYPE_UINT8 , .bind = &this->in_prefix_len }
+DEFAULT_STMT(RRImportListCon, netblockv6_list_source,
+  "SELECT ip.id, ip.registrar_id, ip.start_ip, ip.end_ip, ip.prefix_len, "
+    "ip.netname, ip.descr, org.handle, org.name, org.descr "
+  "FROM netblock_v6 AS ip "
+  "LEFT JOIN org AS org ON org.id = ip.org_id",
+  RRDB_PARAM_OUT,
+  &(RRDBParam){ .type = RRDB_TYPE_UBIGINT  , .bind = &this->out_id             },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT     , .bind = &this->out_registrar_id   },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY   , .bind = &this->out_start_ip      , .size = sizeof(this->out_start_ip) },
+  &(RRDBParam){ .type = RRDB_TYPE_BINARY   , .bind = &this->out_end_ip        , .size = sizeof(this->out_end_ip  ) },
+  &(RRDBParam){ .type = RRDB_TYPE_UINT8    , .bind = &this->out_prefix_len     },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_netname       , .size = sizeof(this->out_netname   ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_descr         , .size = sizeof(this->out_descr     ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_handle    , .size = sizeof(this->out_org_handle),
+    .is_null = &this->out_org_null },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_name      , .size = sizeof(this->out_org_name  ) },
+  &(RRDBParam){ .type = RRDB_TYPE_STRING   , .bind = &this->out_org_descr     , .size = sizeof(this->out_org_descr ),
+    .is_null = &this->out_org_descr_null }
 );
 #pragma endregion
 
@@ -376,29 +717,116 @@ static bool rr_import_registrar_update_serial(unsigned in_registrar_id, unsigned
   return rr_db_stmt_execute(s_import.registrar_update_serial.stmt, NULL);
 }
 
+static bool rr_import_registrar_set_serial(unsigned in_registrar_id, unsigned in_serial)
+{
+  s_import.registrar_set_serial.in_registrar_id = in_registrar_id;
+  s_import.registrar_set_serial.in_serial       = in_serial;
+  return rr_db_stmt_execute(s_import.registrar_set_serial.stmt, NULL);
+}
+
+static bool rr_import_netblockv4_link_handle(unsigned in_org_id, unsigned in_registrar_id, RRStrView in_handle)
+{
+  s_import.netblockv4_link_handle.in_org_id       = in_org_id;
+  s_import.netblockv4_link_handle.in_org_id_null  = in_org_id == 0;
+  s_import.netblockv4_link_handle.in_registrar_id = in_registrar_id;
+  s_import.netblockv4_link_handle.in_handle       = in_handle;
+  return rr_db_stmt_execute(s_import.netblockv4_link_handle.stmt, NULL);
+}
+
+static bool rr_import_netblockv6_link_handle(unsigned in_org_id, unsigned in_registrar_id, RRStrView in_handle)
+{
+  s_import.netblockv6_link_handle.in_org_id       = in_org_id;
+  s_import.netblockv6_link_handle.in_org_id_null  = in_org_id == 0;
+  s_import.netblockv6_link_handle.in_registrar_id = in_registrar_id;
+  s_import.netblockv6_link_handle.in_handle       = in_handle;
+  return rr_db_stmt_execute(s_import.netblockv6_link_handle.stmt, NULL);
+}
+
+/*
+  Record the id of an org for the netblock inserts that follow. During an
+  incremental update netblocks may already reference the handle, these are
+  linked here as there is no finalize step to do it.
+*/
+static bool rr_import_org_map(RRDBOrg *in_org, unsigned org_id)
+{
+  if (!s_import.orgIds)
+    return true;
+
+  uintptr_t old = 0;
+  rr_hashmap_get(s_import.orgIds, in_org->handle.str, in_org->handle.len, &old);
+  if (old == org_id)
+    return true;
+
+  if (!rr_hashmap_put(s_import.orgIds, in_org->handle.str, in_org->handle.len, org_id))
+    return false;
+
+  if (!s_import.incremental)
+    return true;
+
+  return
+    rr_import_netblockv4_link_handle(org_id, in_org->registrar_id, in_org->handle) &&
+    rr_import_netblockv6_link_handle(org_id, in_org->registrar_id, in_org->handle);
+}
+
+static void rr_import_org_resolve(RRStrView handle, unsigned *org_id, char *is_null)
+{
+  uintptr_t id = 0;
+  if (s_import.orgIds && handle.len > 0 &&
+      !rr_hashmap_get(s_import.orgIds, handle.str, handle.len, &id))
+    ++s_import.orgMisses;
+
+  *org_id  = id;
+  *is_null = id == 0;
+}
+
+static bool rr_import_org_select_ids(unsigned in_registrar_id)
+{
+  s_import.org_select_ids.in_registrar_id = in_registrar_id;
+  if (!rr_db_stmt_query(s_import.org_select_ids.stmt))
+    return false;
+
+  int rc;
+  while((rc = rr_db_stmt_fetch(s_import.org_select_ids.stmt)) == 1)
+  {
+    const char *handle = s_import.org_select_ids.out_handle;
+    if (!rr_hashmap_put(s_import.orgIds, handle, strlen(handle),
+      s_import.org_select_ids.out_id))
+    {
+      rc = -1;
+      break;
+    }
+  }
+
+  rr_db_stmt_close(s_import.org_select_ids.stmt);
+  return rc == 0;
+}
+
 bool rr_import_org_insert(RRDBOrg *in_org)
 {
   unsigned long long ra;
-  memcpy(&s_import.org_insert.in, in_org, sizeof(*in_org));
+  s_import.org_insert.in = *in_org;
   if (rr_db_stmt_execute(s_import.org_insert.stmt, &ra))
   {
     if (ra == 1)
       ++s_import.stats.newOrgs;
-    return true;
+
+    // the upsert sets LAST_INSERT_ID to the existing id on update
+    return rr_import_org_map(in_org,
+      rr_db_stmt_insert_id(s_import.org_insert.stmt));
   }
 
   LOG_ERROR(
     "rr_import_org_insert failed:\n"
     "  registrar_id: %u\n"
     "  serial      : %u\n"
-    "  handle      : %s\n"
-    "  name        : %s\n"
-    "  descr       : %s\n",
+    "  handle      : %.*s\n"
+    "  name        : %.*s\n"
+    "  descr       : %.*s\n",
     in_org->registrar_id,
     in_org->serial,
-    in_org->handle,
-    in_org->name,
-    in_org->descr
+    RR_STRVIEW_FMT(in_org->handle),
+    RR_STRVIEW_FMT(in_org->name  ),
+    RR_STRVIEW_FMT(in_org->descr )
   );
 
   return false;
@@ -411,10 +839,37 @@ static bool rr_import_org_delete_old(unsigned in_registrar_id, unsigned in_seria
   return rr_db_stmt_execute(s_import.org_delete_old.stmt, &s_import.stats.deletedOrgs);
 }
 
+bool rr_import_org_delete(RRDBOrg *in_org)
+{
+  unsigned long long ra;
+  s_import.org_delete.in_registrar_id = in_org->registrar_id;
+  s_import.org_delete.in_handle       = in_org->handle;
+
+  // unlink first so the netblocks are not removed by the cascade
+  if (!rr_import_org_map(in_org, 0) ||
+      !rr_db_stmt_execute(s_import.org_delete.stmt, &ra))
+  {
+    LOG_ERROR(
+      "rr_import_org_delete failed:\n"
+      "  registrar_id: %u\n"
+      "  handle      : %.*s\n",
+      in_org->registrar_id,
+      RR_STRVIEW_FMT(in_org->handle));
+    return false;
+  }
+
+  s_import.stats.deletedOrgs += ra;
+  return true;
+}
+
 bool rr_import_netblockv4_insert(RRDBNetBlock *in_netblock)
 {
   unsigned long long ra;
-  memcpy(&s_import.netblockv4_insert.in, in_netblock, sizeof(*in_netblock));
+  s_import.netblockv4_insert.in = *in_netblock;
+  rr_import_org_resolve(in_netblock->org_handle,
+    &s_import.netblockv4_insert.in_org_id,
+    &s_import.netblockv4_insert.in_org_id_null);
+
   if (rr_db_stmt_execute(s_import.netblockv4_insert.stmt, &ra))
   {
     if (ra == 1)
@@ -436,17 +891,17 @@ bool rr_import_netblockv4_insert(RRDBNetBlock *in_netblock)
     "  startAddr   : %s\n"
     "  endAddr     : %s\n"
     "  prefix_len  : %u\n"
-    "  netname     : %s\n"
-    "  org_handle  : %s\n"
-    "  descr       : %s\n",
+    "  netname     : %.*s\n"
+    "  org_handle  : %.*s\n"
+    "  descr       : %.*s\n",
     in_netblock->registrar_id,
     in_netblock->serial,
     sAddr,
     eAddr,
     in_netblock->prefixLen,
-    in_netblock->netname,
-    in_netblock->org_handle,
-    in_netblock->descr);
+    RR_STRVIEW_FMT(in_netblock->netname   ),
+    RR_STRVIEW_FMT(in_netblock->org_handle),
+    RR_STRVIEW_FMT(in_netblock->descr     ));
 
   return false;
 }
@@ -458,15 +913,33 @@ static bool rr_import_netblockv4_delete_old(unsigned in_registrar_id, unsigned i
   return rr_db_stmt_execute(s_import.netblockv4_delete_old.stmt, &s_import.stats.deletedIPv4);
 }
 
-static bool rr_import_netblockv4_link_org(void)
+bool rr_import_netblockv4_delete(RRDBNetBlock *in_netblock)
+{
+  unsigned long long ra;
+  s_import.netblockv4_delete.in_registrar_id = in_netblock->registrar_id;
+  s_import.netblockv4_delete.in_start_ip     = in_netblock->startAddr.v4;
+  s_import.netblockv4_delete.in_end_ip       = in_netblock->endAddr  .v4;
+  if (!rr_db_stmt_execute(s_import.netblockv4_delete.stmt, &ra))
+    return false;
+
+  s_import.stats.deletedIPv4 += ra;
+  return true;
+}
+
+static bool rr_import_netblockv4_link_org(unsigned in_registrar_id)
 {
+  s_import.netblockv4_link_org.in_registrar_id = in_registrar_id;
   return rr_db_stmt_execute(s_import.netblockv4_link_org.stmt, NULL);
 }
 
 bool rr_import_netblockv6_insert(RRDBNetBlock *in_netblock)
 {
   unsigned long long ra;
-  memcpy(&s_import.netblockv6_insert.in, in_netblock, sizeof(*in_netblock));
+  s_import.netblockv6_insert.in = *in_netblock;
+  rr_import_org_resolve(in_netblock->org_handle,
+    &s_import.netblockv6_insert.in_org_id,
+    &s_import.netblockv6_insert.in_org_id_null);
+
   if (rr_db_stmt_execute(s_import.netblockv6_insert.stmt, &ra))
   {
     if (ra == 1)
@@ -486,17 +959,17 @@ bool rr_import_netblockv6_insert(RRDBNetBlock *in_netblock)
     "  startAddr   : %s\n"
     "  endAddr     : %s\n"
     "  prefix_len  : %u\n"
-    "  netname     : %s\n"
-    "  org_handle  : %s\n"
-    "  descr       : %s\n",
+    "  netname     : %.*s\n"
+    "  org_handle  : %.*s\n"
+    "  descr       : %.*s\n",
     in_netblock->registrar_id,
     in_netblock->serial,
     sAddr,
     eAddr,
     in_netblock->prefixLen,
-    in_netblock->netname,
-    in_netblock->org_handle,
-    in_netblock->descr);
+    RR_STRVIEW_FMT(in_netblock->netname   ),
+    RR_STRVIEW_FMT(in_netblock->org_handle),
+    RR_STRVIEW_FMT(in_netblock->descr     ));
 
   return false;
 }
@@ -508,187 +981,184 @@ static bool rr_import_netblockv6_delete_old(unsigned in_registrar_id, unsigned i
   return rr_db_stmt_execute(s_import.netblockv6_delete_old.stmt, &s_import.stats.deletedIPv6);
 }
 
-static bool rr_import_netblockv6_link_org(void)
+bool rr_import_netblockv6_delete(RRDBNetBlock *in_netblock)
 {
-  return rr_db_stmt_execute(s_import.netblockv6_link_org.stmt, NULL);
+  unsigned long long ra;
+  s_import.netblockv6_delete.in_registrar_id = in_netblock->registrar_id;
+  s_import.netblockv6_delete.in_start_ip     = in_netblock->startAddr.v6;
+  s_import.netblockv6_delete.in_end_ip       = in_netblock->endAddr  .v6;
+  if (!rr_db_stmt_execute(s_import.netblockv6_delete.stmt, &ra))
+    return false;
+
+  s_import.stats.deletedIPv6 += ra;
+  return true;
 }
 
-static bool rr_import_netblockv4_union_truncate(void)
+static bool rr_import_netblockv6_link_org(unsigned in_registrar_id)
 {
-  return rr_db_stmt_execute(s_import.netblockv4_union_truncate.stmt, NULL);
+  s_import.netblockv6_link_org.in_registrar_id = in_registrar_id;
+  return rr_db_stmt_execute(s_import.netblockv6_link_org.stmt, NULL);
 }
 
-static bool rr_import_netblockv6_union_truncate(void)
+static bool rr_import_list_insert(RRImportListCon *lc, const char *in_list_name)
 {
-  return rr_db_stmt_execute(s_import.netblockv6_union_truncate.stmt, NULL);
+  strcpy(lc->list_insert.in_list_name, in_list_name);
+  return rr_db_stmt_execute(lc->list_insert.stmt, NULL);
 }
 
-static bool rr_import_netblockv4_union_populate(void)
+static bool rr_import_list_generation_bump(RRImportListCon *lc, unsigned in_list_id,
+  unsigned *out_generation)
 {
-  return rr_db_stmt_execute(s_import.netblockv4_union_populate.stmt, NULL);
+  lc->list_generation_bump.in_list_id = in_list_id;
+  lc->list_generation     .in_list_id = in_list_id;
+  if (!rr_db_stmt_execute(lc->list_generation_bump.stmt, NULL) ||
+      rr_db_stmt_fetch_one(lc->list_generation.stmt) != 1)
+    return false;
+
+  *out_generation = lc->list_generation.out_generation;
+  return true;
 }
 
-static bool rr_import_netblockv6_union_populate(void)
+static bool rr_import_netblockv4_list_delete(RRImportListCon *lc, unsigned in_list_id)
 {
-  return rr_db_stmt_execute(s_import.netblockv6_union_populate.stmt, NULL);
+  lc->netblockv4_list_delete.in_list_id = in_list_id;
+  return rr_db_stmt_execute(lc->netblockv4_list_delete.stmt, NULL);
 }
 
-static bool rr_import_list_insert(const char *in_list_name)
+static bool rr_import_netblockv6_list_delete(RRImportListCon *lc, unsigned in_list_id)
 {
-  strcpy(s_import.list_insert.in_list_name, in_list_name);
-  return rr_db_stmt_execute(s_import.list_insert.stmt, NULL);
+  lc->netblockv6_list_delete.in_list_id = in_list_id;
+  return rr_db_stmt_execute(lc->netblockv6_list_delete.stmt, NULL);
 }
 
-static bool rr_import_netblockv4_list_delete(unsigned in_list_id)
+static bool rr_import_netblockv4_list_union_delete(RRImportListCon *lc, unsigned in_list_id)
 {
-  s_import.netblockv4_list_delete.in_list_id = in_list_id;
-  return rr_db_stmt_execute(s_import.netblockv4_list_delete.stmt, NULL);
+  lc->netblockv4_list_union_delete.in_list_id = in_list_id;
+  return rr_db_stmt_execute(lc->netblockv4_list_union_delete.stmt, NULL);
 }
 
-static bool rr_import_netblockv6_list_delete(unsigned in_list_id)
+static bool rr_import_netblockv6_list_union_delete(RRImportListCon *lc, unsigned in_list_id)
 {
-  s_import.netblockv6_list_delete.in_list_id = in_list_id;
-  return rr_db_stmt_execute(s_import.netblockv6_list_delete.stmt, NULL);
+  lc->netblockv6_list_union_delete.in_list_id = in_list_id;
+  return rr_db_stmt_execute(lc->netblockv6_list_union_delete.stmt, NULL);
 }
 
-static bool rr_import_netblockv4_list_union_delete(unsigned in_list_id)
+static bool rr_import_netblockv4_list_union_insert(RRImportListCon *lc, unsigned in_list_id, uint32_t in_ip, uint8_t in_prefix_len)
 {
-  s_import.netblockv4_list_union_delete.in_list_id = in_list_id;
-  return rr_db_stmt_execute(s_import.netblockv4_list_union_delete.stmt, NULL);
+  ++lc->emitted;
+  return rr_db_bulk_add(lc->netblockv4_list_union_insert,
+    (const void *[]){ &in_list_id, &in_ip, &in_prefix_len });
 }
 
-static bool rr_import_netblockv6_list_union_delete(unsigned in_list_id)
+static bool rr_import_netblockv6_list_union_insert(RRImportListCon *lc, unsigned in_list_id, unsigned __int128 in_ip, uint8_t in_prefix_len)
 {
-  s_import.netblockv6_list_union_delete.in_list_id = in_list_id;
-  return rr_db_stmt_execute(s_import.netblockv6_list_union_delete.stmt, NULL);
+  ++lc->emitted;
+  return rr_db_bulk_add(lc->netblockv6_list_union_insert,
+    (const void *[]){ &in_list_id, &in_ip, &in_prefix_len });
 }
 
-static bool rr_import_netblockv4_list_union_insert(unsigned in_list_id, unsigned in_ip, uint8_t in_prefix_len)
+#pragma endregion
+
+static int rr_import_source_index(const char *name)
 {
-  s_import.netblockv4_list_union_insert.in_list_id    = in_list_id;
-  s_import.netblockv4_list_union_insert.in_ip         = in_ip;
-  s_import.netblockv4_list_union_insert.in_prefix_len = in_prefix_len;
-  return rr_db_stmt_execute(s_import.netblockv4_list_union_insert.stmt, NULL);
+  for(unsigned i = 0; i < g_config.nbSources; ++i)
+    if (g_config.sources[i].name && strcmp(g_config.sources[i].name, name) == 0)
+      return i;
+  return -1;
 }
 
-static bool rr_import_netblockv6_list_union_insert(unsigned in_list_id, unsigned __int128 in_ip, uint8_t in_prefix_len)
+static ConfigList *rr_import_list_by_name(const char *name)
 {
-  s_import.netblockv6_list_union_insert.in_list_id    = in_list_id;
-  s_import.netblockv6_list_union_insert.in_ip         = in_ip;
-  s_import.netblockv6_list_union_insert.in_prefix_len = in_prefix_len;
-  return rr_db_stmt_execute(s_import.netblockv6_list_union_insert.stmt, NULL);
+  for(ConfigList *l = g_config.lists; l->name; ++l)
+    if (strcmp(l->name, name) == 0)
+      return l;
+  return NULL;
 }
 
-#pragma endregion
+/*
+  Mark the sources the list content is built from, this mirrors
+  rr_import_list_terms. Excluded lists are followed too as their
+  content is subtracted from the list.
+*/
+static void rr_import_list_deps(ConfigList *cl, bool *deps)
+{
+  // prevent infinite recursion
+  if (cl->include_seen)
+    return;
+  cl->include_seen = true;
 
-static bool db_build_list_query_where(ConfigList *cl, RRBuffer *qb)
-{
-  #define APPEND_OR_FAIL(qb, str) \
-    do { \
-      if (!rr_buffer_append_str(qb, str)) \
-      { \
-        LOG_ERROR("out of memory"); \
-        return false; \
-      } \
-    } while (0)
-
-  #define ADD_CONDITION(x, y, z) \
-    if (cl->x ##_ ##y.z) \
-      for(const char **str = cl->x ##_ ##y.z; *str; ++str, ++conditions) \
-        if (!rr_buffer_appendf(qb, "%s" #x "." #y " LIKE '%s'", \
-          conditions > 0 ? " OR " : "", \
-          *str)) \
-        { \
-          LOG_ERROR("out of memory"); \
-          return false; \
-        }\
-
-  bool started = false;
+  int index;
   if (cl->registrar)
   {
-    started = true;
-    if (!rr_buffer_appendf(qb,
-      "(ip.registrar_id = (SELECT id FROM registrar WHERE name = '%s'))",
-      cl->registrar))
-    {
-      LOG_ERROR("out of memory");
-      return false;
-    }
+    if ((index = rr_import_source_index(cl->registrar)) >= 0)
+      deps[index] = true;
   }
-
-  if (cl->has_matches)
+  else if (cl->has_matches)
   {
-    if (started)
-      APPEND_OR_FAIL(qb, " AND (");
-    else
-      APPEND_OR_FAIL(qb, "(");
-
-    started = true;
-    int conditions = 0;
-    APPEND_OR_FAIL(qb, "(");
-    #define X(x, y) ADD_CONDITION(x, y, match)
-    CONFIG_LIST_FIELDS
-    #undef X
-    APPEND_OR_FAIL(qb, ")");
-
-    if (cl->has_ignores)
-    {
-      APPEND_OR_FAIL(qb, " AND NOT (");
-
-      conditions = 0;
-      #define X(x, y) ADD_CONDITION(x, y, ignore)
-      CONFIG_LIST_FIELDS
-      #undef X
-      APPEND_OR_FAIL(qb, ")");
-    }
-
-    APPEND_OR_FAIL(qb, ")");
+    // matches without a registrar apply to every source
+    for(unsigned i = 0; i < g_config.nbSources; ++i)
+      deps[i] = true;
   }
 
   if (cl->sources)
-  {
     for(const char **source = cl->sources; *source; ++source)
-      for(typeof(g_config.sources) s = g_config.sources; s->name; ++s)
-      {
-        if (strcmp(s->name, *source) == 0)
-        {
-          if (started)
-            APPEND_OR_FAIL(qb, " OR ");
-          started = true;
-
-          rr_alloc_sprintf(qb,
-            "(ip.registrar_id = (SELECT id FROM registrar WHERE name = '%s'))",
-            s->name);
-          break;
-        }
-      }
-  }
+      if ((index = rr_import_source_index(*source)) >= 0)
+        deps[index] = true;
 
+  ConfigList *l;
   if (cl->include)
-  {
     for(const char **include = cl->include; *include; ++include)
-      for(ConfigList *l = g_config.lists; l->name; ++l)
-      {
-        if (strcmp(l->name, *include) == 0)
-        {
-          // prevent infinite recursion
-          if (l->include_seen)
-            break;
-          l->include_seen = true;
-
-          if (started)
-            APPEND_OR_FAIL(qb, " OR ");
-          if (!db_build_list_query_where(l, qb))
-            return false;
-          started = true;
-          break;
-        }
-      }
+      if ((l = rr_import_list_by_name(*include)))
+        rr_import_list_deps(l, deps);
+
+  if (cl->exclude)
+    for(const char **exclude = cl->exclude; *exclude; ++exclude)
+      if ((l = rr_import_list_by_name(*exclude)))
+        rr_import_list_deps(l, deps);
+}
+
+static int rr_import_list_prepared(const char *name)
+{
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    if (strcmp(s_import.lists[i].cl->name, name) == 0)
+      return i;
+  return -1;
+}
+
+/*
+  Depth first ordering so that the unions of excluded lists are rebuilt
+  before the lists that read them.
+*/
+static void rr_import_list_order(unsigned index, uint8_t *state, unsigned *nbOrder)
+{
+  if (state[index] == 2)
+    return;
+
+  ConfigList *cl = s_import.lists[index].cl;
+  if (state[index] == 1)
+  {
+    LOG_WARN("List exclude cycle at: %s", cl->name);
+    return;
   }
 
-  #undef ADD_CONDITION
-  #undef APPEND_OR_FAIL
-  return true;
+  state[index] = 1;
+  if (cl->exclude)
+    for(const char **exclude = cl->exclude; *exclude; ++exclude)
+    {
+      int dep = rr_import_list_prepared(*exclude);
+      if (dep >= 0)
+        rr_import_list_order(dep, state, nbOrder);
+    }
+
+  state[index] = 2;
+  s_import.listsOrder[(*nbOrder)++] = index;
+}
+
+static void rr_import_lists_mark_dirty(unsigned source)
+{
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    if (s_import.lists[i].deps[source])
+      s_import.lists[i].dirty = true;
 }
 
 static bool db_init_fn(RRDBCon *con, void **udata)
@@ -696,322 +1166,501 @@ static bool db_init_fn(RRDBCon *con, void **udata)
   *udata = &s_import;
   STMT_PREPARE(STATEMENTS, *udata);
 
-  if (!g_config.lists)
-    return true;
+  const RRDBParam v4Cols[] =
+  {
+    { .type = RRDB_TYPE_UINT },
+    { .type = RRDB_TYPE_UINT }
+  };
 
-  s_import.lists_prepare = calloc(g_config.nbListsActive + 1, sizeof(*s_import.lists_prepare));
-  if (!s_import.lists_prepare)
+  const RRDBParam v6Cols[] =
   {
-    LOG_ERROR("out of memory");
+    { .type = RRDB_TYPE_BINARY, .size = sizeof(unsigned __int128) },
+    { .type = RRDB_TYPE_BINARY, .size = sizeof(unsigned __int128) }
+  };
+
+  s_import.netblockv4_union_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v4_union (start_ip, end_ip) VALUES ", "(?,?)",
+    " ON DUPLICATE KEY UPDATE end_ip = VALUES(end_ip)",
+    UNION_BULK_ROWS, v4Cols, ARRAY_SIZE(v4Cols));
+
+  s_import.netblockv6_union_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v6_union (start_ip, end_ip) VALUES ", "(?,?)",
+    " ON DUPLICATE KEY UPDATE end_ip = VALUES(end_ip)",
+    UNION_BULK_ROWS, v6Cols, ARRAY_SIZE(v6Cols));
+
+  s_import.netblockv4_union_delete = rr_db_bulk_new(con,
+    "DELETE FROM netblock_v4_union WHERE start_ip IN (", "?", ")",
+    UNION_BULK_ROWS, v4Cols, 1);
+
+  s_import.netblockv6_union_delete = rr_db_bulk_new(con,
+    "DELETE FROM netblock_v6_union WHERE start_ip IN (", "?", ")",
+    UNION_BULK_ROWS, v6Cols, 1);
+
+  if (!s_import.netblockv4_union_insert || !s_import.netblockv6_union_insert ||
+      !s_import.netblockv4_union_delete || !s_import.netblockv6_union_delete)
+  {
+    LOG_ERROR("failed to prepare the union statements");
     return false;
   }
 
-  RRBuffer qb = { .bufferSz = 8192 };
+  return true;
+}
 
-  typeof(s_import.lists_prepare) list = s_import.lists_prepare;
-  for(ConfigList *cl = g_config.lists; cl->name; ++cl)
-  {
-    bool skip = false;
-    if (!cl->build_list)
-      continue;
+static bool db_deinit_fn(RRDBCon *con, void **udata)
+{
+  STMT_FREE(STATEMENTS, *udata);
+  rr_db_bulk_free(&s_import.netblockv4_union_insert);
+  rr_db_bulk_free(&s_import.netblockv6_union_insert);
+  rr_db_bulk_free(&s_import.netblockv4_union_delete);
+  rr_db_bulk_free(&s_import.netblockv6_union_delete);
 
-    list->cl = cl;
-    for(int n = 0; n < 2; ++n)
-    {
-      const char *ver = n == 0 ? "v4" : "v6";
-      rr_buffer_reset(&qb);
-      if (!rr_buffer_appendf(&qb,
-        "INSERT INTO netblock_%s_list "
-        "SELECT "
-          "list.id, "
-          "ip.id, "
-          "ip.start_ip, "
-          "ip.end_ip, "
-          "ip.prefix_len "
-        "FROM "
-          "netblock_%s          AS ip "
-          "RIGHT JOIN list      AS list      ON list.name    = ? "
-          "LEFT  JOIN org       AS org       ON org.id       = ip.org_id "
-        "WHERE ",
-        ver,
-        ver))
-      {
-        LOG_ERROR("out of memory");
-        rr_buffer_free(&qb);
-        return false;
-      }
-      size_t start = qb.pos;
+  *udata = NULL;
+  return true;
+}
 
-      // reset the seen state
-      for(ConfigList *l = g_config.lists; l->name; ++l)
-        l->include_seen = false;
+static bool list_db_init_fn(RRDBCon *con, void **udata)
+{
+  RRImportListCon *lc = calloc(1, sizeof(*lc));
+  if (!lc)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
 
-      // build the where part of the query
-      if (!db_build_list_query_where(cl, &qb))
-      {
-        LOG_ERROR("out of memory");
-        rr_buffer_free(&qb);
-        return false;
-      }
+  lc->con = con;
+  *udata  = lc;
+  STMT_PREPARE(LIST_STATEMENTS, lc);
 
-      // If there was no query built
-      if (start == qb.pos)
-      {
-        LOG_WARN("Skipping invalid list: %s", cl->name);
-        skip = true;
-        break;
-      }
+  const RRDBParam v4Cols[] =
+  {
+    { .type = RRDB_TYPE_UINT    },
+    { .type = RRDB_TYPE_UBIGINT },
+    { .type = RRDB_TYPE_UINT    },
+    { .type = RRDB_TYPE_UINT    },
+    { .type = RRDB_TYPE_UINT8   }
+  };
+
+  const RRDBParam v6Cols[] =
+  {
+    { .type = RRDB_TYPE_UINT    },
+    { .type = RRDB_TYPE_UBIGINT },
+    { .type = RRDB_TYPE_BINARY, .size = sizeof(unsigned __int128) },
+    { .type = RRDB_TYPE_BINARY, .size = sizeof(unsigned __int128) },
+    { .type = RRDB_TYPE_UINT8   }
+  };
+
+  lc->netblockv4_list_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v4_list "
+      "(list_id, netblock_v4_id, start_ip, end_ip, prefix_len) VALUES ",
+    "(?,?,?,?,?)", "", LIST_BULK_ROWS, v4Cols, ARRAY_SIZE(v4Cols));
+
+  lc->netblockv6_list_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v6_list "
+      "(list_id, netblock_v6_id, start_ip, end_ip, prefix_len) VALUES ",
+    "(?,?,?,?,?)", "", LIST_BULK_ROWS, v6Cols, ARRAY_SIZE(v6Cols));
+
+  const RRDBParam v4UnionCols[] =
+  {
+    { .type = RRDB_TYPE_UINT  },
+    { .type = RRDB_TYPE_UINT  },
+    { .type = RRDB_TYPE_UINT8 }
+  };
 
-      if (!rr_buffer_append_str(&qb, " ORDER BY ip.start_ip ASC"))
-      {
-        LOG_ERROR("out of memory");
-        rr_buffer_free(&qb);
-        return false;
-      }
+  const RRDBParam v6UnionCols[] =
+  {
+    { .type = RRDB_TYPE_UINT  },
+    { .type = RRDB_TYPE_BINARY, .size = sizeof(unsigned __int128) },
+    { .type = RRDB_TYPE_UINT8 }
+  };
 
-      strncpy(list->in_list_name, cl->name, sizeof(list->in_list_name));
-      list->stmt[n] = rr_db_stmt_prepare(con, qb.buffer,
-        &(RRDBParam){ .type = RRDB_TYPE_STRING, .bind = &list->in_list_name },
-        NULL
-      );
+  lc->netblockv4_list_union_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v4_list_union (list_id, ip, prefix_len) VALUES ",
+    "(?,?,?)", "", LIST_BULK_ROWS, v4UnionCols, ARRAY_SIZE(v4UnionCols));
 
-      if (!list->stmt[n])
-      {
-        LOG_ERROR("failed to prepare %s statement for list %s", ver, cl->name);
-        continue;
-      }
-    }
+  lc->netblockv6_list_union_insert = rr_db_bulk_new(con,
+    "INSERT INTO netblock_v6_list_union (list_id, ip, prefix_len) VALUES ",
+    "(?,?,?)", "", LIST_BULK_ROWS, v6UnionCols, ARRAY_SIZE(v6UnionCols));
 
-    if (skip)
-    {
-      rr_db_stmt_free(&list->stmt[0]);
-      continue;
-    }
-
-    ++list;
+  if (!lc->netblockv4_list_insert       || !lc->netblockv6_list_insert ||
+      !lc->netblockv4_list_union_insert || !lc->netblockv6_list_union_insert)
+  {
+    LOG_ERROR("failed to prepare the list member statements");
+    return false;
   }
 
-  #undef CONFIG_LIST_FIELDS
-  rr_buffer_free(&qb);
   return true;
 }
 
-static bool db_deinit_fn(RRDBCon *con, void **udata)
+static bool list_db_deinit_fn(RRDBCon *con, void **udata)
 {
-  STMT_FREE(STATEMENTS, *udata);
+  RRImportListCon *lc = *udata;
+  if (!lc)
+    return true;
 
-  for(typeof(s_import.lists_prepare) list = s_import.lists_prepare; list; ++list)
-  {
-    for(int n = 0; n < ARRAY_SIZE(list->stmt); ++n)
-      rr_db_stmt_free(&list->stmt[n]);
-  }
-  free(s_import.lists_prepare);
-  s_import.lists_prepare = NULL;
+  STMT_FREE(LIST_STATEMENTS, lc);
+  rr_db_bulk_free(&lc->netblockv4_list_insert);
+  rr_db_bulk_free(&lc->netblockv6_list_insert);
+  rr_db_bulk_free(&lc->netblockv4_list_union_insert);
+  rr_db_bulk_free(&lc->netblockv6_list_union_insert);
 
+  free(lc);
   *udata = NULL;
   return true;
 }
 
-bool rr_import_init(void)
+static bool rr_import_list_add_term(typeof(*s_import.lists) *list,
+  const char *registrar, int set)
 {
-  if (!rr_download_init(&s_import.dl))
+  RRListTerm *terms = realloc(list->terms,
+    (list->nbTerms + 1) * sizeof(*terms));
+  if (!terms)
   {
-    LOG_ERROR("rr_download_init failed");
+    LOG_ERROR("out of memory");
     return false;
   }
 
-  // reserve a connection for imports only
-  if (!rr_db_reserve(&s_import.con, db_init_fn, db_deinit_fn))
+  terms[list->nbTerms++] = (RRListTerm)
   {
-    LOG_ERROR("rr_db_reserve failed");
-    return false;
-  }
+    .registrar = registrar,
+    .set       = set
+  };
+  list->terms = terms;
 
+  if (set >= 0)
+    s_import.filterSets[set].used = true;
   return true;
 }
 
-void rr_import_deinit(void)
+/*
+  Collect the terms of the list and of the lists it includes. A list with
+  filters is a term of its registrar, or of every registrar if it has none,
+  and each source is a term of its own.
+*/
+static bool rr_import_list_terms(ConfigList *cl, typeof(*s_import.lists) *list)
 {
-  rr_db_release(&s_import.con);
-  rr_download_deinit(&s_import.dl);
+  // prevent infinite recursion
+  if (cl->include_seen)
+    return true;
+  cl->include_seen = true;
+
+  if (cl->registrar || cl->has_matches)
+    if (!rr_import_list_add_term(list, cl->registrar,
+      cl->has_matches ? (int)(cl - g_config.lists) : -1))
+      return false;
+
+  if (cl->sources)
+    for(const char **source = cl->sources; *source; ++source)
+      if (rr_import_source_index(*source) >= 0 &&
+        !rr_import_list_add_term(list, *source, -1))
+        return false;
+
+  ConfigList *l;
+  if (cl->include)
+    for(const char **include = cl->include; *include; ++include)
+      if ((l = rr_import_list_by_name(*include)) &&
+        !rr_import_list_terms(l, list))
+        return false;
+
+  return true;
 }
 
-static bool rr_emit_ipv4_range_as_cidrs(unsigned list_id, uint32_t start, uint32_t end)
+static bool rr_import_list_filter_add(unsigned field, unsigned set,
+  const char **patterns, bool ignore)
 {
-  uint64_t cur = (uint64_t)start;
-  uint64_t last = (uint64_t)end;
+  if (!patterns)
+    return true;
 
-  while (cur <= last)
+  typeof(*s_import.filters) *f = &s_import.filters[field];
+  for(; *patterns; ++patterns)
   {
-    uint64_t max_size = rr_lowbit_u32((uint32_t)cur);          // alignment-limited
-    uint64_t remain   = last - cur + 1ULL;                     // range-limited
-
-    while (max_size > remain)
-      max_size >>= 1;
+    int index = rr_filter_add(f->filter, *patterns);
+    if (index < 0)
+      return false;
 
-    uint8_t prefix_len = (uint8_t)(32u - (uint8_t)__builtin_ctzll(max_size));
-    if (!rr_import_netblockv4_list_union_insert(list_id, cur, prefix_len))
+    typeof(f->owners) owners = realloc(f->owners,
+      (index + 1) * sizeof(*owners));
+    if (!owners)
+    {
+      LOG_ERROR("out of memory");
       return false;
+    }
 
-    cur += max_size;
+    owners[index].set    = set;
+    owners[index].ignore = ignore;
+    f->owners = owners;
   }
 
+  if (ignore)
+    s_import.filterSets[set].ignoreFields |= 1U << field;
   return true;
 }
 
-typedef struct RRExcludeRangeV4
-{
-  uint32_t start;
-  uint32_t end;
-}
-RRExcludeRangeV4;
-
-typedef struct RRExcludeRangeV6
+/*
+  Compile the patterns of every filter set that is used by a list into a
+  filter per field, so each netblock is matched against all of them at once.
+*/
+static bool rr_import_list_filters_init(void)
 {
-  unsigned __int128 start;
-  unsigned __int128 end;
-}
-RRExcludeRangeV6;
+  for(unsigned f = 0; f < LIST_FIELD_MAX; ++f)
+    if (!rr_filter_init(&s_import.filters[f].filter))
+      return false;
 
-static int rr_exclude_range_v4_cmp(const void *a, const void *b)
-{
-  const RRExcludeRangeV4 *left = a;
-  const RRExcludeRangeV4 *right = b;
-  if (left->start < right->start)
-    return -1;
-  if (left->start > right->start)
-    return 1;
-  if (left->end < right->end)
-    return -1;
-  if (left->end > right->end)
-    return 1;
-  return 0;
-}
+  for(unsigned set = 0; set < g_config.nbLists; ++set)
+  {
+    if (!s_import.filterSets[set].used)
+      continue;
 
-static int rr_exclude_range_v6_cmp(const void *a, const void *b)
-{
-  const RRExcludeRangeV6 *left = a;
-  const RRExcludeRangeV6 *right = b;
-  if (left->start < right->start)
-    return -1;
-  if (left->start > right->start)
-    return 1;
-  if (left->end < right->end)
-    return -1;
-  if (left->end > right->end)
-    return 1;
-  return 0;
-}
+    ConfigList *cl = &g_config.lists[set];
+    #define X(x, y) \
+      if (!rr_import_list_filter_add(LIST_FIELD_ ##x ##_ ##y, set, \
+            cl->x ##_ ##y.match , false) || \
+          !rr_import_list_filter_add(LIST_FIELD_ ##x ##_ ##y, set, \
+            cl->x ##_ ##y.ignore, true )) \
+        return false;
+    CONFIG_LIST_FIELDS
+    #undef X
+  }
 
-static bool rr_append_exclude_v4_range(RRExcludeRangeV4 **ranges, size_t *count, size_t *capacity,
-  uint32_t start, uint32_t end)
-{
-  if (*count >= *capacity)
+  for(unsigned f = 0; f < LIST_FIELD_MAX; ++f)
   {
-    size_t next_capacity = (*capacity == 0) ? 64 : (*capacity * 2);
-    RRExcludeRangeV4 *next = realloc(*ranges, next_capacity * sizeof(*next));
-    if (!next)
+    if (!rr_filter_compile(s_import.filters[f].filter))
+      return false;
+
+    s_import.filters[f].matches = malloc(
+      (rr_filter_count(s_import.filters[f].filter) + 1) *
+      sizeof(*s_import.filters[f].matches));
+    if (!s_import.filters[f].matches)
     {
       LOG_ERROR("out of memory");
       return false;
     }
-    *ranges = next;
-    *capacity = next_capacity;
   }
 
-  (*ranges)[*count] = (RRExcludeRangeV4){ .start = start, .end = end };
-  ++(*count);
   return true;
 }
 
-static bool rr_append_exclude_v6_range(RRExcludeRangeV6 **ranges, size_t *count, size_t *capacity,
-  unsigned __int128 start, unsigned __int128 end)
+static void rr_import_list_free_members(unsigned index)
 {
-  if (*count >= *capacity)
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  free(list->v4);
+  free(list->v6);
+  list->v4   = NULL;
+  list->v6   = NULL;
+  list->nbV4 = list->szV4 = 0;
+  list->nbV6 = list->szV6 = 0;
+}
+
+/*
+  Work out the terms of each list that is built, the sources it depends on
+  and the order the lists must be built in, and compile the list filters.
+  None of this depends on the connection.
+*/
+static bool rr_import_lists_init(void)
+{
+  if (!g_config.lists)
+    return true;
+
+  s_import.lists      = calloc(g_config.nbListsActive + 1, sizeof(*s_import.lists));
+  s_import.filterSets = calloc(g_config.nbLists       + 1, sizeof(*s_import.filterSets));
+  if (!s_import.lists || !s_import.filterSets)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  typeof(s_import.lists) list = s_import.lists;
+  for(ConfigList *cl = g_config.lists; cl->name; ++cl)
   {
-    size_t next_capacity = (*capacity == 0) ? 64 : (*capacity * 2);
-    RRExcludeRangeV6 *next = realloc(*ranges, next_capacity * sizeof(*next));
-    if (!next)
+    if (!cl->build_list)
+      continue;
+
+    // reset the seen state
+    for(ConfigList *l = g_config.lists; l->name; ++l)
+      l->include_seen = false;
+
+    list->cl = cl;
+    if (!rr_import_list_terms(cl, list))
+      return false;
+
+    if (list->nbTerms == 0)
+    {
+      LOG_WARN("Skipping invalid list: %s", cl->name);
+      list->cl = NULL;
+      continue;
+    }
+
+    list->deps = calloc(g_config.nbSources, sizeof(*list->deps));
+    if (!list->deps)
     {
       LOG_ERROR("out of memory");
       return false;
     }
-    *ranges = next;
-    *capacity = next_capacity;
+
+    // reset the seen state
+    for(ConfigList *l = g_config.lists; l->name; ++l)
+      l->include_seen = false;
+
+    rr_import_list_deps(cl, list->deps);
+
+    // the content is unknown until it has been built once
+    list->dirty = true;
+    ++list;
+    ++s_import.nbLists;
+  }
+
+  if (!rr_import_list_filters_init())
+    return false;
+
+  s_import.listsOrder = calloc(s_import.nbLists + 1, sizeof(*s_import.listsOrder));
+  uint8_t *state = calloc(s_import.nbLists + 1, sizeof(*state));
+  if (!s_import.listsOrder || !state)
+  {
+    LOG_ERROR("out of memory");
+    free(state);
+    return false;
   }
 
-  (*ranges)[*count] = (RRExcludeRangeV6){ .start = start, .end = end };
-  ++(*count);
+  unsigned nbOrder = 0;
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    rr_import_list_order(i, state, &nbOrder);
+
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    s_import.lists[s_import.listsOrder[i]].orderPos = i;
+
+  free(state);
   return true;
 }
 
-static size_t rr_merge_exclude_v4_ranges(RRExcludeRangeV4 *ranges, size_t count)
+static void rr_import_lists_deinit(void)
 {
-  if (count == 0)
-    return 0;
-
-  size_t out = 0;
-  for (size_t i = 0; i < count; ++i)
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
   {
-    if (out == 0)
-    {
-      ranges[out++] = ranges[i];
-      continue;
-    }
-
-    RRExcludeRangeV4 *cur = &ranges[out - 1];
-    if ((uint64_t)ranges[i].start <= (uint64_t)cur->end + 1ULL)
-    {
-      if (ranges[i].end > cur->end)
-        cur->end = ranges[i].end;
-      continue;
-    }
+    rr_import_list_free_members(i);
+    free(s_import.lists[i].terms);
+    free(s_import.lists[i].deps);
+  }
 
-    ranges[out++] = ranges[i];
+  for(unsigned f = 0; f < LIST_FIELD_MAX; ++f)
+  {
+    rr_filter_deinit(&s_import.filters[f].filter);
+    free(s_import.filters[f].owners);
+    free(s_import.filters[f].matches);
+    s_import.filters[f].owners  = NULL;
+    s_import.filters[f].matches = NULL;
   }
 
-  return out;
+  free(s_import.lists);
+  free(s_import.listsOrder);
+  free(s_import.filterSets);
+  s_import.lists      = NULL;
+  s_import.listsOrder = NULL;
+  s_import.filterSets = NULL;
+  s_import.nbLists    = 0;
 }
 
-static size_t rr_merge_exclude_v6_ranges(RRExcludeRangeV6 *ranges, size_t count)
+bool rr_import_init(void)
 {
-  if (count == 0)
-    return 0;
+  s_import.nrtm = calloc(g_config.nbSources + 1, sizeof(*s_import.nrtm));
+  if (!s_import.nrtm)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
 
-  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
-  size_t out = 0;
-  for (size_t i = 0; i < count; ++i)
+  if (!rr_download_init(&s_import.dl))
   {
-    if (out == 0)
-    {
-      ranges[out++] = ranges[i];
-      continue;
-    }
+    LOG_ERROR("rr_download_init failed");
+    return false;
+  }
 
-    RRExcludeRangeV6 *cur = &ranges[out - 1];
-    bool overlaps = (ranges[i].start <= cur->end);
-    bool adjacent = (cur->end != U128_MAX) && (ranges[i].start == cur->end + 1);
-    if (overlaps || adjacent)
-    {
-      if (ranges[i].end > cur->end)
-        cur->end = ranges[i].end;
-      continue;
-    }
+  if (!rr_import_lists_init())
+    return false;
+
+  // reserve a connection for imports only
+  if (!rr_db_reserve(&s_import.con, db_init_fn, db_deinit_fn))
+  {
+    LOG_ERROR("rr_db_reserve failed");
+    return false;
+  }
 
-    ranges[out++] = ranges[i];
+  // and one for each list worker, there is no point in more than the lists
+  unsigned workers = g_config.import.list_workers > 0 ?
+    g_config.import.list_workers : 1;
+  if (workers > s_import.nbLists)
+    workers = s_import.nbLists;
+
+  /*
+    the workers must not take the connections the HTTP workers need, leave
+    one per HTTP worker in addition to the one reserved above
+  */
+  int spare = g_config.database.pool - 1 - g_config.http.workers;
+  if (spare < 1)
+    spare = 1;
+
+  if (workers > (unsigned)spare)
+  {
+    LOG_WARN("import.list_workers limited to %d by database.pool %d and "
+      "http.workers %d", spare, g_config.database.pool, g_config.http.workers);
+    workers = spare;
   }
 
-  return out;
+  pthread_mutex_init(&s_import.listsLock, NULL);
+  pthread_cond_init (&s_import.listsCond, NULL);
+
+  s_import.listCons = calloc(workers + 1, sizeof(*s_import.listCons));
+  if (!s_import.listCons)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  for(; s_import.nbListCons < workers; ++s_import.nbListCons)
+    if (!rr_db_reserve(&s_import.listCons[s_import.nbListCons],
+      list_db_init_fn, list_db_deinit_fn))
+      break;
+
+  if (s_import.nbLists > 0 && s_import.nbListCons == 0)
+  {
+    LOG_ERROR("failed to reserve a connection for the list workers");
+    return false;
+  }
+
+  if (s_import.nbListCons < workers)
+    LOG_WARN("only %u of %u list worker connections could be reserved",
+      s_import.nbListCons, workers);
+
+  return true;
+}
+
+void rr_import_deinit(void)
+{
+  for(unsigned i = 0; s_import.listCons && i < s_import.nbListCons; ++i)
+    rr_db_release(&s_import.listCons[i]);
+  free(s_import.listCons);
+  s_import.listCons   = NULL;
+  s_import.nbListCons = 0;
+  pthread_cond_destroy (&s_import.listsCond);
+  pthread_mutex_destroy(&s_import.listsLock);
+
+  rr_db_release(&s_import.con);
+  rr_download_deinit(&s_import.dl);
+  for(unsigned i = 0; s_import.nrtm && i < g_config.nbSources; ++i)
+    rr_hashmap_deinit(&s_import.nrtm[i].orgIds);
+  free(s_import.nrtm);
+  s_import.nrtm = NULL;
+  rr_import_lists_deinit();
 }
 
-static bool rr_collect_exclude_v4_ranges(RRDBCon *con, const ConfigList *cl, RRExcludeRangeV4 **out_ranges, size_t *out_count)
+/*
+  The union of the lists excluded by the list, their unions are read so they
+  must have been built first.
+*/
+static bool rr_collect_exclude_v4_ranges(RRDBCon *con, const ConfigList *cl, RRRangeSetV4 *out)
 {
-  *out_ranges = NULL;
-  *out_count = 0;
+  rr_rangeset_v4_clear(out);
   if (!cl || !cl->exclude)
     return true;
 
-  size_t capacity = 0;
   for (const char **exclude = cl->exclude; *exclude; ++exclude)
   {
     unsigned exclude_list_id;
@@ -1045,7 +1694,7 @@ static bool rr_collect_exclude_v4_ranges(RRDBCon *con, const ConfigList *cl, RRE
         end_ip = network | ~mask;
       }
 
-      if (!rr_append_exclude_v4_range(out_ranges, out_count, &capacity, ip, end_ip))
+      if (!rr_rangeset_v4_add(out, ip, end_ip))
       {
         rr_query_netblockv4_list_union_end(con);
         return false;
@@ -1057,22 +1706,15 @@ static bool rr_collect_exclude_v4_ranges(RRDBCon *con, const ConfigList *cl, RRE
       return false;
   }
 
-  if (*out_count == 0)
-    return true;
-
-  qsort(*out_ranges, *out_count, sizeof(**out_ranges), rr_exclude_range_v4_cmp);
-  *out_count = rr_merge_exclude_v4_ranges(*out_ranges, *out_count);
-  return true;
+  return rr_rangeset_v4_normalize(out);
 }
 
-static bool rr_collect_exclude_v6_ranges(RRDBCon *con, const ConfigList *cl, RRExcludeRangeV6 **out_ranges, size_t *out_count)
+static bool rr_collect_exclude_v6_ranges(RRDBCon *con, const ConfigList *cl, RRRangeSetV6 *out)
 {
-  *out_ranges = NULL;
-  *out_count = 0;
+  rr_rangeset_v6_clear(out);
   if (!cl || !cl->exclude)
     return true;
 
-  size_t capacity = 0;
   for (const char **exclude = cl->exclude; *exclude; ++exclude)
   {
     unsigned exclude_list_id;
@@ -1092,22 +1734,22 @@ static bool rr_collect_exclude_v6_ranges(RRDBCon *con, const ConfigList *cl, RRE
     uint8_t prefix_len;
     while ((rc = rr_query_netblockv6_list_union_fetch(con, &ip, &prefix_len)) == 1)
     {
-      unsigned __int128 end_ip = ip;
+      // BE-numeric domain
+      unsigned __int128 start  = rr_raw_to_be(ip);
+      unsigned __int128 end_ip = start;
       if (prefix_len == 0)
       {
-        ip = 0;
+        start  = 0;
         end_ip = (unsigned __int128)-1;
       }
       else if (prefix_len < 128)
       {
-        unsigned __int128 ip_be = rr_raw_to_be(ip);
         unsigned __int128 mask = ((unsigned __int128)-1) << (128u - prefix_len);
-        unsigned __int128 network = ip_be & mask;
-        ip = rr_be_to_raw(network);
-        end_ip = rr_be_to_raw(network | ~mask);
+        start  = start & mask;
+        end_ip = start | ~mask;
       }
 
-      if (!rr_append_exclude_v6_range(out_ranges, out_count, &capacity, rr_raw_to_be(ip), rr_raw_to_be(end_ip)))
+      if (!rr_rangeset_v6_add(out, start, end_ip))
       {
         rr_query_netblockv6_list_union_end(con);
         return false;
@@ -1119,339 +1761,947 @@ static bool rr_collect_exclude_v6_ranges(RRDBCon *con, const ConfigList *cl, RRE
       return false;
   }
 
-  if (*out_count == 0)
-    return true;
-
-  qsort(*out_ranges, *out_count, sizeof(**out_ranges), rr_exclude_range_v6_cmp);
-  *out_count = rr_merge_exclude_v6_ranges(*out_ranges, *out_count);
-  return true;
+  return rr_rangeset_v6_normalize(out);
 }
 
-static bool rr_emit_ipv4_range_with_excludes(unsigned list_id, uint32_t start, uint32_t end,
-  const RRExcludeRangeV4 *excludes, size_t exclude_count, size_t *exclude_index)
+/*
+  Rebuild the union of all netblocks with a sweep over the sorted netblocks
+  and apply only the difference to the stored union, so an import that
+  changed one registrar only rewrites the regions it touched.
+*/
+static bool rr_import_netblockv4_union_update(void)
 {
-  uint32_t cur = start;
+  RRRangeSetV4 set = { 0 };
+  bool         ret = false;
+  int          rc;
 
-  while (cur <= end)
-  {
-    while (*exclude_index < exclude_count && excludes[*exclude_index].end < cur)
-      ++(*exclude_index);
+  typeof(s_import.netblockv4_union_source ) *src = &s_import.netblockv4_union_source;
+  typeof(s_import.netblockv4_union_current) *cur = &s_import.netblockv4_union_current;
 
-    if (*exclude_index >= exclude_count || excludes[*exclude_index].start > end)
-      return rr_emit_ipv4_range_as_cidrs(list_id, cur, end);
+  if (!rr_db_stmt_query(src->stmt))
+    return false;
 
-    if (excludes[*exclude_index].start > cur)
+  // the netblocks are ordered by start so they are merged as they arrive
+  while((rc = rr_db_stmt_fetch(src->stmt)) == 1)
+    if (!rr_rangeset_v4_push(&set, src->out_start_ip, src->out_end_ip))
     {
-      uint32_t chunk_end = excludes[*exclude_index].start - 1;
-      if (!rr_emit_ipv4_range_as_cidrs(list_id, cur, chunk_end))
-        return false;
+      rc = -1;
+      break;
     }
+  rr_db_stmt_close(src->stmt);
+  if (rc < 0)
+    goto err;
 
-    if (excludes[*exclude_index].end >= end)
-      break;
+  const RRRangeV4 *ranges = set.ranges;
+  size_t           count  = set.count;
 
-    if (excludes[*exclude_index].end == UINT32_MAX)
-      break;
+  // the current union is stored so the changes can be written while reading it
+  if (!rr_db_stmt_query(cur->stmt))
+    goto err;
 
-    cur = excludes[*exclude_index].end + 1;
-    if (cur == 0)
-      break;
+  if (!rr_db_stmt_store(cur->stmt))
+    goto err_cur;
+
+  RRDBBulk *ins = s_import.netblockv4_union_insert;
+  RRDBBulk *del = s_import.netblockv4_union_delete;
+  size_t i = 0;
+  while((rc = rr_db_stmt_fetch(cur->stmt)) == 1)
+  {
+    for(; i < count && ranges[i].start < cur->out_start_ip; ++i)
+      if (!rr_db_bulk_add(ins, (const void *[]){ &ranges[i].start, &ranges[i].end }))
+        goto err_cur;
+
+    if (i < count && ranges[i].start == cur->out_start_ip)
+    {
+      if (ranges[i].end != cur->out_end_ip &&
+          !rr_db_bulk_add(ins, (const void *[]){ &ranges[i].start, &ranges[i].end }))
+        goto err_cur;
+      ++i;
+      continue;
+    }
+
+    if (!rr_db_bulk_add(del, (const void *[]){ &cur->out_start_ip }))
+      goto err_cur;
   }
 
-  return true;
+  if (rc < 0)
+    goto err_cur;
+
+  for(; i < count; ++i)
+    if (!rr_db_bulk_add(ins, (const void *[]){ &ranges[i].start, &ranges[i].end }))
+      goto err_cur;
+
+  ret = rr_db_bulk_flush(ins) && rr_db_bulk_flush(del);
+
+err_cur:
+  rr_db_stmt_close(cur->stmt);
+err:
+  // drop anything left queued by a failure, the transaction is rolled back
+  rr_db_bulk_discard(s_import.netblockv4_union_insert);
+  rr_db_bulk_discard(s_import.netblockv4_union_delete);
+  rr_rangeset_v4_free(&set);
+  return ret;
 }
 
-static bool rr_import_netblockv4_list_union_populate(RRDBCon *con, const ConfigList *cl, unsigned list_id)
+static bool rr_import_netblockv6_union_update(void)
 {
-  uint32_t start_ip, end_ip;
-  uint8_t  prefix_len;
-  uint32_t run_start = 0, run_end = 0;
-  bool     have_run = false;
+  RRRangeSetV6 set = { 0 };
+  bool         ret = false;
+  int          rc;
 
-  RRExcludeRangeV4 *exclude_ranges = NULL;
-  size_t exclude_count = 0;
-  size_t exclude_index = 0;
-  if (!rr_collect_exclude_v4_ranges(con, cl, &exclude_ranges, &exclude_count))
-    return false;
+  typeof(s_import.netblockv6_union_source ) *src = &s_import.netblockv6_union_source;
+  typeof(s_import.netblockv6_union_current) *cur = &s_import.netblockv6_union_current;
 
-  if (!rr_query_netblockv4_list_start(con, list_id, true))
-  {
-    free(exclude_ranges);
+  if (!rr_db_stmt_query(src->stmt))
     return false;
-  }
 
-  int rc;
-  while ((rc = rr_query_netblockv4_list_fetch(con, &start_ip, &end_ip, &prefix_len)) == 1)
-  {
-    if (!have_run)
+  // merged in the BE-numeric domain as they arrive, BINARY orders the same
+  while((rc = rr_db_stmt_fetch(src->stmt)) == 1)
+    if (!rr_rangeset_v6_push(&set,
+      rr_raw_to_be(src->out_start_ip), rr_raw_to_be(src->out_end_ip)))
     {
-      run_start = start_ip;
-      run_end   = end_ip;
-      have_run  = 1;
-      continue;
+      rc = -1;
+      break;
     }
+  rr_db_stmt_close(src->stmt);
+  if (rc < 0)
+    goto err;
+
+  const RRRangeV6 *ranges = set.ranges;
+  size_t           count  = set.count;
+
+  // the current union is stored so the changes can be written while reading it
+  if (!rr_db_stmt_query(cur->stmt))
+    goto err;
+
+  if (!rr_db_stmt_store(cur->stmt))
+    goto err_cur;
+
+  RRDBBulk *ins = s_import.netblockv6_union_insert;
+  RRDBBulk *del = s_import.netblockv6_union_delete;
+  unsigned __int128 start_raw, end_raw;
+  size_t i = 0;
 
-    if ((uint64_t)start_ip <= (uint64_t)run_end + 1ULL)
+  #define INSERT_RANGE(x) \
+    (start_raw = rr_be_to_raw((x).start), \
+     end_raw   = rr_be_to_raw((x).end  ), \
+     rr_db_bulk_add(ins, (const void *[]){ &start_raw, &end_raw }))
+
+  while((rc = rr_db_stmt_fetch(cur->stmt)) == 1)
+  {
+    unsigned __int128 start = rr_raw_to_be(cur->out_start_ip);
+    unsigned __int128 end   = rr_raw_to_be(cur->out_end_ip  );
+
+    for(; i < count && ranges[i].start < start; ++i)
+      if (!INSERT_RANGE(ranges[i]))
+        goto err_cur;
+
+    if (i < count && ranges[i].start == start)
     {
-      if (end_ip > run_end)
-        run_end = end_ip;
+      if (ranges[i].end != end && !INSERT_RANGE(ranges[i]))
+        goto err_cur;
+      ++i;
       continue;
     }
 
-    bool emitted = exclude_count == 0
-      ? rr_emit_ipv4_range_as_cidrs(list_id, run_start, run_end)
-      : rr_emit_ipv4_range_with_excludes(list_id, run_start, run_end, exclude_ranges, exclude_count, &exclude_index);
+    if (!rr_db_bulk_add(del, (const void *[]){ &cur->out_start_ip }))
+      goto err_cur;
+  }
 
-    if (!emitted)
-    {
-      rr_query_netblockv4_list_end(con);
-      free(exclude_ranges);
-      return false;
-    }
+  if (rc < 0)
+    goto err_cur;
+
+  for(; i < count; ++i)
+    if (!INSERT_RANGE(ranges[i]))
+      goto err_cur;
+
+  #undef INSERT_RANGE
+
+  ret = rr_db_bulk_flush(ins) && rr_db_bulk_flush(del);
+
+err_cur:
+  rr_db_stmt_close(cur->stmt);
+err:
+  // drop anything left queued by a failure, the transaction is rolled back
+  rr_db_bulk_discard(s_import.netblockv6_union_insert);
+  rr_db_bulk_discard(s_import.netblockv6_union_delete);
+  rr_rangeset_v6_free(&set);
+  return ret;
+}
 
-    run_start = start_ip;
-    run_end   = end_ip;
+typedef struct RRListUnionEmit
+{
+  RRImportListCon *lc;
+  unsigned         list_id;
+}
+RRListUnionEmit;
+
+static bool rr_import_list_union_emit_v4(void *udata, uint32_t ip, uint8_t prefix_len)
+{
+  RRListUnionEmit *e = udata;
+  return rr_import_netblockv4_list_union_insert(e->lc, e->list_id, ip, prefix_len);
+}
+
+static bool rr_import_list_union_emit_v6(void *udata, unsigned __int128 ip, uint8_t prefix_len)
+{
+  RRListUnionEmit *e = udata;
+  return rr_import_netblockv6_list_union_insert(e->lc, e->list_id,
+    rr_be_to_raw(ip), prefix_len);
+}
+
+/*
+  The union of the list members less the union of the excluded lists,
+  emitted as CIDRs and returned in out.
+*/
+static bool rr_import_netblockv4_list_union_populate(RRImportListCon *lc, unsigned index,
+  unsigned list_id, RRRangeSetV4 *out)
+{
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  RRRangeSetV4 members  = { 0 };
+  RRRangeSetV4 excludes = { 0 };
+  RRRangeSetV4 result   = { 0 };
+  bool         ret      = false;
+
+  for(size_t i = 0; i < list->nbV4; ++i)
+    if (!rr_rangeset_v4_add(&members, list->v4[i].start_ip, list->v4[i].end_ip))
+      goto err;
+
+  if (!rr_rangeset_v4_normalize(&members) ||
+      !rr_collect_exclude_v4_ranges(lc->con, list->cl, &excludes))
+    goto err;
+
+  RRRangeSetV4 *emit = &members;
+  if (excludes.count > 0)
+  {
+    if (!rr_rangeset_v4_difference(&result, &members, &excludes))
+      goto err;
+    emit = &result;
   }
 
-  if (have_run)
+  RRListUnionEmit e = { .lc = lc, .list_id = list_id };
+  if (!rr_rangeset_v4_cidrs(emit, rr_import_list_union_emit_v4, &e))
+    goto err;
+
+  // hand the result to the caller, the old content of out is freed below
+  RRRangeSetV4 swap = *out;
+  *out  = *emit;
+  *emit = swap;
+  ret = true;
+
+err:
+  rr_rangeset_v4_free(&members);
+  rr_rangeset_v4_free(&excludes);
+  rr_rangeset_v4_free(&result);
+  return ret;
+}
+
+static bool rr_import_netblockv6_list_union_populate(RRImportListCon *lc, unsigned index,
+  unsigned list_id, RRRangeSetV6 *out)
+{
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  RRRangeSetV6 members  = { 0 };
+  RRRangeSetV6 excludes = { 0 };
+  RRRangeSetV6 result   = { 0 };
+  bool         ret      = false;
+
+  for(size_t i = 0; i < list->nbV6; ++i)
+    if (!rr_rangeset_v6_add(&members,
+      rr_raw_to_be(list->v6[i].start_ip), rr_raw_to_be(list->v6[i].end_ip)))
+      goto err;
+
+  if (!rr_rangeset_v6_normalize(&members) ||
+      !rr_collect_exclude_v6_ranges(lc->con, list->cl, &excludes))
+    goto err;
+
+  RRRangeSetV6 *emit = &members;
+  if (excludes.count > 0)
   {
-    bool emitted = exclude_count == 0
-      ? rr_emit_ipv4_range_as_cidrs(list_id, run_start, run_end)
-      : rr_emit_ipv4_range_with_excludes(list_id, run_start, run_end, exclude_ranges, exclude_count, &exclude_index);
+    if (!rr_rangeset_v6_difference(&result, &members, &excludes))
+      goto err;
+    emit = &result;
+  }
 
-    if (!emitted)
-    {
-      rr_query_netblockv4_list_end(con);
-      free(exclude_ranges);
+  RRListUnionEmit e = { .lc = lc, .list_id = list_id };
+  if (!rr_rangeset_v6_cidrs(emit, rr_import_list_union_emit_v6, &e))
+    goto err;
+
+  // hand the result to the caller, the old content of out is freed below
+  RRRangeSetV6 swap = *out;
+  *out  = *emit;
+  *emit = swap;
+  ret = true;
+
+err:
+  rr_rangeset_v6_free(&members);
+  rr_rangeset_v6_free(&excludes);
+  rr_rangeset_v6_free(&result);
+  return ret;
+}
+
+static bool rr_import_netblockv4_list_write(RRImportListCon *lc, unsigned index, unsigned list_id)
+{
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  for(size_t i = 0; i < list->nbV4; ++i)
+  {
+    const RRListMemberV4 *m = &list->v4[i];
+    if (!rr_db_bulk_add(lc->netblockv4_list_insert, (const void *[])
+      { &list_id, &m->id, &m->start_ip, &m->end_ip, &m->prefix_len }))
       return false;
-    }
   }
 
-  if (rc < 0)
+  return rr_db_bulk_flush(lc->netblockv4_list_insert);
+}
+
+static bool rr_import_netblockv6_list_write(RRImportListCon *lc, unsigned index, unsigned list_id)
+{
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  for(size_t i = 0; i < list->nbV6; ++i)
   {
-    rr_query_netblockv4_list_end(con);
-    free(exclude_ranges);
-    return false;
+    const RRListMemberV6 *m = &list->v6[i];
+    if (!rr_db_bulk_add(lc->netblockv6_list_insert, (const void *[])
+      { &list_id, &m->id, &m->start_ip, &m->end_ip, &m->prefix_len }))
+      return false;
   }
 
-  rr_query_netblockv4_list_end(con);
-  free(exclude_ranges);
+  return rr_db_bulk_flush(lc->netblockv6_list_insert);
+}
+
+static bool rr_import_build_list(RRImportListCon *lc, unsigned index)
+{
+  RRDBCon     *con     = lc->con;
+  ConfigList  *cl      = s_import.lists[index].cl;
+  uint64_t     emit    = 0;
+  RRRangeSetV4 unionV4 = { 0 };
+  RRRangeSetV6 unionV6 = { 0 };
+
+  unsigned list_id, generation;
+  if (
+    !rr_db_start(con) ||
+    !rr_import_list_insert(lc, cl->name) ||
+    rr_query_list_by_name(con, cl->name, &list_id) != 1 ||
+    !rr_import_list_generation_bump(lc, list_id, &generation) ||
+    !rr_import_netblockv4_list_delete(lc, list_id) ||
+    !rr_import_netblockv6_list_delete(lc, list_id) ||
+    !rr_import_netblockv4_list_write (lc, index, list_id) ||
+    !rr_import_netblockv6_list_write (lc, index, list_id) ||
+    !rr_import_netblockv4_list_union_delete(lc, list_id) ||
+    !rr_import_netblockv6_list_union_delete(lc, list_id))
+    goto err;
+
+  emit        = rr_microtime();
+  lc->emitted = 0;
+  if (
+    !rr_import_netblockv4_list_union_populate(lc, index, list_id, &unionV4) ||
+    !rr_import_netblockv6_list_union_populate(lc, index, list_id, &unionV6) ||
+    !rr_db_bulk_flush(lc->netblockv4_list_union_insert) ||
+    !rr_db_bulk_flush(lc->netblockv6_list_union_insert))
+    goto err;
+  emit = rr_microtime() - emit;
+
+  if (!rr_db_commit(con))
+    goto err;
+
+  // the build is committed, failing to keep its history only loses deltas
+  rr_lists_publish(cl->name, list_id, generation, &unionV4, &unionV6);
+  rr_rangeset_v4_free(&unionV4);
+  rr_rangeset_v6_free(&unionV6);
+
+  LOG_INFO("  Built: %s generation %u, %llu CIDRs emitted in %u.%03us",
+    cl->name,
+    generation,
+    lc->emitted,
+    (unsigned)(emit / 1000000UL),
+    (unsigned)(emit % 1000000UL / 1000));
   return true;
+
+err:
+  rr_rangeset_v4_free(&unionV4);
+  rr_rangeset_v6_free(&unionV6);
+  rr_db_bulk_discard(lc->netblockv4_list_insert);
+  rr_db_bulk_discard(lc->netblockv6_list_insert);
+  rr_db_bulk_discard(lc->netblockv4_list_union_insert);
+  rr_db_bulk_discard(lc->netblockv6_list_union_insert);
+  rr_db_rollback(con);
+  LOG_ERROR("  Failed: %s", cl->name);
+  return false;
 }
 
-static bool rr_emit_ipv6_range_as_cidrs(unsigned list_id, unsigned __int128 start_raw, unsigned __int128 end_raw)
+/*
+  A list can be built once the lists it excludes have been, as it reads
+  their unions. Returns 1 if ready, 0 if it has to wait, or -1 if an excluded
+  list failed. Excludes later in the build order are cycles and are ignored.
+  Must be called with listsLock held.
+*/
+static int rr_import_list_ready(unsigned index)
 {
-  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  if (!list->cl->exclude)
+    return 1;
 
-  // Convert once; do ALL math/comparisons in BE-numeric.
-  unsigned __int128 start = rr_raw_to_be(start_raw);
-  unsigned __int128 end   = rr_raw_to_be(end_raw);
+  int ret = 1;
+  for(const char **exclude = list->cl->exclude; *exclude; ++exclude)
+  {
+    int dep = rr_import_list_prepared(*exclude);
+    if (dep < 0 || s_import.lists[dep].orderPos > list->orderPos)
+      continue;
 
-  if (start > end)
-    return true;
+    if (s_import.lists[dep].failed)
+      return -1;
 
-  // ::/0
-  if (start == 0 && end == U128_MAX)
-    return rr_import_netblockv6_list_union_insert(list_id, (unsigned __int128)0, (uint8_t)0);
+    if (s_import.lists[dep].dirty)
+      ret = 0;
+  }
 
-  unsigned __int128 cur  = start;
-  unsigned __int128 last = end;
+  return ret;
+}
 
-  while (cur <= last)
+static void *rr_import_list_worker(void *opaque)
+{
+  RRDBCon *con = opaque;
+  if (!rr_db_get(&con))
   {
-    unsigned __int128 remain = (last - cur) + 1;   // safe (not the ::/0 case)
+    LOG_ERROR("failed to get the list worker connection");
+    return NULL;
+  }
 
-    uint8_t tz  = rr_u128_ctz_be(cur);             // alignment limit (as exponent)
-    uint8_t msb = rr_u128_msb_be(remain);          // range limit (as exponent)
-    uint8_t exp = (tz < msb) ? tz : msb;
+  RRImportListCon *lc = rr_db_get_con_ludata(con);
+  if (!lc)
+  {
+    LOG_ERROR("the list worker connection is not initialized");
+    rr_db_put(&con);
+    return NULL;
+  }
 
-    unsigned __int128 block_size = ((unsigned __int128)1 << exp);
-    unsigned __int128 block_end  = cur + block_size - 1;
+  pthread_mutex_lock(&s_import.listsLock);
+  while(true)
+  {
+    int  next    = -1;
+    bool pending = false;
+    for(unsigned i = 0; i < s_import.nbLists && next < 0; ++i)
+    {
+      unsigned index = s_import.listsOrder[i];
+      typeof(*s_import.lists) *list = &s_import.lists[index];
+      if (list->busy)
+        pending = true;
 
-    // Convert back to RAW(network bytes) for your CIDR helper + insert
-    unsigned __int128 cur_raw      = rr_be_to_raw(cur);
-    unsigned __int128 block_end_raw= rr_be_to_raw(block_end);
+      if (!list->dirty || list->failed || list->busy)
+        continue;
 
-    uint8_t prefix_len = rr_ipv6_to_cidr(cur_raw, block_end_raw);
+      switch(rr_import_list_ready(index))
+      {
+        case -1:
+          LOG_WARN("  Skipping: %s, an excluded list failed", list->cl->name);
+          list->failed = true;
+          break;
 
-    if (!rr_import_netblockv6_list_union_insert(list_id, cur_raw, prefix_len))
-      return false;
+        case 0:
+          pending = true;
+          break;
+
+        case 1:
+          next = index;
+          break;
+      }
+    }
+
+    if (next < 0)
+    {
+      if (!pending)
+        break;
+
+      pthread_cond_wait(&s_import.listsCond, &s_import.listsLock);
+      continue;
+    }
+
+    typeof(*s_import.lists) *list = &s_import.lists[next];
+    list->busy = true;
+    pthread_mutex_unlock(&s_import.listsLock);
+
+    LOG_INFO("  Building: %s", list->cl->name);
+    bool ok = rr_import_build_list(lc, next);
 
-    cur += block_size;
+    pthread_mutex_lock(&s_import.listsLock);
+    list->busy = false;
+    if (ok)
+      list->dirty = false;
+    else
+      list->failed = true;
+    pthread_cond_broadcast(&s_import.listsCond);
   }
 
-  return true;
+  pthread_cond_broadcast(&s_import.listsCond);
+  pthread_mutex_unlock(&s_import.listsLock);
+
+  rr_db_put(&con);
+  return NULL;
 }
 
-static bool rr_emit_ipv6_range_with_excludes(unsigned list_id, unsigned __int128 start_be, unsigned __int128 end_be,
-  const RRExcludeRangeV6 *excludes, size_t exclude_count, size_t *exclude_index)
+/*
+  Match the fields of a netblock against the patterns of every filter set. A
+  NULL field is SQL NULL, it matches nothing and as NOT (NULL) is not true a
+  set with an ignore on the field can not match. Returns the NULL fields.
+*/
+static unsigned rr_import_list_filter_row(const char *netname,
+  const char *descr, const char *org_handle, const char *org_name,
+  const char *org_descr, bool org_null, bool org_descr_null)
 {
-  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
-  unsigned __int128 cur = start_be;
-
-  while (cur <= end_be)
+  const char *fields[LIST_FIELD_MAX] =
   {
-    while (*exclude_index < exclude_count && excludes[*exclude_index].end < cur)
-      ++(*exclude_index);
-
-    if (*exclude_index >= exclude_count || excludes[*exclude_index].start > end_be)
-      return rr_emit_ipv6_range_as_cidrs(list_id, rr_be_to_raw(cur), rr_be_to_raw(end_be));
+    [LIST_FIELD_org_handle] = org_null                   ? NULL : org_handle,
+    [LIST_FIELD_org_name  ] = org_null                   ? NULL : org_name,
+    [LIST_FIELD_org_descr ] = org_null || org_descr_null ? NULL : org_descr,
+    [LIST_FIELD_ip_netname] = netname,
+    [LIST_FIELD_ip_descr  ] = descr
+  };
+
+  if (++s_import.filterStamp == 0)
+  {
+    for(unsigned i = 0; i < g_config.nbLists; ++i)
+      s_import.filterSets[i].stamp = 0;
+    s_import.filterStamp = 1;
+  }
 
-    if (excludes[*exclude_index].start > cur)
+  unsigned nullFields = 0;
+  for(unsigned f = 0; f < LIST_FIELD_MAX; ++f)
+  {
+    if (!fields[f])
     {
-      unsigned __int128 chunk_end = excludes[*exclude_index].start - 1;
-      if (!rr_emit_ipv6_range_as_cidrs(list_id, rr_be_to_raw(cur), rr_be_to_raw(chunk_end)))
-        return false;
+      nullFields |= 1U << f;
+      continue;
     }
 
-    if (excludes[*exclude_index].end >= end_be)
-      break;
+    typeof(*s_import.filters) *filter = &s_import.filters[f];
+    size_t n = rr_filter_match(filter->filter, fields[f], strlen(fields[f]),
+      filter->matches);
 
-    if (excludes[*exclude_index].end == U128_MAX)
-      break;
+    for(size_t i = 0; i < n; ++i)
+    {
+      typeof(*filter->owners) *owner = &filter->owners[filter->matches[i]];
+      typeof(*s_import.filterSets) *set = &s_import.filterSets[owner->set];
+      if (set->stamp != s_import.filterStamp)
+      {
+        set->stamp   = s_import.filterStamp;
+        set->matched = false;
+        set->ignored = false;
+      }
 
-    cur = excludes[*exclude_index].end + 1;
-    if (cur == 0)
-      break;
+      if (owner->ignore)
+        set->ignored = true;
+      else
+        set->matched = true;
+    }
   }
 
-  return true;
+  return nullFields;
 }
 
-static bool rr_import_netblockv6_list_union_populate(RRDBCon *con, const ConfigList *cl, unsigned list_id)
+// must be called after rr_import_list_filter_row for the netblock
+static bool rr_import_list_member(unsigned index, unsigned registrar_id,
+  unsigned nullFields)
 {
-  unsigned __int128 start_raw, end_raw;
-  uint8_t  prefix_len;
+  typeof(*s_import.lists) *list = &s_import.lists[index];
+  for(unsigned i = 0; i < list->nbTerms; ++i)
+  {
+    const RRListTerm *term = &list->terms[i];
+    if (term->registrar && (!term->known || term->registrar_id != registrar_id))
+      continue;
 
-  const unsigned __int128 U128_MAX = (unsigned __int128)-1;
+    if (term->set < 0)
+      return true;
 
-  unsigned __int128 run_start = 0, run_end = 0; // BE-numeric domain
-  bool have_run = false;
+    typeof(*s_import.filterSets) *set = &s_import.filterSets[term->set];
+    if (set->stamp == s_import.filterStamp && set->matched && !set->ignored &&
+      !(set->ignoreFields & nullFields))
+      return true;
+  }
 
-  RRExcludeRangeV6 *exclude_ranges = NULL;
-  size_t exclude_count = 0;
-  size_t exclude_index = 0;
-  if (!rr_collect_exclude_v6_ranges(con, cl, &exclude_ranges, &exclude_count))
-    return false;
+  return false;
+}
+
+static void *rr_import_grow(void *array, size_t *size, size_t count,
+  size_t elemSize)
+{
+  if (count < *size)
+    return array;
 
-  if (!rr_query_netblockv6_list_start(con, list_id, true))
+  size_t newSize = *size ? *size * 2 : 1024;
+  void  *newArray = realloc(array, newSize * elemSize);
+  if (!newArray)
   {
-    free(exclude_ranges);
-    return false;
+    LOG_ERROR("out of memory");
+    return NULL;
   }
 
+  *size = newSize;
+  return newArray;
+}
+
+static bool rr_import_lists_scan_v4(RRImportListCon *lc, const unsigned *dirty,
+  unsigned nbDirty, unsigned long long *rows)
+{
+  typeof(lc->netblockv4_list_source) *src = &lc->netblockv4_list_source;
+  if (!rr_db_stmt_query(src->stmt))
+    return false;
+
   int rc;
-  while ((rc = rr_query_netblockv6_list_fetch(con, &start_raw, &end_raw, &prefix_len)) == 1)
+  while((rc = rr_db_stmt_fetch(src->stmt)) == 1)
   {
-    (void)prefix_len;
+    ++*rows;
+    unsigned nullFields = rr_import_list_filter_row(
+      src->out_netname, src->out_descr, src->out_org_handle,
+      src->out_org_name, src->out_org_descr, src->out_org_null,
+      src->out_org_descr_null);
 
-    unsigned __int128 start = rr_raw_to_be(start_raw);
-    unsigned __int128 end   = rr_raw_to_be(end_raw);
-
-    if (!have_run)
+    for(unsigned d = 0; d < nbDirty; ++d)
     {
-      run_start = start;
-      run_end   = end;
-      have_run  = true;
-      continue;
-    }
+      if (!rr_import_list_member(dirty[d], src->out_registrar_id, nullFields))
+        continue;
 
-    // overlap OR adjacent (guard +1 overflow)
-    bool overlaps = (start <= run_end);
-    bool adjacent = (run_end != U128_MAX) && (start == run_end + 1);
+      typeof(*s_import.lists) *list = &s_import.lists[dirty[d]];
+      RRListMemberV4 *v4 = rr_import_grow(list->v4, &list->szV4, list->nbV4,
+        sizeof(*v4));
+      if (!v4)
+      {
+        rr_db_stmt_close(src->stmt);
+        return false;
+      }
 
-    if (overlaps || adjacent)
-    {
-      if (end > run_end) run_end = end;
-      continue;
+      list->v4 = v4;
+      list->v4[list->nbV4++] = (RRListMemberV4)
+      {
+        .id         = src->out_id,
+        .start_ip   = src->out_start_ip,
+        .end_ip     = src->out_end_ip,
+        .prefix_len = src->out_prefix_len
+      };
     }
+  }
+
+  rr_db_stmt_close(src->stmt);
+  return rc == 0;
+}
+
+static bool rr_import_lists_scan_v6(RRImportListCon *lc, const unsigned *dirty,
+  unsigned nbDirty, unsigned long long *rows)
+{
+  typeof(lc->netblockv6_list_source) *src = &lc->netblockv6_list_source;
+  if (!rr_db_stmt_query(src->stmt))
+    return false;
 
-    bool emitted = exclude_count == 0
-      ? rr_emit_ipv6_range_as_cidrs(list_id, rr_be_to_raw(run_start), rr_be_to_raw(run_end))
-      : rr_emit_ipv6_range_with_excludes(list_id, run_start, run_end, exclude_ranges, exclude_count, &exclude_index);
+  int rc;
+  while((rc = rr_db_stmt_fetch(src->stmt)) == 1)
+  {
+    ++*rows;
+    unsigned nullFields = rr_import_list_filter_row(
+      src->out_netname, src->out_descr, src->out_org_handle,
+      src->out_org_name, src->out_org_descr, src->out_org_null,
+      src->out_org_descr_null);
 
-    if (!emitted)
+    for(unsigned d = 0; d < nbDirty; ++d)
     {
-      rr_query_netblockv6_list_end(con);
-      free(exclude_ranges);
-      return false;
-    }
+      if (!rr_import_list_member(dirty[d], src->out_registrar_id, nullFields))
+        continue;
 
-    run_start = start;
-    run_end   = end;
+      typeof(*s_import.lists) *list = &s_import.lists[dirty[d]];
+      RRListMemberV6 *v6 = rr_import_grow(list->v6, &list->szV6, list->nbV6,
+        sizeof(*v6));
+      if (!v6)
+      {
+        rr_db_stmt_close(src->stmt);
+        return false;
+      }
+
+      list->v6 = v6;
+      list->v6[list->nbV6++] = (RRListMemberV6)
+      {
+        .id         = src->out_id,
+        .start_ip   = src->out_start_ip,
+        .end_ip     = src->out_end_ip,
+        .prefix_len = src->out_prefix_len
+      };
+    }
   }
 
-  if (have_run)
+  rr_db_stmt_close(src->stmt);
+  return rc == 0;
+}
+
+/*
+  Work out the members of every dirty list in a single pass over the
+  netblocks, they are held in memory until each list is built.
+*/
+static bool rr_import_lists_scan(RRImportListCon *lc)
+{
+  unsigned dirty[s_import.nbLists + 1];
+  unsigned nbDirty = 0;
+
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
   {
-    bool emitted = exclude_count == 0
-      ? rr_emit_ipv6_range_as_cidrs(list_id, rr_be_to_raw(run_start), rr_be_to_raw(run_end))
-      : rr_emit_ipv6_range_with_excludes(list_id, run_start, run_end, exclude_ranges, exclude_count, &exclude_index);
+    typeof(*s_import.lists) *list = &s_import.lists[i];
+    rr_import_list_free_members(i);
+    if (!list->dirty)
+      continue;
 
-    if (!emitted)
+    dirty[nbDirty++] = i;
+    for(unsigned t = 0; t < list->nbTerms; ++t)
     {
-      rr_query_netblockv6_list_end(con);
-      free(exclude_ranges);
-      return false;
+      RRListTerm *term = &list->terms[t];
+      unsigned serial, last_import;
+      term->known = term->registrar && rr_query_registrar_by_name(lc->con,
+        term->registrar, &term->registrar_id, &serial, &last_import) == 1;
     }
   }
 
-  rr_query_netblockv6_list_end(con);
-  free(exclude_ranges);
-  return (rc >= 0);
+  if (nbDirty == 0)
+    return true;
+
+  uint64_t startTime = rr_microtime();
+  unsigned long long rows = 0;
+  if (!rr_import_lists_scan_v4(lc, dirty, nbDirty, &rows) ||
+      !rr_import_lists_scan_v6(lc, dirty, nbDirty, &rows))
+  {
+    LOG_ERROR("failed to scan the netblocks for the lists");
+    for(unsigned d = 0; d < nbDirty; ++d)
+      rr_import_list_free_members(dirty[d]);
+    return false;
+  }
+
+  uint64_t elapsed = rr_microtime() - startTime;
+  LOG_INFO("  Matched %llu netblocks against %u lists in %u.%03us",
+    rows, nbDirty,
+    (unsigned)(elapsed / 1000000UL),
+    (unsigned)(elapsed % 1000000UL / 1000));
+  return true;
 }
 
-static bool rr_import_build_lists_internal(RRDBCon *con)
+/*
+  Rebuild the dirty lists on the list workers. Lists that fail stay dirty
+  and are retried on the next call.
+*/
+static bool rr_import_build_lists_internal(void)
 {
-  if (!g_config.lists)
+  unsigned dirty = 0;
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+  {
+    s_import.lists[i].failed = false;
+    if (s_import.lists[i].dirty)
+      ++dirty;
+  }
+
+  if (dirty == 0)
     return true;
 
   LOG_INFO("rebuilding lists");
-  for(typeof(s_import.lists_prepare) list = s_import.lists_prepare; list->stmt[0] && list->stmt[1]; ++list)
+  uint64_t startTime = rr_microtime();
+
+  // the membership of every dirty list is found on the first worker connection
+  RRDBCon *con = s_import.listCons[0];
+  if (!rr_db_get(&con))
   {
-    LOG_INFO("  Building: %s", list->cl->name);
-    unsigned list_id;
-    if (
-      !rr_db_start(con) ||
-      !rr_import_list_insert(list->cl->name) ||
-      rr_query_list_by_name(con, list->cl->name, &list_id) != 1 ||
-      !rr_import_netblockv4_list_delete(list_id) ||
-      !rr_import_netblockv6_list_delete(list_id) ||
-      !rr_db_stmt_execute(list->stmt[0], NULL) ||
-      !rr_db_stmt_execute(list->stmt[1], NULL) ||
-      !rr_import_netblockv4_list_union_delete  (list_id) ||
-      !rr_import_netblockv6_list_union_delete  (list_id) ||
-      !rr_import_netblockv4_list_union_populate(con, list->cl, list_id) ||
-      !rr_import_netblockv6_list_union_populate(con, list->cl, list_id) ||
-      !rr_db_commit(con))
+    LOG_ERROR("failed to get the list worker connection");
+    return false;
+  }
+
+  RRImportListCon *lc = rr_db_get_con_ludata(con);
+  bool scanned = lc && rr_import_lists_scan(lc);
+  rr_db_put(&con);
+  if (!scanned)
+    return false;
+
+  unsigned  nbThreads = 0;
+  pthread_t threads[s_import.nbListCons];
+  for(unsigned i = 0; i < s_import.nbListCons && i < dirty; ++i)
+  {
+    if (pthread_create(&threads[nbThreads], NULL, rr_import_list_worker,
+      s_import.listCons[i]) != 0)
     {
-      rr_db_rollback(con);
-      LOG_ERROR("failed");
-      return false;
+      LOG_WARN("failed to start list worker %u", i);
+      continue;
     }
+    ++nbThreads;
   }
 
-  LOG_INFO("done");
+  if (nbThreads == 0)
+  {
+    LOG_ERROR("no list workers could be started");
+    for(unsigned i = 0; i < s_import.nbLists; ++i)
+      rr_import_list_free_members(i);
+    return false;
+  }
+
+  for(unsigned i = 0; i < nbThreads; ++i)
+    pthread_join(threads[i], NULL);
+
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    rr_import_list_free_members(i);
+
+  unsigned failed = 0;
+  for(unsigned i = 0; i < s_import.nbLists; ++i)
+    if (s_import.lists[i].dirty)
+      ++failed;
+
+  uint64_t elapsed = rr_microtime() - startTime;
+  if (failed > 0)
+  {
+    LOG_ERROR("failed to build %u of %u lists", failed, dirty);
+    return false;
+  }
+
+  LOG_INFO("done, %u lists in %u.%03us on %u workers",
+    dirty,
+    (unsigned)(elapsed / 1000000UL),
+    (unsigned)(elapsed % 1000000UL / 1000),
+    nbThreads);
   return true;
 }
 
 bool rr_import_build_lists(void)
 {
-  RRDBCon *con = s_import.con;
-  if (!rr_db_get(&con))
+  return rr_import_build_lists_internal();
+}
+
+static bool rr_import_fetch_serial(const char *url, unsigned *out_serial)
+{
+  FILE *fp;
+  if (!rr_download_to_tmpfile(s_import.dl, url, &fp))
+    return false;
+
+  bool ret = fseek(fp, 0, SEEK_SET) == 0 && fscanf(fp, "%u", out_serial) == 1;
+  if (!ret)
+    LOG_ERROR("failed to read the serial from %s", url);
+
+  fclose(fp);
+  return ret;
+}
+
+/*
+  Select the org map for the source. Full loads start from an empty map, the
+  orgs are recorded as they are inserted. Incremental updates reuse the map
+  left by the last commit, or load it from the database if there is none.
+*/
+static bool rr_import_org_ids_begin(unsigned index, unsigned registrar_id,
+  bool incremental)
+{
+  typeof(*s_import.nrtm) *nrtm = &s_import.nrtm[index];
+  if (!nrtm->orgIds && !rr_hashmap_init(&nrtm->orgIds))
+    return false;
+
+  s_import.orgIds      = nrtm->orgIds;
+  s_import.incremental = incremental;
+  s_import.orgMisses   = 0;
+
+  if (incremental && nrtm->orgIdsValid)
+    return true;
+
+  nrtm->orgIdsValid = false;
+  rr_hashmap_clear(nrtm->orgIds);
+  if (incremental && !rr_import_org_select_ids(registrar_id))
   {
-    LOG_ERROR("failed to get the reserved connection");
+    LOG_ERROR("failed to load the org ids");
     return false;
   }
-  bool result = rr_import_build_lists_internal(con);
-  rr_db_put(&con);
-  return result;
+
+  return true;
+}
+
+/*
+  The map is only kept if it still matches the database, and only NRTM
+  sources need it again before their next full load.
+*/
+static void rr_import_org_ids_end(unsigned index, bool keep)
+{
+  typeof(*s_import.nrtm) *nrtm = &s_import.nrtm[index];
+  s_import.orgIds = NULL;
+
+  if (g_config.sources[index].type != SOURCE_TYPE_NRTM)
+  {
+    rr_hashmap_deinit(&nrtm->orgIds);
+    nrtm->orgIdsValid = false;
+    return;
+  }
+
+  nrtm->orgIdsValid = keep;
+}
+
+/*
+  Apply any pending NRTM updates for the source. The caller has already
+  started the transaction, it is committed or rolled back here.
+  Returns -1 if the connection failed, 0 if nothing changed, 1 on changes.
+*/
+static int rr_import_nrtm_poll(RRDBCon *con, unsigned index,
+  unsigned registrar_id, unsigned serial)
+{
+  typeof(*g_config.sources) *src  = &g_config.sources[index];
+  typeof(*s_import.nrtm)    *nrtm = &s_import.nrtm[index];
+
+  time_t now = time(NULL);
+  if (now - nrtm->last_poll < src->nrtm.frequency)
+    return rr_db_rollback(con) ? 0 : -1;
+  nrtm->last_poll = now;
+
+  memset(&s_import.stats, 0, sizeof(s_import.stats));
+  uint64_t startTime = rr_microtime();
+
+  if (!rr_import_org_ids_begin(index, registrar_id, true))
+  {
+    rr_import_org_ids_end(index, false);
+    return rr_db_rollback(con) ? 0 : -1;
+  }
+
+  unsigned new_serial = serial;
+  bool     resync     = false;
+  int rc = rr_nrtm_update(src->name,
+    src->nrtm.host,
+    src->nrtm.port,
+    src->nrtm.source,
+    src->nrtm.version,
+    registrar_id,
+    serial,
+    &new_serial,
+    &resync);
+
+  if (resync)
+  {
+    LOG_WARN("%s: NRTM journal no longer covers serial %u, scheduling a reload",
+      src->name, serial + 1);
+    nrtm->resync = true;
+  }
+
+  if (rc <= 0)
+  {
+    // nothing was applied if the update succeeded, the map is still current
+    rr_import_org_ids_end(index, rc == 0);
+    return rr_db_rollback(con) ? 0 : -1;
+  }
+
+  if (
+    !rr_import_registrar_set_serial(registrar_id, new_serial) ||
+    !rr_db_commit(con))
+  {
+    LOG_ERROR("%s: failed to finalize NRTM update", src->name);
+    rr_import_org_ids_end(index, false);
+    return rr_db_rollback(con) ? 0 : -1;
+  }
+  rr_import_org_ids_end(index, true);
+
+  uint64_t elapsed = rr_microtime() - startTime;
+  LOG_INFO("%s: NRTM %u -> %u applied in %u.%03us",
+    src->name, serial, new_serial,
+    (unsigned)(elapsed / 1000000UL),
+    (unsigned)(elapsed % 1000000UL / 1000));
+  LOG_INFO("  Orgs: %llu new, %llu deleted",
+    s_import.stats.newOrgs, s_import.stats.deletedOrgs);
+  LOG_INFO("  IPv4: %llu new, %llu deleted",
+    s_import.stats.newIPv4, s_import.stats.deletedIPv4);
+  LOG_INFO("  IPv6: %llu new, %llu deleted",
+    s_import.stats.newIPv6, s_import.stats.deletedIPv6);
+  return 1;
 }
 
 bool rr_import_run(void)
 {
   int rc;
   bool rebuild_unions = false;
-  bool rebuild_lists  = false;
   while(true)
   {
     RRDBCon *con = s_import.con;
@@ -1503,13 +2753,56 @@ bool rr_import_run(void)
         LOG_INFO("New registrar inserted");
       }
 
-      if (last_import > 0 && time(NULL) - last_import < src->frequency)
+      bool resync = src->type == SOURCE_TYPE_NRTM && s_import.nrtm[i].resync;
+      if (last_import > 0 && time(NULL) - last_import < src->frequency && !resync)
       {
+        // between full reloads NRTM sources are kept current incrementally
+        if (src->type == SOURCE_TYPE_NRTM)
+        {
+          rc = rr_import_nrtm_poll(con, i, registrar_id, serial);
+          if (rc < 0)
+            goto fail_con;
+
+          if (rc > 0)
+          {
+            rebuild_unions = true;
+            rr_import_lists_mark_dirty(i);
+          }
+          continue;
+        }
+
         if (!rr_db_rollback(con))
           goto fail_con;
         continue;
       }
 
+      // the dump must be loaded at the serial NRTM will continue from
+      unsigned new_serial = serial + 1;
+      if (src->type == SOURCE_TYPE_NRTM)
+      {
+        if (!rr_import_fetch_serial(src->nrtm.serial_url, &new_serial))
+        {
+          LOG_ERROR("failed to fetch the serial for %s", src->name);
+          if (!rr_db_rollback(con))
+            goto fail_con;
+          continue;
+        }
+
+        // NRTM has already brought us past the dump, there is nothing to reload
+        if (new_serial <= serial && !resync)
+        {
+          LOG_INFO("%s: dump serial %u is not newer than %u, skipping reload",
+            src->name, new_serial, serial);
+          if (!rr_import_registrar_update_serial(registrar_id, serial) ||
+              !rr_db_commit(con))
+          {
+            if (!rr_db_rollback(con))
+              goto fail_con;
+          }
+          continue;
+        }
+      }
+
       LOG_INFO("Fetching source: %s", src->name);
       if (src->user && src->pass)
         rr_download_set_auth(s_import.dl, src->user, src->pass);
@@ -1535,13 +2828,25 @@ bool rr_import_run(void)
 
       LOG_INFO("start import %s", src->name);
       uint64_t startTime = rr_microtime();
+      RRSanatizeStats sanStart;
+      rr_sanatize_get_stats(&sanStart);
 
-      ++serial;
+      serial = new_serial;
       bool success = false;
       bool linkOrgs = false;
+      if (!rr_import_org_ids_begin(i, registrar_id, false))
+      {
+        fclose(fp);
+        rr_import_org_ids_end(i, false);
+        if (!rr_db_rollback(con))
+          goto fail_con;
+        continue;
+      }
+
       switch(src->type)
       {
         case SOURCE_TYPE_RPSL:
+        case SOURCE_TYPE_NRTM:
           success  = rr_rpsl_import_gz_FILE(src->name, fp, registrar_id, serial);
           linkOrgs = true;
           break;
@@ -1569,29 +2874,41 @@ bool rr_import_run(void)
       const char *resultStr;
       if (success)
       {
-        //finalize the registrar
+        /*
+          finalize the registrar, netblocks were linked to their org as they
+          were inserted, only those that referenced an org ahead of its
+          definition in the dump are left to fix up
+        */
         LOG_INFO("finalizing");
+        bool fixup = linkOrgs && s_import.orgMisses > 0;
         if (
           !rr_import_org_delete_old         (registrar_id, serial) ||
           !rr_import_netblockv4_delete_old  (registrar_id, serial) ||
           !rr_import_netblockv6_delete_old  (registrar_id, serial) ||
-          (linkOrgs && !rr_import_netblockv4_link_org()) ||
-          (linkOrgs && !rr_import_netblockv6_link_org()) ||
+          (fixup && !rr_import_netblockv4_link_org(registrar_id)) ||
+          (fixup && !rr_import_netblockv6_link_org(registrar_id)) ||
           !rr_import_registrar_update_serial(registrar_id, serial) ||
           !rr_db_commit                     (con))
         {
           LOG_ERROR("failed to finalize");
+          rr_import_org_ids_end(i, false);
           if (!rr_db_rollback(con))
             goto fail_con;
           continue;
         }
+        rr_import_org_ids_end(i, true);
 
         resultStr = "succeeded";
         rebuild_unions = true;
-        rebuild_lists  = true;
+        rr_import_lists_mark_dirty(i);
+
+        // start following the journal from the freshly loaded dump
+        s_import.nrtm[i].resync    = false;
+        s_import.nrtm[i].last_poll = 0;
       }
       else
       {
+        rr_import_org_ids_end(i, false);
         if (!rr_db_rollback(con))
           goto fail_con;
         resultStr = "failed";
@@ -1618,6 +2935,13 @@ bool rr_import_run(void)
       LOG_INFO("IPv6:");
       LOG_INFO("  New    : %llu", s_import.stats.newIPv6    );
       LOG_INFO("  Deleted: %llu", s_import.stats.deletedIPv6);
+
+      RRSanatizeStats sanEnd;
+      rr_sanatize_get_stats(&sanEnd);
+      LOG_INFO("Sanitize:");
+      LOG_INFO("  ASCII  : %llu", sanEnd.ascii - sanStart.ascii);
+      LOG_INFO("  UTF-8  : %llu", sanEnd.utf8  - sanStart.utf8 );
+      LOG_INFO("  ICU    : %llu", sanEnd.slow  - sanStart.slow );
     }
 
     if (rebuild_unions)
@@ -1625,10 +2949,8 @@ bool rr_import_run(void)
       LOG_INFO("rebuilding unions");
       if (
         !rr_db_start(con) ||
-        !rr_import_netblockv4_union_truncate() ||
-        !rr_import_netblockv6_union_truncate() ||
-        !rr_import_netblockv4_union_populate() ||
-        !rr_import_netblockv6_union_populate() ||
+        !rr_import_netblockv4_union_update() ||
+        !rr_import_netblockv6_union_update() ||
         !rr_db_commit(con))
       {
         LOG_ERROR("failed");
@@ -1639,8 +2961,8 @@ bool rr_import_run(void)
       rebuild_unions = false;
     }
 
-    if (rebuild_lists && rr_import_build_lists_internal(con))
-      rebuild_lists = false;
+    // only the lists that depend on an updated source are rebuilt
+    rr_import_build_lists_internal();
 
     fail_con:
     rr_db_put(&con);
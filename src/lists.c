@@ -0,0 +1,618 @@
+#include "lists.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "hashmap.h"
+#include "query.h"
+#include "format.h"
+#include "compress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+/*
+  Each generation is held as varint pairs per range, the gap from the end of
+  the previous range and the length less one, which for typical lists is a
+  few bytes a range.
+*/
+typedef struct RRListsGen
+{
+  unsigned generation;
+  RRBuffer v4;
+  RRBuffer v6;
+}
+RRListsGen;
+
+/*
+  The rendered bodies of each list in http.cache_dir, plain and gzip for each
+  family, indexed by v6 * 2 + gzip.
+*/
+#define RR_LISTS_FILES 4
+static const char *s_fileSuffix[RR_LISTS_FILES] = { "v4", "v4.gz", "v6", "v6.gz" };
+
+typedef struct RRLists
+{
+  pthread_rwlock_t lock;
+  unsigned         depth;
+
+  // built once by init, name to index
+  RRHashMap *index;
+
+  struct
+  {
+    const char *name;
+    unsigned    id; // the list row, 0 until known
+    unsigned    generation;
+    RRListsGen *ring;
+    unsigned    head; // the slot the next generation is written to
+
+    // generation of the rendered files, 0 while they are being replaced
+    unsigned    fileGeneration;
+
+    atomic_ullong requests;   // list requests served
+    atomic_ullong dbRequests; // those that read the list from the database
+  }
+  *lists;
+  unsigned nbLists;
+
+  RRListsNotifyFn notify;
+  void           *notifyUdata;
+}
+RRLists;
+static RRLists s_lists = { 0 };
+
+static bool rr_lists_put_varint(RRBuffer *buf, unsigned __int128 value)
+{
+  char   tmp[19];
+  size_t len = 0;
+  do
+  {
+    uint8_t b = value & 0x7f;
+    value >>= 7;
+    tmp[len++] = (char)(value ? b | 0x80 : b);
+  }
+  while(value);
+
+  return rr_buffer_append(buf, tmp, len) >= 0;
+}
+
+static bool rr_lists_get_varint(const uint8_t **pos, const uint8_t *end,
+  unsigned __int128 *value)
+{
+  *value = 0;
+  for(unsigned shift = 0; *pos < end && shift < 128; shift += 7)
+  {
+    uint8_t b = *(*pos)++;
+    *value |= (unsigned __int128)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static bool rr_lists_pack_v4(RRBuffer *buf, const RRRangeSetV4 *set)
+{
+  uint64_t next = 0;
+  for(size_t i = 0; i < set->count; ++i)
+  {
+    const RRRangeV4 *r = &set->ranges[i];
+    if (!rr_lists_put_varint(buf, r->start - next) ||
+        !rr_lists_put_varint(buf, r->end   - r->start))
+      return false;
+    next = (uint64_t)r->end + 1;
+  }
+  return true;
+}
+
+static bool rr_lists_pack_v6(RRBuffer *buf, const RRRangeSetV6 *set)
+{
+  unsigned __int128 next = 0;
+  for(size_t i = 0; i < set->count; ++i)
+  {
+    const RRRangeV6 *r = &set->ranges[i];
+    if (!rr_lists_put_varint(buf, r->start - next) ||
+        !rr_lists_put_varint(buf, r->end   - r->start))
+      return false;
+    next = r->end + 1;
+  }
+  return true;
+}
+
+static int rr_lists_unpack_v4(const RRBuffer *buf, RRRangeSetV4 *out)
+{
+  const uint8_t *pos = (const uint8_t *)buf->buffer;
+  const uint8_t *end = pos + buf->pos;
+  uint64_t       next = 0;
+
+  rr_rangeset_v4_clear(out);
+  while(pos < end)
+  {
+    unsigned __int128 gap, len;
+    if (!rr_lists_get_varint(&pos, end, &gap) ||
+        !rr_lists_get_varint(&pos, end, &len))
+    {
+      LOG_ERROR("corrupt list history");
+      return -1;
+    }
+
+    uint32_t start = (uint32_t)(next + gap);
+    if (!rr_rangeset_v4_push(out, start, start + (uint32_t)len))
+      return -1;
+    next = (uint64_t)start + (uint32_t)len + 1;
+  }
+  return 1;
+}
+
+static int rr_lists_unpack_v6(const RRBuffer *buf, RRRangeSetV6 *out)
+{
+  const uint8_t    *pos = (const uint8_t *)buf->buffer;
+  const uint8_t    *end = pos + buf->pos;
+  unsigned __int128 next = 0;
+
+  rr_rangeset_v6_clear(out);
+  while(pos < end)
+  {
+    unsigned __int128 gap, len;
+    if (!rr_lists_get_varint(&pos, end, &gap) ||
+        !rr_lists_get_varint(&pos, end, &len))
+    {
+      LOG_ERROR("corrupt list history");
+      return -1;
+    }
+
+    unsigned __int128 start = next + gap;
+    if (!rr_rangeset_v6_push(out, start, start + len))
+      return -1;
+    next = start + len + 1;
+  }
+  return 1;
+}
+
+typedef struct RRListsRender
+{
+  const RRRangeSetV4 *v4;
+  const RRRangeSetV6 *v6;
+  RRRangeSetV4Cursor  v4cur;
+  RRRangeSetV6Cursor  v6cur;
+  RRFormatStream      fmt;
+}
+RRListsRender;
+
+static int rr_lists_render_next_v4(void *udata, uint32_t *ip, uint8_t *prefix_len)
+{
+  RRListsRender *r = udata;
+  return rr_rangeset_v4_cidr_next(r->v4, &r->v4cur, ip, prefix_len) ? 1 : 0;
+}
+
+static int rr_lists_render_next_v6(void *udata, unsigned __int128 *ip, uint8_t *prefix_len)
+{
+  RRListsRender *r = udata;
+  if (!rr_rangeset_v6_cidr_next(r->v6, &r->v6cur, ip, prefix_len))
+    return 0;
+
+  *ip = rr_be_to_raw(*ip);
+  return 1;
+}
+
+static ssize_t rr_lists_render_source(void *udata, char *buf, size_t max)
+{
+  RRListsRender *r = udata;
+  return rr_format_stream_read(&r->fmt, buf, max);
+}
+
+// write the plain list body of v4 or v6, gzip compressed if gzip is set
+static bool rr_lists_render(const char *path, bool gzip,
+  const RRRangeSetV4 *v4, const RRRangeSetV6 *v6)
+{
+  RRListsRender    r = { .v4 = v4, .v6 = v6 };
+  RRCompressStream z = { 0 };
+  bool             ret = false;
+  char            *buf = NULL;
+  FILE            *fp  = NULL;
+
+  if (v6)
+    rr_format_stream_v6(&r.fmt, rr_format_by_name(NULL), "", rr_lists_render_next_v6, &r);
+  else
+    rr_format_stream_v4(&r.fmt, rr_format_by_name(NULL), "", rr_lists_render_next_v4, &r);
+
+  if (gzip && !rr_compress_stream_init(&z, RR_COMPRESS_GZIP,
+    MIN(g_config.http.compress, Z_BEST_COMPRESSION), rr_lists_render_source, &r))
+    return false;
+
+  const size_t bufSize = 64 * 1024;
+  if (!(buf = malloc(bufSize)))
+  {
+    LOG_ERROR("out of memory");
+    goto err;
+  }
+
+  if (!(fp = fopen(path, "wb")))
+  {
+    LOG_ERROR("Failed to open %s for writing", path);
+    goto err;
+  }
+
+  while(true)
+  {
+    ssize_t n = gzip ?
+      rr_compress_stream_read(&z, buf, bufSize) :
+      rr_format_stream_read(&r.fmt, buf, bufSize);
+    if (n < 0)
+      goto err;
+
+    if (n == 0)
+      break;
+
+    if (fwrite(buf, 1, n, fp) != (size_t)n)
+    {
+      LOG_ERROR("Failed to write %s", path);
+      goto err;
+    }
+  }
+
+  if (fclose(fp) != 0)
+  {
+    fp = NULL;
+    LOG_ERROR("Failed to write %s", path);
+    goto err;
+  }
+  fp  = NULL;
+  ret = true;
+
+err:
+  if (fp)
+    fclose(fp);
+  free(buf);
+  rr_compress_stream_free(&z);
+  return ret;
+}
+
+static bool rr_lists_path(char *path, size_t size, const char *name,
+  unsigned file, const char *ext)
+{
+  int n = snprintf(path, size, "%s/%s.%s%s",
+    g_config.http.cache_dir, name, s_fileSuffix[file], ext);
+  return n > 0 && (size_t)n < size;
+}
+
+// the gzip files are only kept when compression is enabled
+static inline bool rr_lists_file_enabled(unsigned file)
+{
+  return !(file & 1) || g_config.http.compress > 0;
+}
+
+/*
+  Render the files of a new generation to temporaries then rename them over
+  the old ones. Readers check fileGeneration on both sides of the open, so it
+  is cleared across the renames.
+*/
+static void rr_lists_write_files(int index, unsigned generation,
+  const RRRangeSetV4 *v4, const RRRangeSetV6 *v6)
+{
+  const char *name = s_lists.lists[index].name;
+  char     tmp[RR_LISTS_FILES][PATH_MAX];
+  char     dst[RR_LISTS_FILES][PATH_MAX];
+  unsigned rendered = 0;
+  unsigned renamed  = 0;
+
+  for(; rendered < RR_LISTS_FILES; ++rendered)
+  {
+    unsigned i = rendered;
+    if (!rr_lists_file_enabled(i))
+      continue;
+
+    if (!rr_lists_path(tmp[i], PATH_MAX, name, i, ".tmp") ||
+        !rr_lists_path(dst[i], PATH_MAX, name, i, ""))
+    {
+      LOG_ERROR("cache path too long for %s", name);
+      goto err;
+    }
+
+    if (!rr_lists_render(tmp[i], i & 1, i < 2 ? v4 : NULL, i < 2 ? NULL : v6))
+    {
+      unlink(tmp[i]);
+      goto err;
+    }
+  }
+
+  pthread_rwlock_wrlock(&s_lists.lock);
+  s_lists.lists[index].fileGeneration = 0;
+  pthread_rwlock_unlock(&s_lists.lock);
+
+  for(; renamed < RR_LISTS_FILES; ++renamed)
+  {
+    unsigned i = renamed;
+    if (rr_lists_file_enabled(i) && rename(tmp[i], dst[i]) != 0)
+    {
+      LOG_ERROR("Failed to rename %s: %s", tmp[i], strerror(errno));
+      goto err;
+    }
+  }
+
+  pthread_rwlock_wrlock(&s_lists.lock);
+  s_lists.lists[index].fileGeneration = generation;
+  pthread_rwlock_unlock(&s_lists.lock);
+  return;
+
+err:
+  for(unsigned i = renamed; i < rendered; ++i)
+    if (rr_lists_file_enabled(i))
+      unlink(tmp[i]);
+
+  pthread_rwlock_wrlock(&s_lists.lock);
+  s_lists.lists[index].fileGeneration = 0;
+  pthread_rwlock_unlock(&s_lists.lock);
+}
+
+static int rr_lists_find(const char *name)
+{
+  uintptr_t index;
+  if (!s_lists.index || !rr_hashmap_get(s_lists.index, name, strlen(name), &index))
+    return -1;
+  return index;
+}
+
+// the ids of lists already in the database, the rest are set by publish
+static void rr_lists_load_ids(void)
+{
+  RRDBCon *con = NULL;
+  if (!rr_db_get(&con))
+  {
+    LOG_WARN("unable to load the list ids");
+    return;
+  }
+
+  for(unsigned i = 0; i < s_lists.nbLists; ++i)
+    if (rr_query_list_by_name(con, s_lists.lists[i].name, &s_lists.lists[i].id) < 0)
+      break;
+
+  rr_db_put(&con);
+}
+
+bool rr_lists_init(void)
+{
+  pthread_rwlock_init(&s_lists.lock, NULL);
+  s_lists.depth = g_config.http.list_history > 0 ?
+    (unsigned)g_config.http.list_history : 1;
+
+  unsigned count = 0;
+  for(ConfigList *cl = g_config.lists; cl && cl->name; ++cl)
+    if (cl->build_list)
+      ++count;
+
+  if (*g_config.http.cache_dir &&
+      mkdir(g_config.http.cache_dir, 0755) != 0 && errno != EEXIST)
+  {
+    LOG_ERROR("Failed to create %s: %s", g_config.http.cache_dir, strerror(errno));
+    return false;
+  }
+
+  s_lists.lists = calloc(count + 1, sizeof(*s_lists.lists));
+  if (!s_lists.lists || !rr_hashmap_init(&s_lists.index))
+  {
+    LOG_ERROR("out of memory");
+    free(s_lists.lists);
+    s_lists.lists = NULL;
+    return false;
+  }
+
+  for(ConfigList *cl = g_config.lists; cl && cl->name; ++cl)
+  {
+    if (!cl->build_list)
+      continue;
+
+    typeof(*s_lists.lists) *list = &s_lists.lists[s_lists.nbLists];
+    list->name = cl->name;
+    list->ring = calloc(s_lists.depth, sizeof(*list->ring));
+    if (!list->ring ||
+        !rr_hashmap_put(s_lists.index, cl->name, strlen(cl->name), s_lists.nbLists++))
+    {
+      LOG_ERROR("out of memory");
+      rr_lists_deinit();
+      return false;
+    }
+  }
+
+  rr_lists_load_ids();
+  return true;
+}
+
+void rr_lists_deinit(void)
+{
+  for(unsigned i = 0; i < s_lists.nbLists; ++i)
+  {
+    RRListsGen *ring = s_lists.lists[i].ring;
+    for(unsigned j = 0; ring && j < s_lists.depth; ++j)
+    {
+      rr_buffer_free(&ring[j].v4);
+      rr_buffer_free(&ring[j].v6);
+    }
+    free(ring);
+  }
+
+  free(s_lists.lists);
+  s_lists.lists   = NULL;
+  s_lists.nbLists = 0;
+  rr_hashmap_deinit(&s_lists.index);
+  pthread_rwlock_destroy(&s_lists.lock);
+}
+
+bool rr_lists_publish(const char *name, unsigned id, unsigned generation,
+  const RRRangeSetV4 *v4, const RRRangeSetV6 *v6)
+{
+  int index = rr_lists_find(name);
+  if (index < 0)
+    return false;
+
+  // pack outside of the lock, the slot is then swapped in
+  RRListsGen gen = { .generation = generation };
+  if (!rr_lists_pack_v4(&gen.v4, v4) ||
+      !rr_lists_pack_v6(&gen.v6, v6))
+  {
+    rr_buffer_free(&gen.v4);
+    rr_buffer_free(&gen.v6);
+    return false;
+  }
+
+  pthread_rwlock_wrlock(&s_lists.lock);
+  typeof(*s_lists.lists) *list = &s_lists.lists[index];
+  RRListsGen old = list->ring[list->head];
+  list->ring[list->head] = gen;
+  list->head       = (list->head + 1) % s_lists.depth;
+  list->id         = id;
+  list->generation = generation;
+  pthread_rwlock_unlock(&s_lists.lock);
+
+  rr_buffer_free(&old.v4);
+  rr_buffer_free(&old.v6);
+
+  if (*g_config.http.cache_dir)
+    rr_lists_write_files(index, generation, v4, v6);
+
+  if (s_lists.notify)
+    s_lists.notify(s_lists.notifyUdata);
+  return true;
+}
+
+void rr_lists_set_notify(RRListsNotifyFn fn, void *udata)
+{
+  s_lists.notify      = fn;
+  s_lists.notifyUdata = udata;
+}
+
+unsigned rr_lists_generation(const char *name)
+{
+  int index = rr_lists_find(name);
+  if (index < 0)
+    return 0;
+
+  pthread_rwlock_rdlock(&s_lists.lock);
+  unsigned generation = s_lists.lists[index].generation;
+  pthread_rwlock_unlock(&s_lists.lock);
+  return generation;
+}
+
+static void rr_lists_get_info(unsigned index, RRListInfo *out)
+{
+  typeof(*s_lists.lists) *list = &s_lists.lists[index];
+
+  pthread_rwlock_rdlock(&s_lists.lock);
+  out->name       = list->name;
+  out->id         = list->id;
+  out->generation = list->generation;
+  pthread_rwlock_unlock(&s_lists.lock);
+
+  out->requests   = atomic_load_explicit(&list->requests  , memory_order_relaxed);
+  out->dbRequests = atomic_load_explicit(&list->dbRequests, memory_order_relaxed);
+}
+
+bool rr_lists_lookup(const char *name, RRListInfo *out)
+{
+  int index = rr_lists_find(name);
+  if (index < 0)
+    return false;
+
+  rr_lists_get_info(index, out);
+  return true;
+}
+
+bool rr_lists_info(unsigned index, RRListInfo *out)
+{
+  if (index >= s_lists.nbLists)
+    return false;
+
+  rr_lists_get_info(index, out);
+  return true;
+}
+
+void rr_lists_count_request(const char *name, bool db)
+{
+  int index = rr_lists_find(name);
+  if (index < 0)
+    return;
+
+  atomic_fetch_add_explicit(&s_lists.lists[index].requests, 1, memory_order_relaxed);
+  if (db)
+    atomic_fetch_add_explicit(&s_lists.lists[index].dbRequests, 1, memory_order_relaxed);
+}
+
+int rr_lists_open(const char *name, bool v6, bool gzip,
+  unsigned *generation, uint64_t *size)
+{
+  int index = rr_lists_find(name);
+  unsigned file = (v6 ? 2 : 0) + (gzip ? 1 : 0);
+  if (index < 0 || !*g_config.http.cache_dir || !rr_lists_file_enabled(file))
+    return -1;
+
+  pthread_rwlock_rdlock(&s_lists.lock);
+  unsigned before = s_lists.lists[index].fileGeneration;
+  pthread_rwlock_unlock(&s_lists.lock);
+  if (!before)
+    return -1;
+
+  char path[PATH_MAX];
+  if (!rr_lists_path(path, sizeof(path), name, file, ""))
+    return -1;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  // a rename between the two reads clears fileGeneration, so it differs
+  pthread_rwlock_rdlock(&s_lists.lock);
+  unsigned after = s_lists.lists[index].fileGeneration;
+  pthread_rwlock_unlock(&s_lists.lock);
+
+  struct stat st;
+  if (after != before || fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  *generation = before;
+  *size       = st.st_size;
+  return fd;
+}
+
+static const RRListsGen *rr_lists_get(int index, unsigned generation)
+{
+  if (index < 0 || generation == 0)
+    return NULL;
+
+  RRListsGen *ring = s_lists.lists[index].ring;
+  for(unsigned i = 0; i < s_lists.depth; ++i)
+    if (ring[i].generation == generation)
+      return &ring[i];
+  return NULL;
+}
+
+int rr_lists_get_v4(const char *name, unsigned generation, RRRangeSetV4 *out)
+{
+  int index = rr_lists_find(name);
+
+  pthread_rwlock_rdlock(&s_lists.lock);
+  const RRListsGen *gen = rr_lists_get(index, generation);
+  int rc = gen ? rr_lists_unpack_v4(&gen->v4, out) : 0;
+  pthread_rwlock_unlock(&s_lists.lock);
+  return rc;
+}
+
+int rr_lists_get_v6(const char *name, unsigned generation, RRRangeSetV6 *out)
+{
+  int index = rr_lists_find(name);
+
+  pthread_rwlock_rdlock(&s_lists.lock);
+  const RRListsGen *gen = rr_lists_get(index, generation);
+  int rc = gen ? rr_lists_unpack_v6(&gen->v6, out) : 0;
+  pthread_rwlock_unlock(&s_lists.lock);
+  return rc;
+}
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "query.h"
 #include "import.h"
+#include "lists.h"
 #include "http.h"
 
 int main(int argc, char *argv[])
@@ -16,6 +17,12 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  if (!rr_lists_init())
+  {
+    LOG_ERROR("rr_lists_init failed");
+    return EXIT_FAILURE;
+  }
+
   if (!rr_import_init())
   {
     LOG_ERROR("rr_import_init failed");
@@ -36,6 +43,7 @@ int main(int argc, char *argv[])
 
   rr_http_deinit();
   rr_import_deinit();
+  rr_lists_deinit();
   rr_db_deinit();
   rr_config_deinit();
   return EXIT_SUCCESS;
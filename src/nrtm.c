@@ -0,0 +1,267 @@
+#include "log.h"
+#include "import.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define NRTM_TIMEOUT 30
+
+static int rr_nrtm_connect(const char *host, int port)
+{
+  char portStr[8];
+  snprintf(portStr, sizeof(portStr), "%d", port);
+
+  struct addrinfo hints =
+  {
+    .ai_family   = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM
+  };
+
+  struct addrinfo *res;
+  int rc = getaddrinfo(host, portStr, &hints, &res);
+  if (rc != 0)
+  {
+    LOG_ERROR("getaddrinfo %s: %s", host, gai_strerror(rc));
+    return -1;
+  }
+
+  int fd = -1;
+  for(struct addrinfo *ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    struct timeval tv = { .tv_sec = NRTM_TIMEOUT };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd < 0)
+    LOG_ERROR("failed to connect to %s:%d", host, port);
+
+  return fd;
+}
+
+static bool rr_nrtm_send(int fd, const char *buf, size_t len)
+{
+  while(len)
+  {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+      LOG_ERROR("send failed");
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+struct NRTMState
+{
+  RRRPSLState *rpsl;
+  const char  *registrar;
+  const char  *source;
+  unsigned     serial;
+
+  bool     started;
+  bool     ended;
+  bool     resync;
+  unsigned applied;
+  unsigned lastSerial;
+};
+
+/*
+  returns false on a fatal error, the stream is also stopped once %END or
+  an error response has been seen
+*/
+static bool rr_nrtm_process_line(char *line, size_t len, struct NRTMState *st)
+{
+  if (len > 0 && line[0] == '%')
+  {
+    unsigned first, last;
+    if (strncmp(line, "%START", 6) == 0)
+    {
+      st->started = true;
+      return true;
+    }
+
+    if (strncmp(line, "%END", 4) == 0)
+    {
+      st->ended = true;
+      return true;
+    }
+
+    if (strncmp(line, "%ERROR:", 7) == 0)
+    {
+      /*
+        401 is returned when the requested range is not in the journal, if we
+        are ahead of the server there is nothing to do, otherwise the journal
+        has been trimmed past our serial and a full reload is required
+      */
+      const char *range = strstr(line, "Not within ");
+      if (range && sscanf(range + 11, "%u-%u", &first, &last) == 2)
+      {
+        if (st->serial + 1 <= last)
+          st->resync = true;
+        st->ended = true;
+        return true;
+      }
+
+      // an invalid range at the head of the journal means we are up to date
+      if (strstr(line, "Invalid range"))
+      {
+        st->ended = true;
+        return true;
+      }
+
+      LOG_ERROR("%s: %s", st->registrar, line);
+      return false;
+    }
+
+    // any other '%' line is a server comment
+    return true;
+  }
+
+  if (!st->started)
+    return true;
+
+  unsigned serial;
+  char     op[4];
+  if (len >= 5 && len <= 16 && sscanf(line, "%3s %u", op, &serial) == 2)
+  {
+    RRRPSLOp rop;
+    if      (strcmp(op, "ADD") == 0) rop = RR_RPSL_OP_REPLACE;
+    else if (strcmp(op, "DEL") == 0) rop = RR_RPSL_OP_DELETE;
+    else goto object;
+
+    // flush the previous object before changing the operation
+    if (!rr_rpsl_state_line(st->rpsl, "", 0))
+      return false;
+
+    rr_rpsl_state_set_op(st->rpsl, rop, serial);
+    if (serial != st->lastSerial)
+      ++st->applied;
+    st->lastSerial = serial;
+    return true;
+  }
+
+object:
+  if (st->applied == 0)
+    return true;
+
+  return rr_rpsl_state_line(st->rpsl, line, len);
+}
+
+int rr_nrtm_update(const char *registrar, const char *host, int port,
+  const char *source, int version, unsigned registrar_id, unsigned serial,
+  unsigned *out_serial, bool *out_resync)
+{
+  int ret = -1;
+  *out_serial = serial;
+  *out_resync = false;
+
+  struct NRTMState st =
+  {
+    .registrar  = registrar,
+    .source     = source,
+    .serial     = serial,
+    .lastSerial = serial
+  };
+
+  st.rpsl = rr_rpsl_state_new(registrar, registrar_id);
+  if (!st.rpsl)
+    return -1;
+
+  int fd = rr_nrtm_connect(host, port);
+  if (fd < 0)
+    goto err_connect;
+
+  char req[256];
+  int reqLen = snprintf(req, sizeof(req), "-g %s:%d:%u-LAST\n",
+    source, version, serial + 1);
+  if (reqLen < 0 || (size_t)reqLen >= sizeof(req))
+  {
+    LOG_ERROR("%s: NRTM source name too long", registrar);
+    goto err_send;
+  }
+
+  if (!rr_nrtm_send(fd, req, reqLen))
+    goto err_send;
+
+  size_t bufSize = 64*1024;
+  char  *buf     = malloc(bufSize);
+  if (!buf)
+  {
+    LOG_ERROR("out of memory");
+    goto err_send;
+  }
+
+  size_t  used = 0;
+  ssize_t n;
+  while(!st.ended && (n = recv(fd, buf + used, bufSize - used, 0)) > 0)
+  {
+    used += n;
+
+    char *line = buf;
+    char *end  = buf + used;
+    char *nl;
+    while(!st.ended && (nl = memchr(line, '\n', end - line)))
+    {
+      size_t len = nl - line;
+      if (len > 0 && line[len - 1] == '\r')
+        --len;
+      line[len] = '\0';
+
+      if (!rr_nrtm_process_line(line, len, &st))
+        goto err_process;
+
+      line = nl + 1;
+    }
+
+    used = end - line;
+    memmove(buf, line, used);
+
+    if (used == bufSize)
+    {
+      LOG_ERROR("%s: NRTM line too long", registrar);
+      goto err_process;
+    }
+  }
+
+  if (!st.ended)
+  {
+    LOG_ERROR("%s: NRTM stream ended unexpectedly", registrar);
+    goto err_process;
+  }
+
+  // flush the final object
+  if (!rr_rpsl_state_line(st.rpsl, "", 0))
+    goto err_process;
+
+  *out_resync = st.resync;
+  *out_serial = st.lastSerial;
+  ret = st.applied > 0 ? 1 : 0;
+
+err_process:
+  free(buf);
+err_send:
+  close(fd);
+err_connect:
+  rr_rpsl_state_free(&st.rpsl);
+  return ret;
+}
@@ -6,6 +6,21 @@
 
 #include "query_macros.h"
 
+// the fixed size row the address lookups fetch into, see RRDBIPInfo
+typedef struct DBIPInfoRow
+{
+  unsigned long long id;
+  unsigned registrar_id;
+  char     org_handle[RRDB_HANDLE_MAX   + 1];
+  char     org_name  [RRDB_ORG_NAME_MAX + 1];
+  RRDBAddr start_ip;
+  RRDBAddr end_ip;
+  uint8_t  prefix_len;
+  char     netname   [RRDB_NETNAME_MAX  + 1];
+  char     descr     [RRDB_DESCR_MAX    + 1];
+}
+DBIPInfoRow;
+
 typedef struct DBQueryData
 {
   // lookup a registrar record by name
@@ -21,14 +36,14 @@ typedef struct DBQueryData
 
   // lookup best match by address
   STMT_STRUCT(lookup_ipv4_by_addr,
-    uint32_t   in_ipv4;
-    RRDBIPInfo out;
+    uint32_t    in_ipv4;
+    DBIPInfoRow out;
   );
 
   // lookup best match by address
   STMT_STRUCT(lookup_ipv6_by_addr,
     unsigned __int128 in_ipv6;
-    RRDBIPInfo out;
+    DBIPInfoRow       out;
   );
 
   // lookup a list record by name
@@ -131,6 +146,38 @@ int rr_query_registrar_insert(
 }
 #pragma endregion
 
+static bool rr_query_copy_str(RRBuffer *strings, const char *str, RRDBStrRef *out)
+{
+  size_t len = strlen(str);
+  out->off = strings->pos;
+  out->len = len;
+
+  if (rr_buffer_append(strings, str, len) < 0)
+    return false;
+
+  // keep the terminator the append wrote so the string can be used in place
+  ++strings->pos;
+  return true;
+}
+
+static int rr_query_copy_ipinfo(const DBIPInfoRow *row, RRDBIPInfo *out,
+  RRBuffer *strings)
+{
+  out->id           = row->id;
+  out->registrar_id = row->registrar_id;
+  out->start_ip     = row->start_ip;
+  out->end_ip       = row->end_ip;
+  out->prefix_len   = row->prefix_len;
+
+  if (!rr_query_copy_str(strings, row->org_handle, &out->org_handle) ||
+      !rr_query_copy_str(strings, row->org_name  , &out->org_name  ) ||
+      !rr_query_copy_str(strings, row->netname   , &out->netname   ) ||
+      !rr_query_copy_str(strings, row->descr     , &out->descr     ))
+    return -1;
+
+  return 1;
+}
+
 #pragma region lookup_ipv4_by_addr
 DEFAULT_STMT(DBQueryData, lookup_ipv4_by_addr,
   "SELECT "
@@ -188,7 +235,8 @@ DEFAULT_STMT(DBQueryData, lookup_ipv4_by_addr,
 int rr_query_netblockv4_by_ip(
   RRDBCon     *con,
   uint32_t     in_ipv4,
-  RRDBIPInfo  *out)
+  RRDBIPInfo  *out,
+  RRBuffer    *strings)
 {
   DBQueryData *qd = rr_db_get_con_gudata(con);
 
@@ -197,8 +245,7 @@ int rr_query_netblockv4_by_ip(
   if (rc < 1)
     return rc;
 
-  memcpy(out, &qd->lookup_ipv4_by_addr.out, sizeof(*out));
-  return 1;
+  return rr_query_copy_ipinfo(&qd->lookup_ipv4_by_addr.out, out, strings);
 }
 #pragma endregion
 
@@ -258,16 +305,17 @@ DEFAULT_STMT(DBQueryData, lookup_ipv6_by_addr,
 int rr_query_netblockv6_by_ip(
   RRDBCon           *con,
   unsigned __int128  in_ipv6,
-  RRDBIPInfo        *out)
+  RRDBIPInfo        *out,
+  RRBuffer          *strings)
 {
   DBQueryData *qd = rr_db_get_con_gudata(con);
 
   qd->lookup_ipv6_by_addr.in_ipv6 = in_ipv6;
-  if (!rr_db_stmt_fetch_one(qd->lookup_ipv6_by_addr.stmt))
-    return false;
+  int rc = rr_db_stmt_fetch_one(qd->lookup_ipv6_by_addr.stmt);
+  if (rc < 1)
+    return rc;
 
-  memcpy(out, &qd->lookup_ipv6_by_addr.out, sizeof(*out));
-  return true;
+  return rr_query_copy_ipinfo(&qd->lookup_ipv6_by_addr.out, out, strings);
 }
 #pragma endregion
 
@@ -386,7 +434,7 @@ void rr_query_netblockv6_list_end(RRDBCon *con)
 
 #pragma region netblock_v4_list_union
 DEFAULT_STMT(DBQueryData, netblock_v4_list_union,
-  "SELECT ip, prefix_len FROM netblock_v4_list_union WHERE list_id = ?",
+  "SELECT ip, prefix_len FROM netblock_v4_list_union WHERE list_id = ? ORDER BY ip ASC",
   &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in_list_id },
   RRDB_PARAM_OUT,
   &(RRDBParam){ .type = RRDB_TYPE_UINT , .bind = &this->out_ip         },
@@ -428,7 +476,7 @@ void rr_query_netblockv4_list_union_end(RRDBCon *con)
 
 #pragma region netblock_v6_list
 DEFAULT_STMT(DBQueryData, netblock_v6_list_union,
-  "SELECT ip, prefix_len FROM netblock_v6_list_union WHERE list_id = ?",
+  "SELECT ip, prefix_len FROM netblock_v6_list_union WHERE list_id = ? ORDER BY ip ASC",
   &(RRDBParam){ .type = RRDB_TYPE_UINT  , .bind = &this->in_list_id },
   RRDB_PARAM_OUT,
   &(RRDBParam){ .type = RRDB_TYPE_BINARY, .bind = &this->out_ip, .size = sizeof(this->out_ip) },
@@ -0,0 +1,47 @@
+#include "rangeset.h"
+#include "log.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RS_T         uint32_t
+#define RS_BITS      32
+#define RS_RANGE     RRRangeV4
+#define RS_SET       RRRangeSetV4
+#define RS_CIDR_FN   RRRangeSetV4CIDRFn
+#define RS_CURSOR    RRRangeSetV4Cursor
+#define RS_FN(x)     rr_rangeset_v4_ ##x
+#define RS_CTZ(x)    ((unsigned)__builtin_ctz(x))
+#define RS_LOG2(x)   (31u - (unsigned)__builtin_clz(x))
+#include "rangeset_impl.h"
+#undef RS_T
+#undef RS_BITS
+#undef RS_RANGE
+#undef RS_SET
+#undef RS_CIDR_FN
+#undef RS_CURSOR
+#undef RS_FN
+#undef RS_CTZ
+#undef RS_LOG2
+
+#define RS_T         unsigned __int128
+#define RS_BITS      128
+#define RS_RANGE     RRRangeV6
+#define RS_SET       RRRangeSetV6
+#define RS_CIDR_FN   RRRangeSetV6CIDRFn
+#define RS_CURSOR    RRRangeSetV6Cursor
+#define RS_FN(x)     rr_rangeset_v6_ ##x
+#define RS_CTZ(x)    rr_u128_ctz_be(x)
+#define RS_LOG2(x)   rr_u128_msb_be(x)
+#include "rangeset_impl.h"
+#undef RS_T
+#undef RS_BITS
+#undef RS_RANGE
+#undef RS_SET
+#undef RS_CIDR_FN
+#undef RS_CURSOR
+#undef RS_FN
+#undef RS_CTZ
+#undef RS_LOG2
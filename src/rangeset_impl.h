@@ -0,0 +1,584 @@
+/*
+  Range set implementation, included by rangeset.c once for each address
+  width with the following defined:
+
+    RS_T        the address type
+    RS_BITS     the address width in bits
+    RS_RANGE    the range type
+    RS_SET      the set type
+    RS_CIDR_FN  the CIDR callback type
+    RS_CURSOR   the CIDR cursor type
+    RS_FN(x)    the public name of function x
+    RS_CTZ(x)   count of trailing zero bits, x != 0
+    RS_LOG2(x)  floor(log2(x)), x != 0
+*/
+
+#define RS_MAX ((RS_T)-1)
+
+// true if r starts within or directly after last
+#define RS_JOINS(last, r) \
+  ((r).start <= (last).end || ((last).end != RS_MAX && (r).start == (last).end + 1))
+
+void RS_FN(free)(RS_SET *s)
+{
+  free(s->ranges);
+  s->ranges = NULL;
+  s->count  = 0;
+  s->size   = 0;
+}
+
+void RS_FN(clear)(RS_SET *s)
+{
+  s->count = 0;
+}
+
+bool RS_FN(add)(RS_SET *s, RS_T start, RS_T end)
+{
+  if (s->count == s->size)
+  {
+    size_t   newSize   = s->size ? s->size * 2 : 64;
+    RS_RANGE *newRanges = realloc(s->ranges, newSize * sizeof(*newRanges));
+    if (!newRanges)
+    {
+      LOG_ERROR("out of memory");
+      return false;
+    }
+    s->ranges = newRanges;
+    s->size   = newSize;
+  }
+
+  s->ranges[s->count++] = (RS_RANGE){ .start = start, .end = end };
+  return true;
+}
+
+bool RS_FN(copy)(RS_SET *out, const RS_SET *in)
+{
+  RS_FN(clear)(out);
+  for(size_t i = 0; i < in->count; ++i)
+    if (!RS_FN(push)(out, in->ranges[i].start, in->ranges[i].end))
+      return false;
+  return true;
+}
+
+bool RS_FN(push)(RS_SET *s, RS_T start, RS_T end)
+{
+  if (s->count > 0)
+  {
+    RS_RANGE *last = &s->ranges[s->count - 1];
+    RS_RANGE  r    = { .start = start, .end = end };
+    if (RS_JOINS(*last, r))
+    {
+      if (end > last->end)
+        last->end = end;
+      return true;
+    }
+  }
+
+  return RS_FN(add)(s, start, end);
+}
+
+bool RS_FN(normalize)(RS_SET *s)
+{
+  if (s->count < 2)
+    return true;
+
+  RS_RANGE *tmp = malloc(s->count * sizeof(*tmp));
+  if (!tmp)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  // LSD radix sort on the start, a byte at a time
+  RS_RANGE *src = s->ranges;
+  RS_RANGE *dst = tmp;
+  for(unsigned shift = 0; shift < RS_BITS; shift += 8)
+  {
+    size_t hist[256] = { 0 };
+    for(size_t i = 0; i < s->count; ++i)
+      ++hist[(uint8_t)(src[i].start >> shift)];
+
+    // every range has the same byte here, nothing to do
+    if (hist[(uint8_t)(src[0].start >> shift)] == s->count)
+      continue;
+
+    size_t pos = 0;
+    for(unsigned b = 0; b < 256; ++b)
+    {
+      size_t n = hist[b];
+      hist[b]  = pos;
+      pos     += n;
+    }
+
+    for(size_t i = 0; i < s->count; ++i)
+      dst[hist[(uint8_t)(src[i].start >> shift)]++] = src[i];
+
+    RS_RANGE *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != s->ranges)
+    memcpy(s->ranges, src, s->count * sizeof(*src));
+  free(tmp);
+
+  size_t out = 1;
+  for(size_t i = 1; i < s->count; ++i)
+  {
+    RS_RANGE *last = &s->ranges[out - 1];
+    if (RS_JOINS(*last, s->ranges[i]))
+    {
+      if (s->ranges[i].end > last->end)
+        last->end = s->ranges[i].end;
+      continue;
+    }
+
+    s->ranges[out++] = s->ranges[i];
+  }
+
+  s->count = out;
+  return true;
+}
+
+bool RS_FN(union)(RS_SET *out, const RS_SET *a, const RS_SET *b)
+{
+  RS_FN(clear)(out);
+
+  size_t i = 0, j = 0;
+  while(i < a->count || j < b->count)
+  {
+    const RS_RANGE *r =
+      j == b->count                                   ? &a->ranges[i++] :
+      i == a->count                                   ? &b->ranges[j++] :
+      a->ranges[i].start <= b->ranges[j].start        ? &a->ranges[i++] :
+                                                        &b->ranges[j++];
+
+    if (!RS_FN(push)(out, r->start, r->end))
+      return false;
+  }
+
+  return true;
+}
+
+bool RS_FN(intersect)(RS_SET *out, const RS_SET *a, const RS_SET *b)
+{
+  RS_FN(clear)(out);
+
+  size_t i = 0, j = 0;
+  while(i < a->count && j < b->count)
+  {
+    const RS_RANGE *ra = &a->ranges[i];
+    const RS_RANGE *rb = &b->ranges[j];
+
+    RS_T start = ra->start > rb->start ? ra->start : rb->start;
+    RS_T end   = ra->end   < rb->end   ? ra->end   : rb->end;
+    if (start <= end && !RS_FN(add)(out, start, end))
+      return false;
+
+    if (ra->end < rb->end)
+      ++i;
+    else
+      ++j;
+  }
+
+  return true;
+}
+
+bool RS_FN(difference)(RS_SET *out, const RS_SET *a, const RS_SET *b)
+{
+  RS_FN(clear)(out);
+
+  size_t j = 0;
+  for(size_t i = 0; i < a->count; ++i)
+  {
+    const RS_RANGE *r = &a->ranges[i];
+    RS_T cur     = r->start;
+    bool covered = false;
+
+    while(j < b->count && b->ranges[j].end < cur)
+      ++j;
+
+    for(size_t k = j; k < b->count && b->ranges[k].start <= r->end; ++k)
+    {
+      if (b->ranges[k].start > cur &&
+          !RS_FN(add)(out, cur, b->ranges[k].start - 1))
+        return false;
+
+      if (b->ranges[k].end >= r->end)
+      {
+        covered = true;
+        break;
+      }
+
+      cur = b->ranges[k].end + 1;
+    }
+
+    if (!covered && !RS_FN(add)(out, cur, r->end))
+      return false;
+  }
+
+  return true;
+}
+
+bool RS_FN(complement)(RS_SET *out, const RS_SET *a)
+{
+  RS_FN(clear)(out);
+
+  RS_T cur = 0;
+  for(size_t i = 0; i < a->count; ++i)
+  {
+    const RS_RANGE *r = &a->ranges[i];
+    if (r->start > cur && !RS_FN(add)(out, cur, r->start - 1))
+      return false;
+
+    if (r->end == RS_MAX)
+      return true;
+
+    cur = r->end + 1;
+  }
+
+  return RS_FN(add)(out, cur, RS_MAX);
+}
+
+bool RS_FN(cidr_next)(const RS_SET *s, RS_CURSOR *c, RS_T *ip,
+  uint8_t *prefix_len)
+{
+  if (c->index >= s->count)
+    return false;
+
+  if (!c->active)
+  {
+    c->cur    = s->ranges[c->index].start;
+    c->active = true;
+  }
+
+  // the block is limited by the alignment of cur and the size remaining
+  RS_T     end    = s->ranges[c->index].end;
+  RS_T     remain = end - c->cur + 1;
+  unsigned align  = c->cur == 0 ? RS_BITS : RS_CTZ(c->cur);
+  unsigned size   = remain == 0 ? RS_BITS : RS_LOG2(remain);
+  unsigned bits   = align < size ? align : size;
+
+  *ip         = c->cur;
+  *prefix_len = (uint8_t)(RS_BITS - bits);
+
+  RS_T last = bits == RS_BITS ? RS_MAX : c->cur + (((RS_T)1 << bits) - 1);
+  if (last >= end)
+  {
+    ++c->index;
+    c->active = false;
+  }
+  else
+    c->cur = last + 1;
+
+  return true;
+}
+
+bool RS_FN(cidrs)(const RS_SET *s, RS_CIDR_FN fn, void *udata)
+{
+  RS_CURSOR c = { 0 };
+  RS_T      ip;
+  uint8_t   prefix_len;
+
+  while(RS_FN(cidr_next)(s, &c, &ip, &prefix_len))
+    if (!fn(udata, ip, prefix_len))
+      return false;
+
+  return true;
+}
+
+/*
+  Lossy aggregation. The CIDRs of the set are the leaves of a binary trie in
+  which each branch is the smallest prefix covering both of its halves.
+  Collapsing a branch into its prefix saves all but one of its entries at
+  the cost of the space it does not cover yet, the cheapest branch per entry
+  saved is collapsed until the set fits.
+*/
+typedef struct RS_FN(agg_node)
+{
+  RS_T     ip;
+  uint8_t  prefix_len;
+  bool     collapsed;
+  bool     dead;
+  bool     dirty;    // entries and covered are out of date
+  int32_t  left, right, parent;
+  size_t   entries;
+  double   covered;
+}
+RS_FN(agg_node);
+
+// a 4-ary heap of branches by cost, half as deep as a binary one
+typedef struct RS_FN(agg_heap)
+{
+  double  key;
+  int32_t node;
+}
+RS_FN(agg_heap);
+
+static inline double RS_FN(agg_size)(uint8_t prefix_len)
+{
+  return ldexp(1.0, RS_BITS - prefix_len);
+}
+
+static void RS_FN(agg_totals)(RS_FN(agg_node) *nodes, int32_t n)
+{
+  RS_FN(agg_node) *node = &nodes[n];
+  if (node->left < 0)
+    return;
+
+  RS_FN(agg_totals)(nodes, node->left );
+  RS_FN(agg_totals)(nodes, node->right);
+  node->entries = nodes[node->left].entries + nodes[node->right].entries;
+  node->covered = nodes[node->left].covered + nodes[node->right].covered;
+}
+
+// bring the totals of a branch up to date from its dirty descendants
+static void RS_FN(agg_refresh)(RS_FN(agg_node) *nodes, int32_t n)
+{
+  RS_FN(agg_node) *node = &nodes[n];
+  if (!node->dirty)
+    return;
+
+  RS_FN(agg_refresh)(nodes, node->left );
+  RS_FN(agg_refresh)(nodes, node->right);
+  node->entries = nodes[node->left].entries + nodes[node->right].entries;
+  node->covered = nodes[node->left].covered + nodes[node->right].covered;
+  node->dirty   = false;
+}
+
+// below a dead or collapsed node everything is already dead
+static void RS_FN(agg_kill)(RS_FN(agg_node) *nodes, int32_t n)
+{
+  if (n < 0 || nodes[n].dead)
+    return;
+
+  nodes[n].dead = true;
+  if (nodes[n].collapsed)
+    return;
+
+  RS_FN(agg_kill)(nodes, nodes[n].left );
+  RS_FN(agg_kill)(nodes, nodes[n].right);
+}
+
+static bool RS_FN(agg_emit)(RS_SET *out, const RS_FN(agg_node) *nodes, int32_t n)
+{
+  const RS_FN(agg_node) *node = &nodes[n];
+  if (node->collapsed || node->left < 0)
+  {
+    RS_T host = node->prefix_len >= RS_BITS ? 0 : RS_MAX >> node->prefix_len;
+    return RS_FN(add)(out, node->ip, node->ip | host);
+  }
+
+  return
+    RS_FN(agg_emit)(out, nodes, node->left ) &&
+    RS_FN(agg_emit)(out, nodes, node->right);
+}
+
+// the space added per entry saved by collapsing the branch
+static inline double RS_FN(agg_key)(const RS_FN(agg_node) *node)
+{
+  return (RS_FN(agg_size)(node->prefix_len) - node->covered) /
+    (double)(node->entries - 1);
+}
+
+// cheapest first, ties in node order so the result does not depend on the heap
+static inline bool RS_FN(agg_before)(const RS_FN(agg_heap) *a,
+  const RS_FN(agg_heap) *b)
+{
+  return a->key < b->key || (a->key == b->key && a->node < b->node);
+}
+
+static void RS_FN(agg_sift_down)(RS_FN(agg_heap) *heap, size_t count, size_t i)
+{
+  RS_FN(agg_heap) e = heap[i];
+  while(true)
+  {
+    size_t c = i * 4 + 1;
+    if (c >= count)
+      break;
+
+    size_t last = c + 4 < count ? c + 4 : count;
+    size_t best = c;
+    for(++c; c < last; ++c)
+      if (RS_FN(agg_before)(&heap[c], &heap[best]))
+        best = c;
+
+    if (!RS_FN(agg_before)(&heap[best], &e))
+      break;
+    heap[i] = heap[best];
+    i = best;
+  }
+  heap[i] = e;
+}
+
+// the heap has room, at most one entry is kept per branch
+static void RS_FN(agg_push)(RS_FN(agg_heap) *heap, size_t *count,
+  const RS_FN(agg_heap) *e)
+{
+  size_t i = (*count)++;
+  while(i > 0 && RS_FN(agg_before)(e, &heap[(i - 1) / 4]))
+  {
+    heap[i] = heap[(i - 1) / 4];
+    i = (i - 1) / 4;
+  }
+  heap[i] = *e;
+}
+
+static RS_FN(agg_heap) RS_FN(agg_pop)(RS_FN(agg_heap) *heap, size_t *count)
+{
+  RS_FN(agg_heap) top = heap[0];
+  if (--*count > 0)
+  {
+    heap[0] = heap[*count];
+    RS_FN(agg_sift_down)(heap, *count, 0);
+  }
+  return top;
+}
+
+bool RS_FN(aggregate)(RS_SET *out, const RS_SET *in, size_t max,
+  unsigned maxprefix)
+{
+  RS_FN(clear)(out);
+
+  // widen every range to the longest allowed prefix
+  RS_T host = maxprefix >= RS_BITS ? 0 : RS_MAX >> maxprefix;
+  for(size_t i = 0; i < in->count; ++i)
+    if (!RS_FN(add)(out, in->ranges[i].start & ~host, in->ranges[i].end | host))
+      return false;
+
+  if (!RS_FN(normalize)(out))
+    return false;
+
+  if (max == 0)
+    return true;
+
+  // count the CIDRs, there is nothing to do if they already fit
+  RS_CURSOR c = { 0 };
+  RS_T      ip;
+  uint8_t   prefix_len;
+  size_t    leaves = 0;
+  while(RS_FN(cidr_next)(out, &c, &ip, &prefix_len))
+    ++leaves;
+
+  if (leaves <= max)
+    return true;
+
+  bool              ret     = false;
+  size_t            nbHeap  = 0;
+  RS_FN(agg_heap)  *heap    = malloc(leaves * sizeof(*heap));
+  int32_t          *stack   = malloc((leaves * 2) * sizeof(*stack));
+  RS_FN(agg_node)  *nodes   = malloc((leaves * 2) * sizeof(*nodes));
+  int32_t           nbNodes = 0, nbStack = 0;
+  if (!heap || !stack || !nodes)
+  {
+    LOG_ERROR("out of memory");
+    goto err;
+  }
+
+  // build the trie as a cartesian tree over the common prefixes of neighbours
+  memset(&c, 0, sizeof(c));
+  while(RS_FN(cidr_next)(out, &c, &ip, &prefix_len))
+  {
+    int32_t leaf = nbNodes++;
+    nodes[leaf] = (RS_FN(agg_node))
+    {
+      .ip         = ip,
+      .prefix_len = prefix_len,
+      .left       = -1,
+      .right      = -1,
+      .parent     = -1,
+      .entries    = 1,
+      .covered    = RS_FN(agg_size)(prefix_len)
+    };
+
+    if (nbStack == 0)
+    {
+      stack[nbStack++] = leaf;
+      continue;
+    }
+
+    RS_T     prev = nodes[stack[nbStack - 1]].ip;
+    RS_T     diff = prev ^ ip;
+    unsigned cpl  = RS_BITS - 1 - RS_LOG2(diff);
+
+    int32_t last = -1;
+    while(nbStack > 0 && nodes[stack[nbStack - 1]].prefix_len > cpl)
+      last = stack[--nbStack];
+
+    RS_T    mask   = cpl == 0 ? 0 : ~(RS_MAX >> cpl);
+    int32_t branch = nbNodes++;
+    nodes[branch] = (RS_FN(agg_node))
+    {
+      .ip         = ip & mask,
+      .prefix_len = cpl,
+      .left       = last,
+      .right      = leaf,
+      .parent     = nbStack > 0 ? stack[nbStack - 1] : -1
+    };
+    nodes[last].parent = branch;
+    nodes[leaf].parent = branch;
+    if (nbStack > 0)
+      nodes[stack[nbStack - 1]].right = branch;
+
+    stack[nbStack++] = branch;
+    stack[nbStack++] = leaf;
+  }
+
+  int32_t root = stack[0];
+  RS_FN(agg_totals)(nodes, root);
+
+  // every branch, leaves - 1 of them, heapified at once
+  for(int32_t n = 0; n < nbNodes; ++n)
+    if (nodes[n].left >= 0)
+      heap[nbHeap++] = (RS_FN(agg_heap)){ RS_FN(agg_key)(&nodes[n]), n };
+  for(size_t i = (nbHeap + 2) / 4; i-- > 0;)
+    RS_FN(agg_sift_down)(heap, nbHeap, i);
+
+  /*
+    A collapse only raises the cost of the branches above it, so they are
+    just marked dirty, up to the first that already is. Their totals are
+    brought up to date when they come up, and if the cost has changed they
+    are pushed again in the place of the entry just popped.
+  */
+  size_t total = leaves;
+  while(total > max && nbHeap > 0)
+  {
+    RS_FN(agg_heap) e    = RS_FN(agg_pop)(heap, &nbHeap);
+    RS_FN(agg_node) *node = &nodes[e.node];
+    if (node->dead || node->collapsed)
+      continue;
+
+    RS_FN(agg_refresh)(nodes, e.node);
+    double key = RS_FN(agg_key)(node);
+    if (key != e.key)
+    {
+      e.key = key;
+      RS_FN(agg_push)(heap, &nbHeap, &e);
+      continue;
+    }
+
+    total -= node->entries - 1;
+
+    RS_FN(agg_kill)(nodes, node->left );
+    RS_FN(agg_kill)(nodes, node->right);
+    node->collapsed = true;
+    node->entries   = 1;
+    node->covered   = RS_FN(agg_size)(node->prefix_len);
+
+    // the branches above now cover more with fewer entries
+    for(int32_t p = node->parent; p >= 0 && !nodes[p].dirty; p = nodes[p].parent)
+      nodes[p].dirty = true;
+  }
+
+  RS_FN(clear)(out);
+  ret = RS_FN(agg_emit)(out, nodes, root) && RS_FN(normalize)(out);
+
+err:
+  free(heap);
+  free(stack);
+  free(nodes);
+  return ret;
+}
+
+#undef RS_JOINS
+#undef RS_MAX
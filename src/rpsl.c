@@ -1,12 +1,14 @@
 #include "log.h"
 #include "util.h"
+#include "config.h"
 #include "import.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <zlib.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <assert.h>
 
 enum RecordType
@@ -24,10 +26,29 @@ enum Registrar
   REGISTRAR_APNIC
 };
 
+struct RPSLChunk;
+
+/*
+  string fields of the current record, for orgs these are the handle, name and
+  descr, for netblocks the org handle, netname and descr
+*/
+enum RecordField
+{
+  FIELD_HANDLE,
+  FIELD_NAME,
+  FIELD_DESCR,
+
+  FIELD_MAX
+};
+
 struct ProcessState
 {
+  // when set records are packed into the chunk instead of written to the DB
+  struct RPSLChunk *sink;
+
   unsigned serial;
   enum Registrar registrar;
+  RRRPSLOp       op;
 
   bool            inRecord;
   enum RecordType recordType;
@@ -38,6 +59,7 @@ struct ProcessState
   unsigned long long numOrg;
   unsigned long long numInetnum;
   unsigned long long numInet6num;
+  unsigned long long numDeleted;
 
   union
   {
@@ -45,29 +67,70 @@ struct ProcessState
     RRDBNetBlock inetnum;
   }
   x;
+
+  // backing storage for the views in x, reused between records
+  RRBuffer field[FIELD_MAX];
 };
 
+static inline const char *rr_rpsl_field(struct ProcessState *state,
+  enum RecordField field)
+{
+  return state->field[field].buffer ? state->field[field].buffer : "";
+}
+
+static inline size_t rr_rpsl_field_max(struct ProcessState *state,
+  enum RecordField field)
+{
+  switch(field)
+  {
+    case FIELD_HANDLE: return RRDB_HANDLE_MAX;
+    case FIELD_NAME  : return state->recordType == RECORD_TYPE_ORG ?
+                         RRDB_ORG_NAME_MAX : RRDB_NETNAME_MAX;
+    case FIELD_DESCR : return RRDB_DESCR_MAX;
+    case FIELD_MAX   : break;
+  }
+  return 0;
+}
+
+// point the record's views at the field buffers
+static void rr_rpsl_bind_fields(struct ProcessState *state)
+{
+  if (state->recordType == RECORD_TYPE_ORG)
+  {
+    state->x.org.handle = rr_buffer_view(&state->field[FIELD_HANDLE]);
+    state->x.org.name   = rr_buffer_view(&state->field[FIELD_NAME  ]);
+    state->x.org.descr  = rr_buffer_view(&state->field[FIELD_DESCR ]);
+  }
+  else
+  {
+    state->x.inetnum.org_handle = rr_buffer_view(&state->field[FIELD_HANDLE]);
+    state->x.inetnum.netname    = rr_buffer_view(&state->field[FIELD_NAME  ]);
+    state->x.inetnum.descr      = rr_buffer_view(&state->field[FIELD_DESCR ]);
+  }
+}
+
 static bool rr_rpsl_skip_inetnum(struct ProcessState *state)
 {
+  const char *netname = rr_rpsl_field(state, FIELD_NAME);
   switch(state->registrar)
   {
     case REGISTRAR_RIPE:
       return
-        (strncmp(state->x.inetnum.netname, "NON-RIPE-", 9) == 0) ||
-        (strncmp(state->x.inetnum.netname, "IANA-BLK" , 8) == 0);
+        (strncmp(netname, "NON-RIPE-", 9) == 0) ||
+        (strncmp(netname, "IANA-BLK" , 8) == 0);
 
     case REGISTRAR_APNIC:
       return
-        (strcmp (state->x.inetnum.netname, "APNIC-AP"              ) == 0) ||
-        (strncmp(state->x.inetnum.netname, "IANA-NETBLOCK-"    , 14) == 0) ||
-        (strcmp (state->x.inetnum.netname, "IANA-BLOCK"            ) == 0) ||
-        (strcmp (state->x.inetnum.netname, "ARIN-CIDR-BLOCK"       ) == 0) ||
-        (strcmp (state->x.inetnum.netname, "RIPE-CIDR-BLOCK"       ) == 0) ||
-        (strncmp(state->x.inetnum.netname, "JPNIC-NET-JP"      , 12) == 0) ||
-        (strcmp (state->x.inetnum.netname, "JPNICNET"              ) == 0) ||
-        (strcmp (state->x.inetnum.netname, "OCN-JPNIC-JP"          ) == 0) ||
-        (strcmp (state->x.inetnum.netname, "LACNIC-CIDR-BLOCK"     ) == 0) ||
-        (strcmp (state->x.inetnum.netname, "AFRINIC-CIDR-BLOCK"    ) == 0);
+        (strcmp (netname, "APNIC-AP"              ) == 0) ||
+        (strncmp(netname, "IANA-NETBLOCK-"    , 14) == 0) ||
+        (strcmp (netname, "IANA-BLOCK"            ) == 0) ||
+        (strcmp (netname, "ARIN-CIDR-BLOCK"       ) == 0) ||
+        (strcmp (netname, "RIPE-CIDR-BLOCK"       ) == 0) ||
+        (strncmp(netname, "JPNIC-NET-JP"      , 12) == 0) ||
+        (strcmp (netname, "JPNICNET"              ) == 0) ||
+        (strcmp (netname, "OCN-JPNIC-JP"          ) == 0) ||
+        (strcmp (netname, "LACNIC-CIDR-BLOCK"     ) == 0) ||
+        (strcmp (netname, "AFRINIC-CIDR-BLOCK"    ) == 0);
 
     case REGISTRAR_GENERIC:
       return false;
@@ -75,7 +138,243 @@ static bool rr_rpsl_skip_inetnum(struct ProcessState *state)
   return false;
 }
 
-static bool rr_rpsl_process_line(char * line, size_t len, struct ProcessState *state)
+/*
+  The gzip import inflates into large chunks that end on a record boundary,
+  these are parsed by a pool of workers which pack the resulting records into
+  the chunk. The chunks are then written to the database in the order they
+  were read by the importing thread as it owns the DB connection.
+*/
+#define RPSL_CHUNK_SIZE (8*1024*1024)
+
+enum ChunkState
+{
+  CHUNK_FREE,
+  CHUNK_READY,
+  CHUNK_BUSY,
+  CHUNK_DONE,
+  CHUNK_FAILED
+};
+
+struct RPSLChunk
+{
+  enum ChunkState    state;
+  unsigned long long seq;
+
+  char   *data;
+  size_t  dataLen;
+  size_t  dataSz;
+
+  uint8_t *rec;
+  size_t   recLen;
+  size_t   recSz;
+
+  unsigned long long numLines;
+  unsigned long long numIngore;
+  unsigned long long numOrg;
+  unsigned long long numInetnum;
+  unsigned long long numInet6num;
+};
+
+struct RPSLPacked
+{
+  uint8_t  type;
+  uint8_t  prefixLen;
+  uint16_t len[3];
+  RRDBAddr startAddr;
+  RRDBAddr endAddr;
+};
+
+static bool rr_rpsl_chunk_put(struct RPSLChunk *chunk, enum RecordType type,
+  struct ProcessState *state)
+{
+  struct RPSLPacked hdr = { .type = type };
+  if (type != RECORD_TYPE_ORG)
+  {
+    hdr.prefixLen = state->x.inetnum.prefixLen;
+    hdr.startAddr = state->x.inetnum.startAddr;
+    hdr.endAddr   = state->x.inetnum.endAddr;
+  }
+
+  static_assert(FIELD_MAX == ARRAY_SIZE(hdr.len));
+  size_t need = sizeof(hdr);
+  for(int i = 0; i < FIELD_MAX; ++i)
+  {
+    hdr.len[i] = state->field[i].pos;
+    need      += hdr.len[i];
+  }
+
+  if (chunk->recLen + need > chunk->recSz)
+  {
+    size_t newSz = chunk->recSz ? chunk->recSz : 1024*1024;
+    while(newSz < chunk->recLen + need)
+      newSz *= 2;
+
+    uint8_t *newRec = realloc(chunk->rec, newSz);
+    if (!newRec)
+    {
+      LOG_ERROR("out of memory");
+      return false;
+    }
+    chunk->rec   = newRec;
+    chunk->recSz = newSz;
+  }
+
+  uint8_t *p = chunk->rec + chunk->recLen;
+  memcpy(p, &hdr, sizeof(hdr));
+  p += sizeof(hdr);
+  for(int i = 0; i < FIELD_MAX; ++i)
+  {
+    if (hdr.len[i])
+      memcpy(p, state->field[i].buffer, hdr.len[i]);
+    p += hdr.len[i];
+  }
+  chunk->recLen += need;
+  return true;
+}
+
+static bool rr_rpsl_store_org(struct ProcessState *state)
+{
+  if (state->sink)
+  {
+    ++state->numOrg;
+    return rr_rpsl_chunk_put(state->sink, RECORD_TYPE_ORG, state);
+  }
+
+  rr_rpsl_bind_fields(state);
+  state->x.org.registrar_id = state->registrar_id;
+  state->x.org.serial       = state->serial;
+
+  if (state->op == RR_RPSL_OP_DELETE)
+  {
+    if (!rr_import_org_delete(&state->x.org))
+      return false;
+    ++state->numDeleted;
+    return true;
+  }
+
+  // orgs are keyed by handle so the upsert also covers RR_RPSL_OP_REPLACE
+  if (!rr_import_org_insert(&state->x.org))
+    return false;
+  ++state->numOrg;
+  return true;
+}
+
+static bool rr_rpsl_store_inetnum(struct ProcessState *state, bool v6)
+{
+  if (rr_rpsl_skip_inetnum(state))
+    return true;
+
+  rr_rpsl_bind_fields(state);
+  state->x.inetnum.registrar_id = state->registrar_id;
+  state->x.inetnum.serial       = state->serial;
+
+  /*
+    netblocks are keyed by org handle and range, a replacement may have moved
+    the range to another org so remove any previous version first
+  */
+  if (state->op != RR_RPSL_OP_INSERT)
+  {
+    if (!(v6 ?
+      rr_import_netblockv6_delete(&state->x.inetnum) :
+      rr_import_netblockv4_delete(&state->x.inetnum)))
+      return false;
+
+    if (state->op == RR_RPSL_OP_DELETE)
+    {
+      ++state->numDeleted;
+      return true;
+    }
+  }
+
+  if (!rr_sanatize_buffer(&state->field[FIELD_DESCR], RRDB_DESCR_MAX))
+    return false;
+  rr_rpsl_bind_fields(state);
+
+  if (state->sink)
+  {
+    if (v6)
+      ++state->numInet6num;
+    else
+      ++state->numInetnum;
+    return rr_rpsl_chunk_put(state->sink,
+      v6 ? RECORD_TYPE_INET6NUM : RECORD_TYPE_INETNUM, state);
+  }
+
+  if (!(v6 ?
+    rr_import_netblockv6_insert(&state->x.inetnum) :
+    rr_import_netblockv4_insert(&state->x.inetnum)))
+    return false;
+
+  if (v6)
+    ++state->numInet6num;
+  else
+    ++state->numInetnum;
+  return true;
+}
+
+enum Attribute
+{
+  ATTR_UNKNOWN,
+  ATTR_ORGANISATION,
+  ATTR_INETNUM,
+  ATTR_INET6NUM,
+  ATTR_ORG,
+  ATTR_ORG_NAME,
+  ATTR_NETNAME,
+  ATTR_DESCR
+};
+
+/*
+  Perfect hash over the attributes we handle, the length plus the first
+  character is unique for each of them in the low four bits. A collision from
+  adding a new attribute is caught at compile time by -Woverride-init.
+*/
+#define ATTR_HASH(len, c) (((len) + (uint8_t)(c)) & 0xf)
+#define ATTR(str, c, id) \
+  [ATTR_HASH(sizeof(str) - 1, c)] = { str, sizeof(str) - 1, id }
+
+static const struct
+{
+  const char    *name;
+  uint8_t        len;
+  enum Attribute id;
+}
+s_attributes[16] =
+{
+  ATTR("organisation", 'o', ATTR_ORGANISATION),
+  ATTR("inetnum"     , 'i', ATTR_INETNUM     ),
+  ATTR("inet6num"    , 'i', ATTR_INET6NUM    ),
+  ATTR("org"         , 'o', ATTR_ORG         ),
+  ATTR("org-name"    , 'o', ATTR_ORG_NAME    ),
+  ATTR("netname"     , 'n', ATTR_NETNAME     ),
+  ATTR("descr"       , 'd', ATTR_DESCR       )
+};
+
+#undef ATTR
+
+static inline enum Attribute rr_rpsl_lookup_attribute(const char *name, size_t len)
+{
+  if (len == 0)
+    return ATTR_UNKNOWN;
+
+  const typeof(*s_attributes) *attr = &s_attributes[ATTR_HASH(len, name[0])];
+  if (attr->len == len && memcmp(attr->name, name, len) == 0)
+    return attr->id;
+
+  return ATTR_UNKNOWN;
+}
+
+static inline void rr_rpsl_trim_view(const char **str, size_t *len)
+{
+  const char *s = *str;
+  const char *e = s + *len;
+  while(s < e && (*s     == ' ' || *s     == '\t')) ++s;
+  while(e > s && (e[-1] == ' ' || e[-1] == '\t')) --e;
+  *str = s;
+  *len = e - s;
+}
+
+static bool rr_rpsl_process_line(const char *line, size_t len, struct ProcessState *state)
 {
   if (len == 0)
   {
@@ -89,128 +388,105 @@ static bool rr_rpsl_process_line(char * line, size_t len, struct ProcessState *s
           break;
 
         case RECORD_TYPE_ORG:
-
-          state->x.org.registrar_id = state->registrar_id;
-          state->x.org.serial       = state->serial;
-          if (!rr_import_org_insert(&state->x.org))
+          if (!rr_rpsl_store_org(state))
             return false;
-          ++state->numOrg;
           break;
 
         case RECORD_TYPE_INETNUM:
-        {
-          if (rr_rpsl_skip_inetnum(state))
-            break;
-
-          state->x.inetnum.registrar_id = state->registrar_id;
-          state->x.inetnum.serial       = state->serial;
-
-          rr_sanatize(state->x.inetnum.descr, sizeof(state->x.inetnum.descr));
-          if (!rr_import_netblockv4_insert(&state->x.inetnum))
+          if (!rr_rpsl_store_inetnum(state, false))
             return false;
-          ++state->numInetnum;
           break;
 
         case RECORD_TYPE_INET6NUM:
-          if (rr_rpsl_skip_inetnum(state))
-            break;
-
-          state->x.inetnum.registrar_id = state->registrar_id;
-          state->x.inetnum.serial       = state->serial;
-
-          rr_sanatize(state->x.inetnum.descr, sizeof(state->x.inetnum.descr));
-          if (!rr_import_netblockv6_insert(&state->x.inetnum))
+          if (!rr_rpsl_store_inetnum(state, true))
             return false;
-          ++state->numInet6num;
           break;
-        }
       }
 
       state->inRecord   = false;
       state->recordType = RECORD_TYPE_IGNORE;
       memset(&state->x, 0, sizeof(state->x));
+      for(int i = 0; i < FIELD_MAX; ++i)
+        rr_buffer_reset(&state->field[i]);
     }
     return true;
   }
 
   // skip comments
   {
-    bool comment = true;
-    for(int i = 0; i < len; ++i)
-    {
-      if (line[i] == ' ' || line[i] == '\t')
-        continue;
-      if (line[i] != '#')
-        comment = false;
-      break;
-    }
-    if (comment)
+    size_t i = 0;
+    while(i < len && (line[i] == ' ' || line[i] == '\t'))
+      ++i;
+    if (i == len || line[i] == '#')
       return true;
   }
 
+  const char    *colon = memchr(line, ':', len);
+  enum Attribute attr  = rr_rpsl_lookup_attribute(line,
+    colon ? (size_t)(colon - line) : len);
+
+  const char *value    = NULL;
+  size_t      valueLen = 0;
+  if (colon)
+  {
+    value    = colon + 1;
+    valueLen = line + len - value;
+    rr_rpsl_trim_view(&value, &valueLen);
+  }
+
   // if new record
   if (!state->inRecord)
   {
     state->inRecord = true;
-
-    char *sp    = NULL;
-    char *name  = __strtok_r(line, ":", &sp);
-    if (strcmp(name, "organisation") == 0)
-      state->recordType = RECORD_TYPE_ORG;
-    else if (strcmp(name, "inetnum" ) == 0)
-      state->recordType = RECORD_TYPE_INETNUM;
-    else if (strcmp(name, "inet6num") == 0)
-      state->recordType = RECORD_TYPE_INET6NUM;
-    else
+    switch(attr)
     {
-      state->recordType = RECORD_TYPE_IGNORE;
-      return true;
+      case ATTR_ORGANISATION: state->recordType = RECORD_TYPE_ORG     ; break;
+      case ATTR_INETNUM     : state->recordType = RECORD_TYPE_INETNUM ; break;
+      case ATTR_INET6NUM    : state->recordType = RECORD_TYPE_INET6NUM; break;
+      default:
+        state->recordType = RECORD_TYPE_IGNORE;
+        return true;
     }
 
-    char *value = __strtok_r(NULL, "" , &sp);
-    if (!value)
+    if (valueLen == 0)
     {
       // invalid record had no value
       state->recordType = RECORD_TYPE_IGNORE;
       return true;
     }
 
-    // trim leading whitespace
-    while(*value == ' ')
-      ++value;
-
     switch(state->recordType)
     {
       case RECORD_TYPE_IGNORE:
         return true;
 
       case RECORD_TYPE_ORG:
-        strncpy(state->x.org.handle, value, sizeof(state->x.org.handle));
-        return true;
+        return rr_buffer_append(&state->field[FIELD_HANDLE], value,
+          MIN(valueLen, RRDB_HANDLE_MAX)) >= 0;
 
       case RECORD_TYPE_INETNUM:
       {
-        sp = NULL;
-        char *start = rr_trim(__strtok_r(value, "-", &sp));
-        char *end   = rr_trim(__strtok_r(NULL , "" , &sp));
-        if (!start || !end)
+        const char *dash = memchr(value, '-', valueLen);
+        if (!dash)
         {
           state->recordType = RECORD_TYPE_IGNORE;
           return true;
         }
 
-        static_assert(sizeof(state->x.inetnum.startAddr.v4) == sizeof(struct in_addr));
-        if ((inet_pton(AF_INET, start, (void *)&state->x.inetnum.startAddr.v4) != 1) ||
-            (inet_pton(AF_INET, end  , (void *)&state->x.inetnum.endAddr  .v4) != 1))
+        const char *start    = value;
+        size_t      startLen = dash - value;
+        const char *end      = dash + 1;
+        size_t      endLen   = value + valueLen - end;
+        rr_rpsl_trim_view(&start, &startLen);
+        rr_rpsl_trim_view(&end  , &endLen  );
+
+        if (!rr_parse_ipv4(start, startLen, &state->x.inetnum.startAddr.v4) ||
+            !rr_parse_ipv4(end  , endLen  , &state->x.inetnum.endAddr  .v4))
         {
           state->recordType = RECORD_TYPE_IGNORE;
           return true;
         }
 
-        // convert to host order
-        state->x.inetnum.startAddr.v4 = ntohl(state->x.inetnum.startAddr.v4);
-        state->x.inetnum.endAddr  .v4 = ntohl(state->x.inetnum.endAddr  .v4);
-
         // calculate the cidr prefix len
         state->x.inetnum.prefixLen = rr_ipv4_to_cidr(
           state->x.inetnum.startAddr.v4,
@@ -228,28 +504,37 @@ static bool rr_rpsl_process_line(char * line, size_t len, struct ProcessState *s
 
       case RECORD_TYPE_INET6NUM:
       {
-        sp = NULL;
-        char *start     = rr_trim(__strtok_r(value, "/", &sp));
-        char *prefixLen = rr_trim(__strtok_r(NULL , "" , &sp));
-        if (!start || !prefixLen)
+        const char *slash = memchr(value, '/', valueLen);
+        if (!slash)
         {
           state->recordType = RECORD_TYPE_IGNORE;
           return true;
         }
 
-        static_assert(sizeof(state->x.inetnum.startAddr.v6) == sizeof(struct in6_addr));
-        if (inet_pton(AF_INET6, start, (void *)&state->x.inetnum.startAddr.v6) != 1)
+        const char *start    = value;
+        size_t      startLen = slash - value;
+        rr_rpsl_trim_view(&start, &startLen);
+
+        if (!rr_parse_ipv6(start, startLen, &state->x.inetnum.startAddr.v6))
         {
           state->recordType = RECORD_TYPE_IGNORE;
           return true;
         }
 
-        state->x.inetnum.prefixLen = strtoul(prefixLen, NULL, 10);
-        if (state->x.inetnum.prefixLen == 0 || state->x.inetnum.prefixLen > 64)
+        unsigned    prefixLen = 0;
+        const char *p         = slash + 1;
+        const char *e         = value + valueLen;
+        while(p < e && (*p == ' ' || *p == '\t'))
+          ++p;
+        for(; p < e && *p >= '0' && *p <= '9' && prefixLen <= 128; ++p)
+          prefixLen = prefixLen * 10 + (*p - '0');
+
+        if (prefixLen == 0 || prefixLen > 64)
         {
           state->recordType = RECORD_TYPE_IGNORE;
           return true;
         }
+        state->x.inetnum.prefixLen = prefixLen;
 
         // calculate the end of the segment
         rr_calc_ipv6_cidr_end(
@@ -262,178 +547,502 @@ static bool rr_rpsl_process_line(char * line, size_t len, struct ProcessState *s
     }
   }
 
-  char *sp    = NULL;
-  char *name  = __strtok_r(line, ":", &sp);
-
-  char  *dst      = NULL;
-  size_t dstSz;
-  bool   dstMulti;
+  enum RecordField field;
+  bool             multi;
 
-#define MATCH(a, b, multi) \
-  else if (strcmp(name, a) == 0) \
-    dst = state->x.b, dstSz = sizeof(state->x.b), dstMulti = multi
+#define DST(f, m) field = f, multi = m
 
   switch(state->recordType)
   {
     case RECORD_TYPE_IGNORE:
+    default:
       return true;
 
     case RECORD_TYPE_ORG:
-      if (0) {}
-      MATCH("org-name", org.name , false);
-      MATCH("descr"   , org.descr, true );
+      switch(attr)
+      {
+        case ATTR_ORG_NAME: DST(FIELD_NAME , false); break;
+        case ATTR_DESCR   : DST(FIELD_DESCR, true ); break;
+        default:
+          return true;
+      }
       break;
 
     case RECORD_TYPE_INETNUM:
-      if (0) {}
-      MATCH("org"    , inetnum.org_handle, false);
-      MATCH("netname", inetnum.netname   , false);
-      MATCH("descr"  , inetnum.descr  ,    true );
-      break;
-
     case RECORD_TYPE_INET6NUM:
-      if (0) {}
-      MATCH("org"    , inetnum.org_handle, false);
-      MATCH("netname", inetnum.netname   , false);
-      MATCH("descr"  , inetnum.descr     , true );
+      switch(attr)
+      {
+        case ATTR_ORG    : DST(FIELD_HANDLE, false); break;
+        case ATTR_NETNAME: DST(FIELD_NAME  , false); break;
+        case ATTR_DESCR  : DST(FIELD_DESCR , true ); break;
+        default:
+          return true;
+      }
       break;
   }
 
-#undef MATCH
+#undef DST
 
-  if (!dst)
-    return true;
-
-  char *value = rr_trim(__strtok_r(NULL, "", &sp));
   if (!value)
     return true;
 
-  if (!dstMulti || dst[0] == '\0')
-    strncpy(dst, value, dstSz);
-  else
+  RRBuffer *dst = &state->field[field];
+  size_t    max = rr_rpsl_field_max(state, field);
+  if (!multi)
+    rr_buffer_reset(dst);
+  else if (dst->pos > 0)
+  {
+    if (dst->pos + 1 >= max)
+      return true;
+    if (rr_buffer_append(dst, "\n", 1) < 0)
+      return false;
+  }
+
+  return rr_buffer_append(dst, value, MIN(valueLen, max - dst->pos)) >= 0;
+}
+
+static void rr_rpsl_init_state(struct ProcessState *state, const char *registrar,
+  unsigned registrar_id, unsigned serial)
+{
+  memset(state, 0, sizeof(*state));
+  state->op           = RR_RPSL_OP_INSERT;
+  state->inRecord     = false;
+  state->recordType   = RECORD_TYPE_IGNORE;
+  state->registrar_id = registrar_id;
+  state->serial       = serial;
+
+  if     (strcmp(registrar, "RIPE" ) == 0) state->registrar = REGISTRAR_RIPE;
+  else if(strcmp(registrar, "APNIC") == 0) state->registrar = REGISTRAR_APNIC;
+  else                                     state->registrar = REGISTRAR_GENERIC;
+}
+
+static void rr_rpsl_free_state(struct ProcessState *state)
+{
+  for(int i = 0; i < FIELD_MAX; ++i)
+    rr_buffer_free(&state->field[i]);
+}
+
+struct RRRPSLState
+{
+  struct ProcessState ps;
+};
+
+RRRPSLState *rr_rpsl_state_new(const char *registrar, unsigned registrar_id)
+{
+  RRRPSLState *state = malloc(sizeof(*state));
+  if (!state)
+  {
+    LOG_ERROR("out of memory");
+    return NULL;
+  }
+
+  rr_rpsl_init_state(&state->ps, registrar, registrar_id, 0);
+  return state;
+}
+
+void rr_rpsl_state_free(RRRPSLState **state)
+{
+  if (!*state)
+    return;
+
+  rr_rpsl_free_state(&(*state)->ps);
+  free(*state);
+  *state = NULL;
+}
+
+void rr_rpsl_state_set_op(RRRPSLState *state, RRRPSLOp op, unsigned serial)
+{
+  state->ps.op     = op;
+  state->ps.serial = serial;
+}
+
+bool rr_rpsl_state_line(RRRPSLState *state, const char *line, size_t len)
+{
+  return rr_rpsl_process_line(line, len, &state->ps);
+}
+
+static bool rr_rpsl_parse_chunk(struct RPSLChunk *chunk, struct ProcessState *state)
+{
+  const char *line = chunk->data;
+  const char *end  = chunk->data + chunk->dataLen;
+  while(line < end)
+  {
+    const char *nl  = memchr(line, '\n', end - line);
+    size_t      len = nl ? (size_t)(nl - line) : (size_t)(end - line);
+
+    if (!rr_rpsl_process_line(line, len, state))
+      return false;
+
+    ++chunk->numLines;
+    line += len + 1;
+  }
+
+  // chunks end on a record boundary, flush the trailing record at EOF
+  if (!rr_rpsl_process_line("", 0, state))
+    return false;
+
+  chunk->numIngore   = state->numIngore;
+  chunk->numOrg      = state->numOrg;
+  chunk->numInetnum  = state->numInetnum;
+  chunk->numInet6num = state->numInet6num;
+  return true;
+}
+
+static bool rr_rpsl_emit_chunk(struct RPSLChunk *chunk, struct ProcessState *state)
+{
+  const uint8_t *p   = chunk->rec;
+  const uint8_t *end = chunk->rec + chunk->recLen;
+  while(p < end)
   {
-    size_t len = strlen(dst);
-    if (len + 2 < dstSz)
+    struct RPSLPacked hdr;
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+
+    // the records views point straight into the packed data
+    RRStrView view[FIELD_MAX];
+    for(int i = 0; i < FIELD_MAX; ++i)
     {
-      dst[len] = '\n';
-      strncpy(dst + len + 1, value, dstSz - len + 1);
+      view[i] = (RRStrView){ .str = (const char *)p, .len = hdr.len[i] };
+      p += hdr.len[i];
+    }
+
+    if (hdr.type == RECORD_TYPE_ORG)
+    {
+      state->x.org.handle = view[FIELD_HANDLE];
+      state->x.org.name   = view[FIELD_NAME  ];
+      state->x.org.descr  = view[FIELD_DESCR ];
+    }
+    else
+    {
+      RRDBNetBlock *nb = &state->x.inetnum;
+      nb->prefixLen  = hdr.prefixLen;
+      nb->startAddr  = hdr.startAddr;
+      nb->endAddr    = hdr.endAddr;
+      nb->org_handle = view[FIELD_HANDLE];
+      nb->netname    = view[FIELD_NAME  ];
+      nb->descr      = view[FIELD_DESCR ];
+    }
+
+    bool ok;
+    switch(hdr.type)
+    {
+      case RECORD_TYPE_ORG:
+        state->x.org.registrar_id = state->registrar_id;
+        state->x.org.serial       = state->serial;
+        ok = rr_import_org_insert(&state->x.org);
+        break;
+
+      case RECORD_TYPE_INETNUM:
+      case RECORD_TYPE_INET6NUM:
+        state->x.inetnum.registrar_id = state->registrar_id;
+        state->x.inetnum.serial       = state->serial;
+        ok = hdr.type == RECORD_TYPE_INET6NUM ?
+          rr_import_netblockv6_insert(&state->x.inetnum) :
+          rr_import_netblockv4_insert(&state->x.inetnum);
+        break;
+
+      default:
+        assert(false);
+        ok = false;
     }
-  }
 
+    if (!ok)
+      return false;
+  }
   return true;
 }
 
-static bool rr_rpsl_import_gzFILE(const char *registrar, gzFile gz,
-  unsigned registar_id, unsigned new_serial)
+struct RPSLPool
 {
-  bool ret = false;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  bool            quit;
 
-  struct ProcessState state =
-  {
-    .inRecord     = false,
-    .recordType   = RECORD_TYPE_IGNORE,
-    .registrar_id = registar_id,
-    .serial       = new_serial
-  };
+  const char *registrar;
+  unsigned    registrar_id;
+  unsigned    serial;
 
-  if     (strcmp(registrar, "RIPE" ) == 0) state.registrar = REGISTRAR_RIPE;
-  else if(strcmp(registrar, "APNIC") == 0) state.registrar = REGISTRAR_APNIC;
-  else                                     state.registrar = REGISTRAR_GENERIC;
+  struct RPSLChunk *chunks;
+  unsigned          nbChunks;
+};
 
-  if (!gz)
+static void * rr_rpsl_worker(void *opaque)
+{
+  struct RPSLPool *pool = opaque;
+  struct ProcessState state;
+
+  pthread_mutex_lock(&pool->lock);
+  while(!pool->quit)
   {
-    LOG_ERROR("gzopen failed");
-    goto err_gzopen;
+    // always take the oldest chunk so the emitter is not kept waiting
+    struct RPSLChunk *chunk = NULL;
+    for(unsigned i = 0; i < pool->nbChunks; ++i)
+    {
+      struct RPSLChunk *c = &pool->chunks[i];
+      if (c->state == CHUNK_READY && (!chunk || c->seq < chunk->seq))
+        chunk = c;
+    }
+
+    if (!chunk)
+    {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+      continue;
+    }
+
+    chunk->state = CHUNK_BUSY;
+    pthread_mutex_unlock(&pool->lock);
+
+    rr_rpsl_init_state(&state, pool->registrar, pool->registrar_id, pool->serial);
+    state.sink = chunk;
+    bool ok = rr_rpsl_parse_chunk(chunk, &state);
+    rr_rpsl_free_state(&state);
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->state = ok ? CHUNK_DONE : CHUNK_FAILED;
+    pthread_cond_broadcast(&pool->cond);
   }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
 
-  size_t bufSize = 64*1024;
-  uint8_t *buf   = malloc(bufSize);
-  if (!buf)
+/*
+  Fill the chunk with inflated data ending on a blank line, the partial record
+  that follows is carried over into the next chunk.
+  Returns -1 on error, 0 at EOF, or 1 if there is more to read.
+*/
+static int rr_rpsl_fill_chunk(gzFile gz, struct RPSLChunk *chunk, RRBuffer *carry)
+{
+  size_t want = MAX((size_t)RPSL_CHUNK_SIZE, carry->pos * 2);
+  if (chunk->dataSz < want)
   {
-    LOG_ERROR("out of memory");
-    goto err_gzopen;
+    char *newData = realloc(chunk->data, want);
+    if (!newData)
+    {
+      LOG_ERROR("out of memory");
+      return -1;
+    }
+    chunk->data   = newData;
+    chunk->dataSz = want;
   }
 
-  uint8_t *ptr  = buf;
-  uint8_t *line = buf;
-  unsigned long long lineNo = 0;
-  int n;
+  memcpy(chunk->data, carry->buffer, carry->pos);
+  chunk->dataLen = carry->pos;
+  carry->pos     = 0;
 
-  while((n = gzread(gz, ptr, buf + bufSize - ptr)) > 0)
+  size_t scanFrom = 0;
+  while(true)
   {
-    uint8_t *p = ptr;
-    for(int i = 0; i < n; ++i)
+    while(chunk->dataLen < chunk->dataSz)
     {
-      if (*p++ == '\n')
+      int n = gzread(gz, chunk->data + chunk->dataLen,
+        (unsigned)MIN(chunk->dataSz - chunk->dataLen, (size_t)INT32_MAX));
+      if (n < 0)
       {
-        p[-1] = '\0';
-        if (!rr_rpsl_process_line((char *)line, (size_t)(p - line - 1), &state))
-        {
-          LOG_ERROR("failed to process line");
-          goto err_realloc;
-        }
-        ++lineNo;
-        line = p;
+        int err;
+        LOG_ERROR("gzread failed: %s", gzerror(gz, &err));
+        return -1;
       }
+
+      if (n == 0)
+        return 0;
+
+      chunk->dataLen += n;
     }
 
-    ptr = p;
-    if (p == buf + bufSize)
+    for(size_t i = chunk->dataLen - 1; i > scanFrom; --i)
     {
-      if (line == buf)
-      {
-        const uintptr_t ptrOff  = ptr  - buf;
-        const uintptr_t lineOff = line - buf;
+      if (chunk->data[i] != '\n' || chunk->data[i - 1] != '\n')
+        continue;
 
-        bufSize *= 2;
-        uint8_t *newBuf = realloc(buf, bufSize);
+      size_t rem = chunk->dataLen - (i + 1);
+      if (carry->bufferSz < rem)
+      {
+        char *newBuf = realloc(carry->buffer, rem);
         if (!newBuf)
         {
           LOG_ERROR("out of memory");
-          goto err_realloc;
+          return -1;
         }
-        ptr  = newBuf + ptrOff;
-        line = newBuf + lineOff;
-        buf  = newBuf;
+        carry->buffer   = newBuf;
+        carry->bufferSz = rem;
+      }
+
+      memcpy(carry->buffer, chunk->data + i + 1, rem);
+      carry->pos     = rem;
+      chunk->dataLen = i + 1;
+      return 1;
+    }
+
+    // a single record larger than the chunk, grow it and keep reading
+    scanFrom = chunk->dataLen - 1;
+    size_t newSz = chunk->dataSz * 2;
+    char *newData = realloc(chunk->data, newSz);
+    if (!newData)
+    {
+      LOG_ERROR("out of memory");
+      return -1;
+    }
+    chunk->data   = newData;
+    chunk->dataSz = newSz;
+  }
+}
+
+static bool rr_rpsl_import_gzFILE(const char *registrar, gzFile gz,
+  unsigned registar_id, unsigned new_serial)
+{
+  bool ret = false;
+
+  if (!gz)
+  {
+    LOG_ERROR("gzopen failed");
+    goto err_gzopen;
+  }
+
+  unsigned nbThreads = g_config.import.threads;
+  if (nbThreads == 0)
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nbThreads = n > 0 ? n : 1;
+  }
+
+  struct RPSLPool pool =
+  {
+    .lock         = PTHREAD_MUTEX_INITIALIZER,
+    .cond         = PTHREAD_COND_INITIALIZER,
+    .registrar    = registrar,
+    .registrar_id = registar_id,
+    .serial       = new_serial,
+    .nbChunks     = nbThreads * 2
+  };
+
+  // used by the emitter to rebuild the records for the DB
+  struct ProcessState *state = malloc(sizeof(*state));
+  pool.chunks  = calloc(pool.nbChunks, sizeof(*pool.chunks));
+  pthread_t *threads = calloc(nbThreads, sizeof(*threads));
+  if (!state || !pool.chunks || !threads)
+  {
+    LOG_ERROR("out of memory");
+    goto err_alloc;
+  }
+  rr_rpsl_init_state(state, registrar, registar_id, new_serial);
+
+  RRBuffer carry = { 0 };
+  unsigned long long readSeq  = 0;
+  unsigned long long emitSeq  = 0;
+  unsigned long long lineNo   = 0;
+  bool               eof      = false;
+  bool               failed   = false;
+
+  unsigned nbStarted = 0;
+  for(; nbStarted < nbThreads; ++nbStarted)
+    if (pthread_create(&threads[nbStarted], NULL, rr_rpsl_worker, &pool) != 0)
+    {
+      LOG_ERROR("failed to create the RPSL worker thread");
+      goto err_threads;
+    }
+
+  pthread_mutex_lock(&pool.lock);
+  while(!failed)
+  {
+    struct RPSLChunk *chunk = &pool.chunks[emitSeq % pool.nbChunks];
+    if (emitSeq < readSeq && (chunk->state == CHUNK_DONE || chunk->state == CHUNK_FAILED))
+    {
+      pthread_mutex_unlock(&pool.lock);
+      if (chunk->state == CHUNK_FAILED)
+      {
+        LOG_ERROR("failed to process line");
+        failed = true;
+      }
+      else if (!rr_rpsl_emit_chunk(chunk, state))
+      {
+        LOG_ERROR("failed to store the records");
+        failed = true;
       }
       else
       {
-        size_t rem = (size_t)(ptr - line);
-        memmove(buf, line, rem);
-        line = buf;
-        ptr = buf + rem;
+        lineNo             += chunk->numLines;
+        state->numIngore   += chunk->numIngore;
+        state->numOrg      += chunk->numOrg;
+        state->numInetnum  += chunk->numInetnum;
+        state->numInet6num += chunk->numInet6num;
       }
+
+      chunk->numLines    = 0;
+      chunk->recLen      = 0;
+      pthread_mutex_lock(&pool.lock);
+      chunk->state = CHUNK_FREE;
+      ++emitSeq;
+      continue;
     }
-  }
 
-  if (ptr > line)
-    if (!rr_rpsl_process_line((char *)line, (size_t)(ptr - line), &state))
+    if (!eof && readSeq - emitSeq < pool.nbChunks)
     {
-      LOG_ERROR("failed to process line");
-      goto err_realloc;
+      chunk = &pool.chunks[readSeq % pool.nbChunks];
+      pthread_mutex_unlock(&pool.lock);
+
+      int rc = rr_rpsl_fill_chunk(gz, chunk, &carry);
+      if (rc < 0)
+        failed = true;
+      eof = rc == 0;
+
+      pthread_mutex_lock(&pool.lock);
+      if (!failed)
+      {
+        chunk->seq   = readSeq++;
+        chunk->state = CHUNK_READY;
+        pthread_cond_broadcast(&pool.cond);
+      }
+      continue;
     }
 
-  if (!rr_rpsl_process_line("", 0, &state))
-  {
-    LOG_ERROR("failed to process line");
-    goto err_realloc;
+    if (eof && emitSeq == readSeq)
+      break;
+
+    pthread_cond_wait(&pool.cond, &pool.lock);
   }
 
-  ret = true;
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+  rr_buffer_free(&carry);
 
-err_realloc:
+  ret = !failed;
+
+err_threads:
+  if (nbStarted < nbThreads)
+  {
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  for(unsigned i = 0; i < nbStarted; ++i)
+    pthread_join(threads[i], NULL);
 
   if (ret)
   {
     LOG_INFO("RPSL Statistics");
-    LOG_INFO("  Total Lines: %llu", lineNo           );
-    LOG_INFO("  Orgs       : %llu", state.numOrg     );
-    LOG_INFO("  Inetnum    : %llu", state.numInetnum );
-    LOG_INFO("  Inet6num   : %llu", state.numInet6num);
-    LOG_INFO("  Ignored    : %llu", state.numIngore  );
+    LOG_INFO("  Threads    : %u"  , nbThreads         );
+    LOG_INFO("  Total Lines: %llu", lineNo            );
+    LOG_INFO("  Orgs       : %llu", state->numOrg     );
+    LOG_INFO("  Inetnum    : %llu", state->numInetnum );
+    LOG_INFO("  Inet6num   : %llu", state->numInet6num);
+    LOG_INFO("  Ignored    : %llu", state->numIngore  );
   }
 
-  free(buf);
+err_alloc:
+  if (pool.chunks)
+    for(unsigned i = 0; i < pool.nbChunks; ++i)
+    {
+      free(pool.chunks[i].data);
+      free(pool.chunks[i].rec );
+    }
+  free(pool.chunks);
+  free(threads);
+  free(state);
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
 err_gzopen:
   LOG_INFO(ret ? "success" : "failure");
   return ret;
@@ -2,8 +2,9 @@
 #include "log.h"
 
 #include <stdlib.h>
-#include <ctype.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <unicode/ucsdet.h>
 #include <unicode/ucnv.h>
 #include <unicode/utypes.h>
@@ -87,6 +88,38 @@ ssize_t rr_buffer_append_str(RRBuffer *buf, const char *str)
   return (ssize_t)buf->pos;
 }
 
+bool rr_buffer_reserve(RRBuffer *buf, size_t size)
+{
+  if (buf->buffer && buf->bufferSz >= size)
+    return true;
+
+  size_t newSize = buf->bufferSz ? buf->bufferSz : 256;
+  while (newSize < size)
+    newSize *= 2;
+
+  char *newBuffer = realloc(buf->buffer, newSize);
+  if (!newBuffer)
+  {
+    LOG_ERROR("out of memory");
+    return false;
+  }
+
+  buf->buffer   = newBuffer;
+  buf->bufferSz = newSize;
+  return true;
+}
+
+ssize_t rr_buffer_append(RRBuffer *buf, const char *data, size_t len)
+{
+  if (!rr_buffer_reserve(buf, buf->pos + len + 1))
+    return -1;
+
+  memcpy(buf->buffer + buf->pos, data, len);
+  buf->pos += len;
+  buf->buffer[buf->pos] = '\0';
+  return (ssize_t)buf->pos;
+}
+
 bool rr_buffer_appendf(RRBuffer *buf, const char *fmt, ...)
 {
   va_list ap;
@@ -177,20 +210,157 @@ static size_t scrub_invalid_utf8_inplace(char *s, size_t cap)
   return o;
 }
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// returns the offset of the first non-ascii byte, or len if there is none
+static size_t rr_ascii_prefix(const char *s, size_t len)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  for(; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    if (_mm_movemask_epi8(v))
+      break;
+  }
+#endif
+
+  for(; i + 8 <= len; i += 8)
+  {
+    uint64_t v;
+    memcpy(&v, s + i, sizeof(v));
+    if (v & 0x8080808080808080ULL)
+      break;
+  }
+
+  for(; i < len; ++i)
+    if ((unsigned char)s[i] & 0x80)
+      break;
+
+  return i;
+}
+
+// strict UTF-8 validation, rejects overlongs, surrogates and > U+10FFFF
+static bool rr_valid_utf8(const char *str, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)str;
+  size_t i = 0;
+  while(i < len)
+  {
+    // skip ascii runs quickly
+    if (s[i] < 0x80)
+    {
+      i += rr_ascii_prefix(str + i, len - i);
+      continue;
+    }
+
+    unsigned char b0 = s[i];
+    size_t need;
+    if      (b0 >= 0xC2 && b0 <= 0xDF) need = 2;
+    else if (b0 >= 0xE0 && b0 <= 0xEF) need = 3;
+    else if (b0 >= 0xF0 && b0 <= 0xF4) need = 4;
+    else
+      return false;
+
+    if (i + need > len)
+      return false;
+
+    unsigned char b1 = s[i + 1];
+    if ((b1 & 0xC0) != 0x80)
+      return false;
+
+    if ((b0 == 0xE0 && b1 < 0xA0) ||
+        (b0 == 0xED && b1 > 0x9F) ||
+        (b0 == 0xF0 && b1 < 0x90) ||
+        (b0 == 0xF4 && b1 > 0x8F))
+      return false;
+
+    for(size_t k = 2; k < need; ++k)
+      if ((s[i + k] & 0xC0) != 0x80)
+        return false;
+
+    i += need;
+  }
+  return true;
+}
+
+static struct
+{
+  atomic_ullong ascii;
+  atomic_ullong utf8;
+  atomic_ullong slow;
+}
+s_sanatizeStats;
+
+void rr_sanatize_get_stats(RRSanatizeStats *out)
+{
+  out->ascii = atomic_load_explicit(&s_sanatizeStats.ascii, memory_order_relaxed);
+  out->utf8  = atomic_load_explicit(&s_sanatizeStats.utf8 , memory_order_relaxed);
+  out->slow  = atomic_load_explicit(&s_sanatizeStats.slow , memory_order_relaxed);
+}
+
+// ICU detectors are expensive to open so each thread keeps its own
+static pthread_key_t  s_detectorKey;
+static pthread_once_t s_detectorOnce = PTHREAD_ONCE_INIT;
+
+static void rr_detector_free(void *opaque)
+{
+  ucsdet_close((UCharsetDetector *)opaque);
+}
+
+static void rr_detector_key_init(void)
+{
+  pthread_key_create(&s_detectorKey, rr_detector_free);
+}
+
+static UCharsetDetector *rr_detector_get(void)
+{
+  pthread_once(&s_detectorOnce, rr_detector_key_init);
+  UCharsetDetector *det = pthread_getspecific(s_detectorKey);
+  if (det)
+    return det;
+
+  UErrorCode status = U_ZERO_ERROR;
+  det = ucsdet_open(&status);
+  if (U_FAILURE(status))
+  {
+    LOG_ERROR("ucsdet_open failed: %s", u_errorName(status));
+    return NULL;
+  }
+
+  pthread_setspecific(s_detectorKey, det);
+  return det;
+}
+
 bool rr_sanatize(char *text, size_t maxLen)
 {
   bool ret = false;
   char *buf = NULL;
   size_t textLen = strlen(text);
 
-  UErrorCode status = U_ZERO_ERROR;
-  UCharsetDetector *det = ucsdet_open(&status);
-  if (U_FAILURE(status))
+  // the vast majority of records are clean and do not need ICU
+  size_t ascii = rr_ascii_prefix(text, textLen);
+  if (ascii == textLen)
   {
-    LOG_ERROR("ucsdet_open failed: %s", u_errorName(status));
-    goto err;
+    atomic_fetch_add_explicit(&s_sanatizeStats.ascii, 1, memory_order_relaxed);
+    return true;
   }
 
+  if (rr_valid_utf8(text + ascii, textLen - ascii))
+  {
+    atomic_fetch_add_explicit(&s_sanatizeStats.utf8, 1, memory_order_relaxed);
+    return true;
+  }
+
+  atomic_fetch_add_explicit(&s_sanatizeStats.slow, 1, memory_order_relaxed);
+
+  UErrorCode status = U_ZERO_ERROR;
+  UCharsetDetector *det = rr_detector_get();
+  if (!det)
+    goto err;
+
   ucsdet_setText(det, text, textLen, &status);
   if (U_FAILURE(status))
     goto err_ucsdet;
@@ -248,8 +418,6 @@ bool rr_sanatize(char *text, size_t maxLen)
 out:
   ret = true;
 err_ucsdet:
-  ucsdet_close(det);
-
   if (ret)
   {
     // there still can be invalid sequences to remove if utf-8 was detected
@@ -276,50 +444,178 @@ err:
   return ret;
 }
 
-int rr_parse_ipv6_decimal(const char *str, unsigned __int128 *host)
+bool rr_sanatize_buffer(RRBuffer *buf, size_t maxLen)
 {
-  return inet_pton(AF_INET6, str, host);
+  if (buf->pos == 0)
+    return true;
+
+  if (!rr_buffer_reserve(buf, maxLen + 1))
+    return false;
+
+  bool ret = rr_sanatize(buf->buffer, maxLen + 1);
+  buf->pos = strlen(buf->buffer);
+  return ret;
 }
 
-int rr_parse_ipv4_decimal(const char *str, uint32_t *host)
+/*
+  Dotted quad of exactly len bytes. Unlike inet_pton a part may have leading
+  zeros, as the importers have always accepted, unless strict is set as it
+  is for the tail of an IPv6 address.
+*/
+static inline int rr_parse_ipv4_quad(const char *str, size_t len, uint32_t *host,
+  bool strict)
 {
   const char *p = str;
+  const char *e = str + len;
+  uint32_t    v = 0;
 
-  uint32_t parts[4];
-
-  for (int i = 0; i < 4; i++)
+  for(int i = 0; i < 4; ++i)
   {
-    if (*p == '\0' || !isdigit(*p))
+    if (i && (p == e || *p++ != '.'))
       return 0;
 
-    unsigned val = 0;
-    int digits = 0;
+    const char *start = p;
+    unsigned    part  = 0;
+    while(p < e && p - start < 3 && (unsigned)(*p - '0') < 10)
+      part = part * 10 + (*p++ - '0');
 
-    while (*p && isdigit(*p)) {
-      val = val * 10u + (unsigned)(*p - '0');
-      if (val > 255u)
-        return 0;
-      p++;
-      if (++digits > 3)
+    if (p == start || part > 255 || (p < e && (unsigned)(*p - '0') < 10))
+      return 0;
+
+    if (strict && *start == '0' && p - start > 1)
+      return 0;
+
+    v = v << 8 | part;
+  }
+
+  if (p != e)
+    return 0;
+
+  *host = v;
+  return 1;
+}
+
+int rr_parse_ipv4(const char *str, size_t len, uint32_t *host)
+{
+  return rr_parse_ipv4_quad(str, len, host, false);
+}
+
+static inline int rr_hex_digit(char c)
+{
+  if ((unsigned)(c - '0') < 10) return c - '0';
+  c |= 0x20;
+  if ((unsigned)(c - 'a') <  6) return c - 'a' + 10;
+  return -1;
+}
+
+/*
+  Follows the glibc inet_pton algorithm so that exactly the same text is
+  accepted, including "::" standing for a single zero group.
+*/
+int rr_parse_ipv6(const char *str, size_t len, unsigned __int128 *raw)
+{
+  uint8_t     addr[16] = {0};
+  uint8_t    *tp       = addr;
+  uint8_t    *endp     = addr + sizeof(addr);
+  uint8_t    *colonp   = NULL;
+  const char *p        = str;
+  const char *e        = str + len;
+
+  // a leading colon must be part of "::"
+  if (p < e && *p == ':')
+    if (++p == e || *p != ':')
+      return 0;
+
+  const char *curtok = p;
+  unsigned    val    = 0;
+  int         digits = 0;
+  while(p < e)
+  {
+    char c = *p++;
+    int  d = rr_hex_digit(c);
+    if (d >= 0)
+    {
+      if (++digits > 4)
         return 0;
+      val = val << 4 | d;
+      continue;
     }
 
-    parts[i] = (uint32_t)val;
+    if (c == ':')
+    {
+      curtok = p;
+      if (!digits)
+      {
+        if (colonp)
+          return 0;
+        colonp = tp;
+        continue;
+      }
 
-    if (i < 3) {
-      if (!*p || *p != '.')
+      if (p == e || tp + 2 > endp)
         return 0;
-      p++;
+
+      *tp++  = val >> 8;
+      *tp++  = val;
+      digits = 0;
+      val    = 0;
+      continue;
     }
+
+    if (c == '.' && tp + 4 <= endp)
+    {
+      uint32_t v4;
+      if (rr_parse_ipv4_quad(curtok, e - curtok, &v4, true) != 1)
+        return 0;
+
+      *tp++  = v4 >> 24;
+      *tp++  = v4 >> 16;
+      *tp++  = v4 >> 8;
+      *tp++  = v4;
+      digits = 0;
+      break;
+    }
+
+    return 0;
   }
 
-  if (*p != '\0')
+  if (digits)
+  {
+    if (tp + 2 > endp)
+      return 0;
+    *tp++ = val >> 8;
+    *tp++ = val;
+  }
+
+  if (colonp)
+  {
+    // "::" can not expand to nothing
+    if (tp == endp)
+      return 0;
+
+    size_t n = tp - colonp;
+    memmove(endp - n, colonp, n);
+    memset(colonp, 0, endp - n - colonp);
+    tp = endp;
+  }
+
+  if (tp != endp)
     return 0;
 
-  *host = (parts[0] << 24) | (parts[1] << 16) | (parts[2] << 8) | parts[3];
+  memcpy(raw, addr, sizeof(addr));
   return 1;
 }
 
+int rr_parse_ipv6_decimal(const char *str, unsigned __int128 *host)
+{
+  return rr_parse_ipv6(str, strlen(str), host);
+}
+
+int rr_parse_ipv4_decimal(const char *str, uint32_t *host)
+{
+  return rr_parse_ipv4(str, strlen(str), host);
+}
+
 uint8_t rr_ipv4_to_cidr(const uint32_t start, const uint32_t end)
 {
   uint32_t diff = start ^ end;
@@ -395,3 +691,149 @@ bool rr_calc_ipv6_cidr_end(const unsigned __int128 *start, unsigned prefix_len,
 
   return true;
 }
+
+/*
+  Each octet as up to three digits followed by the digit count. All four
+  bytes are copied and the count is overwritten by what follows, so the
+  buffer needs one byte past the address, which the _STR_MAX sizes include.
+*/
+static const char s_octetStr[256][4] =
+{
+  {'0',0,0,1}, {'1',0,0,1}, {'2',0,0,1}, {'3',0,0,1}, {'4',0,0,1}, {'5',0,0,1}, {'6',0,0,1}, {'7',0,0,1},
+  {'8',0,0,1}, {'9',0,0,1}, {'1','0',0,2}, {'1','1',0,2}, {'1','2',0,2}, {'1','3',0,2}, {'1','4',0,2}, {'1','5',0,2},
+  {'1','6',0,2}, {'1','7',0,2}, {'1','8',0,2}, {'1','9',0,2}, {'2','0',0,2}, {'2','1',0,2}, {'2','2',0,2}, {'2','3',0,2},
+  {'2','4',0,2}, {'2','5',0,2}, {'2','6',0,2}, {'2','7',0,2}, {'2','8',0,2}, {'2','9',0,2}, {'3','0',0,2}, {'3','1',0,2},
+  {'3','2',0,2}, {'3','3',0,2}, {'3','4',0,2}, {'3','5',0,2}, {'3','6',0,2}, {'3','7',0,2}, {'3','8',0,2}, {'3','9',0,2},
+  {'4','0',0,2}, {'4','1',0,2}, {'4','2',0,2}, {'4','3',0,2}, {'4','4',0,2}, {'4','5',0,2}, {'4','6',0,2}, {'4','7',0,2},
+  {'4','8',0,2}, {'4','9',0,2}, {'5','0',0,2}, {'5','1',0,2}, {'5','2',0,2}, {'5','3',0,2}, {'5','4',0,2}, {'5','5',0,2},
+  {'5','6',0,2}, {'5','7',0,2}, {'5','8',0,2}, {'5','9',0,2}, {'6','0',0,2}, {'6','1',0,2}, {'6','2',0,2}, {'6','3',0,2},
+  {'6','4',0,2}, {'6','5',0,2}, {'6','6',0,2}, {'6','7',0,2}, {'6','8',0,2}, {'6','9',0,2}, {'7','0',0,2}, {'7','1',0,2},
+  {'7','2',0,2}, {'7','3',0,2}, {'7','4',0,2}, {'7','5',0,2}, {'7','6',0,2}, {'7','7',0,2}, {'7','8',0,2}, {'7','9',0,2},
+  {'8','0',0,2}, {'8','1',0,2}, {'8','2',0,2}, {'8','3',0,2}, {'8','4',0,2}, {'8','5',0,2}, {'8','6',0,2}, {'8','7',0,2},
+  {'8','8',0,2}, {'8','9',0,2}, {'9','0',0,2}, {'9','1',0,2}, {'9','2',0,2}, {'9','3',0,2}, {'9','4',0,2}, {'9','5',0,2},
+  {'9','6',0,2}, {'9','7',0,2}, {'9','8',0,2}, {'9','9',0,2}, {'1','0','0',3}, {'1','0','1',3}, {'1','0','2',3}, {'1','0','3',3},
+  {'1','0','4',3}, {'1','0','5',3}, {'1','0','6',3}, {'1','0','7',3}, {'1','0','8',3}, {'1','0','9',3}, {'1','1','0',3}, {'1','1','1',3},
+  {'1','1','2',3}, {'1','1','3',3}, {'1','1','4',3}, {'1','1','5',3}, {'1','1','6',3}, {'1','1','7',3}, {'1','1','8',3}, {'1','1','9',3},
+  {'1','2','0',3}, {'1','2','1',3}, {'1','2','2',3}, {'1','2','3',3}, {'1','2','4',3}, {'1','2','5',3}, {'1','2','6',3}, {'1','2','7',3},
+  {'1','2','8',3}, {'1','2','9',3}, {'1','3','0',3}, {'1','3','1',3}, {'1','3','2',3}, {'1','3','3',3}, {'1','3','4',3}, {'1','3','5',3},
+  {'1','3','6',3}, {'1','3','7',3}, {'1','3','8',3}, {'1','3','9',3}, {'1','4','0',3}, {'1','4','1',3}, {'1','4','2',3}, {'1','4','3',3},
+  {'1','4','4',3}, {'1','4','5',3}, {'1','4','6',3}, {'1','4','7',3}, {'1','4','8',3}, {'1','4','9',3}, {'1','5','0',3}, {'1','5','1',3},
+  {'1','5','2',3}, {'1','5','3',3}, {'1','5','4',3}, {'1','5','5',3}, {'1','5','6',3}, {'1','5','7',3}, {'1','5','8',3}, {'1','5','9',3},
+  {'1','6','0',3}, {'1','6','1',3}, {'1','6','2',3}, {'1','6','3',3}, {'1','6','4',3}, {'1','6','5',3}, {'1','6','6',3}, {'1','6','7',3},
+  {'1','6','8',3}, {'1','6','9',3}, {'1','7','0',3}, {'1','7','1',3}, {'1','7','2',3}, {'1','7','3',3}, {'1','7','4',3}, {'1','7','5',3},
+  {'1','7','6',3}, {'1','7','7',3}, {'1','7','8',3}, {'1','7','9',3}, {'1','8','0',3}, {'1','8','1',3}, {'1','8','2',3}, {'1','8','3',3},
+  {'1','8','4',3}, {'1','8','5',3}, {'1','8','6',3}, {'1','8','7',3}, {'1','8','8',3}, {'1','8','9',3}, {'1','9','0',3}, {'1','9','1',3},
+  {'1','9','2',3}, {'1','9','3',3}, {'1','9','4',3}, {'1','9','5',3}, {'1','9','6',3}, {'1','9','7',3}, {'1','9','8',3}, {'1','9','9',3},
+  {'2','0','0',3}, {'2','0','1',3}, {'2','0','2',3}, {'2','0','3',3}, {'2','0','4',3}, {'2','0','5',3}, {'2','0','6',3}, {'2','0','7',3},
+  {'2','0','8',3}, {'2','0','9',3}, {'2','1','0',3}, {'2','1','1',3}, {'2','1','2',3}, {'2','1','3',3}, {'2','1','4',3}, {'2','1','5',3},
+  {'2','1','6',3}, {'2','1','7',3}, {'2','1','8',3}, {'2','1','9',3}, {'2','2','0',3}, {'2','2','1',3}, {'2','2','2',3}, {'2','2','3',3},
+  {'2','2','4',3}, {'2','2','5',3}, {'2','2','6',3}, {'2','2','7',3}, {'2','2','8',3}, {'2','2','9',3}, {'2','3','0',3}, {'2','3','1',3},
+  {'2','3','2',3}, {'2','3','3',3}, {'2','3','4',3}, {'2','3','5',3}, {'2','3','6',3}, {'2','3','7',3}, {'2','3','8',3}, {'2','3','9',3},
+  {'2','4','0',3}, {'2','4','1',3}, {'2','4','2',3}, {'2','4','3',3}, {'2','4','4',3}, {'2','4','5',3}, {'2','4','6',3}, {'2','4','7',3},
+  {'2','4','8',3}, {'2','4','9',3}, {'2','5','0',3}, {'2','5','1',3}, {'2','5','2',3}, {'2','5','3',3}, {'2','5','4',3}, {'2','5','5',3}
+};
+
+static inline size_t rr_octet_to_str(char *buf, uint8_t octet)
+{
+  memcpy(buf, s_octetStr[octet], 4);
+  return (size_t)s_octetStr[octet][3];
+}
+
+size_t rr_ipv4_to_str(char *buf, uint32_t host)
+{
+  char *p = buf;
+  p += rr_octet_to_str(p, host >> 24);
+  *p++ = '.';
+  p += rr_octet_to_str(p, host >> 16);
+  *p++ = '.';
+  p += rr_octet_to_str(p, host >> 8);
+  *p++ = '.';
+  p += rr_octet_to_str(p, host);
+  return p - buf;
+}
+
+static inline size_t rr_hex16_to_str(char *buf, uint16_t v)
+{
+  static const char hex[] = "0123456789abcdef";
+  char *p = buf;
+  if (v >= 0x1000) *p++ = hex[v >> 12];
+  if (v >= 0x0100) *p++ = hex[(v >> 8) & 0xf];
+  if (v >= 0x0010) *p++ = hex[(v >> 4) & 0xf];
+  *p++ = hex[v & 0xf];
+  return p - buf;
+}
+
+/*
+  RFC 5952 text: lower case, no leading zeros, and the first of the longest
+  runs of two or more zero groups replaced by "::". As inet_ntop does, an
+  address whose first 96 bits are zero, or ::ffff:0:0/96, ends in dotted quad.
+*/
+size_t rr_ipv6_to_str(char *buf, unsigned __int128 raw)
+{
+  const uint8_t *b = (const uint8_t *)&raw;
+  uint16_t w[8];
+  for(unsigned i = 0; i < 8; ++i)
+    w[i] = (uint16_t)(b[i * 2] << 8 | b[i * 2 + 1]);
+
+  int bestBase = -1, bestLen = 0;
+  for(int i = 0; i < 8;)
+  {
+    if (w[i] != 0)
+    {
+      ++i;
+      continue;
+    }
+
+    int base = i;
+    while(i < 8 && w[i] == 0)
+      ++i;
+
+    if (i - base > bestLen)
+    {
+      bestBase = base;
+      bestLen  = i - base;
+    }
+  }
+
+  if (bestLen < 2)
+    bestBase = -1;
+
+  char *p = buf;
+  for(int i = 0; i < 8; ++i)
+  {
+    if (i == bestBase)
+    {
+      *p++ = ':';
+      i += bestLen - 1;
+      if (i == 7)
+        *p++ = ':';
+      continue;
+    }
+
+    if (i)
+      *p++ = ':';
+
+    if (i == 6 && bestBase == 0 &&
+        (bestLen == 6 || (bestLen == 5 && w[5] == 0xffff)))
+      return (p - buf) + rr_ipv4_to_str(p,
+        (uint32_t)b[12] << 24 | (uint32_t)b[13] << 16 | (uint32_t)b[14] << 8 | b[15]);
+
+    p += rr_hex16_to_str(p, w[i]);
+  }
+  return p - buf;
+}
+
+size_t rr_prefix_to_str(char *buf, unsigned prefix_len)
+{
+  char *p = buf;
+  *p++ = '/';
+  if (prefix_len >= 100)
+  {
+    *p++ = '0' + prefix_len / 100;
+    *p++ = '0' + prefix_len / 10 % 10;
+  }
+  else if (prefix_len >= 10)
+    *p++ = '0' + prefix_len / 10;
+  *p++ = '0' + prefix_len % 10;
+  return p - buf;
+}
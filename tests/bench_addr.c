@@ -0,0 +1,149 @@
+#include "test.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/*
+  Times the address formatters against inet_ntop and the parsers against
+  inet_pton on random addresses, reporting the millions of addresses handled
+  per second.
+
+    bench_addr [addresses]
+*/
+
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint64_t bench_rand(void)
+{
+  s_rand ^= s_rand << 13;
+  s_rand ^= s_rand >> 7;
+  s_rand ^= s_rand << 17;
+  return s_rand;
+}
+
+static void report(const char *name, size_t n, uint64_t usec)
+{
+  printf("  %-15s %8.3f ms %8.2f M addresses/s\n", name, usec / 1000.0,
+    usec ? n / (double)usec : 0.0);
+}
+
+// the results are summed so the work is not optimised away
+#define BENCH(name, n, total, expr) do { \
+  uint64_t start = rr_microtime(); \
+  for(size_t i = 0; i < (n); ++i) \
+    (total) += (expr); \
+  report(name, n, rr_microtime() - start); \
+} while(0)
+
+static size_t ntop_len(int af, const void *addr, char *buf)
+{
+  return strlen(inet_ntop(af, addr, buf, INET6_ADDRSTRLEN));
+}
+
+// the parsers are given terminated text as inet_pton needs it
+static uint32_t parse_v4(const char *str)
+{
+  uint32_t host = 0;
+  rr_parse_ipv4(str, strlen(str), &host);
+  return host;
+}
+
+static uint32_t pton_v4(const char *str)
+{
+  struct in_addr addr = { 0 };
+  inet_pton(AF_INET, str, &addr);
+  return ntohl(addr.s_addr);
+}
+
+static uint64_t parse_v6(const char *str)
+{
+  unsigned __int128 raw = 0;
+  rr_parse_ipv6(str, strlen(str), &raw);
+  return (uint64_t)raw ^ (uint64_t)(raw >> 64);
+}
+
+static uint64_t pton_v6(const char *str)
+{
+  unsigned __int128 raw = 0;
+  inet_pton(AF_INET6, str, &raw);
+  return (uint64_t)raw ^ (uint64_t)(raw >> 64);
+}
+
+static void bench_v4(size_t n)
+{
+  uint32_t *host = malloc(n * sizeof(*host));
+  uint32_t *be   = malloc(n * sizeof(*be));
+  char     *text = malloc(n * INET_ADDRSTRLEN);
+  CHECK(host && be && text);
+  if (!host || !be || !text)
+    goto out;
+
+  for(size_t i = 0; i < n; ++i)
+  {
+    host[i] = bench_rand();
+    be  [i] = htonl(host[i]);
+    inet_ntop(AF_INET, &be[i], text + i * INET_ADDRSTRLEN, INET_ADDRSTRLEN);
+  }
+
+  char buf[INET6_ADDRSTRLEN];
+  size_t ours = 0, theirs = 0;
+  printf("v4, %zu addresses\n", n);
+  BENCH("rr_ipv4_to_str", n, ours  , rr_ipv4_to_str(buf, host[i]));
+  BENCH("inet_ntop"     , n, theirs, ntop_len(AF_INET, &be[i], buf));
+  CHECK(ours == theirs);
+
+  ours = theirs = 0;
+  BENCH("rr_parse_ipv4" , n, ours  , parse_v4(text + i * INET_ADDRSTRLEN));
+  BENCH("inet_pton"     , n, theirs, pton_v4 (text + i * INET_ADDRSTRLEN));
+  CHECK(ours == theirs);
+
+out:
+  free(host);
+  free(be);
+  free(text);
+}
+
+static void bench_v6(size_t n)
+{
+  unsigned __int128 *raw  = malloc(n * sizeof(*raw));
+  char              *text = malloc(n * INET6_ADDRSTRLEN);
+  CHECK(raw && text);
+  if (!raw || !text)
+    goto out;
+
+  // starts of random /48s in 2000::/3, so most end in a run of zeros
+  for(size_t i = 0; i < n; ++i)
+  {
+    uint64_t hi = 0x2000000000000000ULL | (bench_rand() & 0x1fffffffffff0000ULL);
+    raw[i] = rr_be_to_raw((unsigned __int128)hi << 64);
+    inet_ntop(AF_INET6, &raw[i], text + i * INET6_ADDRSTRLEN, INET6_ADDRSTRLEN);
+  }
+
+  char buf[INET6_ADDRSTRLEN];
+  size_t ours = 0, theirs = 0;
+  printf("v6, %zu addresses\n", n);
+  BENCH("rr_ipv6_to_str", n, ours  , rr_ipv6_to_str(buf, raw[i]));
+  BENCH("inet_ntop"     , n, theirs, ntop_len(AF_INET6, &raw[i], buf));
+  CHECK(ours == theirs);
+
+  ours = theirs = 0;
+  BENCH("rr_parse_ipv6" , n, ours  , parse_v6(text + i * INET6_ADDRSTRLEN));
+  BENCH("inet_pton"     , n, theirs, pton_v6 (text + i * INET6_ADDRSTRLEN));
+  CHECK(ours == theirs);
+
+out:
+  free(raw);
+  free(text);
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  bench_v4(n);
+  bench_v6(n);
+  return TEST_RESULT;
+}
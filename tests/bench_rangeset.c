@@ -0,0 +1,117 @@
+#include "test.h"
+#include "rangeset.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+/*
+  Times each range set operation on sets of random ranges, reporting the
+  millions of input ranges handled per second.
+
+    bench_rangeset [ranges]
+*/
+
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint64_t bench_rand(void)
+{
+  s_rand ^= s_rand << 13;
+  s_rand ^= s_rand >> 7;
+  s_rand ^= s_rand << 17;
+  return s_rand;
+}
+
+static void report(const char *name, size_t ranges, uint64_t usec)
+{
+  printf("  %-11s %8.3f ms %8.2f M ranges/s\n", name, usec / 1000.0,
+    usec ? ranges / (double)usec : 0.0);
+}
+
+static bool count_cidr_v4(void *udata, uint32_t ip, uint8_t prefix_len)
+{
+  ++*(size_t *)udata;
+  return true;
+}
+
+static bool count_cidr_v6(void *udata, unsigned __int128 ip, uint8_t prefix_len)
+{
+  ++*(size_t *)udata;
+  return true;
+}
+
+#define BENCH(name, ranges, expr) do { \
+  uint64_t start = rr_microtime(); \
+  CHECK(expr); \
+  report(name, ranges, rr_microtime() - start); \
+} while(0)
+
+static void bench_v4(size_t n)
+{
+  RRRangeSetV4 a = { 0 }, b = { 0 }, out = { 0 };
+  for(size_t i = 0; i < n; ++i)
+  {
+    uint32_t start = bench_rand();
+    CHECK(rr_rangeset_v4_add(&a, start, start + (bench_rand() & 0xfff)));
+    start = bench_rand();
+    CHECK(rr_rangeset_v4_add(&b, start, start + (bench_rand() & 0xfff)));
+  }
+
+  printf("v4, %zu ranges\n", n);
+  BENCH("normalize", n, rr_rangeset_v4_normalize(&a));
+  CHECK(rr_rangeset_v4_normalize(&b));
+
+  size_t cidrs = 0;
+  BENCH("union"     , a.count + b.count, rr_rangeset_v4_union     (&out, &a, &b));
+  BENCH("intersect" , a.count + b.count, rr_rangeset_v4_intersect (&out, &a, &b));
+  BENCH("difference", a.count + b.count, rr_rangeset_v4_difference(&out, &a, &b));
+  BENCH("complement", a.count          , rr_rangeset_v4_complement(&out, &a));
+  BENCH("cidrs"     , a.count          , rr_rangeset_v4_cidrs     (&a, count_cidr_v4, &cidrs));
+  BENCH("aggregate" , a.count          , rr_rangeset_v4_aggregate (&out, &a, cidrs / 10, 32));
+  CHECK(cidrs >= a.count);
+
+  rr_rangeset_v4_free(&a);
+  rr_rangeset_v4_free(&b);
+  rr_rangeset_v4_free(&out);
+}
+
+static void bench_v6(size_t n)
+{
+  RRRangeSetV6 a = { 0 }, b = { 0 }, out = { 0 };
+  for(size_t i = 0; i < n; ++i)
+  {
+    // random /48s in 2000::/3 as the registries hand out
+    unsigned __int128 start = (unsigned __int128)(0x2000000000000000ULL |
+      (bench_rand() & 0x1fffffffffff0000ULL)) << 64;
+    CHECK(rr_rangeset_v6_add(&a, start, start | (((unsigned __int128)1 << 80) - 1)));
+    start = (unsigned __int128)(0x2000000000000000ULL |
+      (bench_rand() & 0x1fffffffffff0000ULL)) << 64;
+    CHECK(rr_rangeset_v6_add(&b, start, start | (((unsigned __int128)1 << 80) - 1)));
+  }
+
+  printf("v6, %zu ranges\n", n);
+  BENCH("normalize", n, rr_rangeset_v6_normalize(&a));
+  CHECK(rr_rangeset_v6_normalize(&b));
+
+  size_t cidrs = 0;
+  BENCH("union"     , a.count + b.count, rr_rangeset_v6_union     (&out, &a, &b));
+  BENCH("intersect" , a.count + b.count, rr_rangeset_v6_intersect (&out, &a, &b));
+  BENCH("difference", a.count + b.count, rr_rangeset_v6_difference(&out, &a, &b));
+  BENCH("complement", a.count          , rr_rangeset_v6_complement(&out, &a));
+  BENCH("cidrs"     , a.count          , rr_rangeset_v6_cidrs     (&a, count_cidr_v6, &cidrs));
+  BENCH("aggregate" , a.count          , rr_rangeset_v6_aggregate (&out, &a, cidrs / 10, 128));
+  CHECK(cidrs >= a.count);
+
+  rr_rangeset_v6_free(&a);
+  rr_rangeset_v6_free(&b);
+  rr_rangeset_v6_free(&out);
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+  bench_v4(n);
+  bench_v6(n);
+  return TEST_RESULT;
+}
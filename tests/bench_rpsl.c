@@ -0,0 +1,192 @@
+#include "test.h"
+#include "import.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <zlib.h>
+
+/*
+  Parse-only throughput of the RPSL importer. The database inserts are
+  replaced with counters so only the inflate, tokenizer and record handling
+  are measured. Takes a recorded dump, or the number of records to generate
+  for a synthetic one. The record counts of a generated dump are checked.
+
+    bench_rpsl [records | dump.gz] [threads]
+*/
+
+Config g_config;
+
+static atomic_ullong s_orgs, s_v4, s_v6;
+
+bool rr_import_org_insert(RRDBOrg *in_org)
+{
+  atomic_fetch_add(&s_orgs, 1);
+  return true;
+}
+
+bool rr_import_netblockv4_insert(RRDBNetBlock *in_netblock)
+{
+  atomic_fetch_add(&s_v4, 1);
+  return true;
+}
+
+bool rr_import_netblockv6_insert(RRDBNetBlock *in_netblock)
+{
+  atomic_fetch_add(&s_v6, 1);
+  return true;
+}
+
+bool rr_import_org_delete       (RRDBOrg      *in_org     ) { return true; }
+bool rr_import_netblockv4_delete(RRDBNetBlock *in_netblock) { return true; }
+bool rr_import_netblockv6_delete(RRDBNetBlock *in_netblock) { return true; }
+
+// a dump in the RIPE layout with orgs, inetnums, inet6nums and ignored objects
+static bool generate(const char *path, unsigned records)
+{
+  gzFile gz = gzopen(path, "wb1");
+  if (!gz)
+    return false;
+
+  gzprintf(gz, "# generated RPSL dump\n\n");
+  for(unsigned i = 0; i < records; ++i)
+  {
+    unsigned org = i / 4;
+    switch(i % 4)
+    {
+      case 0:
+        gzprintf(gz,
+          "organisation:   ORG-B%u-TEST\n"
+          "org-name:       Benchmark Organisation %u\n"
+          "org-type:       OTHER\n"
+          "address:        %u Example Street\n"
+          "mnt-by:         BENCH-MNT\n"
+          "source:         TEST\n\n", org, org, org);
+        break;
+
+      case 1:
+        gzprintf(gz,
+          "inetnum:        %u.%u.%u.0 - %u.%u.%u.255\n"
+          "netname:        BENCH-NET-%u\n"
+          "descr:          Benchmark network %u\n"
+          "descr:          Second line of the description\n"
+          "country:        AU\n"
+          "org:            ORG-B%u-TEST\n"
+          "admin-c:        BP%u-TEST\n"
+          "status:         ASSIGNED PA\n"
+          "mnt-by:         BENCH-MNT\n"
+          "source:         TEST\n\n",
+          10 + (org >> 16 & 0x7f), org >> 8 & 0xff, org & 0xff,
+          10 + (org >> 16 & 0x7f), org >> 8 & 0xff, org & 0xff,
+          org, org, org, org);
+        break;
+
+      case 2:
+        gzprintf(gz,
+          "inet6num:       2001:db8:%x::/48\n"
+          "netname:        BENCH-NET6-%u\n"
+          "descr:          Benchmark network %u\n"
+          "country:        AU\n"
+          "org:            ORG-B%u-TEST\n"
+          "status:         ASSIGNED\n"
+          "mnt-by:         BENCH-MNT\n"
+          "source:         TEST\n\n", org & 0xffff, org, org, org);
+        break;
+
+      case 3:
+        gzprintf(gz,
+          "person:         Benchmark Person %u\n"
+          "address:        %u Example Street\n"
+          "phone:          +61 0 0000 0000\n"
+          "nic-hdl:        BP%u-TEST\n"
+          "mnt-by:         BENCH-MNT\n"
+          "source:         TEST\n\n", org, org, org);
+        break;
+    }
+  }
+
+  return gzclose(gz) == Z_OK;
+}
+
+// the inflated size and the time taken to inflate it alone
+static bool inflate_only(const char *path, unsigned long long *bytes, uint64_t *usec)
+{
+  gzFile gz = gzopen(path, "rb");
+  if (!gz)
+    return false;
+
+  static char buf[256 * 1024];
+  uint64_t start = rr_microtime();
+  int n;
+  *bytes = 0;
+  while((n = gzread(gz, buf, sizeof(buf))) > 0)
+    *bytes += n;
+  *usec = rr_microtime() - start;
+  gzclose(gz);
+  return n == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+
+  char        tmp[] = "/tmp/bench_rpsl_XXXXXX";
+  const char *path  = tmp;
+  unsigned    records = 0;
+  char       *end;
+
+  if (argc > 1 && (records = strtoul(argv[1], &end, 10)) > 0 && *end == '\0')
+  {
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+      return 1;
+    close(fd);
+
+    if (!generate(path, records))
+    {
+      fprintf(stderr, "failed to generate %s\n", path);
+      unlink(path);
+      return 1;
+    }
+  }
+  else if (argc > 1)
+    path = argv[1];
+  else
+  {
+    fprintf(stderr, "usage: %s records|dump.gz [threads]\n", argv[0]);
+    return 1;
+  }
+
+  g_config.import.threads = argc > 2 ? atoi(argv[2]) : 0;
+
+  unsigned long long bytes       = 0;
+  uint64_t           inflateTime = 0;
+  CHECK(inflate_only(path, &bytes, &inflateTime));
+
+  uint64_t start = rr_microtime();
+  CHECK(rr_rpsl_import_gz("BENCH", path, 1, 1));
+  uint64_t parseTime = rr_microtime() - start;
+
+  double mb = bytes / (1024.0 * 1024.0);
+  printf("%.1f MB inflated in %.3fs (%.1f MB/s)\n",
+    mb, inflateTime / 1e6, mb / (inflateTime / 1e6));
+  printf("%.1f MB parsed   in %.3fs (%.1f MB/s)\n",
+    mb, parseTime   / 1e6, mb / (parseTime   / 1e6));
+  printf("orgs %llu, inetnum %llu, inet6num %llu\n",
+    (unsigned long long)s_orgs, (unsigned long long)s_v4,
+    (unsigned long long)s_v6);
+
+  if (records)
+  {
+    CHECK(s_orgs == (records + 3) / 4);
+    CHECK(s_v4   == (records + 2) / 4);
+    CHECK(s_v6   == (records + 1) / 4);
+    unlink(path);
+  }
+
+  return TEST_RESULT;
+}
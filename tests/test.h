@@ -0,0 +1,22 @@
+#ifndef _H_RR_TEST_
+#define _H_RR_TEST_
+
+#include <stdio.h>
+
+/*
+  Minimal checks for the test executables, a failed check is reported and
+  counted and the test carries on, main returns TEST_RESULT.
+*/
+static unsigned s_testFailures;
+
+#define CHECK(cond) do { \
+  if (!(cond)) \
+  { \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    ++s_testFailures; \
+  } \
+} while(0)
+
+#define TEST_RESULT (s_testFailures ? 1 : 0)
+
+#endif
@@ -0,0 +1,343 @@
+#include "test.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/*
+  Checks the address formatters against inet_ntop, which RackRadar's output
+  has always matched, and the parsers against inet_pton.
+
+    test_addr [iterations]
+*/
+
+// xorshift, so a failure reproduces
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint32_t test_rand(void)
+{
+  s_rand ^= s_rand << 13;
+  s_rand ^= s_rand >> 7;
+  s_rand ^= s_rand << 17;
+  return (uint32_t)(s_rand >> 32);
+}
+
+static bool test_format_v4_one(uint32_t host)
+{
+  char out[RR_IPV4_STR_MAX + 1], expect[INET_ADDRSTRLEN];
+  out[rr_ipv4_to_str(out, host)] = '\0';
+
+  uint32_t be = htonl(host);
+  inet_ntop(AF_INET, &be, expect, sizeof(expect));
+  if (strcmp(out, expect) == 0)
+    return true;
+
+  fprintf(stderr, "v4 %s, expected %s\n", out, expect);
+  return false;
+}
+
+static bool test_format_v6_one(const uint8_t *addr)
+{
+  unsigned __int128 raw;
+  memcpy(&raw, addr, sizeof(raw));
+
+  char out[RR_IPV6_STR_MAX + 1], expect[INET6_ADDRSTRLEN];
+  out[rr_ipv6_to_str(out, raw)] = '\0';
+
+  inet_ntop(AF_INET6, addr, expect, sizeof(expect));
+  if (strcmp(out, expect) == 0)
+    return true;
+
+  fprintf(stderr, "v6 %s, expected %s\n", out, expect);
+  return false;
+}
+
+static void test_format_v4(void)
+{
+  // a stride that is prime reaches every octet value in each position
+  for(uint64_t i = 0; i <= UINT32_MAX; i += 9973)
+    CHECK(test_format_v4_one((uint32_t)i));
+
+  CHECK(test_format_v4_one(0));
+  CHECK(test_format_v4_one(UINT32_MAX));
+}
+
+// the RFC 5952 section 4 rules, and the embedded IPv4 forms
+static void test_format_v6_cases(void)
+{
+  static const struct
+  {
+    const char *in;
+    const char *out;
+  }
+  cases[] =
+  {
+    { "0:0:0:0:0:0:0:0"         , "::"                        },
+    { "0:0:0:0:0:0:0:1"         , "::1"                       },
+    { "1:0:0:0:0:0:0:0"         , "1::"                       },
+    { "0:0:0:0:0:0:0:100"       , "::100"                     },
+    { "1:2:3:4:5:6:7:8"         , "1:2:3:4:5:6:7:8"           },
+    { "2001:DB8:0:0:0:0:0:1"    , "2001:db8::1"               },
+    { "2001:0db8:0:0:0:0:2:1"   , "2001:db8::2:1"             },
+
+    // the longest run of zeros is the one shortened
+    { "2001:0:0:1:0:0:0:1"      , "2001:0:0:1::1"             },
+
+    // a single zero group is not shortened
+    { "2001:db8:0:1:1:1:1:1"    , "2001:db8:0:1:1:1:1:1"      },
+    { "2001:db8:1:1:1:1:0:1"    , "2001:db8:1:1:1:1:0:1"      },
+
+    // of equal runs the first is shortened
+    { "2001:db8:0:0:1:0:0:1"    , "2001:db8::1:0:0:1"         },
+
+    // IPv4-mapped and IPv4-compatible addresses
+    { "0:0:0:0:0:ffff:c000:201" , "::ffff:192.0.2.1"          },
+    { "0:0:0:0:0:ffff:0:0"      , "::ffff:0.0.0.0"            },
+    { "0:0:0:0:0:0:c000:201"    , "::192.0.2.1"               },
+    { "0:0:0:0:ffff:0:c000:201" , "::ffff:0:c000:201"         },
+    { "64:ff9b:0:0:0:0:c000:201", "64:ff9b::c000:201"         }
+  };
+
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+  {
+    uint8_t addr[16];
+    CHECK(inet_pton(AF_INET6, cases[i].in, addr) == 1);
+
+    unsigned __int128 raw;
+    memcpy(&raw, addr, sizeof(raw));
+
+    char out[RR_IPV6_STR_MAX + 1];
+    out[rr_ipv6_to_str(out, raw)] = '\0';
+    if (strcmp(out, cases[i].out) != 0)
+      fprintf(stderr, "%s formatted as %s, expected %s\n",
+        cases[i].in, out, cases[i].out);
+    CHECK(strcmp(out, cases[i].out) == 0);
+    CHECK(test_format_v6_one(addr));
+  }
+}
+
+static void test_format_v6_random(unsigned iterations)
+{
+  uint8_t addr[16];
+
+  // groups weighted towards zero so runs of every length and place occur
+  for(unsigned n = 0; n < iterations; ++n)
+  {
+    for(unsigned i = 0; i < 8; ++i)
+    {
+      uint32_t r = test_rand();
+      uint16_t v;
+      switch(r & 3)
+      {
+        case 0 : v = r >> 16;         break;
+        case 1 : v = (r >> 16) & 0xf; break;
+        default: v = 0;               break;
+      }
+
+      // sometimes an IPv4-mapped prefix
+      if (i == 5 && (r & 0x70) == 0)
+        v = 0xffff;
+
+      addr[i * 2    ] = v >> 8;
+      addr[i * 2 + 1] = v;
+    }
+    CHECK(test_format_v6_one(addr));
+  }
+
+  // every pattern of zero and non-zero groups
+  static const uint16_t values[] = { 1, 0x10, 0x1234, 0xffff };
+  for(unsigned mask = 0; mask < 256; ++mask)
+    for(unsigned v = 0; v < sizeof(values) / sizeof(*values); ++v)
+    {
+      for(unsigned i = 0; i < 8; ++i)
+      {
+        uint16_t g = (mask >> i) & 1 ? values[v] : 0;
+        addr[i * 2    ] = g >> 8;
+        addr[i * 2 + 1] = g;
+      }
+      CHECK(test_format_v6_one(addr));
+    }
+}
+
+static void test_format_prefix(void)
+{
+  for(unsigned prefix_len = 0; prefix_len <= 128; ++prefix_len)
+  {
+    char out[RR_PREFIX_STR_MAX + 1], expect[8];
+    out[rr_prefix_to_str(out, prefix_len)] = '\0';
+    snprintf(expect, sizeof(expect), "/%u", prefix_len);
+    CHECK(strcmp(out, expect) == 0);
+  }
+}
+
+/*
+  Copies str without the leading zeros of its dotted quad parts, returning
+  false if it has none or a part longer than the three digits allowed.
+*/
+static bool test_strip_zeros(const char *str, char *out)
+{
+  bool     stripped = false;
+  bool     leading  = true;
+  unsigned digits   = 0;
+  for(const char *p = str; *p; ++p)
+  {
+    if (*p == '.')
+    {
+      digits  = 0;
+      leading = true;
+    }
+    else if (++digits > 3)
+      return false;
+    else if (leading && *p == '0' && (unsigned)(p[1] - '0') < 10)
+    {
+      stripped = true;
+      continue;
+    }
+    else
+      leading = false;
+    *out++ = *p;
+  }
+  *out = '\0';
+  return stripped;
+}
+
+/*
+  inet_pton rejects leading zeros in IPv4 parts that rr_parse_ipv4 takes as
+  decimal, as the registries write them, otherwise both must agree
+*/
+static bool test_parse_v4_one(const char *str)
+{
+  struct in_addr addr;
+  uint32_t host   = 0;
+  int      expect = inet_pton(AF_INET, str, &addr);
+  int      rc     = rr_parse_ipv4(str, strlen(str), &host);
+
+  char stripped[32];
+  if (expect != 1 && strlen(str) < sizeof(stripped) &&
+      test_strip_zeros(str, stripped))
+    expect = inet_pton(AF_INET, stripped, &addr);
+
+  if (rc == expect && (rc != 1 || host == ntohl(addr.s_addr)))
+    return true;
+
+  fprintf(stderr, "v4 \"%s\" parsed %d, inet_pton %d\n", str, rc, expect);
+  return false;
+}
+
+static bool test_parse_v6_one(const char *str)
+{
+  uint8_t           addr[16];
+  unsigned __int128 raw    = 0;
+  int               expect = inet_pton(AF_INET6, str, addr);
+  int               rc     = rr_parse_ipv6(str, strlen(str), &raw);
+
+  if (rc == expect && (rc != 1 || memcmp(&raw, addr, sizeof(addr)) == 0))
+    return true;
+
+  fprintf(stderr, "v6 \"%s\" parsed %d, inet_pton %d\n", str, rc, expect);
+  return false;
+}
+
+static void test_parse_v4(unsigned iterations)
+{
+  char str[INET6_ADDRSTRLEN];
+  for(uint64_t i = 0; i <= UINT32_MAX; i += 7919)
+  {
+    uint32_t be = htonl((uint32_t)i);
+    inet_ntop(AF_INET, &be, str, sizeof(str));
+    CHECK(test_parse_v4_one(str));
+  }
+
+  static const char *cases[] =
+  {
+    "", "0.0.0.0", "1.2.3.4", "255.255.255.255", "256.1.1.1", "1.2.3",
+    "1.2.3.4.", ".1.2.3.4", "1.2.3.4.5", "01.2.3.4", "1..2.3", "1.2.3.4 ",
+    " 1.2.3.4", "0000.1.1.1", "1.2.3.1000", "1.2.3.-4", "1.2.3.0x4"
+  };
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+    CHECK(test_parse_v4_one(cases[i]));
+
+  // random text over the characters of a dotted quad
+  static const char chars[] = "0123456789..";
+  for(unsigned n = 0; n < iterations; ++n)
+  {
+    unsigned len = test_rand() % 17;
+    for(unsigned i = 0; i < len; ++i)
+      str[i] = chars[test_rand() % (sizeof(chars) - 1)];
+    str[len] = '\0';
+    CHECK(test_parse_v4_one(str));
+  }
+}
+
+static void test_parse_v6(unsigned iterations)
+{
+  static const char *cases[] =
+  {
+    "", ":", "::", ":::", "::1", "1::", ":1::", "1:", "1::2::3",
+    "1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7::", "::1:2:3:4:5:6:7",
+    "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7:8::", "12345::", "0::00:000:0000",
+    "::ffff:1.2.3.4", "::1.2.3.4", "1:2:3:4:5:6:1.2.3.4",
+    "1:2:3:4:5:6:7:1.2.3.4", "::1.2.3.4:1", "::01.2.3.4", "::1.2.3",
+    "::1.2.3.4.5", "::256.1.1.1", "1.2.3.4", "::g", "FE80::ABCD"
+  };
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+    CHECK(test_parse_v6_one(cases[i]));
+
+  // random text over the characters of an address
+  static const char chars[] = "0123456789abcdefABCDEF:.:::";
+  char str[64];
+  for(unsigned n = 0; n < iterations; ++n)
+  {
+    unsigned len = test_rand() % 40;
+    for(unsigned i = 0; i < len; ++i)
+      str[i] = chars[test_rand() % (sizeof(chars) - 1)];
+    str[len] = '\0';
+    CHECK(test_parse_v6_one(str));
+  }
+
+  // formatted addresses, then each with one character changed
+  for(unsigned n = 0; n < iterations; ++n)
+  {
+    uint8_t addr[16];
+    for(unsigned i = 0; i < 16; ++i)
+      addr[i] = test_rand() % 3 ? 0 : test_rand();
+    inet_ntop(AF_INET6, addr, str, sizeof(str));
+    CHECK(test_parse_v6_one(str));
+
+    size_t len = strlen(str);
+    str[test_rand() % (len + 1)] = "0:.f1"[test_rand() % 5];
+    CHECK(test_parse_v6_one(str));
+  }
+}
+
+// only len bytes are parsed, whatever follows them
+static void test_parse_len(void)
+{
+  unsigned __int128 raw;
+  uint8_t           expect[16] = { [15] = 1 };
+  CHECK(rr_parse_ipv6("::1garbage", 3, &raw) == 1);
+  CHECK(memcmp(&raw, expect, sizeof(expect)) == 0);
+  CHECK(rr_parse_ipv6("::1", 2, &raw) == 1);
+  CHECK(rr_parse_ipv6("::1", 1, &raw) == 0);
+
+  uint32_t host;
+  CHECK(rr_parse_ipv4("1.2.3.45", 7, &host) == 1 && host == 0x01020304);
+  CHECK(rr_parse_ipv4("1.2.3.4", 6, &host) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  test_format_v4();
+  test_format_v6_cases();
+  test_format_v6_random(iterations);
+  test_format_prefix();
+  test_parse_v4(iterations);
+  test_parse_v6(iterations);
+  test_parse_len();
+
+  return TEST_RESULT;
+}
@@ -0,0 +1,248 @@
+#include "test.h"
+#include "filter.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  Checks the filter against a plain recursive LIKE over the pattern text,
+  pattern by pattern, for fixed cases and for random patterns and text.
+
+    test_filter [iterations]
+*/
+
+// xorshift, so a failure reproduces
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint32_t test_rand(void)
+{
+  s_rand ^= s_rand << 13;
+  s_rand ^= s_rand >> 7;
+  s_rand ^= s_rand << 17;
+  return (uint32_t)(s_rand >> 32);
+}
+
+static size_t ref_char_len(const char *s, size_t len)
+{
+  uint8_t c = *s;
+  size_t  n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+  return n > len ? len : n;
+}
+
+static char ref_lower(char c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// SQL LIKE with ASCII case folding, '_' and '%' counting UTF-8 characters
+static bool ref_like(const char *p, const char *s, size_t len)
+{
+  if (*p == '\0')
+    return len == 0;
+
+  if (*p == '%')
+  {
+    for(size_t i = 0;; i += ref_char_len(s + i, len - i))
+    {
+      if (ref_like(p + 1, s + i, len - i))
+        return true;
+      if (i == len)
+        return false;
+    }
+  }
+
+  if (len == 0)
+    return false;
+
+  if (*p == '_')
+  {
+    size_t n = ref_char_len(s, len);
+    return ref_like(p + 1, s + n, len - n);
+  }
+
+  if (*p == '\\' && p[1])
+    ++p;
+
+  return ref_lower(*p) == ref_lower(*s) && ref_like(p + 1, s + 1, len - 1);
+}
+
+// compiles the patterns, matches text and checks each pattern against ref_like
+static void test_filter_check(const char *const *patterns, unsigned count,
+  const char *text)
+{
+  RRFilter *f = NULL;
+  CHECK(rr_filter_init(&f));
+  for(unsigned i = 0; i < count; ++i)
+    CHECK(rr_filter_add(f, patterns[i]) == (int)i);
+  CHECK(rr_filter_compile(f));
+  CHECK(rr_filter_count(f) == count);
+
+  unsigned out[count + 1];
+  bool     matched[count + 1];
+  memset(matched, 0, sizeof(matched));
+
+  size_t n = rr_filter_match(f, text, strlen(text), out);
+  CHECK(n <= count);
+  for(size_t i = 0; i < n && i <= count; ++i)
+  {
+    CHECK(out[i] < count && !matched[out[i]]);
+    if (out[i] < count)
+      matched[out[i]] = true;
+  }
+
+  for(unsigned i = 0; i < count; ++i)
+    if (matched[i] != ref_like(patterns[i], text, strlen(text)))
+    {
+      fprintf(stderr, "\"%s\" LIKE \"%s\": filter %d\n",
+        text, patterns[i], matched[i]);
+      ++s_testFailures;
+    }
+
+  rr_filter_deinit(&f);
+  CHECK(f == NULL);
+}
+
+static void test_filter_cases(void)
+{
+  static const struct
+  {
+    const char *pattern;
+    const char *text;
+    bool        match;
+  }
+  cases[] =
+  {
+    // '%' and '_'
+    { "%"           , ""                 , true  },
+    { "%"           , "anything"         , true  },
+    { "%%"          , ""                 , true  },
+    { "_"           , ""                 , false },
+    { "_"           , "a"                , true  },
+    { "_"           , "ab"               , false },
+    { "a%"          , "abc"              , true  },
+    { "%c"          , "abc"              , true  },
+    { "%b%"         , "abc"              , true  },
+    { "%d%"         , "abc"              , false },
+    { "a_c"         , "abc"              , true  },
+    { "a_c"         , "ac"               , false },
+    { "%amazon%"    , "AMAZON-2011"      , true  },
+    { "amazon"      , "AMAZON-2011"      , false },
+    { "%a%a%a"      , "banan"            , false },
+    { "%a%a%a"      , "banana"           , true  },
+    { "%aab"        , "aaaab"            , true  },
+
+    // '_' is one UTF-8 character, not one byte
+    { "caf_"        , "caf\xc3\xa9"      , true  },
+    { "caf__"       , "caf\xc3\xa9"      , false },
+    { "_\xe2\x82\xac", "a\xe2\x82\xac"   , true  },
+
+    // escapes, and a trailing '\' is literal
+    { "100\\%"      , "100%"             , true  },
+    { "100\\%"      , "1000"             , false },
+    { "a\\_b"       , "a_b"              , true  },
+    { "a\\_b"       , "axb"              , false },
+    { "a\\\\b"      , "a\\b"             , true  },
+    { "a\\"         , "a\\"              , true  },
+
+    // only ASCII is case folded
+    { "HETZNER%"    , "hetzner online"   , true  },
+    { "%online"     , "Hetzner ONLINE"   , true  },
+    { "\xc3\x89"    , "\xc3\xa9"         , false },
+    { "\xc3\xa9%"   , "\xc3\xa9t\xc3\xa9", true  },
+
+    // an empty term matches only an empty field
+    { ""            , ""                 , true  },
+    { ""            , "a"                , false }
+  };
+
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+  {
+    const char *text = cases[i].text;
+    if (ref_like(cases[i].pattern, text, strlen(text)) != cases[i].match)
+    {
+      fprintf(stderr, "reference: \"%s\" LIKE \"%s\" is not %d\n",
+        text, cases[i].pattern, cases[i].match);
+      ++s_testFailures;
+    }
+    test_filter_check(&cases[i].pattern, 1, text);
+  }
+
+  // every case pattern at once against every case text
+  const char *all[sizeof(cases) / sizeof(*cases)];
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+    all[i] = cases[i].pattern;
+  for(unsigned i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+    test_filter_check(all, sizeof(all) / sizeof(*all), cases[i].text);
+}
+
+// import matches every field even when no list has a term for it
+static void test_filter_empty(void)
+{
+  unsigned  out[1];
+  RRFilter *f = NULL;
+  CHECK(rr_filter_init(&f));
+
+  // nothing matches before the filter is compiled
+  CHECK(rr_filter_add(f, "%") == 0);
+  CHECK(rr_filter_match(f, "a", 1, out) == 0);
+  rr_filter_deinit(&f);
+
+  CHECK(rr_filter_init(&f));
+  CHECK(rr_filter_compile(f));
+  CHECK(rr_filter_count(f) == 0);
+  CHECK(rr_filter_match(f, ""     , 0, out) == 0);
+  CHECK(rr_filter_match(f, "text" , 4, out) == 0);
+  CHECK(rr_filter_add(f, "late") == -1);
+  rr_filter_deinit(&f);
+  rr_filter_deinit(&f);
+}
+
+// a small alphabet so literals overlap and the automaton shares states
+static void test_filter_random(unsigned iterations)
+{
+  static const char *patAtoms[] =
+  {
+    "a", "b", "A", "B", "ab", "ba", "%", "_", "\\%", "\\_", "\\\\", "-",
+    "\xc3\xa9"
+  };
+  static const char *textAtoms[] =
+  {
+    "a", "b", "A", "B", "%", "_", "\\", "-", "\xc3\xa9", "\xc3\x89"
+  };
+  #define ATOMS(x) (sizeof(x) / sizeof(*(x)))
+
+  char  store[32][40];
+  const char *patterns[32];
+  for(unsigned n = 0; n < iterations; ++n)
+  {
+    unsigned count = 1 + test_rand() % 32;
+    for(unsigned i = 0; i < count; ++i)
+    {
+      store[i][0] = '\0';
+      for(unsigned a = test_rand() % 7; a > 0; --a)
+        strcat(store[i], patAtoms[test_rand() % ATOMS(patAtoms)]);
+      patterns[i] = store[i];
+    }
+
+    for(unsigned t = 0; t < 8; ++t)
+    {
+      char text[64] = "";
+      for(unsigned a = test_rand() % 12; a > 0; --a)
+        strcat(text, textAtoms[test_rand() % ATOMS(textAtoms)]);
+      test_filter_check(patterns, count, text);
+    }
+  }
+  #undef ATOMS
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000;
+
+  test_filter_cases();
+  test_filter_empty();
+  test_filter_random(iterations);
+
+  return TEST_RESULT;
+}
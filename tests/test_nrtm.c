@@ -0,0 +1,287 @@
+#include "test.h"
+#include "import.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+  Replays a recorded journal through a stand-in NRTM server on the loopback
+  interface. The server answers a "-g SOURCE:VERSION:FIRST-LAST" query the
+  way the registries do, and the RPSL record parser is replaced with one
+  that records what the client passed it.
+*/
+
+#define TEST_SOURCE "TEST"
+#define MAX_OPS     16
+
+struct RRRPSLState
+{
+  unsigned ops;
+  RRRPSLOp op    [MAX_OPS];
+  unsigned serial[MAX_OPS];
+  unsigned lines;   // attribute lines passed on
+  unsigned objects; // records started, counted on their class attribute
+};
+
+static struct RRRPSLState s_last;
+
+RRRPSLState *rr_rpsl_state_new(const char *registrar, unsigned registrar_id)
+{
+  return calloc(1, sizeof(RRRPSLState));
+}
+
+void rr_rpsl_state_free(RRRPSLState **state)
+{
+  s_last = **state;
+  free(*state);
+  *state = NULL;
+}
+
+void rr_rpsl_state_set_op(RRRPSLState *state, RRRPSLOp op, unsigned serial)
+{
+  if (state->ops == MAX_OPS)
+    return;
+  state->op    [state->ops] = op;
+  state->serial[state->ops] = serial;
+  ++state->ops;
+}
+
+bool rr_rpsl_state_line(RRRPSLState *state, const char *line, size_t len)
+{
+  if (len == 0)
+    return true;
+
+  ++state->lines;
+  if (strncmp(line, "inetnum:"     , 8 ) == 0 ||
+      strncmp(line, "inet6num:"    , 9 ) == 0 ||
+      strncmp(line, "organisation:", 13) == 0)
+    ++state->objects;
+  return true;
+}
+
+typedef struct Entry
+{
+  unsigned    serial;
+  const char *text; // from the operation line to the end of the object
+  size_t      len;
+}
+Entry;
+
+static char    *s_journal;
+static Entry    s_entries[MAX_OPS];
+static unsigned s_nbEntries;
+
+static bool load_journal(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+  {
+    perror(path);
+    return false;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  s_journal = calloc(1, size + 1);
+  bool ok = s_journal && fread(s_journal, 1, size, fp) == (size_t)size;
+  fclose(fp);
+  if (!ok)
+    return false;
+
+  // each entry starts at an "ADD n" or "DEL n" line
+  for(char *p = s_journal; *p; p = strchr(p, '\n') + 1)
+  {
+    unsigned serial;
+    if ((strncmp(p, "ADD ", 4) == 0 || strncmp(p, "DEL ", 4) == 0) &&
+        sscanf(p + 4, "%u", &serial) == 1 && s_nbEntries < MAX_OPS)
+    {
+      if (s_nbEntries)
+        s_entries[s_nbEntries - 1].len = p - s_entries[s_nbEntries - 1].text;
+      s_entries[s_nbEntries++] = (Entry){ .serial = serial, .text = p };
+    }
+
+    if (!strchr(p, '\n'))
+      break;
+  }
+
+  if (s_nbEntries == 0)
+    return false;
+
+  s_entries[s_nbEntries - 1].len = strlen(s_entries[s_nbEntries - 1].text);
+  return true;
+}
+
+typedef struct Server
+{
+  int      listenFd;
+  int      port;
+  size_t   chunk;    // bytes per send, to split lines across reads
+  bool     truncate; // close the connection before %END
+  char     query[128];
+}
+Server;
+
+static void server_send(Server *srv, int fd, const char *buf, size_t len)
+{
+  while(len)
+  {
+    size_t n = len < srv->chunk ? len : srv->chunk;
+    ssize_t sent = send(fd, buf, n, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return;
+    buf += sent;
+    len -= sent;
+  }
+}
+
+static void server_sendstr(Server *srv, int fd, const char *str)
+{
+  server_send(srv, fd, str, strlen(str));
+}
+
+static void *server_thread(void *opaque)
+{
+  Server *srv = opaque;
+  int fd = accept(srv->listenFd, NULL, NULL);
+  if (fd < 0)
+    return NULL;
+
+  size_t used = 0;
+  while(used < sizeof(srv->query) - 1 && !memchr(srv->query, '\n', used))
+  {
+    ssize_t n = recv(fd, srv->query + used, sizeof(srv->query) - 1 - used, 0);
+    if (n <= 0)
+      break;
+    used += n;
+  }
+  srv->query[used] = '\0';
+
+  unsigned version, first;
+  unsigned jFirst = s_entries[0].serial;
+  unsigned jLast  = s_entries[s_nbEntries - 1].serial;
+  char     buf[128];
+  if (sscanf(srv->query, "-g " TEST_SOURCE ":%u:%u-LAST", &version, &first) != 2)
+    server_sendstr(srv, fd, "%ERROR:405: no flags passed\n");
+  else if (first < jFirst || first > jLast)
+  {
+    snprintf(buf, sizeof(buf),
+      "%%ERROR:401: invalid range: Not within %u-%u\n", jFirst, jLast);
+    server_sendstr(srv, fd, buf);
+  }
+  else
+  {
+    server_sendstr(srv, fd, "% The TEST Database\n\n");
+    snprintf(buf, sizeof(buf), "%%START Version: %u " TEST_SOURCE " %u-%u\n\n",
+      version, first, jLast);
+    server_sendstr(srv, fd, buf);
+
+    for(unsigned i = 0; i < s_nbEntries; ++i)
+      if (s_entries[i].serial >= first)
+        server_send(srv, fd, s_entries[i].text, s_entries[i].len);
+
+    if (!srv->truncate)
+      server_sendstr(srv, fd, "%END " TEST_SOURCE "\n");
+  }
+
+  close(fd);
+  return NULL;
+}
+
+static int run(Server *srv, unsigned serial, unsigned *outSerial, bool *outResync)
+{
+  pthread_t thread;
+  pthread_create(&thread, NULL, server_thread, srv);
+
+  memset(&s_last, 0, sizeof(s_last));
+  int rc = rr_nrtm_update("test", "127.0.0.1", srv->port, TEST_SOURCE, 3, 1,
+    serial, outSerial, outResync);
+
+  pthread_join(thread, NULL);
+  return rc;
+}
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  if (argc != 2 || !load_journal(argv[1]))
+  {
+    fprintf(stderr, "usage: %s journal\n", argv[0]);
+    return 1;
+  }
+
+  Server srv = { .chunk = 4096 };
+  srv.listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr =
+  {
+    .sin_family      = AF_INET,
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+  };
+  socklen_t addrLen = sizeof(addr);
+  if (srv.listenFd < 0 ||
+      bind(srv.listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(srv.listenFd, 1) != 0 ||
+      getsockname(srv.listenFd, (struct sockaddr *)&addr, &addrLen) != 0)
+  {
+    perror("listen");
+    return 1;
+  }
+  srv.port = ntohs(addr.sin_port);
+
+  unsigned outSerial;
+  bool     outResync;
+  int      rc;
+
+  // the whole journal after the dump serial
+  rc = run(&srv, 100, &outSerial, &outResync);
+  CHECK(strcmp(srv.query, "-g " TEST_SOURCE ":3:101-LAST\n") == 0);
+  CHECK(rc == 1);
+  CHECK(outSerial == 105);
+  CHECK(!outResync);
+  CHECK(s_last.ops == 5);
+  CHECK(s_last.op[0] == RR_RPSL_OP_REPLACE && s_last.serial[0] == 101);
+  CHECK(s_last.op[1] == RR_RPSL_OP_REPLACE && s_last.serial[1] == 102);
+  CHECK(s_last.op[2] == RR_RPSL_OP_DELETE  && s_last.serial[2] == 103);
+  CHECK(s_last.op[3] == RR_RPSL_OP_REPLACE && s_last.serial[3] == 104);
+  CHECK(s_last.op[4] == RR_RPSL_OP_REPLACE && s_last.serial[4] == 105);
+  CHECK(s_last.objects == 5);
+  CHECK(s_last.lines   == 18);
+
+  // the same journal a few bytes at a time so lines span reads
+  srv.chunk = 7;
+  rc = run(&srv, 100, &outSerial, &outResync);
+  CHECK(rc == 1 && outSerial == 105 && !outResync);
+  CHECK(s_last.ops == 5 && s_last.objects == 5 && s_last.lines == 18);
+  srv.chunk = 4096;
+
+  // only the entries after the serial held
+  rc = run(&srv, 103, &outSerial, &outResync);
+  CHECK(strcmp(srv.query, "-g " TEST_SOURCE ":3:104-LAST\n") == 0);
+  CHECK(rc == 1 && outSerial == 105 && !outResync);
+  CHECK(s_last.ops == 2 && s_last.serial[0] == 104 && s_last.objects == 2);
+
+  // up to date, the server rejects the range past its last serial
+  rc = run(&srv, 105, &outSerial, &outResync);
+  CHECK(rc == 0 && outSerial == 105 && !outResync);
+  CHECK(s_last.ops == 0 && s_last.lines == 0);
+
+  // the journal was trimmed past our serial, "Not within a-b" needs a reload
+  rc = run(&srv, 50, &outSerial, &outResync);
+  CHECK(rc == 0 && outSerial == 50 && outResync);
+  CHECK(s_last.ops == 0);
+
+  // the connection is lost before %END
+  srv.truncate = true;
+  rc = run(&srv, 100, &outSerial, &outResync);
+  CHECK(rc == -1 && !outResync);
+  srv.truncate = false;
+
+  close(srv.listenFd);
+  free(s_journal);
+  return TEST_RESULT;
+}
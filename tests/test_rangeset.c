@@ -0,0 +1,56 @@
+#include "test.h"
+#include "rangeset.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+// xorshift, so a failure reproduces
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint32_t test_rand(void)
+{
+  s_rand ^= s_rand << 13;
+  s_rand ^= s_rand >> 7;
+  s_rand ^= s_rand << 17;
+  return (uint32_t)(s_rand >> 32);
+}
+
+#define RS_T       uint32_t
+#define RS_BITS    32
+#define RS_SET     RRRangeSetV4
+#define RS_CURSOR  RRRangeSetV4Cursor
+#define RS_FN(x)   rr_rangeset_v4_ ##x
+#define T_FN(x)    test_v4_ ##x
+#include "test_rangeset_impl.h"
+#undef RS_T
+#undef RS_BITS
+#undef RS_SET
+#undef RS_CURSOR
+#undef RS_FN
+#undef T_FN
+
+#define RS_T       unsigned __int128
+#define RS_BITS    128
+#define RS_SET     RRRangeSetV6
+#define RS_CURSOR  RRRangeSetV6Cursor
+#define RS_FN(x)   rr_rangeset_v6_ ##x
+#define T_FN(x)    test_v6_ ##x
+#include "test_rangeset_impl.h"
+#undef RS_T
+#undef RS_BITS
+#undef RS_SET
+#undef RS_CURSOR
+#undef RS_FN
+#undef T_FN
+
+int main(int argc, char *argv[])
+{
+  rr_log_init();
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+
+  test_v4_edges();
+  test_v6_edges();
+  test_v4_random_ops(iterations);
+  test_v6_random_ops(iterations);
+
+  return TEST_RESULT;
+}
@@ -0,0 +1,324 @@
+/*
+  Range set tests, included by test_rangeset.c once for each address width
+  with the following defined:
+
+    RS_T        the address type
+    RS_BITS     the address width in bits
+    RS_SET      the set type
+    RS_CURSOR   the CIDR cursor type
+    RS_FN(x)    the range set function x
+    T_FN(x)     the name of test function x
+*/
+
+#define RS_MAX ((RS_T)-1)
+
+typedef bool (*T_FN(op_fn))(RS_SET *out, const RS_SET *a, const RS_SET *b);
+
+// endpoints are drawn from here, packed around 0, the middle and the maximum
+static RS_T T_FN(pool)[64];
+static size_t T_FN(nbPool);
+
+static void T_FN(init_pool)(void)
+{
+  const RS_T mid = (RS_T)1 << (RS_BITS - 1);
+  const RS_T fixed[] =
+  {
+    0, 1, 2, 3, 4, 7, 8, 255, 256,
+    mid - 2, mid - 1, mid, mid + 1,
+    RS_MAX - 256, RS_MAX - 255, RS_MAX - 8, RS_MAX - 7, RS_MAX - 4,
+    RS_MAX - 3, RS_MAX - 2, RS_MAX - 1, RS_MAX
+  };
+
+  T_FN(nbPool) = 0;
+  for(size_t i = 0; i < sizeof(fixed) / sizeof(*fixed); ++i)
+    T_FN(pool)[T_FN(nbPool)++] = fixed[i];
+
+  while(T_FN(nbPool) < sizeof(T_FN(pool)) / sizeof(*T_FN(pool)))
+  {
+    RS_T v = 0;
+    for(unsigned b = 0; b < RS_BITS; b += 32)
+      v = (RS_T)(v << 16 << 16) | test_rand();
+    T_FN(pool)[T_FN(nbPool)++] = v;
+  }
+}
+
+static RS_T T_FN(pick)(void)
+{
+  return T_FN(pool)[test_rand() % T_FN(nbPool)];
+}
+
+static void T_FN(random)(RS_SET *s, unsigned maxRanges)
+{
+  RS_FN(clear)(s);
+  unsigned n = test_rand() % (maxRanges + 1);
+  for(unsigned i = 0; i < n; ++i)
+  {
+    RS_T a = T_FN(pick)();
+    RS_T b = test_rand() % 4 ? T_FN(pick)() : a;
+    CHECK(RS_FN(add)(s, a < b ? a : b, a < b ? b : a));
+  }
+  CHECK(RS_FN(normalize)(s));
+}
+
+static bool T_FN(normalized)(const RS_SET *s)
+{
+  for(size_t i = 0; i < s->count; ++i)
+  {
+    if (s->ranges[i].start > s->ranges[i].end)
+      return false;
+
+    // sorted with a gap between neighbours, or they should have been merged
+    if (i > 0 && (s->ranges[i - 1].end == RS_MAX ||
+        s->ranges[i].start <= s->ranges[i - 1].end + 1))
+      return false;
+  }
+  return true;
+}
+
+static bool T_FN(contains)(const RS_SET *s, RS_T v)
+{
+  size_t lo = 0, hi = s->count;
+  while(lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (s->ranges[mid].end < v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < s->count && s->ranges[lo].start <= v;
+}
+
+static bool T_FN(equal)(const RS_SET *a, const RS_SET *b)
+{
+  if (a->count != b->count)
+    return false;
+  for(size_t i = 0; i < a->count; ++i)
+    if (a->ranges[i].start != b->ranges[i].start ||
+        a->ranges[i].end   != b->ranges[i].end)
+      return false;
+  return true;
+}
+
+/*
+  Membership can only change at the endpoints of the sets involved, so
+  checking each endpoint and its neighbours compares the sets exactly.
+*/
+static bool T_FN(same_at)(const RS_SET *out, const RS_SET *a, const RS_SET *b,
+  RS_T v, int op)
+{
+  bool ina = T_FN(contains)(a, v);
+  bool inb = b ? T_FN(contains)(b, v) : false;
+  bool exp;
+  switch(op)
+  {
+    case 0 : exp = ina || inb; break;
+    case 1 : exp = ina && inb; break;
+    case 2 : exp = ina && !inb; break;
+    default: exp = !ina; break;
+  }
+  return T_FN(contains)(out, v) == exp;
+}
+
+static bool T_FN(check_set)(const RS_SET *s, const RS_SET *out,
+  const RS_SET *a, const RS_SET *b, int op)
+{
+  for(size_t i = 0; s && i < s->count; ++i)
+  {
+    const RS_T ends[2] = { s->ranges[i].start, s->ranges[i].end };
+    for(int e = 0; e < 2; ++e)
+    {
+      if (!T_FN(same_at)(out, a, b, ends[e], op))
+        return false;
+      if (ends[e] > 0      && !T_FN(same_at)(out, a, b, ends[e] - 1, op))
+        return false;
+      if (ends[e] < RS_MAX && !T_FN(same_at)(out, a, b, ends[e] + 1, op))
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool T_FN(check_op)(const RS_SET *out, const RS_SET *a, const RS_SET *b,
+  int op)
+{
+  return
+    T_FN(same_at)(out, a, b, 0, op) && T_FN(same_at)(out, a, b, RS_MAX, op) &&
+    T_FN(check_set)(a  , out, a, b, op) &&
+    T_FN(check_set)(b  , out, a, b, op) &&
+    T_FN(check_set)(out, out, a, b, op);
+}
+
+typedef struct T_FN(cidrs)
+{
+  RS_SET   set;
+  size_t   count;
+  bool     aligned;
+  unsigned minPrefix;
+  unsigned maxPrefix;
+}
+T_FN(cidrs);
+
+static bool T_FN(cidr_cb)(void *udata, RS_T ip, uint8_t prefix_len)
+{
+  T_FN(cidrs) *c = udata;
+  RS_T host = prefix_len == 0 ? RS_MAX : (((RS_T)1 << (RS_BITS - prefix_len)) - 1);
+  if (prefix_len > RS_BITS || (ip & host) != 0)
+    c->aligned = false;
+  if (prefix_len < c->minPrefix) c->minPrefix = prefix_len;
+  if (prefix_len > c->maxPrefix) c->maxPrefix = prefix_len;
+  ++c->count;
+  return RS_FN(push)(&c->set, ip, ip | host);
+}
+
+static void T_FN(collect)(const RS_SET *s, T_FN(cidrs) *c)
+{
+  RS_FN(clear)(&c->set);
+  c->count     = 0;
+  c->aligned   = true;
+  c->minPrefix = RS_BITS;
+  c->maxPrefix = 0;
+  CHECK(RS_FN(cidrs)(s, T_FN(cidr_cb), c));
+}
+
+static void T_FN(set)(RS_SET *s, RS_T start, RS_T end)
+{
+  RS_FN(clear)(s);
+  CHECK(RS_FN(add)(s, start, end));
+}
+
+static void T_FN(edges)(void)
+{
+  RS_SET      a = { 0 }, b = { 0 }, out = { 0 }, empty = { 0 };
+  T_FN(cidrs) c = { 0 };
+
+  // the whole space is a single /0, and the complement of nothing
+  T_FN(set)(&a, 0, RS_MAX);
+  T_FN(collect)(&a, &c);
+  CHECK(c.count == 1 && c.minPrefix == 0);
+  CHECK(RS_FN(complement)(&out, &a) && out.count == 0);
+  CHECK(RS_FN(complement)(&out, &empty) && T_FN(equal)(&out, &a));
+
+  // single addresses at both ends
+  RS_FN(clear)(&a);
+  CHECK(RS_FN(add)(&a, RS_MAX, RS_MAX));
+  CHECK(RS_FN(add)(&a, 0, 0));
+  CHECK(RS_FN(normalize)(&a));
+  CHECK(a.count == 2 && a.ranges[0].end == 0 && a.ranges[1].start == RS_MAX);
+  CHECK(RS_FN(complement)(&out, &a));
+  CHECK(out.count == 1 && out.ranges[0].start == 1 && out.ranges[0].end == RS_MAX - 1);
+  T_FN(collect)(&a, &c);
+  CHECK(c.count == 2 && c.minPrefix == RS_BITS && T_FN(equal)(&c.set, &a));
+
+  // adjacent ranges merge, including at the maximum where end + 1 wraps
+  RS_FN(clear)(&a);
+  CHECK(RS_FN(push)(&a, RS_MAX - 1, RS_MAX - 1));
+  CHECK(RS_FN(push)(&a, RS_MAX, RS_MAX));
+  CHECK(a.count == 1 && a.ranges[0].start == RS_MAX - 1 && a.ranges[0].end == RS_MAX);
+  T_FN(set)(&b, 0, 0);
+  CHECK(RS_FN(add)(&b, 1, 1));
+  CHECK(RS_FN(normalize)(&b) && b.count == 1 && b.ranges[0].end == 1);
+  CHECK(RS_FN(union)(&out, &a, &b) && out.count == 2);
+
+  // differences and intersections that reach either end
+  T_FN(set)(&a, 0, RS_MAX);
+  T_FN(set)(&b, 0, 0);
+  CHECK(RS_FN(difference)(&out, &a, &b));
+  CHECK(out.count == 1 && out.ranges[0].start == 1 && out.ranges[0].end == RS_MAX);
+  T_FN(set)(&b, RS_MAX, RS_MAX);
+  CHECK(RS_FN(difference)(&out, &a, &b));
+  CHECK(out.count == 1 && out.ranges[0].start == 0 && out.ranges[0].end == RS_MAX - 1);
+  CHECK(RS_FN(intersect)(&out, &a, &b) && T_FN(equal)(&out, &b));
+  CHECK(RS_FN(difference)(&out, &b, &a) && out.count == 0);
+  CHECK(RS_FN(union)(&out, &a, &empty) && T_FN(equal)(&out, &a));
+  CHECK(RS_FN(intersect)(&out, &a, &empty) && out.count == 0);
+
+  // everything but 0 takes one CIDR of each size
+  T_FN(set)(&a, 1, RS_MAX);
+  T_FN(collect)(&a, &c);
+  CHECK(c.count == RS_BITS && c.aligned && T_FN(equal)(&c.set, &a));
+  CHECK(c.minPrefix == 1 && c.maxPrefix == RS_BITS);
+
+  // the maximum widens to its /(bits - 8) and the two ends fold into /0
+  T_FN(set)(&a, RS_MAX, RS_MAX);
+  CHECK(RS_FN(aggregate)(&out, &a, 0, RS_BITS - 8));
+  CHECK(out.count == 1 && out.ranges[0].start == RS_MAX - 255 && out.ranges[0].end == RS_MAX);
+  CHECK(RS_FN(add)(&a, 0, 0) && RS_FN(normalize)(&a));
+  CHECK(RS_FN(aggregate)(&out, &a, 1, RS_BITS));
+  CHECK(out.count == 1 && out.ranges[0].start == 0 && out.ranges[0].end == RS_MAX);
+  CHECK(RS_FN(aggregate)(&out, &a, 2, RS_BITS) && T_FN(equal)(&out, &a));
+
+  RS_FN(free)(&a);
+  RS_FN(free)(&b);
+  RS_FN(free)(&out);
+  RS_FN(free)(&c.set);
+}
+
+static void T_FN(random_ops)(unsigned iterations)
+{
+  RS_SET      a = { 0 }, b = { 0 }, out = { 0 }, tmp = { 0 };
+  T_FN(cidrs) c = { 0 };
+
+  static const T_FN(op_fn) ops[] =
+  {
+    RS_FN(union), RS_FN(intersect), RS_FN(difference)
+  };
+
+  for(unsigned it = 0; it < iterations; ++it)
+  {
+    if (it % 256 == 0)
+      T_FN(init_pool)();
+
+    T_FN(random)(&a, 12);
+    T_FN(random)(&b, 12);
+    CHECK(T_FN(normalized)(&a) && T_FN(normalized)(&b));
+
+    for(int op = 0; op < 3; ++op)
+    {
+      CHECK(ops[op](&out, &a, &b));
+      CHECK(T_FN(normalized)(&out));
+      CHECK(T_FN(check_op)(&out, &a, &b, op));
+    }
+
+    CHECK(RS_FN(complement)(&out, &a));
+    CHECK(T_FN(normalized)(&out));
+    CHECK(T_FN(check_op)(&out, &a, NULL, 3));
+    CHECK(RS_FN(complement)(&tmp, &out) && T_FN(equal)(&tmp, &a));
+
+    // the CIDRs rebuild the set exactly and the cursor walks the same ones
+    T_FN(collect)(&a, &c);
+    CHECK(c.aligned && T_FN(equal)(&c.set, &a));
+
+    RS_CURSOR cur = { 0 };
+    RS_T      ip;
+    uint8_t   prefix_len;
+    size_t    n = 0;
+    RS_FN(clear)(&tmp);
+    while(RS_FN(cidr_next)(&a, &cur, &ip, &prefix_len))
+    {
+      RS_T host = prefix_len == 0 ? RS_MAX :
+        (((RS_T)1 << (RS_BITS - prefix_len)) - 1);
+      CHECK(RS_FN(push)(&tmp, ip, ip | host));
+      ++n;
+    }
+    CHECK(n == c.count && T_FN(equal)(&tmp, &a));
+
+    // aggregation only ever adds space, within the budget and prefix limit
+    size_t   max       = test_rand() % 8;
+    unsigned maxprefix = RS_BITS - test_rand() % 16;
+    CHECK(RS_FN(aggregate)(&out, &a, max, maxprefix));
+    CHECK(T_FN(normalized)(&out));
+    CHECK(RS_FN(difference)(&tmp, &a, &out) && tmp.count == 0);
+    T_FN(collect)(&out, &c);
+    CHECK(max == 0 || c.count <= max);
+    CHECK(c.count == 0 || c.maxPrefix <= maxprefix);
+  }
+
+  RS_FN(free)(&a);
+  RS_FN(free)(&b);
+  RS_FN(free)(&out);
+  RS_FN(free)(&tmp);
+  RS_FN(free)(&c.set);
+}
+
+#undef RS_MAX
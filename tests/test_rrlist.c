@@ -0,0 +1,132 @@
+#include "test.h"
+#include "rrlist.h"
+#include "format.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+typedef struct TestCIDR
+{
+  uint32_t ip;
+  uint8_t  prefix_len;
+}
+TestCIDR;
+
+typedef struct TestList
+{
+  const TestCIDR *cidrs;
+  size_t          count;
+  size_t          pos;
+}
+TestList;
+
+static int test_next_v4(void *udata, uint32_t *ip, uint8_t *prefix_len)
+{
+  TestList *list = udata;
+  if (list->pos == list->count)
+    return 0;
+
+  *ip         = list->cidrs[list->pos  ].ip;
+  *prefix_len = list->cidrs[list->pos++].prefix_len;
+  return 1;
+}
+
+static size_t test_encode(const TestCIDR *cidrs, size_t count, uint8_t *buf,
+  size_t max)
+{
+  TestList list = { .cidrs = cidrs, .count = count };
+  RRFormatStream s;
+  rr_format_stream_v4(&s, rr_format_by_name("compact"), NULL, test_next_v4,
+    &list);
+  s.generation = 7;
+
+  size_t len = 0;
+  ssize_t rd;
+  while((rd = rr_format_stream_read(&s, (char *)buf + len, max - len)) > 0)
+    len += rd;
+
+  CHECK(rd == 0);
+  return len;
+}
+
+// rewrites the trailer's entry count and the CRC that covers it
+static void test_set_count(uint8_t *buf, size_t len, uint32_t count)
+{
+  uint8_t *trailer = buf + len - RRLIST_TRAILER_SIZE;
+  uint32_t v = htonl(count);
+  memcpy(trailer + 1, &v, 4);
+
+  v = htonl(rrlist_crc32(0, buf, len - 4));
+  memcpy(trailer + 5, &v, 4);
+}
+
+// returns the result that ended the list and the number of entries decoded
+static int test_decode(const uint8_t *buf, size_t len, const TestCIDR *expect,
+  size_t *decoded)
+{
+  RRListDecoder d;
+  if (rrlist_open(&d, buf, len) != 0)
+    return -2;
+
+  CHECK(d.family == 4);
+  CHECK(d.generation == 7);
+
+  uint8_t ip[16], prefix_len;
+  int rc;
+  *decoded = 0;
+  while((rc = rrlist_next(&d, ip, &prefix_len)) == 1)
+  {
+    uint32_t v;
+    memcpy(&v, ip, 4);
+    CHECK(ntohl(v)   == expect[*decoded].ip);
+    CHECK(prefix_len == expect[*decoded].prefix_len);
+    ++*decoded;
+  }
+  return rc;
+}
+
+int main(void)
+{
+  rr_log_init();
+
+  static const TestCIDR cidrs[] =
+  {
+    { 0x0a000000,  8 },
+    { 0x0b000000, 24 },
+    { 0x0b000100, 32 },
+    { 0xc0a80000, 16 },
+    { 0xfffffffe, 31 }
+  };
+  const size_t count = sizeof(cidrs) / sizeof(*cidrs);
+
+  uint8_t buf[RR_FORMAT_BLOCK_MIN * 4];
+  size_t len = test_encode(cidrs, count, buf, sizeof(buf));
+
+  size_t decoded;
+  CHECK(test_decode(buf, len, cidrs, &decoded) == 0);
+  CHECK(decoded == count);
+
+  // an empty list
+  size_t emptyLen = test_encode(NULL, 0, buf + len, sizeof(buf) - len);
+  CHECK(test_decode(buf + len, emptyLen, cidrs, &decoded) == 0);
+  CHECK(decoded == 0);
+
+  // more entries than the count claims fails on the first extra one
+  test_set_count(buf, len, count - 2);
+  CHECK(test_decode(buf, len, cidrs, &decoded) == -1);
+  CHECK(decoded == count - 2);
+
+  // fewer entries than the count claims fails at the trailer
+  test_set_count(buf, len, count + 1);
+  CHECK(test_decode(buf, len, cidrs, &decoded) == -1);
+  CHECK(decoded == count);
+
+  // a damaged count without a matching CRC is rejected by rrlist_open
+  test_set_count(buf, len, count);
+  buf[len - RRLIST_TRAILER_SIZE + 4] ^= 1;
+  CHECK(test_decode(buf, len, cidrs, &decoded) == -2);
+
+  return TEST_RESULT;
+}